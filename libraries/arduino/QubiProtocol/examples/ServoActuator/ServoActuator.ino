@@ -1,6 +1,7 @@
 #include <WiFi.h>
 #include <Servo.h>
 #include <QubiProtocol.h>
+#include <QubiSchema.h>
 
 // WiFi credentials
 const char* ssid = "your_wifi_ssid";
@@ -10,8 +11,15 @@ const char* password = "your_wifi_password";
 Servo servo;
 const int servoPin = 9;
 
-// Qubi module
-ActuatorModule actuator;
+// Qubi module. Deriving from QubiHandlerModule binds handleCommand()
+// statically, so dispatch calls it directly.
+class ServoActuator : public QubiHandlerModule<ServoActuator, ActuatorModule> {
+public:
+  void handleCommand(const QubiCommand& cmd) override;
+};
+
+QubiConnectionManager connection;
+ServoActuator actuator;
 
 void setup() {
   Serial.begin(115200);
@@ -20,62 +28,56 @@ void setup() {
   servo.attach(servoPin);
   servo.write(90); // Center position
   
-  // Connect to WiFi
-  WiFi.begin(ssid, password);
-  while (WiFi.status() != WL_CONNECTED) {
-    delay(1000);
-    Serial.println("Connecting to WiFi...");
-  }
-  Serial.println("WiFi connected!");
-  Serial.print("IP address: ");
-  Serial.println(WiFi.localIP());
-  
-  // Initialize Qubi actuator module
-  if (actuator.begin("servo_01", QubiModuleType::ACTUATOR)) {
-    Serial.println("Actuator module started successfully");
-  } else {
-    Serial.println("Failed to start actuator module");
-  }
-  
-  // Set command handler
-  actuator.setCommandHandler([](const QubiCommand& cmd) {
-    handleActuatorCommand(cmd);
-  });
+  // Connect to WiFi without blocking; loop() starts the module once connected
+  connection.begin(ssid, password);
 }
 
 void loop() {
-  // Process incoming Qubi messages
+  // Initialize Qubi actuator module; WiFi must be up, as the profile sets radio options
+  if (connection.update() == QubiConnectionState::CONNECTED && !actuator.isInitialized()) {
+    Serial.print("IP address: ");
+    Serial.println(WiFi.localIP());
+    if (!actuator.begin("servo_01", QubiModuleType::ACTUATOR, QUBI_DEFAULT_PORT, QubiLatencyProfile::BALANCED)) {
+      Serial.println("Failed to start actuator module");
+    }
+  }
+  
+  // Process incoming Qubi messages. Called while WiFi is down too, so the
+  // module notices the drop and reopens its socket when the link is back.
   actuator.processMessages();
   
-  // Add your other loop code here
-  delay(10);
+  // Add your other loop code here; it runs while WiFi is still connecting
+  delay(actuator.getLoopDelay());
 }
 
-void handleActuatorCommand(const QubiCommand& cmd) {
-  if (cmd.action == "set_servo") {
-    int angle = cmd.params["angle"];
-    int speed = cmd.params["speed"] | 255; // Default to max speed if not specified
-    
-    // Validate angle range
-    if (angle < 0 || angle > 180) {
-      actuator.sendError(QubiStatusCode::BAD_REQUEST, "Angle must be between 0 and 180");
-      return;
+void ServoActuator::handleCommand(const QubiCommand& cmd) {
+  switch (qubiActuatorAction(cmd.action)) {
+    case QubiActuatorAction::SET_SERVO: {
+      // Range checks and the default speed come from extras/schema/actuator.json
+      QubiSetServoParams params;
+      if (!qubiDecode(*this, cmd, params)) {
+        return;
+      }
+      
+      // Move servo to position
+      servo.write(params.angle);
+      
+      // Send response
+      sendServoResponse(params.angle, params.speed);
+      
+      Serial.printf("Servo moved to %d degrees\n", params.angle);
+      break;
     }
     
-    // Move servo to position
-    servo.write(angle);
-    
-    // Send response
-    actuator.sendServoResponse(angle, speed);
-    
-    Serial.printf("Servo moved to %d degrees\n", angle);
-    
-  } else if (cmd.action == "get_position") {
-    // Return current servo position
-    int currentAngle = servo.read();
-    actuator.sendServoResponse(currentAngle);
+    case QubiActuatorAction::GET_POSITION: {
+      // Return current servo position
+      int currentAngle = servo.read();
+      sendServoResponse(currentAngle);
+      break;
+    }
     
-  } else {
-    actuator.sendError(QubiStatusCode::METHOD_NOT_ALLOWED, "Unknown action: " + cmd.action);
+    default:
+      sendError(QubiStatusCode::METHOD_NOT_ALLOWED, "Unknown action: " + cmd.action);
+      break;
   }
-}
\ No newline at end of file
+}
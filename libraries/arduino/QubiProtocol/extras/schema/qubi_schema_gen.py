@@ -0,0 +1,333 @@
+#!/usr/bin/env python3
+"""Generate typed parameter structs and decoders from Qubi module schemas.
+
+Reads every ``*.json`` schema in this directory and writes ``QubiSchema.h``
+and ``QubiSchema.cpp`` into the library's ``src/`` directory:
+
+    python3 extras/schema/qubi_schema_gen.py [--schemas DIR] [--out DIR]
+
+Each schema lists a module type's actions and, per action, its parameters:
+
+    "set_servo": {
+      "angle": { "type": "int", "min": 0, "max": 180, "required": true },
+      "speed": { "type": "int", "min": 0, "max": 255, "default": 255 }
+    }
+
+Supported types are ``int``, ``float``, ``bool``, ``string``, ``enum``
+(``name`` and ``values``) and ``object`` (``name`` and nested ``fields``).
+Optional parameters take ``default``; ``exclusive_min`` makes ``min`` strict.
+"""
+
+import argparse
+import json
+import os
+import sys
+from typing import Dict, List, Tuple
+
+SCRIPT_DIR = os.path.dirname(os.path.abspath(__file__))
+DEFAULT_OUT = os.path.normpath(os.path.join(SCRIPT_DIR, "..", "..", "src"))
+
+HEADER_NOTE = "// Generated by extras/schema/qubi_schema_gen.py from extras/schema/*.json. Do not edit."
+
+C_TYPES = {"int": "int32_t", "float": "float", "bool": "bool", "string": "const char*"}
+
+
+class SchemaError(Exception):
+    """Raised when a schema file is malformed."""
+
+
+def camel(name: str, upper: bool = False) -> str:
+    """Convert snake_case or kebab-case to camelCase (or PascalCase)."""
+    parts = name.replace("-", "_").split("_")
+    text = parts[0] + "".join(p[:1].upper() + p[1:] for p in parts[1:])
+    return text[:1].upper() + text[1:] if upper else text
+
+
+def constant(name: str) -> str:
+    """Convert an action or enum value to an UPPER_CASE enumerator."""
+    return name.replace("-", "_").upper()
+
+
+def literal(value) -> str:
+    """Render a JSON scalar as a C++ literal."""
+    if isinstance(value, bool):
+        return "true" if value else "false"
+    if isinstance(value, float):
+        return repr(value) + "f"
+    if isinstance(value, int):
+        return str(value)
+    return json.dumps(value)
+
+
+def number(value, kind: str) -> str:
+    """Render a range bound for an int or float field."""
+    return literal(float(value)) if kind == "float" else str(int(value))
+
+
+class Generator:
+    """Collects schemas and emits the generated C++ sources."""
+
+    def __init__(self):
+        self.modules: List[Tuple[str, List[str]]] = []
+        self.enums: Dict[str, List[str]] = {}
+        self.objects: Dict[str, Dict[str, dict]] = {}
+        self.structs: List[Tuple[str, Dict[str, dict]]] = []
+        self.struct_names: Dict[str, Dict[str, dict]] = {}
+
+    def load(self, path: str) -> None:
+        """Add one module schema."""
+        with open(path, "r", encoding="utf-8") as fh:
+            schema = json.load(fh)
+
+        module_type = schema.get("module_type")
+        actions = schema.get("actions")
+        if not module_type or not isinstance(actions, dict):
+            raise SchemaError(f"{path}: needs module_type and actions")
+
+        self.modules.append((module_type, list(actions)))
+        for action, params in actions.items():
+            self.register_fields(f"{path}: {action}", params)
+            if params:
+                self.add_struct(f"Qubi{camel(action, True)}Params", params, path)
+
+    def register_fields(self, where: str, fields: Dict[str, dict]) -> None:
+        """Validate fields and collect the enums and objects they use."""
+        if len(fields) > 32:
+            raise SchemaError(f"{where}: at most 32 fields per object")
+        for name, field in fields.items():
+            kind = field.get("type")
+            if kind == "enum":
+                self.add_named(self.enums, field.get("name"), field.get("values"), f"{where}.{name}")
+            elif kind == "object":
+                self.register_fields(f"{where}.{name}", field.get("fields", {}))
+                self.add_named(self.objects, field.get("name"), field.get("fields"), f"{where}.{name}")
+            elif kind not in C_TYPES:
+                raise SchemaError(f"{where}.{name}: unknown type {kind!r}")
+            if not field.get("required") and "default" not in field and kind != "object":
+                raise SchemaError(f"{where}.{name}: optional fields need a default")
+
+    @staticmethod
+    def add_named(table: dict, name, value, where: str) -> None:
+        if not name or not value:
+            raise SchemaError(f"{where}: needs a name and a definition")
+        if name in table and table[name] != value:
+            raise SchemaError(f"{where}: {name} is defined differently elsewhere")
+        table[name] = value
+
+    def add_struct(self, name: str, params: Dict[str, dict], path: str) -> None:
+        if name in self.struct_names:
+            if self.struct_names[name] != params:
+                raise SchemaError(f"{path}: {name} is defined differently elsewhere")
+            return
+        self.struct_names[name] = params
+        self.structs.append((name, params))
+
+    # Header
+
+    def member(self, name: str, field: dict) -> str:
+        kind = field["type"]
+        if kind == "enum":
+            values = self.enums[field["name"]]
+            initial = field.get("default", values[0])
+            return f"  {field['name']} {camel(name)} = {field['name']}::{constant(initial)};"
+        if kind == "object":
+            return f"  {field['name']} {camel(name)};"
+        initial = field.get("default", {"int": 0, "float": 0.0, "bool": False, "string": ""}[kind])
+        value = number(initial, kind) if kind in ("int", "float") else literal(initial)
+        return f"  {C_TYPES[kind]} {camel(name)} = {value};"
+
+    def header(self) -> str:
+        out = [HEADER_NOTE, "", "#ifndef QUBI_SCHEMA_H", "#define QUBI_SCHEMA_H", "",
+               '#include "QubiProtocol.h"', ""]
+
+        for module_type, actions in self.modules:
+            enum = f"Qubi{camel(module_type, True)}Action"
+            out.append(f"enum class {enum} : uint8_t {{")
+            out.append("  UNKNOWN,")
+            out.extend(f"  {constant(a)}," for a in actions)
+            out.append("};")
+            out.append("")
+
+        for name, values in self.enums.items():
+            out.append(f"enum class {name} : uint8_t {{")
+            out.extend(f"  {constant(v)}," for v in values)
+            out.append("};")
+            out.append("")
+
+        for name, fields in list(self.objects.items()) + self.structs:
+            out.append(f"struct {name} {{")
+            out.extend(self.member(n, f) for n, f in fields.items())
+            out.append("};")
+            out.append("")
+
+        out.append("// Action name lookups; UNKNOWN for actions the schema does not list")
+        for module_type, _ in self.modules:
+            enum = f"Qubi{camel(module_type, True)}Action"
+            out.append(f"{enum} qubi{camel(module_type, True)}Action(const String& action);")
+        out.append("")
+
+        out.append("// Decode and validate cmd.params in one pass. On failure the module has")
+        out.append("// already answered 400 with the reason and false is returned.")
+        for name, _ in self.structs:
+            out.append(f"bool qubiDecode(QubiModule& module, const QubiCommand& cmd, {name}& params);")
+        out.append("")
+        out.append("#endif // QUBI_SCHEMA_H")
+        return "\n".join(out) + "\n"
+
+    # Source
+
+    def lookup(self, module_type: str, actions: List[str]) -> List[str]:
+        enum = f"Qubi{camel(module_type, True)}Action"
+        out = [f"{enum} qubi{camel(module_type, True)}Action(const String& action) {{",
+               "  const char* name = action.c_str();",
+               "  switch (action.length()) {"]
+        by_length: Dict[int, List[str]] = {}
+        for action in actions:
+            by_length.setdefault(len(action), []).append(action)
+        for length in sorted(by_length):
+            out.append(f"    case {length}:")
+            for action in by_length[length]:
+                out.append(f'      if (strcmp(name, "{action}") == 0) return {enum}::{constant(action)};')
+            out.append("      break;")
+        out.append("  }")
+        out.append(f"  return {enum}::UNKNOWN;")
+        out.append("}")
+        return out
+
+    def check(self, field: dict, target: str, path: str, indent: str) -> List[str]:
+        """Statements that type-check value{depth} and store it into target."""
+        kind = field["type"]
+        value = "value" + self.suffix
+        out = []
+        if kind in ("int", "float"):
+            c_type = C_TYPES[kind]
+            noun = "an integer" if kind == "int" else "a number"
+            out.append(f"{indent}if (!{value}.is<{c_type}>()) return reject(module, \"{path} must be {noun}\");")
+            out.append(f"{indent}{target} = {value}.as<{c_type}>();")
+            lo, hi = field.get("min"), field.get("max")
+            exclusive = field.get("exclusive_min", False)
+            tests, message = [], None
+            if lo is not None:
+                tests.append(f"{target} {'<=' if exclusive else '<'} {number(lo, kind)}")
+            if hi is not None:
+                tests.append(f"{target} > {number(hi, kind)}")
+            if lo is not None and hi is not None:
+                message = f"{path} must be between {lo} and {hi}"
+            elif lo is not None:
+                message = f"{path} must be {'greater than' if exclusive else 'at least'} {lo}"
+            elif hi is not None:
+                message = f"{path} must be at most {hi}"
+            if tests:
+                out.append(f"{indent}if ({' || '.join(tests)}) return reject(module, \"{message}\");")
+        elif kind == "bool":
+            out.append(f"{indent}if (!{value}.is<bool>()) return reject(module, \"{path} must be true or false\");")
+            out.append(f"{indent}{target} = {value}.as<bool>();")
+        elif kind == "string":
+            out.append(f"{indent}if (!{value}.is<const char*>()) return reject(module, \"{path} must be a string\");")
+            out.append(f"{indent}{target} = {value}.as<const char*>();")
+        elif kind == "enum":
+            values = self.enums[field["name"]]
+            text = "text" + self.suffix
+            out.append(f"{indent}const char* {text} = {value} | \"\";")
+            keyword = "if"
+            for option in values:
+                out.append(f"{indent}{keyword} (strcmp({text}, \"{option}\") == 0) {target} = {field['name']}::{constant(option)};")
+                keyword = "else if"
+            out.append(f"{indent}else return reject(module, \"{path} must be one of {', '.join(values)}\");")
+        elif kind == "object":
+            out.append(f"{indent}if (!{value}.is<JsonObject>()) return reject(module, \"{path} must be an object\");")
+            out.extend(self.object(field["fields"], f"{value}.as<JsonObject>()", target + ".", path + ".", indent))
+        return out
+
+    def object(self, fields: Dict[str, dict], source: str, target: str, prefix: str, indent: str) -> List[str]:
+        """One pass over a JSON object, dispatching on each key as it is met."""
+        depth = self.depth
+        self.depth += 1
+        suffix = str(depth) if depth else ""
+        field_var, key, value, seen = (f"field{suffix}", f"key{suffix}", f"value{suffix}", f"seen{suffix}")
+        required = [i for i, f in enumerate(fields.values()) if f.get("required")]
+
+        out = []
+        if required:
+            out.append(f"{indent}uint32_t {seen} = 0;")
+        out.append(f"{indent}for (JsonPair {field_var} : {source}) {{")
+        out.append(f"{indent}  const char* {key} = {field_var}.key().c_str();")
+        out.append(f"{indent}  JsonVariant {value} = {field_var}.value();")
+        out.append(f"{indent}  switch ({key}[0]) {{")
+
+        by_initial: Dict[str, List[Tuple[int, str, dict]]] = {}
+        for index, (name, field) in enumerate(fields.items()):
+            by_initial.setdefault(name[0], []).append((index, name, field))
+        for initial in sorted(by_initial):
+            out.append(f"{indent}    case '{initial}':")
+            keyword = "if"
+            for index, name, field in by_initial[initial]:
+                out.append(f"{indent}      {keyword} (strcmp({key}, \"{name}\") == 0) {{")
+                self.suffix = suffix
+                out.extend(self.check(field, target + camel(name), prefix + name, indent + "        "))
+                self.suffix = suffix
+                if field.get("required"):
+                    out.append(f"{indent}        {seen} |= 1UL << {index};")
+                out.append(f"{indent}      }}")
+                keyword = "else if"
+            out.append(f"{indent}      break;")
+        out.append(f"{indent}  }}")
+        out.append(f"{indent}}}")
+
+        names = list(fields)
+        for index in required:
+            out.append(f"{indent}if (!({seen} & (1UL << {index}))) return reject(module, \"Missing parameter: {prefix}{names[index]}\");")
+        self.depth -= 1
+        return out
+
+    def decoder(self, name: str, params: Dict[str, dict]) -> List[str]:
+        self.depth = 0
+        self.suffix = ""
+        out = [f"bool qubiDecode(QubiModule& module, const QubiCommand& cmd, {name}& params) {{",
+               f"  params = {name}();"]
+        out.extend(self.object(params, "cmd.params", "params.", "", "  "))
+        out.append("  return true;")
+        out.append("}")
+        return out
+
+    def source(self) -> str:
+        out = [HEADER_NOTE, "", '#include "QubiSchema.h"', "", "#include <string.h>", "",
+               "namespace {", "",
+               "bool reject(QubiModule& module, const char* message) {",
+               "  module.sendError(QubiStatusCode::BAD_REQUEST, message);",
+               "  return false;",
+               "}", "",
+               "}  // namespace", ""]
+        for module_type, actions in self.modules:
+            out.extend(self.lookup(module_type, actions))
+            out.append("")
+        for name, params in self.structs:
+            out.extend(self.decoder(name, params))
+            out.append("")
+        return "\n".join(out).rstrip("\n") + "\n"
+
+
+def main() -> int:
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--schemas", default=SCRIPT_DIR, help="directory of *.json schemas")
+    parser.add_argument("--out", default=DEFAULT_OUT, help="directory for QubiSchema.h/.cpp")
+    args = parser.parse_args()
+
+    generator = Generator()
+    try:
+        for name in sorted(os.listdir(args.schemas)):
+            if name.endswith(".json"):
+                generator.load(os.path.join(args.schemas, name))
+    except (SchemaError, ValueError) as error:
+        print(f"error: {error}", file=sys.stderr)
+        return 1
+
+    with open(os.path.join(args.out, "QubiSchema.h"), "w", encoding="utf-8") as fh:
+        fh.write(generator.header())
+    with open(os.path.join(args.out, "QubiSchema.cpp"), "w", encoding="utf-8") as fh:
+        fh.write(generator.source())
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
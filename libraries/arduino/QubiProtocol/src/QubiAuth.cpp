@@ -0,0 +1,163 @@
+#include "QubiAuth.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <Preferences.h>
+#endif
+
+namespace {
+
+struct StoredSequences {
+  uint64_t fingerprint;
+  QubiAuthSequences sequences;
+};
+
+#ifndef ARDUINO_ARCH_ESP32
+// Host builds: lasts for the process, so a test can restart a module
+#define QUBI_HOST_STORED_KEYS 16
+StoredSequences hostStore[QUBI_HOST_STORED_KEYS];
+uint8_t hostStoreCount = 0;
+#endif
+
+// Tag of a fixed string, so the stored entry doesn't reveal the key
+uint64_t keyFingerprint(const uint8_t key[QUBI_AUTH_KEY_SIZE]) {
+  static const char label[] = "qubi sequence store";
+  QubiSipHash mac(key);
+  mac.update((const uint8_t*)label, sizeof(label) - 1);
+  return mac.finish();
+}
+
+inline uint64_t rotl(uint64_t x, int b) {
+  return (x << b) | (x >> (64 - b));
+}
+
+inline uint64_t readLE64(const uint8_t* p) {
+  uint64_t value = 0;
+  for (int i = 7; i >= 0; i--) {
+    value = (value << 8) | p[i];
+  }
+  return value;
+}
+
+inline void sipRound(uint64_t& v0, uint64_t& v1, uint64_t& v2, uint64_t& v3) {
+  v0 += v1; v1 = rotl(v1, 13); v1 ^= v0; v0 = rotl(v0, 32);
+  v2 += v3; v3 = rotl(v3, 16); v3 ^= v2;
+  v0 += v3; v3 = rotl(v3, 21); v3 ^= v0;
+  v2 += v1; v1 = rotl(v1, 17); v1 ^= v2; v2 = rotl(v2, 32);
+}
+
+}  // namespace
+
+QubiSipHash::QubiSipHash(const uint8_t key[QUBI_AUTH_KEY_SIZE])
+  : _tail(0), _tailLength(0), _totalLength(0) {
+  uint64_t k0 = readLE64(key);
+  uint64_t k1 = readLE64(key + 8);
+  _v0 = k0 ^ 0x736f6d6570736575ULL;
+  _v1 = k1 ^ 0x646f72616e646f6dULL;
+  _v2 = k0 ^ 0x6c7967656e657261ULL;
+  _v3 = k1 ^ 0x7465646279746573ULL;
+}
+
+void QubiSipHash::compress(uint64_t word) {
+  _v3 ^= word;
+  sipRound(_v0, _v1, _v2, _v3);
+  sipRound(_v0, _v1, _v2, _v3);
+  _v0 ^= word;
+}
+
+void QubiSipHash::update(const uint8_t* data, size_t len) {
+  _totalLength += (uint8_t)len;
+
+  // Top up a partial word left by the previous call
+  while (_tailLength > 0 && len > 0) {
+    _tail |= (uint64_t)*data++ << (8 * _tailLength);
+    len--;
+    if (++_tailLength == 8) {
+      compress(_tail);
+      _tail = 0;
+      _tailLength = 0;
+    }
+  }
+
+  for (; len >= 8; data += 8, len -= 8) {
+    compress(readLE64(data));
+  }
+
+  for (; len > 0; len--) {
+    _tail |= (uint64_t)*data++ << (8 * _tailLength++);
+  }
+}
+
+uint64_t QubiSipHash::finish() {
+  compress(_tail | ((uint64_t)_totalLength << 56));
+  _v2 ^= 0xff;
+  for (int i = 0; i < 4; i++) {
+    sipRound(_v0, _v1, _v2, _v3);
+  }
+  return _v0 ^ _v1 ^ _v2 ^ _v3;
+}
+
+void QubiSipHash::finish(uint8_t tag[QUBI_AUTH_TAG_SIZE]) {
+  uint64_t value = finish();
+  for (int i = 0; i < QUBI_AUTH_TAG_SIZE; i++) {
+    tag[i] = (uint8_t)(value >> (8 * i));
+  }
+}
+
+bool qubiTagsEqual(const uint8_t* a, const uint8_t* b) {
+  uint8_t difference = 0;
+  for (int i = 0; i < QUBI_AUTH_TAG_SIZE; i++) {
+    difference |= a[i] ^ b[i];
+  }
+  return difference == 0;
+}
+
+bool qubiLoadSequences(const uint8_t key[QUBI_AUTH_KEY_SIZE], QubiAuthSequences& sequences) {
+  uint64_t fingerprint = keyFingerprint(key);
+#ifdef ARDUINO_ARCH_ESP32
+  char name[12];
+  snprintf(name, sizeof(name), "seq%08lx", (unsigned long)(uint32_t)fingerprint);
+  StoredSequences stored;
+  Preferences prefs;
+  prefs.begin("qubi", true);
+  bool found = prefs.getBytes(name, &stored, sizeof(stored)) == sizeof(stored) && stored.fingerprint == fingerprint;
+  prefs.end();
+  if (found) sequences = stored.sequences;
+  return found;
+#else
+  for (uint8_t i = 0; i < hostStoreCount; i++) {
+    if (hostStore[i].fingerprint == fingerprint) {
+      sequences = hostStore[i].sequences;
+      return true;
+    }
+  }
+  return false;
+#endif
+}
+
+void qubiSaveSequences(const uint8_t key[QUBI_AUTH_KEY_SIZE], const QubiAuthSequences& sequences) {
+  StoredSequences stored;
+  memset(&stored, 0, sizeof(stored));
+  stored.fingerprint = keyFingerprint(key);
+  stored.sequences = sequences;
+#ifdef ARDUINO_ARCH_ESP32
+  char name[12];
+  snprintf(name, sizeof(name), "seq%08lx", (unsigned long)(uint32_t)stored.fingerprint);
+  Preferences prefs;
+  prefs.begin("qubi", false);
+  prefs.putBytes(name, &stored, sizeof(stored));
+  prefs.end();
+#else
+  for (uint8_t i = 0; i < hostStoreCount; i++) {
+    if (hostStore[i].fingerprint == stored.fingerprint) {
+      hostStore[i] = stored;
+      return;
+    }
+  }
+  if (hostStoreCount < QUBI_HOST_STORED_KEYS) {
+    hostStore[hostStoreCount++] = stored;
+  }
+#endif
+}
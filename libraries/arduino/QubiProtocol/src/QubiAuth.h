@@ -0,0 +1,56 @@
+#ifndef QUBI_AUTH_H
+#define QUBI_AUTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// SipHash-2-4 keyed MAC (Aumasson & Bernstein), fed incrementally so a
+// datagram can be authenticated as it is read from the socket. It needs no
+// tables and runs in a few microseconds per datagram on an ESP32.
+#define QUBI_AUTH_KEY_SIZE 16
+#define QUBI_AUTH_TAG_SIZE 8
+
+class QubiSipHash {
+private:
+  uint64_t _v0, _v1, _v2, _v3;
+  uint64_t _tail;       // Bytes not yet forming a full 8-byte word
+  uint8_t _tailLength;
+  uint8_t _totalLength; // Only the low byte enters the final block
+
+  void compress(uint64_t word);
+
+public:
+  explicit QubiSipHash(const uint8_t key[QUBI_AUTH_KEY_SIZE]);
+
+  void update(const uint8_t* data, size_t len);
+  uint64_t finish();
+  // Writes the tag little-endian, as the reference implementation does
+  void finish(uint8_t tag[QUBI_AUTH_TAG_SIZE]);
+};
+
+// The first byte of every tagged input says which way the frame travels,
+// so a module's own responses are not valid requests
+#define QUBI_AUTH_DOMAIN_REQUEST 0x01
+#define QUBI_AUTH_DOMAIN_RESPONSE 0x02
+
+// Sequence numbers are reserved this far ahead in non-volatile storage (NVS
+// on the ESP32; memory for the life of the process on the host), one write
+// per reservation. After a restart, a key only accepts and sends sequence
+// numbers above its last reservation, so frames captured earlier stay
+// replays.
+#define QUBI_AUTH_SEQUENCE_RESERVE 4096
+
+struct QubiAuthSequences {
+  uint32_t rx;   // Highest request sequence number that may have been accepted
+  uint32_t tx;   // Highest response sequence number that may have been sent
+};
+
+// Stored per key, under a fingerprint of the key rather than the key itself
+bool qubiLoadSequences(const uint8_t key[QUBI_AUTH_KEY_SIZE], QubiAuthSequences& sequences);
+void qubiSaveSequences(const uint8_t key[QUBI_AUTH_KEY_SIZE], const QubiAuthSequences& sequences);
+
+// Compares tags without an early exit, so timing does not reveal how many
+// leading bytes of a forged tag were right
+bool qubiTagsEqual(const uint8_t* a, const uint8_t* b);
+
+#endif // QUBI_AUTH_H
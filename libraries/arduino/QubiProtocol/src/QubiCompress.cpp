@@ -0,0 +1,162 @@
+#include "QubiCompress.h"
+
+#include <string.h>
+
+namespace {
+
+class BitWriter {
+private:
+  uint8_t* _out;
+  size_t _capacity;
+  size_t _length;
+  uint32_t _bits;
+  uint8_t _bitCount;
+  bool _overflow;
+
+public:
+  BitWriter(uint8_t* out, size_t capacity)
+    : _out(out), _capacity(capacity), _length(0), _bits(0), _bitCount(0), _overflow(false) {}
+
+  void write(uint32_t value, uint8_t count) {
+    _bits = (_bits << count) | (value & ((1UL << count) - 1));
+    _bitCount += count;
+    while (_bitCount >= 8) {
+      _bitCount -= 8;
+      put((uint8_t)(_bits >> _bitCount));
+    }
+  }
+
+  void put(uint8_t byte) {
+    if (_length < _capacity) {
+      _out[_length++] = byte;
+    } else {
+      _overflow = true;
+    }
+  }
+
+  size_t finish() {
+    // Pad the last byte with zeros; a 0 tag needs more bits than remain, so
+    // the decoder treats the padding as end of stream
+    if (_bitCount > 0) {
+      put((uint8_t)(_bits << (8 - _bitCount)));
+      _bitCount = 0;
+    }
+    return _overflow ? 0 : _length;
+  }
+
+  bool overflow() const { return _overflow; }
+};
+
+inline uint8_t hash2(const uint8_t* p) {
+  return (uint8_t)((p[0] * 31) ^ p[1]);
+}
+
+}  // namespace
+
+size_t QubiCompressor::compress(const uint8_t* in, size_t inLen, uint8_t* out, size_t outCap) {
+  memset(_head, 0xFF, sizeof(_head));
+  memset(_prev, 0xFF, sizeof(_prev));
+
+  BitWriter writer(out, outCap);
+  size_t pos = 0;
+
+  while (pos < inLen && !writer.overflow()) {
+    size_t bestLength = 0;
+    size_t bestDistance = 0;
+
+    if (pos + QUBI_LZ_MIN_MATCH <= inLen) {
+      size_t maxLength = inLen - pos < QUBI_LZ_MAX_MATCH ? inLen - pos : QUBI_LZ_MAX_MATCH;
+      uint16_t candidate = _head[hash2(in + pos)];
+
+      for (uint8_t chain = 0; candidate != 0xFFFF && chain < QUBI_LZ_MAX_CHAIN; chain++) {
+        size_t distance = pos - candidate;
+        if (distance == 0 || distance > QUBI_LZ_WINDOW_SIZE) break;
+
+        size_t length = 0;
+        while (length < maxLength && in[candidate + length] == in[pos + length]) {
+          length++;
+        }
+        if (length > bestLength) {
+          bestLength = length;
+          bestDistance = distance;
+          if (length == maxLength) break;
+        }
+
+        uint16_t next = _prev[candidate % QUBI_LZ_WINDOW_SIZE];
+        if (next == 0xFFFF || next >= candidate) break;
+        candidate = next;
+      }
+    }
+
+    size_t advance;
+    if (bestLength >= QUBI_LZ_MIN_MATCH) {
+      writer.write(0, 1);
+      writer.write((uint32_t)(bestDistance - 1), QUBI_LZ_WINDOW_BITS);
+      writer.write((uint32_t)(bestLength - QUBI_LZ_MIN_MATCH), QUBI_LZ_LENGTH_BITS);
+      advance = bestLength;
+    } else {
+      writer.write(1, 1);
+      writer.write(in[pos], 8);
+      advance = 1;
+    }
+
+    // Index every position covered so later matches can start inside this one
+    for (size_t i = 0; i < advance; i++, pos++) {
+      if (pos + 1 < inLen) {
+        uint8_t h = hash2(in + pos);
+        _prev[pos % QUBI_LZ_WINDOW_SIZE] = _head[h];
+        _head[h] = (uint16_t)pos;
+      }
+    }
+  }
+
+  return writer.finish();
+}
+
+QubiDecompressor::QubiDecompressor(uint8_t* out, size_t capacity)
+  : _out(out), _capacity(capacity), _length(0), _bits(0), _bitCount(0),
+    _state(TAG), _distance(0), _error(false) {}
+
+bool QubiDecompressor::feed(const uint8_t* in, size_t len) {
+  for (size_t i = 0; i < len && !_error; i++) {
+    _bits = (_bits << 8) | in[i];
+    _bitCount += 8;
+
+    for (;;) {
+      uint8_t need = _state == TAG ? 1
+                   : _state == LITERAL ? 8
+                   : _state == DISTANCE ? QUBI_LZ_WINDOW_BITS
+                   : QUBI_LZ_LENGTH_BITS;
+      if (_bitCount < need) break;
+
+      _bitCount -= need;
+      uint32_t value = (_bits >> _bitCount) & ((1UL << need) - 1);
+
+      if (_state == TAG) {
+        _state = value ? LITERAL : DISTANCE;
+      } else if (_state == LITERAL) {
+        if (_length >= _capacity) {
+          _error = true;
+          break;
+        }
+        _out[_length++] = (uint8_t)value;
+        _state = TAG;
+      } else if (_state == DISTANCE) {
+        _distance = (uint16_t)(value + 1);
+        _state = LENGTH;
+      } else {
+        size_t length = value + QUBI_LZ_MIN_MATCH;
+        if (_distance > _length || _length + length > _capacity) {
+          _error = true;
+          break;
+        }
+        // Byte by byte: the source may overlap the bytes being written
+        for (size_t j = 0; j < length; j++, _length++) {
+          _out[_length] = _out[_length - _distance];
+        }
+        _state = TAG;
+      }
+    }
+  }
+  return !_error;
+}
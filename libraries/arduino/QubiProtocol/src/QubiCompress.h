@@ -0,0 +1,60 @@
+#ifndef QUBI_COMPRESS_H
+#define QUBI_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Small-footprint LZSS codec in the style of heatshrink, sized for ESP32 RAM.
+//
+// Bit stream (MSB first):
+//   1 + 8 bits                  literal byte
+//   0 + WINDOW_BITS + LENGTH_BITS   back-reference: distance-1, length-MIN_MATCH
+//
+// The decoder keeps no window of its own: back-references are resolved
+// against the output buffer, so data can be decompressed in chunks straight
+// into the JSON parse buffer as it is read from the socket.
+#define QUBI_LZ_WINDOW_BITS 9
+#define QUBI_LZ_LENGTH_BITS 5
+#define QUBI_LZ_WINDOW_SIZE (1 << QUBI_LZ_WINDOW_BITS)
+#define QUBI_LZ_MIN_MATCH 2
+#define QUBI_LZ_MAX_MATCH (QUBI_LZ_MIN_MATCH + (1 << QUBI_LZ_LENGTH_BITS) - 1)
+#define QUBI_LZ_HASH_SIZE 256
+#define QUBI_LZ_MAX_CHAIN 16
+
+class QubiCompressor {
+private:
+  // Most recent position per 2-byte hash, and the previous position with the
+  // same hash for each window slot (0xFFFF = none)
+  uint16_t _head[QUBI_LZ_HASH_SIZE];
+  uint16_t _prev[QUBI_LZ_WINDOW_SIZE];
+
+public:
+  // Returns the compressed size, or 0 if the output does not fit in outCap
+  size_t compress(const uint8_t* in, size_t inLen, uint8_t* out, size_t outCap);
+};
+
+class QubiDecompressor {
+private:
+  enum State : uint8_t { TAG, LITERAL, DISTANCE, LENGTH };
+
+  uint8_t* _out;
+  size_t _capacity;
+  size_t _length;
+  uint32_t _bits;
+  uint8_t _bitCount;
+  State _state;
+  uint16_t _distance;
+  bool _error;
+
+public:
+  QubiDecompressor(uint8_t* out, size_t capacity);
+
+  // Consumes the next chunk of compressed input; false once the stream is
+  // found to be corrupt or would overflow the output buffer
+  bool feed(const uint8_t* in, size_t len);
+
+  size_t length() const { return _length; }
+  bool error() const { return _error; }
+};
+
+#endif // QUBI_COMPRESS_H
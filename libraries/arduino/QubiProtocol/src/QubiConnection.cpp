@@ -0,0 +1,239 @@
+#include "QubiConnection.h"
+
+#include <string.h>
+
+#ifdef ARDUINO_ARCH_ESP32
+#include <Preferences.h>
+#include <esp_netif.h>
+#include <esp_netif_net_stack.h>
+#include <lwip/dhcp.h>
+#include <lwip/tcpip.h>
+#endif
+
+#define QUBI_WIFI_CACHE_MAGIC 0x51574331  // "QWC1"
+
+namespace {
+
+// Read first on wake from deep sleep; NVS is only needed after power loss
+#ifdef ARDUINO_ARCH_ESP32
+RTC_DATA_ATTR QubiWiFiCache rtcCache;
+#else
+QubiWiFiCache rtcCache;  // Host builds: lasts for the process
+#endif
+
+#ifdef ARDUINO_ARCH_ESP32
+struct netif* stationNetif() {
+  esp_netif_t* station = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
+  return station ? (struct netif*)esp_netif_get_netif_impl(station) : nullptr;
+}
+#endif
+
+// Moves a link on the cached static address over to DHCP without taking the
+// address down. WiFi.config() with a zero address goes through
+// esp_netif_dhcpc_start(), which clears the interface address until the
+// lease arrives, so the module would see its link drop. lwIP's own client
+// keeps the address until the server acks, and the server normally hands
+// back the same one.
+void startLeaseKeepingAddress() {
+#if defined(ARDUINO_ARCH_ESP32)
+  struct netif* netif = stationNetif();
+  if (netif) {
+    tcpip_callback([](void* arg) { dhcp_start((struct netif*)arg); }, netif);
+    return;
+  }
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());
+#elif defined(QUBI_HOST_PLATFORM)
+  WiFi.startLeaseKeepingAddress();
+#else
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());
+#endif
+}
+
+// Stops a client started above before the interface is configured again;
+// esp_netif doesn't know about it, so WiFi.config() wouldn't
+void stopLeaseKeepingAddress() {
+#ifdef ARDUINO_ARCH_ESP32
+  struct netif* netif = stationNetif();
+  if (netif) {
+    tcpip_callback([](void* arg) { dhcp_stop((struct netif*)arg); }, netif);
+  }
+#endif
+}
+
+}  // namespace
+
+QubiConnectionManager::QubiConnectionManager()
+  : _ssid(nullptr), _password(nullptr), _state(QubiConnectionState::IDLE), _startedAt(0), _attemptAt(0),
+    _connectTimeMs(0), _connectedAt(0), _retryDelayMs(QUBI_RETRY_MIN_MS), _fastConnected(false),
+    _useCachedIP(true), _onCachedIP(false), _leaseStarted(false), _attempts(0) {
+  memset(&_cache, 0, sizeof(_cache));
+}
+
+void QubiConnectionManager::begin(const char* ssid, const char* password) {
+  _ssid = ssid;
+  _password = password;
+  _startedAt = millis();
+  _attempts = 0;
+
+#ifdef ARDUINO_ARCH_ESP32
+  // Credentials come from the sketch; don't rewrite them to flash every boot
+  WiFi.persistent(false);
+  WiFi.mode(WIFI_STA);
+#endif
+
+  if (loadCache()) {
+    startFastConnect();
+  } else {
+    startConnect();
+  }
+}
+
+QubiConnectionState QubiConnectionManager::update() {
+  wl_status_t status = WiFi.status();
+  unsigned long elapsed = millis() - _attemptAt;
+
+  switch (_state) {
+    case QubiConnectionState::FAST_CONNECT:
+      if (status == WL_CONNECTED) {
+        _fastConnected = true;
+        onConnected();
+      } else if (status == WL_NO_SSID_AVAIL || status == WL_CONNECT_FAILED ||
+                 elapsed >= QUBI_FAST_CONNECT_TIMEOUT_MS) {
+        // Access point moved channel or was replaced: do it the slow way
+        Serial.println("Fast connect failed, scanning");
+        startConnect();
+      }
+      break;
+    case QubiConnectionState::CONNECT:
+      if (status == WL_CONNECTED) {
+        _fastConnected = false;
+        onConnected();
+      } else if (elapsed >= QUBI_CONNECT_TIMEOUT_MS) {
+        Serial.printf("WiFi connect timed out, retrying in %lu ms\n", _retryDelayMs);
+        WiFi.disconnect();
+        _state = QubiConnectionState::FAILED;
+        _attemptAt = millis();
+      }
+      break;
+    case QubiConnectionState::CONNECTED:
+      if (status != WL_CONNECTED) {
+        Serial.println("WiFi connection lost, reconnecting");
+        _startedAt = millis();
+        startFastConnect();
+      } else if (_onCachedIP && millis() - _connectedAt >= QUBI_CACHED_IP_RENEW_MS) {
+        // From here on the address is a lease the DHCP client keeps renewing
+        _onCachedIP = false;
+        _leaseStarted = true;
+        startLeaseKeepingAddress();
+      } else if ((uint32_t)WiFi.localIP() != 0 && (uint32_t)WiFi.localIP() != _cache.localIP) {
+        updateCache();  // DHCP gave us another address
+      }
+      break;
+    case QubiConnectionState::FAILED:
+      // Back off, so a missing access point doesn't keep the radio busy
+      if (elapsed >= _retryDelayMs) {
+        _retryDelayMs = min(_retryDelayMs * 2, (unsigned long)QUBI_RETRY_MAX_MS);
+        startConnect();
+      }
+      break;
+    case QubiConnectionState::IDLE:
+      break;
+  }
+  return _state;
+}
+
+void QubiConnectionManager::startFastConnect() {
+  _state = QubiConnectionState::FAST_CONNECT;
+  _attemptAt = millis();
+  _attempts++;
+  stopLease();
+
+  _onCachedIP = _useCachedIP && _cache.localIP != 0;
+  if (_onCachedIP) {
+    WiFi.config(IPAddress(_cache.localIP), IPAddress(_cache.gateway), IPAddress(_cache.subnet),
+                IPAddress(_cache.dns));
+  } else {
+    WiFi.config(IPAddress(), IPAddress(), IPAddress());
+  }
+  WiFi.begin(_ssid, _password, _cache.channel, _cache.bssid);
+}
+
+void QubiConnectionManager::startConnect() {
+  _state = QubiConnectionState::CONNECT;
+  _attemptAt = millis();
+  _attempts++;
+  stopLease();
+
+  _onCachedIP = false;
+  WiFi.disconnect();
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());  // Back to DHCP
+  WiFi.begin(_ssid, _password);
+}
+
+void QubiConnectionManager::stopLease() {
+  if (_leaseStarted) {
+    _leaseStarted = false;
+    stopLeaseKeepingAddress();
+  }
+}
+
+void QubiConnectionManager::onConnected() {
+  _state = QubiConnectionState::CONNECTED;
+  _connectedAt = millis();
+  _connectTimeMs = _connectedAt - _startedAt;
+  _retryDelayMs = QUBI_RETRY_MIN_MS;
+  Serial.printf("WiFi connected in %lu ms (%s)\n", _connectTimeMs, _fastConnected ? "cached" : "full scan");
+  updateCache();
+}
+
+void QubiConnectionManager::updateCache() {
+  QubiWiFiCache fresh;
+  memset(&fresh, 0, sizeof(fresh));
+  fresh.magic = QUBI_WIFI_CACHE_MAGIC;
+  strncpy(fresh.ssid, _ssid, QUBI_SSID_SIZE - 1);
+  fresh.channel = WiFi.channel();
+  memcpy(fresh.bssid, WiFi.BSSID(), sizeof(fresh.bssid));
+  fresh.localIP = (uint32_t)WiFi.localIP();
+  fresh.gateway = (uint32_t)WiFi.gatewayIP();
+  fresh.subnet = (uint32_t)WiFi.subnetMask();
+  fresh.dns = (uint32_t)WiFi.dnsIP();
+
+  // Flash writes wear the chip; only write what changed
+  if (memcmp(&fresh, &_cache, sizeof(fresh)) != 0) {
+    _cache = fresh;
+    saveCache();
+  }
+}
+
+bool QubiConnectionManager::loadCache() {
+  if (rtcCache.magic == QUBI_WIFI_CACHE_MAGIC) {
+    _cache = rtcCache;
+  } else {
+#ifdef ARDUINO_ARCH_ESP32
+    Preferences prefs;
+    prefs.begin("qubi", true);
+    if (prefs.getBytes("wifi", &_cache, sizeof(_cache)) != sizeof(_cache)) {
+      _cache.magic = 0;
+    }
+    prefs.end();
+#endif
+  }
+
+  return _cache.magic == QUBI_WIFI_CACHE_MAGIC && _cache.channel > 0 &&
+         strncmp(_cache.ssid, _ssid, QUBI_SSID_SIZE) == 0;
+}
+
+void QubiConnectionManager::saveCache() {
+  rtcCache = _cache;
+#ifdef ARDUINO_ARCH_ESP32
+  Preferences prefs;
+  prefs.begin("qubi", false);
+  prefs.putBytes("wifi", &_cache, sizeof(_cache));
+  prefs.end();
+#endif
+}
+
+void QubiConnectionManager::clearCache() {
+  memset(&_cache, 0, sizeof(_cache));
+  saveCache();
+}
@@ -0,0 +1,89 @@
+#ifndef QUBI_CONNECTION_H
+#define QUBI_CONNECTION_H
+
+#include <WiFi.h>
+
+// Non-blocking WiFi station startup. After the first successful connect,
+// the access point's channel and BSSID and the DHCP lease are kept in RTC
+// memory (survives deep sleep) and NVS (survives power loss). The next
+// start joins that access point directly with the cached address instead
+// of scanning all channels and waiting for DHCP, and falls back to a full
+// connect if that fails. The cached address is only used to get going:
+// shortly after such a connect, DHCP is started on the live link, so the
+// module doesn't hold on to a lease the server may have given away. The
+// address stays up meanwhile, so the module's link doesn't drop unless the
+// server hands out a different one.
+#define QUBI_FAST_CONNECT_TIMEOUT_MS 2000
+#define QUBI_CONNECT_TIMEOUT_MS 20000
+#define QUBI_CACHED_IP_RENEW_MS 10000    // After a connect on the cached address
+#define QUBI_RETRY_MIN_MS 1000           // Wait after a failed full connect, doubling
+#define QUBI_RETRY_MAX_MS 60000
+#define QUBI_SSID_SIZE 33
+
+enum class QubiConnectionState : uint8_t {
+  IDLE,           // begin() not called yet
+  FAST_CONNECT,   // Joining the cached access point with the cached address
+  CONNECT,        // Full scan and DHCP
+  CONNECTED,
+  FAILED          // Full connect timed out; retried after a backoff
+};
+
+struct QubiWiFiCache {
+  uint32_t magic;
+  char ssid[QUBI_SSID_SIZE];
+  int32_t channel;
+  uint8_t bssid[6];
+  uint32_t localIP;
+  uint32_t gateway;
+  uint32_t subnet;
+  uint32_t dns;
+};
+
+class QubiConnectionManager {
+private:
+  const char* _ssid;
+  const char* _password;
+  QubiConnectionState _state;
+  unsigned long _startedAt;      // millis() when begin() was called
+  unsigned long _attemptAt;      // millis() when the current attempt started
+  unsigned long _connectTimeMs;
+  unsigned long _connectedAt;
+  unsigned long _retryDelayMs;
+  bool _fastConnected;
+  bool _useCachedIP;
+  bool _onCachedIP;              // Connected with the cached address, no lease yet
+  bool _leaseStarted;            // DHCP started on the cached address, see update()
+  uint16_t _attempts;
+  QubiWiFiCache _cache;
+
+  bool loadCache();
+  void saveCache();
+  void updateCache();
+  void startFastConnect();
+  void startConnect();
+  void stopLease();
+  void onConnected();
+
+public:
+  QubiConnectionManager();
+
+  // Starts connecting and returns at once; call update() from loop()
+  void begin(const char* ssid, const char* password);
+  QubiConnectionState update();
+
+  QubiConnectionState getState() const { return _state; }
+  bool isConnected() const { return _state == QubiConnectionState::CONNECTED; }
+  // Time from begin() to the last connect, and whether the cache was used
+  unsigned long getConnectTime() const { return _connectTimeMs; }
+  bool wasFastConnect() const { return _fastConnected; }
+  uint16_t getAttempts() const { return _attempts; }
+
+  // Reusing the DHCP address skips DHCP at connect time but assumes, until
+  // DHCP runs QUBI_CACHED_IP_RENEW_MS later, that the lease is still ours;
+  // turn it off on networks with short leases
+  void setUseCachedIP(bool use) { _useCachedIP = use; }
+  // Forgets the cached access point, e.g. after changing networks
+  void clearCache();
+};
+
+#endif // QUBI_CONNECTION_H
@@ -0,0 +1,155 @@
+#ifndef QUBI_PIPELINE_H
+#define QUBI_PIPELINE_H
+
+#include "QubiProtocol.h"
+#include <type_traits>
+
+// Compile-time middleware around command handling. Each stage sees every
+// command addressed to the module (built-in actions too) before and after it
+// is handled:
+//
+//   class ServoModule : public QubiPipelineModule<ActuatorModule, QubiMetricsStage, QubiAuthStage> {
+//     void handleCommand(const QubiCommand& cmd) override { ... }
+//   };
+//
+// Stages run in the order listed, and their after() hooks in reverse. A
+// before() that returns false stops the command there; it should have sent
+// an error response, or drops the command silently. after() runs for every
+// stage whose before() ran, with the status of the response sent for the
+// command (0 if none). Stages are plain members called directly, so hooks a
+// stage doesn't define compile away and the rest inline into the dispatch;
+// the pipeline itself is entered through the module's virtual
+// dispatchCommand(), as QubiHandlerModule is.
+// Commands given to a stream handler go through the pipeline as well; their
+// stages see the command without params, which stay with the handler's
+// cursor.
+
+// Base for stages: hooks that do nothing. A stage defines the ones it needs.
+struct QubiStage {
+  bool before(QubiModule& module, const QubiCommand& cmd) { (void)module; (void)cmd; return true; }
+  void after(QubiModule& module, const QubiCommand& cmd, uint16_t status) { (void)module; (void)cmd; (void)status; }
+};
+
+template <typename... Stages>
+class QubiPipeline;
+
+template <>
+class QubiPipeline<> {
+public:
+  template <typename Handler>
+  void run(QubiModule& module, const QubiCommand& cmd, Handler& handler) {
+    (void)module;
+    handler(cmd);
+  }
+};
+
+template <typename First, typename... Rest>
+class QubiPipeline<First, Rest...> {
+private:
+  First _stage;
+  QubiPipeline<Rest...> _rest;
+
+public:
+  template <typename Handler>
+  void run(QubiModule& module, const QubiCommand& cmd, Handler& handler) {
+    if (_stage.before(module, cmd)) {
+      _rest.run(module, cmd, handler);
+    }
+    _stage.after(module, cmd, module.getLastStatus());
+  }
+
+  // The stage of type S, e.g. to configure it or read its counters
+  template <typename S>
+  typename std::enable_if<std::is_same<S, First>::value, S&>::type stage() { return _stage; }
+  template <typename S>
+  typename std::enable_if<!std::is_same<S, First>::value, S&>::type stage() { return _rest.template stage<S>(); }
+};
+
+// A module class (QubiModule or one of its subclasses) with a pipeline
+// around its command dispatch
+template <typename Base, typename... Stages>
+class QubiPipelineModule : public Base {
+protected:
+  QubiPipeline<Stages...> _pipeline;
+
+  void dispatchCommand(const QubiCommand& cmd) override {
+    auto handler = [this](const QubiCommand& command) { Base::dispatchCommand(command); };
+    _pipeline.run(*this, cmd, handler);
+  }
+
+  void dispatchStreamCommand(QubiStreamCommand& command) override {
+    QubiCommand cmd;
+    cmd.moduleId = command.moduleId;
+    cmd.moduleType = this->stringToModuleType(command.moduleType);
+    cmd.action = command.action;
+    auto handler = [this, &command](const QubiCommand&) { Base::dispatchStreamCommand(command); };
+    _pipeline.run(*this, cmd, handler);
+  }
+
+public:
+  template <typename S>
+  S& stage() { return _pipeline.template stage<S>(); }
+};
+
+// Prints each command with its status and handling time
+struct QubiLogStage : QubiStage {
+  unsigned long start = 0;
+
+  bool before(QubiModule& module, const QubiCommand& cmd) {
+    (void)module;
+    (void)cmd;
+    start = micros();
+    return true;
+  }
+  void after(QubiModule& module, const QubiCommand& cmd, uint16_t status) {
+    (void)module;
+    Serial.printf("%s: %u in %lu us\n", cmd.action.c_str(), status, micros() - start);
+  }
+};
+
+// Counts commands by outcome and times their handling
+struct QubiMetricsStage : QubiStage {
+  uint32_t commands = 0;
+  uint32_t errors = 0;       // Answered with a status of 400 or above
+  uint32_t unanswered = 0;   // No response sent
+  uint32_t totalMicros = 0;
+  uint32_t maxMicros = 0;
+  unsigned long start = 0;
+
+  bool before(QubiModule& module, const QubiCommand& cmd) {
+    (void)module;
+    (void)cmd;
+    start = micros();
+    return true;
+  }
+  void after(QubiModule& module, const QubiCommand& cmd, uint16_t status) {
+    (void)module;
+    (void)cmd;
+    uint32_t elapsed = micros() - start;
+    commands++;
+    totalMicros += elapsed;
+    maxMicros = max(maxMicros, elapsed);
+    if (status == 0) {
+      unanswered++;
+    } else if (status >= 400) {
+      errors++;
+    }
+  }
+};
+
+// Drops commands that didn't come in an authenticated frame, except
+// discover and handshake. With setAuthRequired(false), modules can then be
+// found by anyone but only controlled by key holders.
+struct QubiAuthStage : QubiStage {
+  uint32_t dropped = 0;
+
+  bool before(QubiModule& module, const QubiCommand& cmd) {
+    if (module.isAuthenticated() || cmd.action == "discover" || cmd.action == "handshake") {
+      return true;
+    }
+    dropped++;
+    return false;
+  }
+};
+
+#endif // QUBI_PIPELINE_H
@@ -1,22 +1,125 @@
 #include "QubiProtocol.h"
 
-QubiModule::QubiModule() : _initialized(false), _port(QUBI_DEFAULT_PORT) {}
+// readPayload() results besides a payload length
+#define QUBI_PAYLOAD_INVALID -1   // Malformed frame, answered with 400
+#define QUBI_PAYLOAD_DROPPED -2   // Failed authentication, dropped silently
 
-bool QubiModule::begin(const String& moduleId, QubiModuleType moduleType, uint16_t port) {
+namespace {
+
+// Counts station disconnects as they happen, so a drop is seen even if
+// processMessages() wasn't called during it and the link came back with
+// the same address
+#ifdef ARDUINO_ARCH_ESP32
+volatile uint32_t stationDrops = 0;
+volatile unsigned long stationDroppedAt = 0;
+
+void onStationDisconnected(arduino_event_id_t event) {
+  (void)event;
+  stationDrops++;
+  stationDroppedAt = millis();
+}
+
+uint32_t linkGeneration() {
+  static bool watching = false;
+  if (!watching) {
+    watching = true;
+    WiFi.onEvent(onStationDisconnected, ARDUINO_EVENT_WIFI_STA_DISCONNECTED);
+  }
+  return stationDrops;
+}
+
+unsigned long linkDownAt() {
+  return stationDroppedAt;
+}
+#else
+uint32_t linkGeneration() {
+  return WiFi.linkGeneration();
+}
+
+unsigned long linkDownAt() {
+  return WiFi.linkDownAt();
+}
+#endif
+
+}  // namespace
+
+QubiModule::QubiModule() : _port(QUBI_DEFAULT_PORT), _initialized(false),
+  _rxSequence(0), _rxMicros(0), _txStatus(0), _capabilities(QUBI_CAP_COMPRESSION | QUBI_CAP_LOAD_REPORT), _currentSession(nullptr), _linkUp(false),
+  _linkLost(false), _linkGeneration(0), _linkLostAt(0), _authKeyCount(0),
+  _authRequired(false), _rxAuthKey(-1), _rateLimit(0), _rateBurst(0), _loadWindowStart(0), _loadCalls(0),
+  _loadBusyUs(0), _loadDropsAtStart(0), _backlog(0), _peakBacklog(0), _loadBeaconInterval(0),
+  _lastLoadBeacon(0), _compressThreshold(QUBI_COMPRESS_THRESHOLD), _stateFieldCount(0), _jobCount(0), _nextJob(0),
+  _backgroundBudgetUs(QUBI_BACKGROUND_BUDGET_US), _actionStatsCount(0) {
+  for (uint8_t i = 0; i < QUBI_MAX_SESSIONS; i++) {
+    _sessions[i] = QubiSession();
+  }
+  memset(_stateDefaults, 0, sizeof(_stateDefaults));
+  memset(_state, 0, sizeof(_state));
+  memset(_authKeys, 0, sizeof(_authKeys));
+  memset(&_stats, 0, sizeof(_stats));
+  memset(&_load, 0, sizeof(_load));
+  memset(&_profile, 0, sizeof(_profile));
+  memset(_actionStats, 0, sizeof(_actionStats));
+  _profile.loopDelayMs = 10;  // As BALANCED, until begin() applies a profile
+  for (uint8_t i = 0; i < QUBI_MAX_RATE_SOURCES; i++) {
+    _rateBuckets[i] = QubiRateBucket();
+  }
+}
+
+bool QubiModule::begin(const String& moduleId, QubiModuleType moduleType, uint16_t port,
+                       QubiLatencyProfile profile) {
   _moduleId = moduleId;
   _moduleType = moduleType;
   _port = port;
+  applyProfile(profile);
   
-  if (!_udp.begin(_port)) {
+  if (!openSocket()) {
     Serial.println("Failed to start UDP server");
     return false;
   }
   
   _initialized = true;
+  _linkUp = WiFi.status() == WL_CONNECTED;
+  _linkLost = false;
+  _linkIP = WiFi.localIP();
+  _linkGeneration = linkGeneration();
+  _loadWindowStart = _lastLoadBeacon = millis();
   Serial.printf("Qubi module '%s' started on port %d\n", _moduleId.c_str(), _port);
   return true;
 }
 
+void QubiModule::applyProfile(QubiLatencyProfile profile) {
+  _profile.profile = profile;
+  switch (profile) {
+    case QubiLatencyProfile::LOW_LATENCY:
+      // Modem sleep holds frames until the next DTIM beacon (~100 ms)
+      _profile.powerSave = WIFI_PS_NONE;
+      _profile.txPower = WIFI_POWER_19_5dBm;
+      _profile.taskPriority = 5;  // Above other sketch tasks, below lwIP and WiFi
+      _profile.loopDelayMs = 1;
+      break;
+    case QubiLatencyProfile::LOW_POWER:
+      _profile.powerSave = WIFI_PS_MAX_MODEM;
+      _profile.txPower = WIFI_POWER_8_5dBm;
+      _profile.taskPriority = 1;
+      _profile.loopDelayMs = 50;
+      break;
+    case QubiLatencyProfile::BALANCED:
+    default:
+      _profile.powerSave = WIFI_PS_MIN_MODEM;
+      _profile.txPower = WIFI_POWER_19_5dBm;
+      _profile.taskPriority = 1;
+      _profile.loopDelayMs = 10;
+      break;
+  }
+  
+  WiFi.setSleep((wifi_ps_type_t)_profile.powerSave);
+  WiFi.setTxPower((wifi_power_t)_profile.txPower);
+#ifdef ARDUINO_ARCH_ESP32
+  vTaskPrioritySet(nullptr, _profile.taskPriority);
+#endif
+}
+
 void QubiModule::end() {
   if (_initialized) {
     _udp.stop();
@@ -25,40 +128,576 @@ void QubiModule::end() {
 }
 
 void QubiModule::processMessages() {
-  if (!_initialized) return;
+  if (!_initialized || !checkLink()) return;
   
-  int packetSize = _udp.parsePacket();
-  if (packetSize > 0) {
-    char buffer[QUBI_BUFFER_SIZE];
-    int len = _udp.read(buffer, QUBI_BUFFER_SIZE - 1);
-    buffer[len] = '\0';
+  updateLoad();
+  if (_loadBeaconInterval > 0 && millis() - _lastLoadBeacon >= _loadBeaconInterval) {
+    sendLoadBeacon();
+  }
+  _loadCalls++;
+  
+  bool empty;
+  receivePacket(false, empty);
+  
+  // An idle call gives its time to background jobs; a packet that arrives
+  // meanwhile is handled in this call. The call still found the socket
+  // empty, so it counts as one without a backlog.
+  if (empty && _jobCount > 0 && runBackgroundJobs()) {
+    bool idle;
+    receivePacket(true, idle);
+  }
+  
+  // Calls that keep finding a packet waiting mean packets are queueing up
+  if (empty) {
+    _backlog = 0;
+  } else if (_backlog < 0xFFFF) {
+    _backlog++;
+    _peakBacklog = max(_peakBacklog, _backlog);
+  }
+}
+
+// Reads until a packet is processed or the socket is empty. Packets dropped
+// unparsed are cheap, so they don't use up the call. With parsed set, a
+// packet has already been parsed and is taken first. The time from reading
+// each packet to being done with it counts as busy time for the load report.
+void QubiModule::receivePacket(bool parsed, bool& empty) {
+  empty = false;
+  for (uint8_t i = 0; i < QUBI_MAX_DROPS_PER_CALL; i++) {
+    if (!parsed && _udp.parsePacket() <= 0) {
+      empty = true;
+      return;
+    }
+    parsed = false;
+    _stats.received++;
+    unsigned long start = micros();
     
-    _lastClientIP = _udp.remoteIP();
-    _lastClientPort = _udp.remotePort();
+    if (!admitPacket(_udp.remoteIP(), _udp.remotePort())) {
+      _stats.rateLimited++;
+      _udp.flush();
+      _loadBusyUs += micros() - start;
+      continue;
+    }
+    bool processed = processPacket();
+    _loadBusyUs += micros() - start;
+    if (processed) {
+      return;
+    }
+  }
+}
+
+int8_t QubiModule::addBackgroundJob(const char* name, std::function<bool()> step, uint32_t sliceUs) {
+  if (_jobCount >= QUBI_MAX_BACKGROUND_JOBS) {
+    return -1;
+  }
+  QubiBackgroundJob& job = _jobs[_jobCount];
+  job.name = name;
+  job.step = step;
+  job.sliceUs = sliceUs;
+  job.enabled = true;
+  job.steps = 0;
+  job.totalUs = 0;
+  job.maxStepUs = 0;
+  return (int8_t)_jobCount++;
+}
+
+// Gives each job a turn, starting where the last call left off, until the
+// budget is used up. Returns true if it stopped because a packet arrived;
+// that packet has been parsed and is ready to read.
+bool QubiModule::runBackgroundJobs() {
+  unsigned long start = micros();
+  for (uint8_t turn = 0; turn < _jobCount; turn++) {
+    QubiBackgroundJob& job = _jobs[_nextJob];
+    _nextJob = (_nextJob + 1) % _jobCount;
+    if (!job.enabled) {
+      continue;
+    }
     
-    QubiMessage message;
-    if (parseMessage(buffer, message)) {
-      // Process each command in the message
-      for (uint8_t i = 0; i < message.commandCount; i++) {
-        const QubiCommand& cmd = message.commands[i];
-        
-        // Check if this command is for our module
-        if (cmd.moduleId == _moduleId || cmd.moduleId == "*") {
-          if (_commandHandler) {
-            _commandHandler(cmd);
-          } else {
-            handleCommand(cmd);
-          }
-        }
+    unsigned long sliceStart = micros();
+    bool more = true;
+    for (uint16_t i = 0; more && i < QUBI_JOB_MAX_STEPS; i++) {
+      unsigned long stepStart = micros();
+      more = job.step();
+      unsigned long now = micros();
+      uint32_t elapsed = now - stepStart;
+      job.steps++;
+      job.totalUs += elapsed;
+      job.maxStepUs = max(job.maxStepUs, elapsed);
+      
+      if (_udp.parsePacket() > 0) {
+        return true;
+      }
+      if (now - start >= _backgroundBudgetUs) {
+        return false;
+      }
+      if (now - sliceStart >= job.sliceUs) {
+        break;
       }
-    } else {
-      sendError(QubiStatusCode::BAD_REQUEST, "Invalid message format");
     }
   }
+  return false;
+}
+
+bool QubiModule::setMulticastGroup(const IPAddress& group) {
+  _multicastGroup = group;
+  return !_initialized || openSocket();
+}
+
+bool QubiModule::openSocket() {
+  _udp.stop();
+  if ((uint32_t)_multicastGroup != 0) {
+    return _udp.beginMulticast(_multicastGroup, _port);
+  }
+  return _udp.begin(_port);
+}
+
+// Returns false while the link is down; the socket is reopened when it
+// comes back, since one bound before the drop may never receive again
+bool QubiModule::checkLink() {
+#ifdef ARDUINO_ARCH_ESP32
+  // Access-point-only modules have no station link to watch
+  if (!(WiFi.getMode() & WIFI_MODE_STA)) return true;
+#endif
+  // Connected without an address yet means DHCP is still running
+  IPAddress ip = WiFi.status() == WL_CONNECTED ? WiFi.localIP() : IPAddress();
+  bool up = (uint32_t)ip != 0;
+  uint32_t generation = linkGeneration();
+  if (up && _linkUp && ip == _linkIP && generation == _linkGeneration) return true;
+  
+  // Down, back with another address, or dropped and back since the last call
+  if (_linkUp) {
+    _linkUp = false;
+    _linkLost = true;
+    _linkLostAt = generation != _linkGeneration ? linkDownAt() : millis();
+    _stats.linkDrops++;
+    Serial.println("WiFi link lost");
+  }
+  if (!up || !openSocket()) return false;  // Retried on the next call
+  
+  _linkUp = true;
+  _linkIP = ip;
+  _linkGeneration = generation;
+  if (_linkLost) {
+    _linkLost = false;
+    _stats.recoveries++;
+    _stats.lastOutageMs = millis() - _linkLostAt;
+    Serial.printf("Socket reopened %lu ms after link loss\n", _stats.lastOutageMs);
+    announce();
+  }
+  return true;
+}
+
+// Tells known clients, and the multicast group, that the module is back,
+// so they need not wait for a timeout. Sessions are kept across the drop.
+void QubiModule::announce() {
+  for (uint8_t i = 0; i < QUBI_MAX_SESSIONS; i++) {
+    if (_sessions[i].active) {
+      selectSession(_sessions[i]);
+      sendDiscovery("Module reconnected");
+    }
+  }
+  _currentSession = nullptr;
+  _rxAuthKey = -1;
+  _rxSequence = 0;
+  
+  if ((uint32_t)_multicastGroup != 0) {
+    _lastClientIP = _multicastGroup;
+    _lastClientPort = _port;
+    sendDiscovery("Module reconnected");
+  }
+}
+
+// Points responses at a session, as if it had just sent a request
+void QubiModule::selectSession(QubiSession& session) {
+  _lastClientIP = session.ip;
+  _lastClientPort = session.port;
+  _currentSession = &session;
+  _rxAuthKey = session.authKey;
+  _rxSequence = 0;
+}
+
+void QubiModule::updateLoad() {
+  unsigned long now = millis();
+  unsigned long elapsed = now - _loadWindowStart;
+  if (elapsed < QUBI_LOAD_WINDOW_MS) return;
+  
+  uint32_t drops = droppedCount() - _loadDropsAtStart;
+  _load.backlog = _peakBacklog;
+  _load.drops = (uint16_t)min(drops, (uint32_t)0xFFFF);
+  _load.utilization = (uint8_t)min((uint64_t)_loadBusyUs / 10 / elapsed, (uint64_t)100);
+  
+  // Each call handles at most one packet, so the call rate is the most the
+  // module can take; a per-source rate limit caps a single controller further
+  uint32_t capacity = (uint32_t)((uint64_t)_loadCalls * 1000 / elapsed);
+  uint32_t rate = capacity * QUBI_LOAD_HEADROOM_PERCENT / 100;
+  if (_rateLimit > 0 && rate > _rateLimit) {
+    rate = _rateLimit;
+  }
+  _load.maxRate = (uint16_t)min(rate, (uint32_t)0xFFFF);
+  
+  _loadWindowStart = now;
+  _loadCalls = 0;
+  _loadBusyUs = 0;
+  _loadDropsAtStart += drops;
+  _peakBacklog = _backlog;
+}
+
+uint32_t QubiModule::droppedCount() const {
+  return _stats.rateLimited + _stats.authFailures + _stats.replays + _stats.unauthenticated;
+}
+
+void QubiModule::sendLoadBeacon() {
+  _lastLoadBeacon = millis();
+  for (uint8_t i = 0; i < QUBI_MAX_SESSIONS; i++) {
+    QubiSession& session = _sessions[i];
+    if (!session.active || !(session.capabilities & QUBI_CAP_LOAD_REPORT) ||
+        _lastLoadBeacon - session.lastSeen > QUBI_LOAD_BEACON_IDLE_MS) {
+      continue;
+    }
+    selectSession(session);
+    sendSuccess("Load report");
+  }
+  _currentSession = nullptr;
+  _rxAuthKey = -1;
+}
+
+// Returns false if the packet was dropped without a reply
+bool QubiModule::processPacket() {
+  _rxMicros = micros();
+  _lastClientIP = _udp.remoteIP();
+  _lastClientPort = _udp.remotePort();
+  _currentSession = nullptr;
+  _rxSequence = 0;
+  
+  char buffer[QUBI_BUFFER_SIZE];
+  int len = readPayload(buffer, QUBI_BUFFER_SIZE - 1);
+  if (len == QUBI_PAYLOAD_DROPPED) {
+    return false;  // Failed authentication: no reply, so forgeries get no feedback
+  }
+  
+  _currentSession = findSession(_lastClientIP, _lastClientPort);
+  if (_currentSession) {
+    _currentSession->lastSeen = millis();
+    _currentSession->authKey = _rxAuthKey;
+  }
+  
+  if (len < 0) {
+    sendError(QubiStatusCode::BAD_REQUEST, "Invalid frame");
+    return true;
+  }
+  buffer[len] = '\0';
+  if (_stats.firstCommandMs == 0) {
+    _stats.firstCommandMs = max(millis(), 1UL);
+  }
+  
+  if (_streamHandler) {
+    processStream(buffer, len);
+    return true;
+  }
+  
+  QubiMessage message;
+  if (parseMessage(buffer, message)) {
+    // Process each command in the message
+    for (uint8_t i = 0; i < message.commandCount; i++) {
+      const QubiCommand& cmd = message.commands[i];
+      
+      // Check if this command is for our module
+      if (cmd.moduleId == _moduleId || cmd.moduleId == "*") {
+        _txStatus = 0;
+        unsigned long handlerStart = micros();
+        dispatchCommand(cmd);
+        recordLatency(cmd.action.c_str(), handlerStart);
+      }
+    }
+  } else {
+    sendError(QubiStatusCode::BAD_REQUEST, "Invalid message format");
+  }
+  return true;
+}
+
+void QubiModule::setRateLimit(uint16_t packetsPerSecond, uint16_t burst) {
+  _rateLimit = packetsPerSecond;
+  _rateBurst = burst > 0 ? burst : 1;
+  for (uint8_t i = 0; i < QUBI_MAX_RATE_SOURCES; i++) {
+    _rateBuckets[i].active = false;
+  }
+}
+
+bool QubiModule::admitPacket(const IPAddress& ip, uint16_t port) {
+  if (_rateLimit == 0) return true;
+  
+  unsigned long now = micros();
+  uint32_t capacity = (uint32_t)_rateBurst * 1000;
+  
+  QubiRateBucket* bucket = nullptr;
+  QubiRateBucket* replace = &_rateBuckets[0];
+  for (uint8_t i = 0; i < QUBI_MAX_RATE_SOURCES; i++) {
+    QubiRateBucket& candidate = _rateBuckets[i];
+    if (candidate.active && candidate.ip == ip && candidate.port == port) {
+      bucket = &candidate;
+      break;
+    }
+    // Reuse a free slot, else the one idle longest
+    if (replace->active && (!candidate.active || now - candidate.lastRefill > now - replace->lastRefill)) {
+      replace = &candidate;
+    }
+  }
+  
+  if (!bucket) {
+    bucket = replace;
+    bucket->ip = ip;
+    bucket->port = port;
+    bucket->tokens = capacity;
+    bucket->lastRefill = now;
+    bucket->active = true;
+  } else {
+    uint64_t refill = (uint64_t)(now - bucket->lastRefill) * _rateLimit / 1000;
+    bucket->tokens = (uint32_t)min((uint64_t)capacity, bucket->tokens + refill);
+    bucket->lastRefill = now;
+  }
+  
+  if (bucket->tokens < 1000) return false;
+  bucket->tokens -= 1000;
+  return true;
+}
+
+int QubiModule::readPayload(char* buffer, size_t capacity) {
+  _rxAuthKey = -1;
+  
+  if (_udp.peek() != QUBI_FRAME_MAGIC) {
+    if (_authRequired) {
+      _stats.unauthenticated++;
+      return QUBI_PAYLOAD_DROPPED;
+    }
+    return _udp.read(buffer, capacity);
+  }
+  
+  uint8_t header[QUBI_FRAME_HEADER_SIZE + QUBI_AUTH_HEADER_SIZE];
+  if (_udp.read(header, QUBI_FRAME_HEADER_SIZE) != QUBI_FRAME_HEADER_SIZE) return QUBI_PAYLOAD_INVALID;
+  
+  uint8_t flags = header[1];
+  size_t length = ((size_t)header[2] << 8) | header[3];
+  bool authenticated = flags & QUBI_FRAME_AUTHENTICATED;
+  
+  if (!authenticated) {
+    if (_authRequired) {
+      _stats.unauthenticated++;
+      return QUBI_PAYLOAD_DROPPED;
+    }
+    if ((flags & ~QUBI_FRAME_COMPRESSED) || length > capacity) return QUBI_PAYLOAD_INVALID;
+    return readFrameBody(buffer, length, flags, _udp.available(), nullptr);
+  }
+  
+  // Everything before the tag check is dropped silently: until then the
+  // sender is unknown
+  if (_udp.read(header + QUBI_FRAME_HEADER_SIZE, QUBI_AUTH_HEADER_SIZE) != QUBI_AUTH_HEADER_SIZE ||
+      header[4] >= _authKeyCount || (flags & ~(QUBI_FRAME_COMPRESSED | QUBI_FRAME_AUTHENTICATED)) ||
+      length > capacity || _udp.available() < QUBI_AUTH_TAG_SIZE) {
+    _stats.authFailures++;
+    return QUBI_PAYLOAD_DROPPED;
+  }
+  
+  QubiAuthKey& key = _authKeys[header[4]];
+  uint32_t sequence = ((uint32_t)header[5] << 24) | ((uint32_t)header[6] << 16) |
+                      ((uint32_t)header[7] << 8) | header[8];
+  
+  // Cheap check first; the window only moves once the tag is verified
+  if (isReplay(key, sequence)) {
+    _stats.replays++;
+    return QUBI_PAYLOAD_DROPPED;
+  }
+  
+  QubiSipHash mac(key.key);
+  const uint8_t domain = QUBI_AUTH_DOMAIN_REQUEST;
+  mac.update(&domain, 1);
+  mac.update(header, sizeof(header));
+  size_t bodyLength = _udp.available() - QUBI_AUTH_TAG_SIZE;
+  
+  // Compressed bodies are checked before they are decoded, so forgeries
+  // cost no more than the tag
+  uint8_t compressed[QUBI_BUFFER_SIZE];
+  int len = 0;
+  if (flags & QUBI_FRAME_COMPRESSED) {
+    if (bodyLength > sizeof(compressed) || _udp.read(compressed, bodyLength) != (int)bodyLength) {
+      _stats.authFailures++;
+      return QUBI_PAYLOAD_DROPPED;
+    }
+    mac.update(compressed, bodyLength);
+  } else {
+    len = readFrameBody(buffer, length, flags, bodyLength, &mac);
+  }
+  
+  uint8_t tag[QUBI_AUTH_TAG_SIZE];
+  uint8_t expected[QUBI_AUTH_TAG_SIZE];
+  mac.finish(expected);
+  if (_udp.read(tag, sizeof(tag)) != (int)sizeof(tag) || !qubiTagsEqual(tag, expected)) {
+    _stats.authFailures++;
+    return QUBI_PAYLOAD_DROPPED;
+  }
+  
+  acceptSequence(key, sequence);
+  _rxAuthKey = (int8_t)header[4];
+  if (flags & QUBI_FRAME_COMPRESSED) {
+    QubiDecompressor decompressor((uint8_t*)buffer, length);
+    len = decompressor.feed(compressed, bodyLength) && decompressor.length() == length ? (int)length
+                                                                                       : QUBI_PAYLOAD_INVALID;
+  }
+  return len;
+}
+
+int QubiModule::readFrameBody(char* buffer, size_t length, uint8_t flags, size_t bodyLength, QubiSipHash* mac) {
+  uint8_t chunk[64];
+  
+  if (!(flags & QUBI_FRAME_COMPRESSED)) {
+    if (bodyLength < length) return QUBI_PAYLOAD_INVALID;
+    if (_udp.read((uint8_t*)buffer, length) != (int)length) return QUBI_PAYLOAD_INVALID;
+    if (mac) mac->update((const uint8_t*)buffer, length);
+    
+    // Bytes past the declared length are ignored but still authenticated
+    for (size_t left = bodyLength - length; left > 0;) {
+      int n = _udp.read(chunk, min(left, sizeof(chunk)));
+      if (n <= 0) return QUBI_PAYLOAD_INVALID;
+      if (mac) mac->update(chunk, n);
+      left -= n;
+    }
+    return (int)length;
+  }
+  
+  // Decompress straight into the parse buffer, a small chunk at a time
+  QubiDecompressor decompressor((uint8_t*)buffer, length);
+  bool valid = true;
+  for (size_t left = bodyLength; left > 0;) {
+    int n = _udp.read(chunk, min(left, sizeof(chunk)));
+    if (n <= 0) return QUBI_PAYLOAD_INVALID;
+    if (mac) mac->update(chunk, n);
+    if (valid) valid = decompressor.feed(chunk, n);
+    left -= n;
+  }
+  return valid && decompressor.length() == length ? (int)length : QUBI_PAYLOAD_INVALID;
+}
+
+bool QubiModule::isReplay(const QubiAuthKey& key, uint32_t sequence) const {
+  if (!key.rxStarted || sequence > key.rxHighest) return false;
+  uint32_t age = key.rxHighest - sequence;
+  return age >= QUBI_REPLAY_WINDOW || ((key.rxWindow >> age) & 1);
+}
+
+void QubiModule::acceptSequence(QubiAuthKey& key, uint32_t sequence) {
+  if (!key.rxStarted || sequence > key.rxHighest) {
+    uint32_t shift = key.rxStarted ? sequence - key.rxHighest : QUBI_REPLAY_WINDOW;
+    key.rxWindow = (shift >= QUBI_REPLAY_WINDOW ? 0 : key.rxWindow << shift) | 1;
+    key.rxHighest = sequence;
+    key.rxStarted = true;
+    if (sequence > key.reserved.rx) {
+      reserveSequences(key);
+    }
+  } else {
+    key.rxWindow |= 1ULL << (key.rxHighest - sequence);
+  }
+}
+
+// Stores new limits for both directions in one write. A flash write takes
+// a few milliseconds, once per QUBI_AUTH_SEQUENCE_RESERVE frames.
+void QubiModule::reserveSequences(QubiAuthKey& key) {
+  if (key.rxHighest >= key.reserved.rx) {
+    key.reserved.rx = key.rxHighest + QUBI_AUTH_SEQUENCE_RESERVE;
+  }
+  if (key.txSequence >= key.reserved.tx) {
+    key.reserved.tx = key.txSequence + QUBI_AUTH_SEQUENCE_RESERVE;
+  }
+  qubiSaveSequences(key.key, key.reserved);
+}
+
+int8_t QubiModule::addAuthKey(const uint8_t key[QUBI_AUTH_KEY_SIZE]) {
+  if (_authKeyCount >= QUBI_MAX_AUTH_KEYS) return -1;
+  QubiAuthKey& entry = _authKeys[_authKeyCount];
+  memset(&entry, 0, sizeof(entry));
+  memcpy(entry.key, key, QUBI_AUTH_KEY_SIZE);
+  
+  // After a restart, everything up to the last reservation counts as seen,
+  // and responses continue above it
+  if (qubiLoadSequences(key, entry.reserved)) {
+    entry.rxHighest = entry.reserved.rx;
+    entry.rxWindow = ~0ULL;
+    entry.rxStarted = true;
+    entry.txSequence = entry.reserved.tx;
+  }
+  _authRequired = true;
+  return (int8_t)_authKeyCount++;
+}
+
+void QubiModule::sendPayload(const uint8_t* data, size_t len) {
+  _udp.beginPacket(_lastClientIP, _lastClientPort);
+  
+  const uint8_t* body = data;
+  size_t bodyLength = len;
+  uint8_t flags = 0;
+  
+  uint8_t compressed[QUBI_BUFFER_SIZE];
+  if (len >= _compressThreshold && len <= 0xFFFF && clientSupports(QUBI_CAP_COMPRESSION)) {
+    size_t capacity = min(len - 1, (size_t)QUBI_BUFFER_SIZE);
+    size_t compressedLength = _compressor.compress(data, len, compressed, capacity);
+    
+    // Only worth it if the frame ends up smaller than the plain JSON
+    if (compressedLength > 0 && compressedLength + QUBI_FRAME_HEADER_SIZE < len) {
+      body = compressed;
+      bodyLength = compressedLength;
+      flags |= QUBI_FRAME_COMPRESSED;
+    }
+  }
+  
+  // Answer authenticated requests in kind, under the same key
+  if (_rxAuthKey >= 0 && len <= 0xFFFF) {
+    flags |= QUBI_FRAME_AUTHENTICATED;
+  }
+  
+  if (!flags) {
+    _udp.write(data, len);
+    _udp.endPacket();
+    return;
+  }
+  
+  uint8_t header[QUBI_FRAME_HEADER_SIZE + QUBI_AUTH_HEADER_SIZE];
+  size_t headerLength = QUBI_FRAME_HEADER_SIZE;
+  header[0] = QUBI_FRAME_MAGIC;
+  header[1] = flags;
+  header[2] = (uint8_t)(len >> 8);
+  header[3] = (uint8_t)len;
+  
+  if (!(flags & QUBI_FRAME_AUTHENTICATED)) {
+    _udp.write(header, headerLength);
+    _udp.write(body, bodyLength);
+    _udp.endPacket();
+    return;
+  }
+  
+  QubiAuthKey& key = _authKeys[_rxAuthKey];
+  uint32_t sequence = ++key.txSequence;
+  if (sequence > key.reserved.tx) {
+    reserveSequences(key);
+  }
+  header[4] = (uint8_t)_rxAuthKey;
+  header[5] = (uint8_t)(sequence >> 24);
+  header[6] = (uint8_t)(sequence >> 16);
+  header[7] = (uint8_t)(sequence >> 8);
+  header[8] = (uint8_t)sequence;
+  headerLength += QUBI_AUTH_HEADER_SIZE;
+  
+  QubiSipHash mac(key.key);
+  const uint8_t domain = QUBI_AUTH_DOMAIN_RESPONSE;
+  mac.update(&domain, 1);
+  mac.update(header, headerLength);
+  mac.update(body, bodyLength);
+  uint8_t tag[QUBI_AUTH_TAG_SIZE];
+  mac.finish(tag);
+  
+  _udp.write(header, headerLength);
+  _udp.write(body, bodyLength);
+  _udp.write(tag, sizeof(tag));
+  _udp.endPacket();
 }
 
 bool QubiModule::parseMessage(const char* buffer, QubiMessage& message) {
-  JsonDocument doc;
+  JsonDocument& doc = _rxDoc;
   DeserializationError error = deserializeJson(doc, buffer);
   
   if (error) {
@@ -70,9 +709,9 @@ bool QubiModule::parseMessage(const char* buffer, QubiMessage& message) {
   message.version = doc["version"].as<String>();
   message.timestamp = doc["timestamp"].as<unsigned long>();
   message.sequence = doc["sequence"].as<uint32_t>();
+  _rxSequence = message.sequence;
   
-  if (message.version != QUBI_PROTOCOL_VERSION) {
-    Serial.printf("Unsupported protocol version: %s\n", message.version.c_str());
+  if (!isSupportedVersion(message.version.c_str())) {
     return false;
   }
   
@@ -93,6 +732,517 @@ bool QubiModule::parseMessage(const char* buffer, QubiMessage& message) {
   return true;
 }
 
+bool QubiModule::isSupportedVersion(const char* version) {
+  // Any minor version of a supported major version is accepted: minor
+  // versions only add optional fields, which older modules ignore
+  uint16_t encoded;
+  if (!parseVersion(version, encoded) ||
+      (encoded >> 8) < (QUBI_PROTOCOL_VERSION_MIN_CODE >> 8) ||
+      (encoded >> 8) > (QUBI_PROTOCOL_VERSION_MAX_CODE >> 8)) {
+    Serial.printf("Unsupported protocol version: %s\n", version);
+    return false;
+  }
+  return true;
+}
+
+void QubiModule::processStream(const char* buffer, size_t len) {
+  // Responses go out while the message is still being walked; the parser
+  // holds commands back until it has read the sequence number they echo
+  bool ok = _streamParser.parse(buffer, len, isSupportedVersion, [this](QubiStreamCommand& command) {
+    _rxSequence = _streamParser.sequence();
+    dispatchStream(command);
+  });
+  _rxSequence = _streamParser.sequence();
+  if (!ok) {
+    sendError(QubiStatusCode::BAD_REQUEST, "Invalid message format");
+  }
+}
+
+void QubiModule::dispatchStream(QubiStreamCommand& command) {
+  if (strcmp(command.moduleId, _moduleId.c_str()) != 0 && strcmp(command.moduleId, "*") != 0) {
+    return;
+  }
+  
+  _txStatus = 0;
+  unsigned long handlerStart = micros();
+  if (!isBuiltinAction(command.action)) {
+    dispatchStreamCommand(command);
+    recordLatency(command.action, handlerStart);
+    return;
+  }
+  
+  // Built-in actions read their params through ArduinoJson; parse just this
+  // command's params, so the document stays the size of one command
+  QubiCommand cmd;
+  cmd.moduleId = command.moduleId;
+  cmd.moduleType = stringToModuleType(command.moduleType);
+  cmd.action = command.action;
+  if (command.params.json()) {
+    deserializeJson(_rxDoc, command.params.json(), command.params.jsonLength());
+  } else {
+    _rxDoc.clear();
+  }
+  cmd.params = _rxDoc.as<JsonObject>();
+  dispatchCommand(cmd);
+  recordLatency(command.action, handlerStart);
+}
+
+void QubiModule::dispatchStreamCommand(QubiStreamCommand& command) {
+  _streamHandler(command);
+}
+
+bool QubiModule::isBuiltinAction(const char* action) const {
+  if (strcmp(action, "handshake") == 0 || strcmp(action, "discover") == 0 ||
+      strcmp(action, "action_stats") == 0) return true;
+  return _stateFieldCount > 0 &&
+         (strcmp(action, "sync_state") == 0 || strcmp(action, "get_state") == 0 ||
+          strcmp(action, "pose_frame") == 0);
+}
+
+bool QubiModule::handleBuiltinCommand(const QubiCommand& cmd) {
+  // Runs before every handler call, so most actions are ruled out by their
+  // first letter without a string comparison
+  const char* action = cmd.action.c_str();
+  switch (action[0]) {
+    case 'a':
+      if (strcmp(action, "action_stats") != 0) return false;
+      handleActionStats();
+      return true;
+    case 'h':
+      if (strcmp(action, "handshake") != 0) return false;
+      handleHandshake(cmd);
+      return true;
+    case 'd':
+      if (strcmp(action, "discover") != 0) return false;
+      handleDiscover();
+      return true;
+    case 's':
+      if (_stateFieldCount == 0 || strcmp(action, "sync_state") != 0) return false;
+      handleSyncState(cmd);
+      return true;
+    case 'g':
+      if (_stateFieldCount == 0 || strcmp(action, "get_state") != 0) return false;
+      handleGetState();
+      return true;
+    case 'p':
+      if (_stateFieldCount == 0 || strcmp(action, "pose_frame") != 0) return false;
+      handlePoseFrame(cmd);
+      return true;
+    default:
+      return false;
+  }
+}
+
+void QubiModule::handleHandshake(const QubiCommand& cmd) {
+  uint16_t theirMin, theirMax;
+  const char* minStr = cmd.params["min_version"] | QUBI_PROTOCOL_VERSION;
+  const char* maxStr = cmd.params["max_version"] | minStr;
+  if (!parseVersion(minStr, theirMin) || !parseVersion(maxStr, theirMax) || theirMin > theirMax) {
+    sendError(QubiStatusCode::BAD_REQUEST, "Invalid version range");
+    return;
+  }
+  
+  uint16_t low = max((uint16_t)QUBI_PROTOCOL_VERSION_MIN_CODE, theirMin);
+  uint16_t high = min((uint16_t)QUBI_PROTOCOL_VERSION_MAX_CODE, theirMax);
+  if (low > high) {
+    sendError(QubiStatusCode::BAD_REQUEST, "No common protocol version");
+    return;
+  }
+  
+  QubiSession* session = openSession(_lastClientIP, _lastClientPort);
+  session->version = high;
+  session->capabilities = (cmd.params["capabilities"] | (uint32_t)0) & _capabilities;
+  session->lastSeen = millis();
+  _currentSession = session;
+  
+  char version[8];
+  snprintf(version, sizeof(version), "%u.%u", high >> 8, high & 0xFF);
+  
+  QubiResponseBuilder builder;
+  builder.addField("version", String(version))
+         .addField("capabilities", (int)session->capabilities)
+         .addField("module_capabilities", (int)_capabilities);
+  sendSuccess("Handshake complete", builder.build());
+}
+
+void QubiModule::handleDiscover() {
+  sendDiscovery("Module discovered");
+}
+
+void QubiModule::sendDiscovery(const String& message) {
+  QubiResponseBuilder builder;
+  builder.addField("module_type", moduleTypeToString(_moduleType))
+         .addField("min_version", String(QUBI_PROTOCOL_VERSION_MIN))
+         .addField("max_version", String(QUBI_PROTOCOL_VERSION_MAX))
+         .addField("capabilities", (int)_capabilities)
+         .addField("profile", profileToString(_profile.profile));
+  sendSuccess(message, builder.build());
+}
+
+int8_t QubiModule::addStateField(const char* name, int32_t initial, int32_t minValue, int32_t maxValue) {
+  if (_stateFieldCount >= QUBI_MAX_STATE_FIELDS) return -1;
+  
+  uint8_t index = _stateFieldCount++;
+  _stateFields[index].name = name;
+  _stateFields[index].minValue = minValue;
+  _stateFields[index].maxValue = maxValue;
+  _stateDefaults[index] = initial;
+  _state[index] = initial;
+  return index;
+}
+
+void QubiModule::handleSyncState(const QubiCommand& cmd) {
+  QubiSession* session = openSession(_lastClientIP, _lastClientPort);
+  session->lastSeen = millis();
+  _currentSession = session;
+  
+  // Version 0 is always the registered defaults
+  uint32_t base = cmd.params["b"] | (uint32_t)0;
+  const int32_t* baseState;
+  if (base == session->stateVersion) {
+    baseState = session->state;
+  } else if (base == session->prevStateVersion) {
+    baseState = session->prevState;
+  } else if (base == 0) {
+    baseState = _stateDefaults;
+  } else {
+    sendStateVersion(QubiStatusCode::CONFLICT, "Unknown base version", session->stateVersion);
+    return;
+  }
+  
+  // Patch is a flat [index, value, index, value, ...] array; it is checked
+  // completely before anything is applied
+  JsonArray delta = cmd.params["d"];
+  if (delta.size() % 2 != 0) {
+    sendError(QubiStatusCode::BAD_REQUEST, "State patch must be index/value pairs");
+    return;
+  }
+  
+  int32_t next[QUBI_MAX_STATE_FIELDS];
+  memcpy(next, baseState, sizeof(next));
+  for (size_t i = 0; i < delta.size(); i += 2) {
+    int index = delta[i] | -1;
+    if (index < 0 || index >= _stateFieldCount) {
+      sendError(QubiStatusCode::BAD_REQUEST, "Unknown state field");
+      return;
+    }
+    if (!delta[i + 1].is<int32_t>()) {
+      sendError(QubiStatusCode::BAD_REQUEST, String("State value must be an integer: ") + _stateFields[index].name);
+      return;
+    }
+    int32_t value = delta[i + 1];
+    if (value < _stateFields[index].minValue || value > _stateFields[index].maxValue) {
+      sendError(QubiStatusCode::BAD_REQUEST, String("State field out of range: ") + _stateFields[index].name);
+      return;
+    }
+    next[index] = value;
+  }
+  
+  // Only fields named in the patch touch the live state, so clients patching
+  // different fields do not overwrite each other
+  uint32_t changedMask = 0;
+  for (size_t i = 0; i < delta.size(); i += 2) {
+    int index = delta[i];
+    if (_state[index] != next[index]) {
+      _state[index] = next[index];
+      changedMask |= 1UL << index;
+    }
+  }
+  
+  memcpy(session->prevState, session->state, sizeof(session->state));
+  session->prevStateVersion = session->stateVersion;
+  memcpy(session->state, next, sizeof(next));
+  session->stateVersion++;
+  
+  if (changedMask && _stateHandler) {
+    _stateHandler(changedMask);
+  }
+  
+  sendStateVersion(QubiStatusCode::SUCCESS, "State synced", session->stateVersion);
+}
+
+void QubiModule::handleGetState() {
+  QubiSession* session = openSession(_lastClientIP, _lastClientPort);
+  session->lastSeen = millis();
+  _currentSession = session;
+  
+  // The live state becomes this client's new base
+  memcpy(session->prevState, session->state, sizeof(session->state));
+  session->prevStateVersion = session->stateVersion;
+  memcpy(session->state, _state, sizeof(_state));
+  session->stateVersion++;
+  
+  JsonDocument doc;
+  doc["v"] = session->stateVersion;
+  JsonArray fields = doc.createNestedArray("fields");
+  JsonArray values = doc.createNestedArray("values");
+  for (uint8_t i = 0; i < _stateFieldCount; i++) {
+    fields.add(_stateFields[i].name);
+    values.add(_state[i]);
+  }
+  sendSuccess("State", doc.as<JsonObject>());
+}
+
+void QubiModule::handleActionStats() {
+  JsonDocument doc;
+  JsonArray actions = doc["actions"].to<JsonArray>();
+  for (uint8_t i = 0; i < _actionStatsCount; i++) {
+    const QubiActionStats& stats = _actionStats[i];
+    JsonObject entry = actions.add<JsonObject>();
+    entry["action"] = stats.action;
+    entry["count"] = stats.count;
+    entry["budget_us"] = stats.budgetUs;
+    entry["overruns"] = stats.overruns;
+    entry["queue_p99_us"] = stats.queue.percentile(99);
+    entry["handler_p50_us"] = stats.handler.percentile(50);
+    entry["handler_p99_us"] = stats.handler.percentile(99);
+    entry["total_p50_us"] = stats.total.percentile(50);
+    entry["total_p99_us"] = stats.total.percentile(99);
+    entry["total_max_us"] = stats.total.maxUs;
+  }
+  sendSuccess("Action stats", doc.as<JsonObject>());
+}
+
+// The entry for an action. A new action gets one of its own only if named
+// and there is room; otherwise it shares the "*" entry.
+QubiActionStats* QubiModule::actionStats(const char* action, bool named) {
+  QubiActionStats* stats = const_cast<QubiActionStats*>(findActionStats(action));
+  if (stats) {
+    return stats;
+  }
+  // One slot is kept for "*" until it exists
+  QubiActionStats* shared = const_cast<QubiActionStats*>(findActionStats("*"));
+  if (named && _actionStatsCount < QUBI_MAX_ACTION_STATS - (shared ? 0 : 1)) {
+    return addActionStats(action);
+  }
+  return shared ? shared : addActionStats("*");
+}
+
+QubiActionStats* QubiModule::addActionStats(const char* action) {
+  QubiActionStats& stats = _actionStats[_actionStatsCount++];
+  memset(&stats, 0, sizeof(stats));
+  strncpy(stats.action, action, QUBI_ACTION_NAME_SIZE - 1);
+  return &stats;
+}
+
+const QubiActionStats* QubiModule::findActionStats(const char* action) const {
+  for (uint8_t i = 0; i < _actionStatsCount; i++) {
+    if (strncmp(_actionStats[i].action, action, QUBI_ACTION_NAME_SIZE - 1) == 0) {
+      return &_actionStats[i];
+    }
+  }
+  return nullptr;
+}
+
+bool QubiModule::setActionBudget(const char* action, uint32_t budgetUs) {
+  QubiActionStats* stats = actionStats(action, true);
+  if (strncmp(stats->action, action, QUBI_ACTION_NAME_SIZE - 1) != 0) {
+    return false;  // Table full
+  }
+  stats->budgetUs = budgetUs;
+  return true;
+}
+
+bool QubiModule::trackAction(const char* action) {
+  QubiActionStats* stats = actionStats(action, true);
+  return strncmp(stats->action, action, QUBI_ACTION_NAME_SIZE - 1) == 0;
+}
+
+void QubiModule::resetActionStats() {
+  for (uint8_t i = 0; i < _actionStatsCount; i++) {
+    QubiActionStats& stats = _actionStats[i];
+    stats.count = 0;
+    stats.overruns = 0;
+    memset(&stats.queue, 0, sizeof(stats.queue));
+    memset(&stats.handler, 0, sizeof(stats.handler));
+    memset(&stats.total, 0, sizeof(stats.total));
+  }
+}
+
+void QubiModule::recordLatency(const char* action, unsigned long handlerStart) {
+  unsigned long end = micros();
+  uint32_t total = end - _rxMicros;
+  QubiActionStats* stats = actionStats(action, isBuiltinAction(action));
+  stats->count++;
+  stats->queue.add(handlerStart - _rxMicros);
+  stats->handler.add(end - handlerStart);
+  stats->total.add(total);
+  if (stats->budgetUs > 0 && total > stats->budgetUs) {
+    stats->overruns++;
+    _stats.budgetOverruns++;
+    if (_budgetHandler) {
+      _budgetHandler(*stats, total);
+    }
+  }
+}
+
+void QubiLatencyHistogram::add(uint32_t us) {
+  uint8_t bucket = 0;
+  if (us > 1) {
+    bucket = 31 - __builtin_clz(us);
+    if (bucket >= QUBI_LATENCY_BUCKETS) {
+      bucket = QUBI_LATENCY_BUCKETS - 1;
+    }
+  }
+  buckets[bucket]++;
+  if (us > maxUs) {
+    maxUs = us;
+  }
+}
+
+uint32_t QubiLatencyHistogram::percentile(uint8_t percent) const {
+  uint32_t count = 0;
+  for (uint8_t i = 0; i < QUBI_LATENCY_BUCKETS; i++) {
+    count += buckets[i];
+  }
+  if (count == 0) {
+    return 0;
+  }
+  
+  uint32_t rank = max((uint32_t)(((uint64_t)count * percent + 99) / 100), (uint32_t)1);
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < QUBI_LATENCY_BUCKETS - 1; i++) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      return min((2UL << i) - 1, (unsigned long)maxUs);
+    }
+  }
+  return maxUs;
+}
+
+void QubiModule::handlePoseFrame(const QubiCommand& cmd) {
+  // "v" holds the values; "c" the channel index of each one. Without "c"
+  // the values address channels 0, 1, 2, ... in order.
+  JsonArray channels = cmd.params["c"];
+  JsonArray values = cmd.params["v"];
+  bool indexed = !channels.isNull();
+  size_t count = values.size();
+  
+  if (count == 0 || count > _stateFieldCount || (indexed && channels.size() != count)) {
+    sendError(QubiStatusCode::BAD_REQUEST, "Pose frame needs one value per channel");
+    return;
+  }
+  
+  // Decode and validate every channel before touching anything, so a bad
+  // frame is rejected whole instead of leaving the robot half-posed
+  uint8_t index[QUBI_MAX_STATE_FIELDS];
+  int32_t next[QUBI_MAX_STATE_FIELDS];
+  uint32_t mask = 0;
+  for (size_t i = 0; i < count; i++) {
+    int channel = indexed ? (channels[i] | -1) : (int)i;
+    if (channel < 0 || channel >= _stateFieldCount || (mask & (1UL << channel))) {
+      sendError(QubiStatusCode::BAD_REQUEST, "Invalid pose channel");
+      return;
+    }
+    if (!values[i].is<int32_t>()) {
+      sendError(QubiStatusCode::BAD_REQUEST, String("Pose value must be an integer: ") + _stateFields[channel].name);
+      return;
+    }
+    int32_t value = values[i];
+    if (value < _stateFields[channel].minValue || value > _stateFields[channel].maxValue) {
+      sendError(QubiStatusCode::BAD_REQUEST, String("Pose value out of range: ") + _stateFields[channel].name);
+      return;
+    }
+    index[i] = (uint8_t)channel;
+    next[i] = value;
+    mask |= 1UL << channel;
+  }
+  
+  for (size_t i = 0; i < count; i++) {
+    _state[index[i]] = next[i];
+  }
+  
+  if (_poseHandler) {
+    QubiPoseFrame frame;
+    frame.channelMask = mask;
+    frame.durationMs = cmd.params["t"] | (uint16_t)0;
+    frame.values = _state;
+    _poseHandler(frame);
+  } else if (_stateHandler) {
+    _stateHandler(mask);
+  }
+  
+  sendSuccess("Pose applied");
+}
+
+String QubiModule::rangeMessage(const char* name, const String& minValue, const String& maxValue,
+                                bool hasMin, bool hasMax) {
+  if (hasMin && hasMax) return String(name) + " must be between " + minValue + " and " + maxValue;
+  if (hasMin) return String(name) + " must be at least " + minValue;
+  return String(name) + " must be at most " + maxValue;
+}
+
+void QubiModule::sendStateVersion(QubiStatusCode code, const String& message, uint32_t version) {
+  JsonDocument doc;
+  doc["v"] = version;
+  sendResponse(code, message, doc.as<JsonObject>());
+}
+
+QubiSession* QubiModule::findSession(const IPAddress& ip, uint16_t port) {
+  for (uint8_t i = 0; i < QUBI_MAX_SESSIONS; i++) {
+    if (_sessions[i].active && _sessions[i].ip == ip && _sessions[i].port == port) {
+      return &_sessions[i];
+    }
+  }
+  return nullptr;
+}
+
+QubiSession* QubiModule::openSession(const IPAddress& ip, uint16_t port) {
+  QubiSession* session = findSession(ip, port);
+  if (session) return session;
+  
+  // Reuse a free slot, otherwise evict the least recently seen client.
+  // Ages rather than timestamps, which wrap after 49 days.
+  unsigned long now = millis();
+  session = &_sessions[0];
+  for (uint8_t i = 0; i < QUBI_MAX_SESSIONS; i++) {
+    if (!_sessions[i].active) {
+      session = &_sessions[i];
+      break;
+    }
+    if (now - _sessions[i].lastSeen > now - session->lastSeen) {
+      session = &_sessions[i];
+    }
+  }
+  
+  *session = QubiSession();
+  session->ip = ip;
+  session->port = port;
+  session->active = true;
+  session->authKey = _rxAuthKey;
+  memcpy(session->state, _stateDefaults, sizeof(session->state));
+  memcpy(session->prevState, _stateDefaults, sizeof(session->prevState));
+  return session;
+}
+
+bool QubiModule::clientSupports(uint32_t capability) const {
+  return _currentSession && (_currentSession->capabilities & capability) == capability;
+}
+
+bool QubiModule::parseVersion(const char* version, uint16_t& encoded) {
+  if (!version) return false;
+  
+  unsigned int major, minor;
+  char extra;
+  if (sscanf(version, "%u.%u%c", &major, &minor, &extra) != 2 || major > 255 || minor > 255) {
+    return false;
+  }
+  encoded = (uint16_t)((major << 8) | minor);
+  return true;
+}
+
+void QubiModule::dispatchCommand(const QubiCommand& cmd) {
+  if (handleBuiltinCommand(cmd)) {
+    return;
+  }
+  
+  if (_commandHandler) {
+    _commandHandler(cmd);
+  } else {
+    handleCommand(cmd);
+  }
+}
+
 void QubiModule::handleCommand(const QubiCommand& cmd) {
   Serial.printf("Received command: %s.%s\n", cmd.moduleId.c_str(), cmd.action.c_str());
   sendError(QubiStatusCode::METHOD_NOT_ALLOWED, "Command handler not implemented");
@@ -103,6 +1253,7 @@ void QubiModule::setCommandHandler(std::function<void(const QubiCommand&)> handl
 }
 
 void QubiModule::sendResponse(QubiStatusCode statusCode, const String& message, const JsonObject& data) {
+  _txStatus = (uint16_t)statusCode;
   JsonDocument doc;
   doc["status"] = (int)statusCode;
   doc["message"] = message;
@@ -112,13 +1263,23 @@ void QubiModule::sendResponse(QubiStatusCode statusCode, const String& message,
   if (!data.isNull()) {
     doc["data"] = data;
   }
+  // Lets controllers match responses to pipelined requests
+  if (_rxSequence != 0) {
+    doc["data"]["sequence"] = _rxSequence;
+  }
+  
+  if (clientSupports(QUBI_CAP_LOAD_REPORT)) {
+    JsonObject load = doc["load"].to<JsonObject>();
+    load["backlog"] = _load.backlog;
+    load["drops"] = _load.drops;
+    load["utilization"] = _load.utilization;
+    load["max_rate"] = _load.maxRate;
+  }
   
   String response;
   serializeJson(doc, response);
   
-  _udp.beginPacket(_lastClientIP, _lastClientPort);
-  _udp.print(response);
-  _udp.endPacket();
+  sendPayload((const uint8_t*)response.c_str(), response.length());
 }
 
 void QubiModule::sendSuccess(const String& message, const JsonObject& data) {
@@ -140,6 +1301,14 @@ String QubiModule::moduleTypeToString(QubiModuleType type) {
   }
 }
 
+String QubiModule::profileToString(QubiLatencyProfile profile) {
+  switch (profile) {
+    case QubiLatencyProfile::LOW_LATENCY: return "low_latency";
+    case QubiLatencyProfile::LOW_POWER: return "low_power";
+    default: return "balanced";
+  }
+}
+
 QubiModuleType QubiModule::stringToModuleType(const String& typeStr) {
   if (typeStr == "actuator") return QubiModuleType::ACTUATOR;
   if (typeStr == "display") return QubiModuleType::DISPLAY;
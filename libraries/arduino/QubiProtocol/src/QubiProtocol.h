@@ -5,11 +5,74 @@
 #include <WiFiUdp.h>
 #include <ArduinoJson.h>
 #include <functional>
+#include <float.h>
+#include <string.h>
+#include "QubiAuth.h"
+#include "QubiCompress.h"
+#include "QubiConnection.h"
+#include "QubiStreamParser.h"
 
 #define QUBI_PROTOCOL_VERSION "1.0"
+#define QUBI_PROTOCOL_VERSION_MIN "1.0"
+#define QUBI_PROTOCOL_VERSION_MAX "1.0"
+// The same range encoded as major << 8 | minor, the form versions are compared in
+#define QUBI_PROTOCOL_VERSION_MIN_CODE 0x0100
+#define QUBI_PROTOCOL_VERSION_MAX_CODE 0x0100
 #define QUBI_DEFAULT_PORT 8888
 #define QUBI_BUFFER_SIZE 1024
 #define QUBI_MAX_COMMANDS 16
+#define QUBI_MAX_SESSIONS 4
+#define QUBI_MAX_STATE_FIELDS 16
+
+// Per-source rate limiting. Packets dropped before parsing do not use up a
+// processMessages() call; up to this many are skipped in one call.
+#define QUBI_MAX_RATE_SOURCES 8
+#define QUBI_MAX_DROPS_PER_CALL 32
+
+// Binary framing. A datagram starting with QUBI_FRAME_MAGIC (never the first
+// byte of JSON text) carries a 4-byte header: magic, flags, and the decoded
+// payload length (big-endian), followed by the payload.
+#define QUBI_FRAME_MAGIC 0xA7
+#define QUBI_FRAME_HEADER_SIZE 4
+#define QUBI_FRAME_COMPRESSED 0x01
+#define QUBI_FRAME_AUTHENTICATED 0x02
+
+// Authenticated frames add a key id and a big-endian sequence number after
+// the header, and end with a SipHash-2-4 tag over everything before it
+#define QUBI_AUTH_HEADER_SIZE 5
+#define QUBI_MAX_AUTH_KEYS 4
+#define QUBI_REPLAY_WINDOW 64
+
+// Load reporting: figures cover the last full window, and the suggested
+// send rate leaves this much of the measured capacity in use
+#define QUBI_LOAD_WINDOW_MS 1000
+#define QUBI_LOAD_HEADROOM_PERCENT 80
+#define QUBI_LOAD_BEACON_IDLE_MS 10000   // No beacons to sessions quiet this long
+
+// Responses at least this long are compressed for clients that negotiated it
+#define QUBI_COMPRESS_THRESHOLD 256
+
+// Background jobs, run by processMessages() in calls that find no packet
+#define QUBI_MAX_BACKGROUND_JOBS 8
+#define QUBI_BACKGROUND_BUDGET_US 2000   // Per processMessages() call
+#define QUBI_JOB_SLICE_US 1000           // Per job per turn, unless set otherwise
+#define QUBI_JOB_MAX_STEPS 256           // Per job per turn, also ends turns on a clock that stands still
+
+// Per-action latency tracking: actions without an entry of their own share
+// one named "*", and latencies are counted in power-of-two buckets
+#define QUBI_MAX_ACTION_STATS 8
+#define QUBI_ACTION_NAME_SIZE 24
+#define QUBI_LATENCY_BUCKETS 20
+
+// Optional protocol features, negotiated per client with the "handshake" action
+enum QubiCapability : uint32_t {
+  QUBI_CAP_BINARY_ENCODING = 1UL << 0,
+  QUBI_CAP_COMPRESSION = 1UL << 1,
+  QUBI_CAP_AGGREGATION = 1UL << 2,
+  QUBI_CAP_RELIABILITY = 1UL << 3,
+  QUBI_CAP_TIME_SYNC = 1UL << 4,
+  QUBI_CAP_LOAD_REPORT = 1UL << 5
+};
 
 enum class QubiModuleType {
   ACTUATOR,
@@ -19,11 +82,27 @@ enum class QubiModuleType {
   CUSTOM
 };
 
+// Coherent sets of radio and scheduling settings, applied by begin()
+enum class QubiLatencyProfile : uint8_t {
+  BALANCED,      // ESP32 defaults: modem sleep, full TX power, 10 ms loop
+  LOW_LATENCY,   // Radio always on, loop task raised, 1 ms loop
+  LOW_POWER      // Deep modem sleep, reduced TX power, 50 ms loop
+};
+
+struct QubiProfileSettings {
+  QubiLatencyProfile profile;
+  uint8_t powerSave;       // wifi_ps_type_t: 0 = off, 1 = min modem, 2 = max modem
+  int8_t txPower;          // wifi_power_t, in 0.25 dBm
+  uint8_t taskPriority;    // FreeRTOS priority of the task that called begin()
+  uint16_t loopDelayMs;    // Suggested delay() between processMessages() calls
+};
+
 enum class QubiStatusCode {
   SUCCESS = 200,
   BAD_REQUEST = 400,
   NOT_FOUND = 404,
   METHOD_NOT_ALLOWED = 405,
+  CONFLICT = 409,
   INTERNAL_ERROR = 500
 };
 
@@ -34,6 +113,163 @@ struct QubiCommand {
   JsonObject params;
 };
 
+// Typed parameter binding. A params struct lists its fields in a constexpr
+// table and QubiModule::bind() fills it from cmd.params in one pass; fields
+// the command leaves out keep the struct's own default values:
+//
+//   struct ServoParams {
+//     int angle = 0;
+//     int speed = 255;
+//     static constexpr QubiField<ServoParams> fields[] = {
+//       {"angle", &ServoParams::angle, 0, 180, QUBI_REQUIRED},
+//       {"speed", &ServoParams::speed, 0, 255},
+//     };
+//   };
+//
+// Needs C++17 (inline static members); on older toolchains also define
+// ServoParams::fields outside the struct.
+#define QUBI_REQUIRED true
+
+enum class QubiFieldType : uint8_t { INT, FLOAT, BOOL, STRING };
+
+template <typename T>
+struct QubiField {
+  const char* name;
+  QubiFieldType type;
+  bool required;
+  int T::* intMember;
+  float T::* floatMember;
+  bool T::* boolMember;
+  const char* T::* stringMember;
+  int32_t minInt, maxInt;
+  float minFloat, maxFloat;
+  
+  constexpr QubiField(const char* name, int T::* member, int32_t minValue = INT32_MIN,
+                      int32_t maxValue = INT32_MAX, bool required = false)
+    : name(name), type(QubiFieldType::INT), required(required), intMember(member), floatMember(nullptr),
+      boolMember(nullptr), stringMember(nullptr), minInt(minValue), maxInt(maxValue), minFloat(0), maxFloat(0) {}
+  constexpr QubiField(const char* name, float T::* member, float minValue = -FLT_MAX,
+                      float maxValue = FLT_MAX, bool required = false)
+    : name(name), type(QubiFieldType::FLOAT), required(required), intMember(nullptr), floatMember(member),
+      boolMember(nullptr), stringMember(nullptr), minInt(0), maxInt(0), minFloat(minValue), maxFloat(maxValue) {}
+  constexpr QubiField(const char* name, bool T::* member, bool required = false)
+    : name(name), type(QubiFieldType::BOOL), required(required), intMember(nullptr), floatMember(nullptr),
+      boolMember(member), stringMember(nullptr), minInt(0), maxInt(0), minFloat(0), maxFloat(0) {}
+  constexpr QubiField(const char* name, const char* T::* member, bool required = false)
+    : name(name), type(QubiFieldType::STRING), required(required), intMember(nullptr), floatMember(nullptr),
+      boolMember(nullptr), stringMember(member), minInt(0), maxInt(0), minFloat(0), maxFloat(0) {}
+};
+
+// One named integer in the module's synchronized state vector
+struct QubiStateField {
+  const char* name;
+  int32_t minValue;
+  int32_t maxValue;
+};
+
+// A whole-robot pose applied in one step. values points at the live state
+// vector; channelMask has a bit for every channel the frame set.
+struct QubiPoseFrame {
+  uint32_t channelMask;
+  uint16_t durationMs;     // Requested transition time, 0 = immediate
+  const int32_t* values;
+};
+
+// Per-client state (IP/port): handshake result and delta-sync snapshots
+struct QubiSession {
+  IPAddress ip;
+  uint16_t port;
+  uint16_t version;        // Negotiated version, (major << 8) | minor
+  uint32_t capabilities;   // Features both ends support
+  unsigned long lastSeen;
+  bool active;
+  int8_t authKey;          // Key the client last authenticated with, -1 if none
+  
+  // Last acknowledged state and the one before it, so a patch resent after
+  // a lost acknowledgement still finds its base
+  uint32_t stateVersion;
+  uint32_t prevStateVersion;
+  int32_t state[QUBI_MAX_STATE_FIELDS];
+  int32_t prevState[QUBI_MAX_STATE_FIELDS];
+};
+
+// A shared key and the sequence numbers seen and sent under it. Replay
+// state is per key rather than per address, which a forger can choose.
+struct QubiAuthKey {
+  uint8_t key[QUBI_AUTH_KEY_SIZE];
+  uint32_t rxHighest;      // Highest sequence accepted
+  uint64_t rxWindow;       // Bit n set: rxHighest - n was accepted
+  bool rxStarted;
+  uint32_t txSequence;
+  QubiAuthSequences reserved;  // Stored limits, see QUBI_AUTH_SEQUENCE_RESERVE
+};
+
+// Token bucket for one source address (tokens in thousandths of a packet)
+struct QubiRateBucket {
+  IPAddress ip;
+  uint16_t port;
+  uint32_t tokens;
+  unsigned long lastRefill;  // micros()
+  bool active;
+};
+
+// Counters for traffic the module received
+struct QubiModuleStats {
+  uint32_t received;         // Datagrams read from the socket
+  uint32_t rateLimited;      // Dropped because the source exceeded its rate
+  uint32_t authFailures;     // Unknown key, bad tag or malformed authenticated frame
+  uint32_t replays;          // Sequence already seen or older than the window
+  uint32_t unauthenticated;  // Plain datagrams dropped while authentication is required
+  unsigned long firstCommandMs;  // millis() at the first valid request (time since boot), 0 = none yet
+  uint32_t linkDrops;        // Times the WiFi link went down or the address changed
+  uint32_t recoveries;       // Times the socket was reopened afterwards
+  unsigned long lastOutageMs;  // Link loss to socket reopened, for the latest recovery
+  uint32_t budgetOverruns;   // Commands that took longer than their action's budget
+};
+
+// Latencies in microseconds. Bucket i counts values from 2^i to 2^(i+1) - 1
+// (bucket 0 also 0); the last bucket counts everything above.
+struct QubiLatencyHistogram {
+  uint32_t buckets[QUBI_LATENCY_BUCKETS];
+  uint32_t maxUs;
+  
+  void add(uint32_t us);
+  // Upper end of the bucket the given percentile falls in, 0 if empty
+  uint32_t percentile(uint8_t percent) const;
+};
+
+// Timings of one action, measured from when the module read the datagram
+struct QubiActionStats {
+  char action[QUBI_ACTION_NAME_SIZE];
+  uint32_t count;
+  uint32_t budgetUs;             // For the total time, 0 = none
+  uint32_t overruns;             // Commands over budget
+  QubiLatencyHistogram queue;    // Read to handler start: parsing and earlier commands in the message
+  QubiLatencyHistogram handler;
+  QubiLatencyHistogram total;    // Read to handler return
+};
+
+// Work done in the module's idle time, e.g. flash writes or log draining,
+// split into short steps. step() returns false when there is nothing more
+// to do for now; it is called again in a later idle call.
+struct QubiBackgroundJob {
+  const char* name;
+  std::function<bool()> step;
+  uint32_t sliceUs;        // Steps run back to back for up to this long, and QUBI_JOB_MAX_STEPS, per turn
+  bool enabled;
+  uint32_t steps;
+  uint32_t totalUs;
+  uint32_t maxStepUs;      // A packet that arrives during a step waits up to this long
+};
+
+// How well the module is keeping up, so controllers can pace themselves
+struct QubiLoadReport {
+  uint16_t backlog;        // Longest run of loop calls that each found a packet waiting
+  uint16_t drops;          // Packets dropped without a reply
+  uint8_t utilization;     // Percent of the time spent handling packets
+  uint16_t maxRate;        // Suggested packets per second for a single controller
+};
+
 struct QubiMessage {
   String version;
   unsigned long timestamp;
@@ -49,44 +285,332 @@ protected:
   WiFiUDP _udp;
   uint16_t _port;
   bool _initialized;
+  IPAddress _multicastGroup;
   IPAddress _lastClientIP;
   uint16_t _lastClientPort;
   
+  // Parsed form of the current datagram; commands' params point into it
+  JsonDocument _rxDoc;
+  uint32_t _rxSequence;      // Echoed in responses as data.sequence, 0 if the request had none
+  unsigned long _rxMicros;   // When the current datagram was read
+  uint16_t _txStatus;        // Status of the last response to the current command, 0 = none yet
+  
+  // Capability negotiation
+  uint32_t _capabilities;
+  QubiSession _sessions[QUBI_MAX_SESSIONS];
+  QubiSession* _currentSession;
+  
+  // Link monitoring: the socket is reopened when WiFi comes back
+  bool _linkUp;
+  bool _linkLost;
+  IPAddress _linkIP;
+  uint32_t _linkGeneration;  // Disconnects seen by the WiFi driver when the socket was opened
+  unsigned long _linkLostAt;
+  
+  // Message authentication
+  QubiAuthKey _authKeys[QUBI_MAX_AUTH_KEYS];
+  uint8_t _authKeyCount;
+  bool _authRequired;
+  int8_t _rxAuthKey;         // Key that authenticated the current datagram, -1 if none
+  QubiModuleStats _stats;
+  
+  QubiProfileSettings _profile;
+  
+  // Rate limiting
+  QubiRateBucket _rateBuckets[QUBI_MAX_RATE_SOURCES];
+  uint16_t _rateLimit;       // Packets per second per source, 0 = off
+  uint16_t _rateBurst;
+  
+  // Load reporting
+  QubiLoadReport _load;
+  unsigned long _loadWindowStart;
+  uint32_t _loadCalls;
+  uint32_t _loadBusyUs;      // Spent handling packets, this window
+  uint32_t _loadDropsAtStart;
+  uint16_t _backlog;
+  uint16_t _peakBacklog;
+  uint16_t _loadBeaconInterval;  // ms, 0 = off
+  unsigned long _lastLoadBeacon;
+  
+  // Compression
+  QubiCompressor _compressor;
+  uint16_t _compressThreshold;
+  
+  // Delta state sync
+  QubiStateField _stateFields[QUBI_MAX_STATE_FIELDS];
+  int32_t _stateDefaults[QUBI_MAX_STATE_FIELDS];
+  int32_t _state[QUBI_MAX_STATE_FIELDS];
+  uint8_t _stateFieldCount;
+  std::function<void(uint32_t)> _stateHandler;
+  std::function<void(const QubiPoseFrame&)> _poseHandler;
+  
+  // Background jobs
+  QubiBackgroundJob _jobs[QUBI_MAX_BACKGROUND_JOBS];
+  uint8_t _jobCount;
+  uint8_t _nextJob;          // First to run next time, so every job gets turns
+  uint32_t _backgroundBudgetUs;
+  
+  // Per-action latency
+  QubiActionStats _actionStats[QUBI_MAX_ACTION_STATS];
+  uint8_t _actionStatsCount;
+  std::function<void(const QubiActionStats&, uint32_t)> _budgetHandler;
+  
   // Command handler function pointer
   std::function<void(const QubiCommand&)> _commandHandler;
   
+  // Streaming dispatch (no DOM for the whole message)
+  QubiStreamParser _streamParser;
+  std::function<void(QubiStreamCommand&)> _streamHandler;
+  
   // Internal methods
+  bool checkLink();
+  bool openSocket();
+  void announce();
+  void selectSession(QubiSession& session);
+  void sendDiscovery(const String& message);
+  void receivePacket(bool parsed, bool& empty);
+  bool processPacket();
+  bool runBackgroundJobs();
+  bool admitPacket(const IPAddress& ip, uint16_t port);
+  int readPayload(char* buffer, size_t capacity);
+  int readFrameBody(char* buffer, size_t length, uint8_t flags, size_t bodyLength, QubiSipHash* mac);
+  bool isReplay(const QubiAuthKey& key, uint32_t sequence) const;
+  void acceptSequence(QubiAuthKey& key, uint32_t sequence);
+  void reserveSequences(QubiAuthKey& key);
+  void applyProfile(QubiLatencyProfile profile);
+  void updateLoad();
+  uint32_t droppedCount() const;
+  void sendLoadBeacon();
+  void sendPayload(const uint8_t* data, size_t len);
   bool parseMessage(const char* buffer, QubiMessage& message);
+  static bool isSupportedVersion(const char* version);
+  void processStream(const char* buffer, size_t len);
+  void dispatchStream(QubiStreamCommand& command);
+  bool isBuiltinAction(const char* action) const;
+  bool handleBuiltinCommand(const QubiCommand& cmd);
+  // Runs one command addressed to this module: built-in actions, then the
+  // handler function or handleCommand(). QubiPipelineModule wraps it.
+  virtual void dispatchCommand(const QubiCommand& cmd);
+  // Runs one streamed command that isn't a built-in action: the stream
+  // handler. QubiPipelineModule wraps it too.
+  virtual void dispatchStreamCommand(QubiStreamCommand& command);
+  void handleHandshake(const QubiCommand& cmd);
+  void handleDiscover();
+  void handleSyncState(const QubiCommand& cmd);
+  void handleGetState();
+  void handlePoseFrame(const QubiCommand& cmd);
+  void handleActionStats();
+  QubiActionStats* actionStats(const char* action, bool named);
+  QubiActionStats* addActionStats(const char* action);
+  void recordLatency(const char* action, unsigned long handlerStart);
+  template <typename T>
+  bool bindField(const QubiField<T>& field, JsonVariant value, T& params);
+  static String rangeMessage(const char* name, const String& minValue, const String& maxValue,
+                             bool hasMin, bool hasMax);
+  void sendStateVersion(QubiStatusCode code, const String& message, uint32_t version);
+  QubiSession* findSession(const IPAddress& ip, uint16_t port);
+  QubiSession* openSession(const IPAddress& ip, uint16_t port);
   void sendResponse(QubiStatusCode statusCode, const String& message, const JsonObject& data = JsonObject());
   String moduleTypeToString(QubiModuleType type);
   QubiModuleType stringToModuleType(const String& typeStr);
+  String profileToString(QubiLatencyProfile profile);
   
 public:
   QubiModule();
   virtual ~QubiModule() = default;
   
   // Initialization
-  bool begin(const String& moduleId, QubiModuleType moduleType, uint16_t port = QUBI_DEFAULT_PORT);
+  // Call after WiFi is connected: the profile's radio settings need it up
+  bool begin(const String& moduleId, QubiModuleType moduleType, uint16_t port = QUBI_DEFAULT_PORT,
+             QubiLatencyProfile profile = QubiLatencyProfile::BALANCED);
   void end();
   
-  // Main loop method - call this regularly
+  // Also listen on a multicast group; rejoined whenever the socket reopens
+  bool setMulticastGroup(const IPAddress& group);
+  
+  // Main loop method - call this on every loop after begin(), also while
+  // WiFi is down; it does nothing until the link is back
   void processMessages();
   
-  // Command handling - override this or set a handler function
+  // Command handling - override this or set a handler function; see
+  // QubiHandlerModule below for a binding the compiler can inline
   virtual void handleCommand(const QubiCommand& cmd);
   void setCommandHandler(std::function<void(const QubiCommand&)> handler);
   
+  // Streaming alternative to the command handler: messages are walked once
+  // without building a DOM, and each command is handed over, with a cursor
+  // over its params, as soon as its object has been read
+  void setStreamHandler(std::function<void(QubiStreamCommand&)> handler) { _streamHandler = handler; }
+  
+  // Capability negotiation
+  void setCapabilities(uint32_t capabilities) { _capabilities = capabilities; }
+  uint32_t getCapabilities() const { return _capabilities; }
+  const QubiSession* getSession() const { return _currentSession; }
+  bool clientSupports(uint32_t capability) const;
+  void setCompressionThreshold(uint16_t bytes) { _compressThreshold = bytes; }
+  
+  // Message authentication. Adding a key makes authentication required, so
+  // plain datagrams are dropped unless setAuthRequired(false) is called.
+  // Sequence numbers the key was used with before a restart are restored.
+  // Returns the key id clients put in their frames, or -1 if the table is full.
+  int8_t addAuthKey(const uint8_t key[QUBI_AUTH_KEY_SIZE]);
+  void setAuthRequired(bool required) { _authRequired = required; }
+  
+  // Per-source token buckets, checked before a packet is read. Sources over
+  // their rate are dropped without a reply. 0 packets per second turns it off.
+  void setRateLimit(uint16_t packetsPerSecond, uint16_t burst);
+  
+  const QubiModuleStats& getStats() const { return _stats; }
+  // Cooperative background work. Jobs run only in processMessages() calls
+  // that find the socket empty, round robin, for up to the background budget
+  // per call. Between steps the module checks for a packet and, if one has
+  // arrived, stops and handles it, so a command waits for one step at most.
+  // Returns the job id, or -1 if the table is full.
+  int8_t addBackgroundJob(const char* name, std::function<bool()> step, uint32_t sliceUs = QUBI_JOB_SLICE_US);
+  void setBackgroundJobEnabled(int8_t id, bool enabled) {
+    if (id >= 0 && id < _jobCount) _jobs[id].enabled = enabled;
+  }
+  const QubiBackgroundJob* getBackgroundJob(int8_t id) const {
+    return id >= 0 && id < _jobCount ? &_jobs[id] : nullptr;
+  }
+  void setBackgroundBudget(uint32_t us) { _backgroundBudgetUs = us; }
+  
+  // Per-action latency. Each action's queueing, handler and total time is
+  // kept in a histogram; a command whose total time exceeds its action's
+  // budget counts as an overrun and is passed to the budget handler. The
+  // "action_stats" built-in action reports them to controllers.
+  //
+  // Built-in actions, actions given a budget and actions passed to
+  // trackAction() get entries of their own while there is room; all others
+  // share the "*" entry, so that made-up action names from a client can't
+  // take the entries of real ones. Both return false if the table is full.
+  bool setActionBudget(const char* action, uint32_t budgetUs);
+  bool trackAction(const char* action);
+  void setBudgetHandler(std::function<void(const QubiActionStats& stats, uint32_t totalUs)> handler) {
+    _budgetHandler = handler;
+  }
+  uint8_t getActionStatsCount() const { return _actionStatsCount; }
+  const QubiActionStats* getActionStats(uint8_t index) const {
+    return index < _actionStatsCount ? &_actionStats[index] : nullptr;
+  }
+  const QubiActionStats* findActionStats(const char* action) const;
+  // Clears counts and histograms; budgets are kept
+  void resetActionStats();
+  
+  // Whether the current datagram came in an authenticated frame
+  bool isAuthenticated() const { return _rxAuthKey >= 0; }
+  // Status of the last response sent for the current command, 0 if none yet
+  uint16_t getLastStatus() const { return _txStatus; }
+  const QubiProfileSettings& getProfile() const { return _profile; }
+  uint16_t getLoopDelay() const { return _profile.loopDelayMs; }
+  
+  // Backpressure. Clients that negotiate QUBI_CAP_LOAD_REPORT get a "load"
+  // object in every response; with a beacon interval set, sessions that
+  // negotiated it are also sent a load report that often.
+  const QubiLoadReport& getLoad() const { return _load; }
+  void setLoadBeacon(uint16_t intervalMs) { _loadBeaconInterval = intervalMs; }
+  
+  // Delta state sync. Register fields in setup(); each client then patches
+  // its last acknowledged copy with "sync_state" and the handler is called
+  // with a bitmask of the live fields that changed.
+  int8_t addStateField(const char* name, int32_t initial, int32_t minValue, int32_t maxValue);
+  void setStateHandler(std::function<void(uint32_t changedMask)> handler) { _stateHandler = handler; }
+  int32_t getState(uint8_t index) const { return index < _stateFieldCount ? _state[index] : 0; }
+  void setState(uint8_t index, int32_t value) { if (index < _stateFieldCount) _state[index] = value; }
+  uint8_t getStateFieldCount() const { return _stateFieldCount; }
+  
+  // Pose frames set many state fields (channels) at once by index; without
+  // a pose handler they are reported through the state handler
+  void setPoseHandler(std::function<void(const QubiPoseFrame&)> handler) { _poseHandler = handler; }
+  
+  // Versions are encoded as (major << 8) | minor; returns false if malformed
+  static bool parseVersion(const char* version, uint16_t& encoded);
+  
   // Utility methods
   bool isInitialized() const { return _initialized; }
   String getModuleId() const { return _moduleId; }
   QubiModuleType getModuleType() const { return _moduleType; }
   uint16_t getPort() const { return _port; }
+
+#ifdef QUBI_HOST_PLATFORM
+  // Host builds only: direct access to the UDP backend (e.g. impairment setup)
+  WiFiUDP& udp() { return _udp; }
+#endif
+
+  // Fills params from cmd.params using T::fields. On a missing, mistyped or
+  // out-of-range field, answers 400 and returns false.
+  template <typename T>
+  bool bind(const QubiCommand& cmd, T& params);
   
   // Response helpers
   void sendSuccess(const String& message = "OK", const JsonObject& data = JsonObject());
   void sendError(QubiStatusCode code, const String& message);
 };
 
+template <typename T>
+bool QubiModule::bind(const QubiCommand& cmd, T& params) {
+  const size_t count = sizeof(T::fields) / sizeof(T::fields[0]);
+  static_assert(sizeof(T::fields) / sizeof(T::fields[0]) <= 32, "bind() supports up to 32 fields");
+  
+  // One pass over the params object; each key is matched against the table
+  uint32_t seen = 0;
+  for (JsonPair pair : cmd.params) {
+    const char* key = pair.key().c_str();
+    for (size_t i = 0; i < count; i++) {
+      if (strcmp(key, T::fields[i].name) != 0) continue;
+      if (!bindField(T::fields[i], pair.value(), params)) return false;
+      seen |= 1UL << i;
+      break;
+    }
+  }
+  
+  for (size_t i = 0; i < count; i++) {
+    if (T::fields[i].required && !(seen & (1UL << i))) {
+      sendError(QubiStatusCode::BAD_REQUEST, String("Missing parameter: ") + T::fields[i].name);
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename T>
+bool QubiModule::bindField(const QubiField<T>& field, JsonVariant value, T& params) {
+  switch (field.type) {
+    case QubiFieldType::INT: {
+      if (!value.is<int32_t>()) break;
+      int32_t number = value.as<int32_t>();
+      if (number < field.minInt || number > field.maxInt) {
+        sendError(QubiStatusCode::BAD_REQUEST, rangeMessage(field.name, String(field.minInt), String(field.maxInt),
+                                                            field.minInt != INT32_MIN, field.maxInt != INT32_MAX));
+        return false;
+      }
+      params.*field.intMember = number;
+      return true;
+    }
+    case QubiFieldType::FLOAT: {
+      if (!value.is<float>()) break;
+      float number = value.as<float>();
+      if (number < field.minFloat || number > field.maxFloat) {
+        sendError(QubiStatusCode::BAD_REQUEST, rangeMessage(field.name, String(field.minFloat), String(field.maxFloat),
+                                                            field.minFloat != -FLT_MAX, field.maxFloat != FLT_MAX));
+        return false;
+      }
+      params.*field.floatMember = number;
+      return true;
+    }
+    case QubiFieldType::BOOL:
+      if (!value.is<bool>()) break;
+      params.*field.boolMember = value.as<bool>();
+      return true;
+    case QubiFieldType::STRING:
+      if (!value.is<const char*>()) break;
+      params.*field.stringMember = value.as<const char*>();
+      return true;
+  }
+  sendError(QubiStatusCode::BAD_REQUEST, String("Invalid type for parameter: ") + field.name);
+  return false;
+}
+
 // Specialized module classes
 class ActuatorModule : public QubiModule {
 public:
@@ -124,6 +648,30 @@ public:
   void sendSensorReading(const String& sensorType, float value, const String& unit = "");
 };
 
+// Static handler binding, the fastest way to handle commands. A module class
+// deriving from QubiHandlerModule<itself> (optionally over one of the
+// module classes above) has its handleCommand() called directly from
+// dispatchCommand() instead of through a std::function or a second virtual
+// call, so it can be inlined there. The receive loop, compiled once in
+// QubiProtocol.cpp, still reaches dispatchCommand() through its vtable
+// slot: one indirect call per command remains.
+//
+//   class ServoModule : public QubiHandlerModule<ServoModule, ActuatorModule> {
+//   public:
+//     void handleCommand(const QubiCommand& cmd) override { ... }
+//   };
+//
+// Such modules ignore a handler set with setCommandHandler().
+template <typename Derived, typename Base = QubiModule>
+class QubiHandlerModule : public Base {
+protected:
+  void dispatchCommand(const QubiCommand& cmd) override {
+    if (!this->handleBuiltinCommand(cmd)) {
+      static_cast<Derived*>(this)->Derived::handleCommand(cmd);
+    }
+  }
+};
+
 // Utility class for building responses
 class QubiResponseBuilder {
 private:
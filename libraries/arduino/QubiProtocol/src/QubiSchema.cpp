@@ -0,0 +1,473 @@
+// Generated by extras/schema/qubi_schema_gen.py from extras/schema/*.json. Do not edit.
+
+#include "QubiSchema.h"
+
+#include <string.h>
+
+namespace {
+
+bool reject(QubiModule& module, const char* message) {
+  module.sendError(QubiStatusCode::BAD_REQUEST, message);
+  return false;
+}
+
+}  // namespace
+
+QubiActuatorAction qubiActuatorAction(const String& action) {
+  const char* name = action.c_str();
+  switch (action.length()) {
+    case 4:
+      if (strcmp(name, "stop") == 0) return QubiActuatorAction::STOP;
+      break;
+    case 9:
+      if (strcmp(name, "set_servo") == 0) return QubiActuatorAction::SET_SERVO;
+      break;
+    case 12:
+      if (strcmp(name, "set_position") == 0) return QubiActuatorAction::SET_POSITION;
+      if (strcmp(name, "get_position") == 0) return QubiActuatorAction::GET_POSITION;
+      break;
+  }
+  return QubiActuatorAction::UNKNOWN;
+}
+
+QubiDisplayAction qubiDisplayAction(const String& action) {
+  const char* name = action.c_str();
+  switch (action.length()) {
+    case 8:
+      if (strcmp(name, "set_eyes") == 0) return QubiDisplayAction::SET_EYES;
+      break;
+    case 13:
+      if (strcmp(name, "clear_display") == 0) return QubiDisplayAction::CLEAR_DISPLAY;
+      break;
+    case 14:
+      if (strcmp(name, "set_expression") == 0) return QubiDisplayAction::SET_EXPRESSION;
+      if (strcmp(name, "set_brightness") == 0) return QubiDisplayAction::SET_BRIGHTNESS;
+      break;
+  }
+  return QubiDisplayAction::UNKNOWN;
+}
+
+QubiMobileAction qubiMobileAction(const String& action) {
+  const char* name = action.c_str();
+  switch (action.length()) {
+    case 4:
+      if (strcmp(name, "move") == 0) return QubiMobileAction::MOVE;
+      if (strcmp(name, "stop") == 0) return QubiMobileAction::STOP;
+      break;
+    case 6:
+      if (strcmp(name, "rotate") == 0) return QubiMobileAction::ROTATE;
+      break;
+    case 12:
+      if (strcmp(name, "set_location") == 0) return QubiMobileAction::SET_LOCATION;
+      if (strcmp(name, "get_location") == 0) return QubiMobileAction::GET_LOCATION;
+      break;
+  }
+  return QubiMobileAction::UNKNOWN;
+}
+
+QubiSensorAction qubiSensorAction(const String& action) {
+  const char* name = action.c_str();
+  switch (action.length()) {
+    case 4:
+      if (strcmp(name, "read") == 0) return QubiSensorAction::READ;
+      break;
+    case 9:
+      if (strcmp(name, "calibrate") == 0) return QubiSensorAction::CALIBRATE;
+      break;
+    case 10:
+      if (strcmp(name, "get_status") == 0) return QubiSensorAction::GET_STATUS;
+      break;
+    case 14:
+      if (strcmp(name, "stop_streaming") == 0) return QubiSensorAction::STOP_STREAMING;
+      break;
+    case 15:
+      if (strcmp(name, "start_streaming") == 0) return QubiSensorAction::START_STREAMING;
+      break;
+  }
+  return QubiSensorAction::UNKNOWN;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetServoParams& params) {
+  params = QubiSetServoParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 'a':
+        if (strcmp(key, "angle") == 0) {
+          if (!value.is<int32_t>()) return reject(module, "angle must be an integer");
+          params.angle = value.as<int32_t>();
+          if (params.angle < 0 || params.angle > 180) return reject(module, "angle must be between 0 and 180");
+          seen |= 1UL << 0;
+        }
+        break;
+      case 'e':
+        if (strcmp(key, "easing") == 0) {
+          const char* text = value | "";
+          if (strcmp(text, "linear") == 0) params.easing = QubiEasing::LINEAR;
+          else if (strcmp(text, "ease-in") == 0) params.easing = QubiEasing::EASE_IN;
+          else if (strcmp(text, "ease-out") == 0) params.easing = QubiEasing::EASE_OUT;
+          else return reject(module, "easing must be one of linear, ease-in, ease-out");
+        }
+        break;
+      case 's':
+        if (strcmp(key, "speed") == 0) {
+          if (!value.is<int32_t>()) return reject(module, "speed must be an integer");
+          params.speed = value.as<int32_t>();
+          if (params.speed < 0 || params.speed > 255) return reject(module, "speed must be between 0 and 255");
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: angle");
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetPositionParams& params) {
+  params = QubiSetPositionParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 'x':
+        if (strcmp(key, "x") == 0) {
+          if (!value.is<float>()) return reject(module, "x must be a number");
+          params.x = value.as<float>();
+          seen |= 1UL << 0;
+        }
+        break;
+      case 'y':
+        if (strcmp(key, "y") == 0) {
+          if (!value.is<float>()) return reject(module, "y must be a number");
+          params.y = value.as<float>();
+          seen |= 1UL << 1;
+        }
+        break;
+      case 'z':
+        if (strcmp(key, "z") == 0) {
+          if (!value.is<float>()) return reject(module, "z must be a number");
+          params.z = value.as<float>();
+          seen |= 1UL << 2;
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: x");
+  if (!(seen & (1UL << 1))) return reject(module, "Missing parameter: y");
+  if (!(seen & (1UL << 2))) return reject(module, "Missing parameter: z");
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetEyesParams& params) {
+  params = QubiSetEyesParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 'b':
+        if (strcmp(key, "blink") == 0) {
+          if (!value.is<bool>()) return reject(module, "blink must be true or false");
+          params.blink = value.as<bool>();
+        }
+        break;
+      case 'l':
+        if (strcmp(key, "left_eye") == 0) {
+          if (!value.is<JsonObject>()) return reject(module, "left_eye must be an object");
+          uint32_t seen1 = 0;
+          for (JsonPair field1 : value.as<JsonObject>()) {
+            const char* key1 = field1.key().c_str();
+            JsonVariant value1 = field1.value();
+            switch (key1[0]) {
+              case 'x':
+                if (strcmp(key1, "x") == 0) {
+                  if (!value1.is<int32_t>()) return reject(module, "left_eye.x must be an integer");
+                  params.leftEye.x = value1.as<int32_t>();
+                  if (params.leftEye.x < 0) return reject(module, "left_eye.x must be at least 0");
+                  seen1 |= 1UL << 0;
+                }
+                break;
+              case 'y':
+                if (strcmp(key1, "y") == 0) {
+                  if (!value1.is<int32_t>()) return reject(module, "left_eye.y must be an integer");
+                  params.leftEye.y = value1.as<int32_t>();
+                  if (params.leftEye.y < 0) return reject(module, "left_eye.y must be at least 0");
+                  seen1 |= 1UL << 1;
+                }
+                break;
+            }
+          }
+          if (!(seen1 & (1UL << 0))) return reject(module, "Missing parameter: left_eye.x");
+          if (!(seen1 & (1UL << 1))) return reject(module, "Missing parameter: left_eye.y");
+          seen |= 1UL << 0;
+        }
+        break;
+      case 'r':
+        if (strcmp(key, "right_eye") == 0) {
+          if (!value.is<JsonObject>()) return reject(module, "right_eye must be an object");
+          uint32_t seen1 = 0;
+          for (JsonPair field1 : value.as<JsonObject>()) {
+            const char* key1 = field1.key().c_str();
+            JsonVariant value1 = field1.value();
+            switch (key1[0]) {
+              case 'x':
+                if (strcmp(key1, "x") == 0) {
+                  if (!value1.is<int32_t>()) return reject(module, "right_eye.x must be an integer");
+                  params.rightEye.x = value1.as<int32_t>();
+                  if (params.rightEye.x < 0) return reject(module, "right_eye.x must be at least 0");
+                  seen1 |= 1UL << 0;
+                }
+                break;
+              case 'y':
+                if (strcmp(key1, "y") == 0) {
+                  if (!value1.is<int32_t>()) return reject(module, "right_eye.y must be an integer");
+                  params.rightEye.y = value1.as<int32_t>();
+                  if (params.rightEye.y < 0) return reject(module, "right_eye.y must be at least 0");
+                  seen1 |= 1UL << 1;
+                }
+                break;
+            }
+          }
+          if (!(seen1 & (1UL << 0))) return reject(module, "Missing parameter: right_eye.x");
+          if (!(seen1 & (1UL << 1))) return reject(module, "Missing parameter: right_eye.y");
+          seen |= 1UL << 1;
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: left_eye");
+  if (!(seen & (1UL << 1))) return reject(module, "Missing parameter: right_eye");
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetExpressionParams& params) {
+  params = QubiSetExpressionParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 'e':
+        if (strcmp(key, "expression") == 0) {
+          const char* text = value | "";
+          if (strcmp(text, "happy") == 0) params.expression = QubiExpression::HAPPY;
+          else if (strcmp(text, "sad") == 0) params.expression = QubiExpression::SAD;
+          else if (strcmp(text, "surprised") == 0) params.expression = QubiExpression::SURPRISED;
+          else if (strcmp(text, "neutral") == 0) params.expression = QubiExpression::NEUTRAL;
+          else if (strcmp(text, "angry") == 0) params.expression = QubiExpression::ANGRY;
+          else return reject(module, "expression must be one of happy, sad, surprised, neutral, angry");
+          seen |= 1UL << 0;
+        }
+        break;
+      case 'i':
+        if (strcmp(key, "intensity") == 0) {
+          if (!value.is<int32_t>()) return reject(module, "intensity must be an integer");
+          params.intensity = value.as<int32_t>();
+          if (params.intensity < 0 || params.intensity > 100) return reject(module, "intensity must be between 0 and 100");
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: expression");
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetBrightnessParams& params) {
+  params = QubiSetBrightnessParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 'b':
+        if (strcmp(key, "brightness") == 0) {
+          if (!value.is<int32_t>()) return reject(module, "brightness must be an integer");
+          params.brightness = value.as<int32_t>();
+          if (params.brightness < 0 || params.brightness > 100) return reject(module, "brightness must be between 0 and 100");
+          seen |= 1UL << 0;
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: brightness");
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiMoveParams& params) {
+  params = QubiMoveParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 'd':
+        if (strcmp(key, "direction") == 0) {
+          if (!value.is<float>()) return reject(module, "direction must be a number");
+          params.direction = value.as<float>();
+          seen |= 1UL << 1;
+        }
+        else if (strcmp(key, "duration") == 0) {
+          if (!value.is<float>()) return reject(module, "duration must be a number");
+          params.duration = value.as<float>();
+          if (params.duration <= 0.0f) return reject(module, "duration must be greater than 0");
+        }
+        break;
+      case 'v':
+        if (strcmp(key, "velocity") == 0) {
+          if (!value.is<float>()) return reject(module, "velocity must be a number");
+          params.velocity = value.as<float>();
+          seen |= 1UL << 0;
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: velocity");
+  if (!(seen & (1UL << 1))) return reject(module, "Missing parameter: direction");
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetLocationParams& params) {
+  params = QubiSetLocationParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 'h':
+        if (strcmp(key, "heading") == 0) {
+          if (!value.is<float>()) return reject(module, "heading must be a number");
+          params.heading = value.as<float>();
+        }
+        break;
+      case 'x':
+        if (strcmp(key, "x") == 0) {
+          if (!value.is<float>()) return reject(module, "x must be a number");
+          params.x = value.as<float>();
+          seen |= 1UL << 0;
+        }
+        break;
+      case 'y':
+        if (strcmp(key, "y") == 0) {
+          if (!value.is<float>()) return reject(module, "y must be a number");
+          params.y = value.as<float>();
+          seen |= 1UL << 1;
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: x");
+  if (!(seen & (1UL << 1))) return reject(module, "Missing parameter: y");
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiRotateParams& params) {
+  params = QubiRotateParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 'a':
+        if (strcmp(key, "angle") == 0) {
+          if (!value.is<float>()) return reject(module, "angle must be a number");
+          params.angle = value.as<float>();
+          seen |= 1UL << 0;
+        }
+        break;
+      case 's':
+        if (strcmp(key, "speed") == 0) {
+          if (!value.is<float>()) return reject(module, "speed must be a number");
+          params.speed = value.as<float>();
+          if (params.speed < 0.0f || params.speed > 100.0f) return reject(module, "speed must be between 0 and 100");
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: angle");
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiReadParams& params) {
+  params = QubiReadParams();
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 's':
+        if (strcmp(key, "sensor_type") == 0) {
+          if (!value.is<const char*>()) return reject(module, "sensor_type must be a string");
+          params.sensorType = value.as<const char*>();
+        }
+        break;
+    }
+  }
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiStartStreamingParams& params) {
+  params = QubiStartStreamingParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 'i':
+        if (strcmp(key, "interval") == 0) {
+          if (!value.is<float>()) return reject(module, "interval must be a number");
+          params.interval = value.as<float>();
+          if (params.interval <= 0.0f) return reject(module, "interval must be greater than 0");
+          seen |= 1UL << 1;
+        }
+        break;
+      case 's':
+        if (strcmp(key, "sensor_type") == 0) {
+          if (!value.is<const char*>()) return reject(module, "sensor_type must be a string");
+          params.sensorType = value.as<const char*>();
+          seen |= 1UL << 0;
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: sensor_type");
+  if (!(seen & (1UL << 1))) return reject(module, "Missing parameter: interval");
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiStopStreamingParams& params) {
+  params = QubiStopStreamingParams();
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 's':
+        if (strcmp(key, "sensor_type") == 0) {
+          if (!value.is<const char*>()) return reject(module, "sensor_type must be a string");
+          params.sensorType = value.as<const char*>();
+        }
+        break;
+    }
+  }
+  return true;
+}
+
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiCalibrateParams& params) {
+  params = QubiCalibrateParams();
+  uint32_t seen = 0;
+  for (JsonPair field : cmd.params) {
+    const char* key = field.key().c_str();
+    JsonVariant value = field.value();
+    switch (key[0]) {
+      case 's':
+        if (strcmp(key, "sensor_type") == 0) {
+          if (!value.is<const char*>()) return reject(module, "sensor_type must be a string");
+          params.sensorType = value.as<const char*>();
+          seen |= 1UL << 0;
+        }
+        break;
+    }
+  }
+  if (!(seen & (1UL << 0))) return reject(module, "Missing parameter: sensor_type");
+  return true;
+}
@@ -0,0 +1,143 @@
+// Generated by extras/schema/qubi_schema_gen.py from extras/schema/*.json. Do not edit.
+
+#ifndef QUBI_SCHEMA_H
+#define QUBI_SCHEMA_H
+
+#include "QubiProtocol.h"
+
+enum class QubiActuatorAction : uint8_t {
+  UNKNOWN,
+  SET_SERVO,
+  SET_POSITION,
+  GET_POSITION,
+  STOP,
+};
+
+enum class QubiDisplayAction : uint8_t {
+  UNKNOWN,
+  SET_EYES,
+  SET_EXPRESSION,
+  CLEAR_DISPLAY,
+  SET_BRIGHTNESS,
+};
+
+enum class QubiMobileAction : uint8_t {
+  UNKNOWN,
+  MOVE,
+  SET_LOCATION,
+  GET_LOCATION,
+  ROTATE,
+  STOP,
+};
+
+enum class QubiSensorAction : uint8_t {
+  UNKNOWN,
+  READ,
+  START_STREAMING,
+  STOP_STREAMING,
+  CALIBRATE,
+  GET_STATUS,
+};
+
+enum class QubiEasing : uint8_t {
+  LINEAR,
+  EASE_IN,
+  EASE_OUT,
+};
+
+enum class QubiExpression : uint8_t {
+  HAPPY,
+  SAD,
+  SURPRISED,
+  NEUTRAL,
+  ANGRY,
+};
+
+struct QubiEyePosition {
+  int32_t x = 0;
+  int32_t y = 0;
+};
+
+struct QubiSetServoParams {
+  int32_t angle = 0;
+  int32_t speed = 255;
+  QubiEasing easing = QubiEasing::LINEAR;
+};
+
+struct QubiSetPositionParams {
+  float x = 0.0f;
+  float y = 0.0f;
+  float z = 0.0f;
+};
+
+struct QubiSetEyesParams {
+  QubiEyePosition leftEye;
+  QubiEyePosition rightEye;
+  bool blink = false;
+};
+
+struct QubiSetExpressionParams {
+  QubiExpression expression = QubiExpression::HAPPY;
+  int32_t intensity = 100;
+};
+
+struct QubiSetBrightnessParams {
+  int32_t brightness = 0;
+};
+
+struct QubiMoveParams {
+  float velocity = 0.0f;
+  float direction = 0.0f;
+  float duration = 0.0f;
+};
+
+struct QubiSetLocationParams {
+  float x = 0.0f;
+  float y = 0.0f;
+  float heading = 0.0f;
+};
+
+struct QubiRotateParams {
+  float angle = 0.0f;
+  float speed = 100.0f;
+};
+
+struct QubiReadParams {
+  const char* sensorType = "";
+};
+
+struct QubiStartStreamingParams {
+  const char* sensorType = "";
+  float interval = 0.0f;
+};
+
+struct QubiStopStreamingParams {
+  const char* sensorType = "";
+};
+
+struct QubiCalibrateParams {
+  const char* sensorType = "";
+};
+
+// Action name lookups; UNKNOWN for actions the schema does not list
+QubiActuatorAction qubiActuatorAction(const String& action);
+QubiDisplayAction qubiDisplayAction(const String& action);
+QubiMobileAction qubiMobileAction(const String& action);
+QubiSensorAction qubiSensorAction(const String& action);
+
+// Decode and validate cmd.params in one pass. On failure the module has
+// already answered 400 with the reason and false is returned.
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetServoParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetPositionParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetEyesParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetExpressionParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetBrightnessParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiMoveParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiSetLocationParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiRotateParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiReadParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiStartStreamingParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiStopStreamingParams& params);
+bool qubiDecode(QubiModule& module, const QubiCommand& cmd, QubiCalibrateParams& params);
+
+#endif // QUBI_SCHEMA_H
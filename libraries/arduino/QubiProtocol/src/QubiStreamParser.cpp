@@ -0,0 +1,532 @@
+#include "QubiStreamParser.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+namespace {
+
+inline bool isSpace(char c) {
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+const char* skipSpace(const char* p, const char* end) {
+  while (p < end && isSpace(*p)) p++;
+  return p;
+}
+
+// p points at the opening quote; returns the position after the closing one
+const char* skipString(const char* p, const char* end) {
+  for (p++; p < end; p++) {
+    if (*p == '\\') {
+      p++;
+    } else if (*p == '"') {
+      return p + 1;
+    }
+  }
+  return nullptr;
+}
+
+inline bool isDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+// Number as JSON defines it: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+const char* skipNumber(const char* p, const char* end) {
+  if (p < end && *p == '-') p++;
+  if (p >= end || !isDigit(*p)) return nullptr;
+  if (*p == '0') {
+    p++;
+  } else {
+    while (p < end && isDigit(*p)) p++;
+  }
+  if (p < end && *p == '.') {
+    if (++p >= end || !isDigit(*p)) return nullptr;
+    while (p < end && isDigit(*p)) p++;
+  }
+  if (p < end && (*p == 'e' || *p == 'E')) {
+    p++;
+    if (p < end && (*p == '+' || *p == '-')) p++;
+    if (p >= end || !isDigit(*p)) return nullptr;
+    while (p < end && isDigit(*p)) p++;
+  }
+  return p;
+}
+
+// A number or one of true, false and null
+const char* skipScalar(const char* p, const char* end) {
+  const char* literal;
+  switch (*p) {
+    case 't': literal = "true"; break;
+    case 'f': literal = "false"; break;
+    case 'n': literal = "null"; break;
+    default: return skipNumber(p, end);
+  }
+  size_t length = strlen(literal);
+  if ((size_t)(end - p) < length || strncmp(p, literal, length) != 0) return nullptr;
+  return p + length;
+}
+
+// p points at an object key; returns the start of its value
+const char* skipKey(const char* p, const char* end) {
+  if (p >= end || *p != '"') return nullptr;
+  p = skipString(p, end);
+  if (!p) return nullptr;
+  p = skipSpace(p, end);
+  if (p >= end || *p != ':') return nullptr;
+  return skipSpace(p + 1, end);
+}
+
+// Returns the position just past the value starting at p, or nullptr if it
+// is malformed. Containers are checked token by token without decoding, so
+// anything the DOM parser would reject is rejected here too.
+const char* skipValue(const char* p, const char* end) {
+  uint32_t arrays = 0;  // Bit per nesting level: 1 = array, 0 = object
+  int depth = 0;
+  for (;;) {
+    if (p >= end) return nullptr;
+
+    // Opening a container leaves p at its first value, or past it if empty
+    char c = *p;
+    if (c == '{' || c == '[') {
+      if (depth == QUBI_STREAM_MAX_DEPTH) return nullptr;
+      arrays = c == '[' ? arrays | (1UL << depth) : arrays & ~(1UL << depth);
+      depth++;
+      p = skipSpace(p + 1, end);
+      if (p < end && *p == (c == '[' ? ']' : '}')) {
+        p++;
+        depth--;
+      } else {
+        if (c == '{' && !(p = skipKey(p, end))) return nullptr;
+        continue;
+      }
+    } else {
+      p = c == '"' ? skipString(p, end) : skipScalar(p, end);
+      if (!p) return nullptr;
+    }
+
+    // After a value: close containers until one has another member
+    for (;;) {
+      if (depth == 0) return p;
+      p = skipSpace(p, end);
+      if (p >= end) return nullptr;
+      bool inArray = (arrays >> (depth - 1)) & 1;
+      if (*p == ',') {
+        p = skipSpace(p + 1, end);
+        if (!inArray && !(p = skipKey(p, end))) return nullptr;
+        break;
+      }
+      if (*p != (inArray ? ']' : '}')) return nullptr;
+      p++;
+      depth--;
+    }
+  }
+}
+
+size_t putUtf8(uint32_t code, char* out, size_t room) {
+  char bytes[3];
+  size_t count;
+  if (code < 0x80) {
+    bytes[0] = (char)code;
+    count = 1;
+  } else if (code < 0x800) {
+    bytes[0] = (char)(0xC0 | (code >> 6));
+    bytes[1] = (char)(0x80 | (code & 0x3F));
+    count = 2;
+  } else {
+    bytes[0] = (char)(0xE0 | (code >> 12));
+    bytes[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+    bytes[2] = (char)(0x80 | (code & 0x3F));
+    count = 3;
+  }
+  if (count > room) return 0;
+  memcpy(out, bytes, count);
+  return count;
+}
+
+// Integer decoding. Params are mostly short integers (angles, speeds,
+// brightness), so numbers of up to 8 digits are converted a word at a time
+// (SWAR): the word ending at the last digit is loaded, the bytes before the
+// number are replaced with '0', all digits are checked in one go, and they
+// are combined pairwise with three multiplications, or two for up to 4
+// digits. Longer numbers take the digit loop.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define QUBI_SWAR_DIGITS 1
+#endif
+
+// Up to 18 digits can't overflow, so only longer numbers are checked
+// against limit
+bool parseDigitLoop(const char* p, size_t count, uint64_t limit, uint64_t& magnitude) {
+  magnitude = 0;
+  for (size_t i = 0; i < count; i++) {
+    uint8_t digit = (uint8_t)(p[i] - '0');
+    if (digit > 9) return false;  // Fractions and exponents are not integers
+    if (i >= 18 && magnitude > (limit - digit) / 10) return false;
+    magnitude = magnitude * 10 + digit;
+  }
+  return true;
+}
+
+#ifdef QUBI_SWAR_DIGITS
+// The last digit ends up in the highest byte and the padding in the lowest
+template <typename Word>
+Word loadDigits(const char* p, size_t count, size_t before) {
+  const Word padding = (Word)UINT64_C(0x3030303030303030);
+  Word word;
+  if (before + count >= sizeof(Word)) {
+    // There's always a key before a value, so this is the usual case
+    memcpy(&word, p + count - sizeof(Word), sizeof(Word));
+  } else {
+    word = 0;
+    for (size_t i = 0; i < count; i++) {
+      word = (word >> 8) | ((Word)(uint8_t)p[i] << (8 * (sizeof(Word) - 1)));
+    }
+  }
+  Word keep = ~(Word)0 << (8 * (sizeof(Word) - count));
+  return (word & keep) | (padding & ~keep);
+}
+
+inline bool allDigits32(uint32_t word) {
+  return (word & 0xF0F0F0F0) == 0x30303030 && ((word + 0x06060606) & 0xF0F0F0F0) == 0x30303030;
+}
+
+inline bool allDigits64(uint64_t word) {
+  return (word & UINT64_C(0xF0F0F0F0F0F0F0F0)) == UINT64_C(0x3030303030303030) &&
+         ((word + UINT64_C(0x0606060606060606)) & UINT64_C(0xF0F0F0F0F0F0F0F0)) == UINT64_C(0x3030303030303030);
+}
+#endif
+
+// count digits at p, with before bytes of the message readable ahead of p
+bool parseDigits(const char* p, size_t count, size_t before, uint64_t limit, uint64_t& magnitude) {
+#ifdef QUBI_SWAR_DIGITS
+  if (count <= 4) {
+    uint32_t word = loadDigits<uint32_t>(p, count, before);
+    if (!allDigits32(word)) return false;
+    word = ((word & 0x0F0F0F0F) * 2561) >> 8;        // Pairs of digits
+    word = ((word & 0x00FF00FF) * 6553601) >> 16;    // Both pairs
+    magnitude = word & 0xFFFF;
+    return true;
+  }
+  if (count <= 8) {
+    uint64_t word = loadDigits<uint64_t>(p, count, before);
+    if (!allDigits64(word)) return false;
+    word = ((word & UINT64_C(0x0F0F0F0F0F0F0F0F)) * 2561) >> 8;
+    word = ((word & UINT64_C(0x00FF00FF00FF00FF)) * 6553601) >> 16;
+    magnitude = ((word & UINT64_C(0x0000FFFF0000FFFF)) * UINT64_C(42949672960001)) >> 32;
+    return true;
+  }
+#else
+  (void)before;
+#endif
+  return parseDigitLoop(p, count, limit, magnitude);
+}
+
+}  // namespace
+
+QubiParamCursor::QubiParamCursor()
+  : _begin(nullptr), _end(nullptr), _position(nullptr), _key(nullptr), _keyLength(0),
+    _value(nullptr), _valueEnd(nullptr), _closed(nullptr), _isArray(false), _first(true), _error(false) {}
+
+QubiParamCursor::QubiParamCursor(const char* json, size_t length) : QubiParamCursor() {
+  _begin = json;
+  _end = json + length;
+  rewind();
+}
+
+void QubiParamCursor::rewind() {
+  _key = _value = _valueEnd = nullptr;
+  _keyLength = 0;
+  _first = true;
+  _error = false;
+  _position = _closed = nullptr;
+  if (!_begin) return;
+
+  const char* p = skipSpace(_begin, _end);
+  if (p < _end && (*p == '{' || *p == '[')) {
+    _isArray = *p == '[';
+    _position = p + 1;
+  } else {
+    _error = true;
+  }
+}
+
+bool QubiParamCursor::next() {
+  return readKey() && finishValue(skipValue(_value, _end));
+}
+
+bool QubiParamCursor::readKey() {
+  if (!_position || _error) return false;
+
+  char close = _isArray ? ']' : '}';
+  const char* p = skipSpace(_position, _end);
+
+  if (p < _end && *p == close) {
+    _position = nullptr;
+    _key = _value = nullptr;
+    _closed = p + 1;
+    return false;
+  }
+  if (!_first) {
+    if (p >= _end || *p != ',') {
+      _error = true;
+      return false;
+    }
+    p = skipSpace(p + 1, _end);
+  }
+  _first = false;
+
+  if (_isArray) {
+    _key = nullptr;
+    _keyLength = 0;
+  } else {
+    if (p >= _end || *p != '"') {
+      _error = true;
+      return false;
+    }
+    const char* keyEnd = skipString(p, _end);
+    if (!keyEnd) {
+      _error = true;
+      return false;
+    }
+    _key = p + 1;
+    _keyLength = keyEnd - p - 2;
+    p = skipSpace(keyEnd, _end);
+    if (p >= _end || *p != ':') {
+      _error = true;
+      return false;
+    }
+    p = skipSpace(p + 1, _end);
+  }
+
+  if (p >= _end) {
+    _error = true;
+    return false;
+  }
+  _value = p;
+  _valueEnd = nullptr;
+  return true;
+}
+
+bool QubiParamCursor::finishValue(const char* valueEnd) {
+  if (!valueEnd) {
+    _error = true;
+    return false;
+  }
+  _valueEnd = valueEnd;
+  _position = valueEnd;
+  return true;
+}
+
+bool QubiParamCursor::find(const char* key) {
+  rewind();
+  while (next()) {
+    if (keyIs(key)) return true;
+  }
+  return false;
+}
+
+bool QubiParamCursor::keyIs(const char* key) const {
+  return _key && strncmp(_key, key, _keyLength) == 0 && key[_keyLength] == '\0';
+}
+
+QubiJsonType QubiParamCursor::type() const {
+  if (!_value) return QubiJsonType::NONE;
+  switch (*_value) {
+    case '{': return QubiJsonType::OBJECT;
+    case '[': return QubiJsonType::ARRAY;
+    case '"': return QubiJsonType::STRING;
+    case 't':
+    case 'f': return QubiJsonType::BOOL;
+    case 'n': return QubiJsonType::NULL_VALUE;
+    default: return QubiJsonType::NUMBER;  // skipValue() has checked the syntax
+  }
+}
+
+bool QubiParamCursor::toInt(int64_t& value) const {
+  if (type() != QubiJsonType::NUMBER) return false;
+
+  const char* p = _value;
+  bool negative = *p == '-';
+  if (negative) p++;
+  if (p == _valueEnd) return false;
+
+  // INT64_MIN has no positive counterpart
+  uint64_t limit = UINT64_C(0x7FFFFFFFFFFFFFFF) + negative;
+  uint64_t magnitude;
+  if (!parseDigits(p, _valueEnd - p, p - _begin, limit, magnitude)) return false;
+  value = negative ? (int64_t)(0 - magnitude) : (int64_t)magnitude;
+  return true;
+}
+
+bool QubiParamCursor::toInt(int32_t& value) const {
+  int64_t wide;
+  if (!toInt(wide) || wide < INT32_MIN || wide > INT32_MAX) return false;
+  value = (int32_t)wide;
+  return true;
+}
+
+bool QubiParamCursor::toUInt(uint32_t& value) const {
+  int64_t wide;
+  if (!toInt(wide) || wide < 0 || wide > UINT32_MAX) return false;
+  value = (uint32_t)wide;
+  return true;
+}
+
+bool QubiParamCursor::toFloat(float& value) const {
+  size_t length = valueLength();
+  if (type() != QubiJsonType::NUMBER || length >= 32) return false;
+
+  // Copy out: the message text is not terminated after the number
+  char text[32];
+  memcpy(text, _value, length);
+  text[length] = '\0';
+  char* end;
+  float parsed = strtof(text, &end);
+  if (end != text + length) return false;
+  value = parsed;
+  return true;
+}
+
+bool QubiParamCursor::toBool(bool& value) const {
+  size_t length = valueLength();
+  if (length == 4 && strncmp(_value, "true", 4) == 0) {
+    value = true;
+    return true;
+  }
+  if (length == 5 && strncmp(_value, "false", 5) == 0) {
+    value = false;
+    return true;
+  }
+  return false;
+}
+
+size_t QubiParamCursor::toString(char* out, size_t capacity) const {
+  if (capacity == 0) return 0;
+  out[0] = '\0';
+  if (type() != QubiJsonType::STRING) return 0;
+
+  size_t length = 0;
+  const char* end = _valueEnd - 1;  // Closing quote
+  for (const char* p = _value + 1; p < end && length + 1 < capacity; p++) {
+    if (*p != '\\') {
+      out[length++] = *p;
+      continue;
+    }
+    if (++p >= end) break;
+    switch (*p) {
+      case 'b': out[length++] = '\b'; break;
+      case 'f': out[length++] = '\f'; break;
+      case 'n': out[length++] = '\n'; break;
+      case 'r': out[length++] = '\r'; break;
+      case 't': out[length++] = '\t'; break;
+      case 'u': {
+        if (end - p < 5) return length;
+        char hex[5] = {p[1], p[2], p[3], p[4], '\0'};
+        size_t written = putUtf8((uint32_t)strtoul(hex, nullptr, 16), out + length, capacity - 1 - length);
+        if (written == 0) {
+          out[length] = '\0';
+          return length;
+        }
+        length += written;
+        p += 4;
+        break;
+      }
+      default: out[length++] = *p; break;  // \" \\ \/
+    }
+  }
+  out[length] = '\0';
+  return length;
+}
+
+QubiParamCursor QubiParamCursor::child() const {
+  QubiJsonType kind = type();
+  if (kind != QubiJsonType::OBJECT && kind != QubiJsonType::ARRAY) return QubiParamCursor();
+  return QubiParamCursor(_value, valueLength());
+}
+
+QubiStreamParser::QubiStreamParser()
+  : _versionAccepted(false), _sequenceSeen(false), _timestamp(0), _sequence(0), _dispatched(0),
+    _deferredCount(0) {
+  _version[0] = '\0';
+}
+
+bool QubiStreamParser::parse(const char* json, size_t length, VersionCheck acceptVersion,
+                             const CommandHandler& onCommand) {
+  _version[0] = '\0';
+  _versionAccepted = false;
+  _sequenceSeen = false;
+  _timestamp = 0;
+  _sequence = 0;
+  _dispatched = 0;
+  _deferredCount = 0;
+
+  QubiParamCursor message(json, length);
+  while (message.readKey()) {
+    if (message.keyIs("commands") && message.type() == QubiJsonType::ARRAY) {
+      // Walk the array in place: each command runs once its own object has
+      // been read, before anything after it is looked at
+      QubiParamCursor commands(message.value(), json + length - message.value());
+      while (commands.next()) {
+        if (commands.type() != QubiJsonType::OBJECT) continue;
+        if (_versionAccepted && _sequenceSeen) {
+          dispatch(commands.value(), commands.valueLength(), onCommand);
+        } else if (_deferredCount < QUBI_STREAM_MAX_DEFERRED) {
+          _deferred[_deferredCount] = commands.value();
+          _deferredLength[_deferredCount] = commands.valueLength();
+          _deferredCount++;
+        }
+      }
+      if (!message.finishValue(commands._closed)) return false;
+      continue;
+    }
+    
+    if (!message.finishValue(skipValue(message.value(), json + length))) break;
+    
+    if (message.keyIs("version")) {
+      message.toString(_version, sizeof(_version));
+      if (!acceptVersion(_version)) return false;
+      _versionAccepted = true;
+      if (_sequenceSeen) dispatchDeferred(onCommand);
+    } else if (message.keyIs("timestamp")) {
+      int64_t timestamp;
+      if (message.toInt(timestamp)) {
+        _timestamp = (unsigned long)timestamp;
+      }
+    } else if (message.keyIs("sequence")) {
+      message.toUInt(_sequence);
+      _sequenceSeen = true;
+      if (_versionAccepted) dispatchDeferred(onCommand);
+    }
+  }
+
+  if (message.error() || !_versionAccepted) return false;
+  dispatchDeferred(onCommand);  // The message has no sequence
+  return true;
+}
+
+void QubiStreamParser::dispatchDeferred(const CommandHandler& onCommand) {
+  for (uint8_t i = 0; i < _deferredCount; i++) {
+    dispatch(_deferred[i], _deferredLength[i], onCommand);
+  }
+  _deferredCount = 0;
+}
+
+void QubiStreamParser::dispatch(const char* json, size_t length, const CommandHandler& onCommand) {
+  QubiStreamCommand command;
+  command.moduleId[0] = command.moduleType[0] = command.action[0] = '\0';
+
+  QubiParamCursor fields(json, length);
+  while (fields.next()) {
+    if (fields.keyIs("module_id")) {
+      fields.toString(command.moduleId, sizeof(command.moduleId));
+    } else if (fields.keyIs("module_type")) {
+      fields.toString(command.moduleType, sizeof(command.moduleType));
+    } else if (fields.keyIs("action")) {
+      fields.toString(command.action, sizeof(command.action));
+    } else if (fields.keyIs("params")) {
+      command.params = fields.child();
+    }
+  }
+
+  _dispatched++;
+  onCommand(command);
+}
@@ -0,0 +1,123 @@
+#ifndef QUBI_STREAM_PARSER_H
+#define QUBI_STREAM_PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+
+// Single-pass JSON reading without a DOM. QubiStreamParser walks a message,
+// handing each command to a callback as soon as its object closes, and
+// QubiParamCursor reads a command's params straight from the message text.
+#define QUBI_STREAM_NAME_SIZE 32
+#define QUBI_STREAM_MAX_DEFERRED 16
+#define QUBI_STREAM_MAX_DEPTH 32
+
+enum class QubiJsonType : uint8_t { NONE, OBJECT, ARRAY, STRING, NUMBER, BOOL, NULL_VALUE };
+
+// Iterates the members of one JSON object (or the elements of an array) in
+// place. Values are decoded only when asked for; nested objects and arrays
+// are skipped unless opened with child().
+class QubiParamCursor {
+private:
+  const char* _begin;
+  const char* _end;
+  const char* _position;
+  const char* _key;
+  size_t _keyLength;
+  const char* _value;
+  const char* _valueEnd;
+  const char* _closed;     // Just past the closing bracket, once reached
+  bool _isArray;
+  bool _first;
+  bool _error;
+  
+  // next() in two steps, so the parser can walk into a value in place
+  // instead of skipping over it first
+  bool readKey();
+  bool finishValue(const char* valueEnd);
+  
+  friend class QubiStreamParser;
+
+public:
+  QubiParamCursor();
+  QubiParamCursor(const char* json, size_t length);
+
+  // Moves to the next member; false at the end or on malformed input
+  bool next();
+  void rewind();
+  // Rewinds and scans for a key
+  bool find(const char* key);
+  bool error() const { return _error; }
+  // The whole object or array text; null for a cursor over nothing
+  const char* json() const { return _begin; }
+  size_t jsonLength() const { return _begin ? (size_t)(_end - _begin) : 0; }
+
+  bool keyIs(const char* key) const;
+  const char* key() const { return _key; }
+  size_t keyLength() const { return _keyLength; }
+
+  QubiJsonType type() const;
+  const char* value() const { return _value; }
+  size_t valueLength() const { return _value ? (size_t)(_valueEnd - _value) : 0; }
+
+  // Each returns false, leaving value untouched, if the current value has
+  // another type or does not fit
+  bool toInt(int32_t& value) const;
+  bool toInt(int64_t& value) const;
+  bool toUInt(uint32_t& value) const;
+  bool toFloat(float& value) const;
+  bool toBool(bool& value) const;
+  // Decodes a string value (escapes included) into out, truncating to fit;
+  // returns the length written, or 0 if the value is not a string
+  size_t toString(char* out, size_t capacity) const;
+
+  // Cursor over the current value when it is an object or array
+  QubiParamCursor child() const;
+};
+
+struct QubiStreamCommand {
+  char moduleId[QUBI_STREAM_NAME_SIZE];
+  char moduleType[QUBI_STREAM_NAME_SIZE];
+  char action[QUBI_STREAM_NAME_SIZE];
+  QubiParamCursor params;
+};
+
+class QubiStreamParser {
+public:
+  typedef bool (*VersionCheck)(const char* version);
+  typedef std::function<void(QubiStreamCommand&)> CommandHandler;
+
+private:
+  char _version[16];
+  bool _versionAccepted;
+  bool _sequenceSeen;
+  unsigned long _timestamp;
+  uint32_t _sequence;
+  uint8_t _dispatched;
+  // Commands seen before the version or sequence field, replayed once both
+  // have been read, or at the end of a message without a sequence
+  const char* _deferred[QUBI_STREAM_MAX_DEFERRED];
+  size_t _deferredLength[QUBI_STREAM_MAX_DEFERRED];
+  uint8_t _deferredCount;
+
+  void dispatch(const char* json, size_t length, const CommandHandler& onCommand);
+  void dispatchDeferred(const CommandHandler& onCommand);
+
+public:
+  QubiStreamParser();
+
+  // Walks one message. Commands are passed to onCommand as they complete, so
+  // earlier commands may already have run when a later part turns out to be
+  // malformed; false is returned in that case and when the version is
+  // missing or rejected by acceptVersion. A command only runs once the
+  // version and the sequence number, if the message has one, are known, so
+  // sequence() is always final inside onCommand.
+  bool parse(const char* json, size_t length, VersionCheck acceptVersion, const CommandHandler& onCommand);
+
+  const char* version() const { return _version; }
+  unsigned long timestamp() const { return _timestamp; }
+  uint32_t sequence() const { return _sequence; }
+  uint8_t commandCount() const { return _dispatched; }
+};
+
+#endif // QUBI_STREAM_PARSER_H
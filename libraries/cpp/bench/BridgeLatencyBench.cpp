@@ -0,0 +1,216 @@
+/*
+ * Latency and message rate through QubiBridge, against sending the same
+ * request straight to the module over UDP.
+ *
+ * A WebSocket client, the bridge and a QubiModule answering every command
+ * share one thread over loopback, each stepped in turn, so the round trips
+ * are CPU time on one core without scheduler wake-ups. Round trips are timed
+ * one request at a time; rates with 64 requests in flight, sent one per
+ * frame or as 16-message batches.
+ *
+ *   g++ -std=c++17 -O2 -Iplatform -Isrc -I../arduino/QubiProtocol/src \
+ *     -I/path/to/ArduinoJson/src bench/BridgeLatencyBench.cpp src/Qubi*.cpp \
+ *     ../arduino/QubiProtocol/src/Qubi*.cpp platform/Host*.cpp platform/Qubi*.cpp \
+ *     -lpthread -o bridge_latency_bench
+ *
+ *   ./bridge_latency_bench [round-trips]
+ */
+
+#include "QubiBridge.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define MODULE_PORT 19801
+#define WINDOW 64
+#define BATCH 16
+
+class EchoModule : public QubiModule {
+public:
+  void handleCommand(const QubiCommand& cmd) override {
+    sendSuccess(cmd.action);
+  }
+};
+
+static double nowUs() {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static std::string request(uint32_t sequence) {
+  char text[160];
+  snprintf(text, sizeof(text),
+           "{\"version\":\"1.0\",\"sequence\":%u,\"commands\":[{\"module_id\":\"echo\",\"module_type\":\"custom\","
+           "\"action\":\"ping\",\"params\":{}}]}",
+           sequence);
+  return text;
+}
+
+// Just enough of a browser: the upgrade request, masked frames out and
+// unmasked frames in
+class WebSocketClient {
+private:
+  int _fd;
+  std::string _input;
+
+public:
+  bool connect(uint16_t port) {
+    _fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(_fd, (sockaddr*)&address, sizeof(address)) < 0) return false;
+    int yes = 1;
+    setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    const char* upgrade = "GET / HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                          "Sec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\nSec-WebSocket-Version: 13\r\n\r\n";
+    return send(_fd, upgrade, strlen(upgrade), 0) > 0;
+  }
+
+  // False until the 101 response has been read
+  bool upgraded() {
+    fill();
+    size_t end = _input.find("\r\n\r\n");
+    if (end == std::string::npos) return false;
+    _input.erase(0, end + 4);
+    return true;
+  }
+
+  void sendText(const std::string& text) {
+    std::string frame;
+    frame += (char)0x81;
+    if (text.size() < 126) {
+      frame += (char)(0x80 | text.size());
+    } else {
+      frame += (char)(0x80 | 126);
+      frame += (char)(text.size() >> 8);
+      frame += (char)text.size();
+    }
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    frame.append((const char*)mask, 4);
+    for (size_t i = 0; i < text.size(); i++) frame += (char)(text[i] ^ mask[i & 3]);
+    send(_fd, frame.data(), frame.size(), 0);
+  }
+
+  // Number of complete frames received
+  size_t receive() {
+    fill();
+    size_t frames = 0;
+    for (;;) {
+      if (_input.size() < 2) break;
+      size_t length = (uint8_t)_input[1] & 0x7F;
+      size_t header = 2;
+      if (length == 126) {
+        if (_input.size() < 4) break;
+        length = (size_t)(uint8_t)_input[2] << 8 | (uint8_t)_input[3];
+        header = 4;
+      }
+      if (_input.size() < header + length) break;
+      _input.erase(0, header + length);
+      frames++;
+    }
+    return frames;
+  }
+
+  void fill() {
+    char buffer[65536];
+    ssize_t received;
+    while ((received = recv(_fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) _input.append(buffer, received);
+  }
+
+  ~WebSocketClient() { ::close(_fd); }
+};
+
+struct Percentiles {
+  double p50;
+  double p99;
+};
+
+static Percentiles percentiles(std::vector<double>& samples) {
+  std::sort(samples.begin(), samples.end());
+  return Percentiles{samples[samples.size() / 2], samples[samples.size() * 99 / 100]};
+}
+
+int main(int argc, char** argv) {
+  int roundTrips = argc > 1 ? atoi(argv[1]) : 20000;
+
+  EchoModule module;
+  module.begin("echo", QubiModuleType::CUSTOM, MODULE_PORT);
+  QubiBridge bridge;
+  bridge.begin(0);
+  bridge.addModule("echo", IPAddress(127, 0, 0, 1), MODULE_PORT);
+  WebSocketClient client;
+  client.connect(bridge.localPort());
+  while (!client.upgraded()) bridge.poll();
+
+  WiFiUDP direct;
+  direct.begin(0);
+  IPAddress moduleIp(127, 0, 0, 1);
+
+  // Round trips, one at a time
+  std::vector<double> directUs, bridgeUs;
+  for (int i = 1; i <= roundTrips; i++) {
+    std::string text = request(i);
+    double start = nowUs();
+    direct.beginPacket(moduleIp, MODULE_PORT);
+    direct.write((const uint8_t*)text.data(), text.size());
+    direct.endPacket();
+    do {
+      module.processMessages();
+    } while (direct.parsePacket() <= 0);
+    directUs.push_back(nowUs() - start);
+
+    start = nowUs();
+    client.sendText(text);
+    do {
+      bridge.poll();
+      module.processMessages();
+      bridge.poll();
+    } while (client.receive() == 0);
+    bridgeUs.push_back(nowUs() - start);
+  }
+  Percentiles directRtt = percentiles(directUs);
+  Percentiles bridgeRtt = percentiles(bridgeUs);
+  printf("%-28s %10s %10s\n", "round trip (us)", "p50", "p99");
+  printf("%-28s %10.1f %10.1f\n", "UDP to module", directRtt.p50, directRtt.p99);
+  printf("%-28s %10.1f %10.1f\n", "WebSocket through bridge", bridgeRtt.p50, bridgeRtt.p99);
+  printf("%-28s %10.1f %10.1f\n", "added by bridge", bridgeRtt.p50 - directRtt.p50, bridgeRtt.p99 - directRtt.p99);
+
+  // Rate with WINDOW requests in flight, one message per frame or batched
+  const int batches[] = {1, BATCH};
+  printf("\n%-28s %10s\n", "messages per frame", "msgs/s");
+  for (int batch : batches) {
+    uint32_t sequence = 0;
+    size_t answered = 0;
+    size_t total = (size_t)roundTrips;
+    double start = nowUs();
+    while (answered < total) {
+      for (int sent = 0; sent < WINDOW; sent += batch) {
+        std::string frame = batch == 1 ? request(++sequence) : "[";
+        for (int i = 0; batch > 1 && i < batch; i++) {
+          frame += (i ? "," : "") + request(++sequence);
+        }
+        client.sendText(batch == 1 ? frame : frame + "]");
+      }
+      size_t received = 0;
+      while (received < WINDOW) {
+        bridge.poll();
+        module.processMessages();
+        received += client.receive();
+      }
+      answered += received;
+    }
+    double seconds = (nowUs() - start) / 1e6;
+    printf("%-28d %10.0f\n", batch, answered / seconds);
+  }
+
+  const QubiBridgeStats& stats = bridge.getStats();
+  printf("\nforwarded %u, routed %u, unroutable %u\n", stats.forwarded, stats.routed, stats.unroutable);
+  return 0;
+}
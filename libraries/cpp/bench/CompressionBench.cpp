@@ -0,0 +1,111 @@
+/*
+ * Compression ratio and speed of the QubiProtocol LZ codec on typical large
+ * payloads.
+ *
+ *   g++ -std=c++17 -O2 -I../arduino/QubiProtocol/src \
+ *     bench/CompressionBench.cpp ../arduino/QubiProtocol/src/QubiCompress.cpp \
+ *     -o compression_bench
+ */
+
+#include "QubiCompress.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+static std::string trajectoryUpload() {
+  std::string json = "{\"version\":\"1.0\",\"timestamp\":1699123456789,\"sequence\":7,\"commands\":["
+                     "{\"module_id\":\"arm_01\",\"module_type\":\"actuator\",\"action\":\"upload_trajectory\","
+                     "\"params\":{\"points\":[";
+  for (int i = 0; i < 24; i++) {
+    char point[64];
+    snprintf(point, sizeof(point), "%s{\"t\":%d,\"angle\":%d,\"speed\":128}", i ? "," : "", i * 40, 90 + (i % 12) * 5);
+    json += point;
+  }
+  return json + "]}}]}";
+}
+
+static std::string animationBlob() {
+  std::string json = "{\"version\":\"1.0\",\"timestamp\":1699123456789,\"commands\":["
+                     "{\"module_id\":\"display_01\",\"module_type\":\"display\",\"action\":\"play_animation\","
+                     "\"params\":{\"frames\":[";
+  const char* expressions[] = {"neutral", "happy", "surprised", "happy"};
+  for (int i = 0; i < 12; i++) {
+    char frame[160];
+    snprintf(frame, sizeof(frame),
+             "%s{\"left_eye\":{\"x\":%d,\"y\":50},\"right_eye\":{\"x\":%d,\"y\":50},\"expression\":\"%s\"}",
+             i ? "," : "", 40 + i, 60 + i, expressions[i % 4]);
+    json += frame;
+  }
+  return json + "]}}]}";
+}
+
+static std::string sensorHistory() {
+  std::string json = "{\"status\":200,\"message\":\"Sensor history\",\"module_id\":\"sensor_01\","
+                     "\"timestamp\":1699123456890,\"data\":{\"sensor_type\":\"temperature\",\"unit\":\"C\",\"samples\":[";
+  for (int i = 0; i < 60; i++) {
+    char sample[32];
+    snprintf(sample, sizeof(sample), "%s%d.%d", i ? "," : "", 21 + (i / 20), (i * 7) % 10);
+    json += sample;
+  }
+  return json + "]}}";
+}
+
+static std::string discoveryList() {
+  std::string json = "{\"status\":200,\"message\":\"Module discovered\",\"module_id\":\"hub_01\","
+                     "\"timestamp\":1699123456890,\"data\":{\"module_type\":\"custom\",\"actions\":[";
+  const char* actions[] = {"set_servo", "get_position", "set_position", "set_eyes", "set_expression",
+                           "set_brightness", "clear_display", "get_status", "move", "stop",
+                           "get_location", "read_sensor", "get_sensor_history"};
+  for (size_t i = 0; i < sizeof(actions) / sizeof(actions[0]); i++) {
+    char action[96];
+    snprintf(action, sizeof(action), "%s{\"action\":\"%s\",\"module_type\":\"%s\"}",
+             i ? "," : "", actions[i], i < 3 ? "actuator" : i < 8 ? "display" : i < 11 ? "mobile" : "sensor");
+    json += action;
+  }
+  return json + "]}}";
+}
+
+static void run(const char* name, const std::string& payload) {
+  static QubiCompressor compressor;
+  uint8_t compressed[4096];
+  uint8_t decompressed[4096];
+  const int iterations = 2000;
+
+  size_t compressedLen = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    compressedLen = compressor.compress((const uint8_t*)payload.data(), payload.size(), compressed, sizeof(compressed));
+  }
+  auto mid = std::chrono::steady_clock::now();
+
+  size_t decompressedLen = 0;
+  for (int i = 0; i < iterations; i++) {
+    QubiDecompressor decompressor(decompressed, sizeof(decompressed));
+    // Feed in 64-byte chunks, as QubiModule does when reading a datagram
+    for (size_t offset = 0; offset < compressedLen; offset += 64) {
+      size_t chunk = compressedLen - offset < 64 ? compressedLen - offset : 64;
+      decompressor.feed(compressed + offset, chunk);
+    }
+    decompressedLen = decompressor.length();
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  bool ok = decompressedLen == payload.size() && memcmp(decompressed, payload.data(), payload.size()) == 0;
+  double kb = payload.size() / 1024.0;
+  double compressUs = std::chrono::duration<double, std::micro>(mid - start).count() / iterations;
+  double decompressUs = std::chrono::duration<double, std::micro>(end - mid).count() / iterations;
+
+  printf("%-20s %6zu %6zu %7.2f %12.2f %12.2f %s\n", name, payload.size(), compressedLen,
+         (double)payload.size() / compressedLen, compressUs / kb, decompressUs / kb, ok ? "ok" : "MISMATCH");
+}
+
+int main() {
+  printf("%-20s %6s %6s %7s %12s %12s\n", "payload", "bytes", "lz", "ratio", "comp us/KB", "decomp us/KB");
+  run("trajectory upload", trajectoryUpload());
+  run("animation blob", animationBlob());
+  run("sensor history", sensorHistory());
+  run("discovery list", discoveryList());
+  return 0;
+}
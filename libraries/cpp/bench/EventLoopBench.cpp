@@ -0,0 +1,178 @@
+/*
+ * Echo throughput of QubiEventLoop with the io_uring and epoll backends,
+ * against polling one WiFiUDP socket per module as QubiModule does.
+ *
+ * A client socket sends bursts of datagrams spread over N echo sockets, which
+ * stand in for simulated modules, and waits for every echo. All sockets are
+ * served from one thread. Reported per datagram handled (each echo is two
+ * receives and two sends): CPU time, syscalls, and the resulting rate for one
+ * core.
+ *
+ *   g++ -std=c++17 -O2 -Iplatform bench/EventLoopBench.cpp \
+ *     platform/Host*.cpp platform/Qubi*.cpp -lpthread -o event_loop_bench
+ *
+ *   ./event_loop_bench [seconds-per-run]
+ */
+
+#include "QubiEventLoop.h"
+#include "WiFiUdp.h"
+
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <memory>
+#include <sys/socket.h>
+#include <vector>
+
+#define BURST 256
+
+static double threadCpuSeconds() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void setReceiveBuffer(int fd) {
+  int size = 4 * 1024 * 1024;
+  setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+}
+
+struct RunResult {
+  uint64_t datagrams;  // Receives and sends
+  uint64_t lost;
+  uint64_t syscalls;
+  double cpu;
+};
+
+static RunResult runEventLoop(QubiEventLoop& loop, unsigned modules, size_t size, double seconds) {
+  const uint32_t loopback = htonl(0x7F000001);
+  std::vector<int> echoes;
+  std::vector<uint16_t> ports;
+  for (unsigned i = 0; i < modules; i++) {
+    int fd = loop.open(0, [&loop](int socket, const uint8_t* data, size_t len, uint32_t address, uint16_t port) {
+      loop.send(socket, data, len, address, port);
+    }, loopback);
+    setReceiveBuffer(fd);
+    echoes.push_back(fd);
+    ports.push_back(loop.localPort(fd));
+  }
+
+  uint32_t answered = 0;
+  int client = loop.open(0, [&answered](int, const uint8_t*, size_t, uint32_t, uint16_t) { answered++; }, loopback);
+  setReceiveBuffer(client);
+
+  uint8_t payload[1024];
+  memset(payload, 'x', sizeof(payload));
+  RunResult result = {};
+  uint64_t syscallsBefore = loop.getStats().syscalls;
+  unsigned next = 0;
+
+  double start = threadCpuSeconds();
+  unsigned long wallStart = millis();
+  while (millis() - wallStart < seconds * 1000) {
+    answered = 0;
+    for (int i = 0; i < BURST; i++) {
+      loop.send(client, payload, size, loopback, ports[next]);
+      next = (next + 1) % modules;
+    }
+    unsigned long roundStart = millis();
+    while (answered < BURST && millis() - roundStart < 200) {
+      loop.run(10);
+    }
+    result.datagrams += 2 * BURST + 2 * answered;
+    result.lost += BURST - answered;
+  }
+  result.cpu = threadCpuSeconds() - start;
+  result.syscalls = loop.getStats().syscalls - syscallsBefore;
+
+  for (int fd : echoes) loop.close(fd);
+  loop.close(client);
+  return result;
+}
+
+static RunResult runPolling(unsigned modules, size_t size, double seconds) {
+  std::vector<std::unique_ptr<WiFiUDP>> echoes;
+  for (unsigned i = 0; i < modules; i++) {
+    echoes.emplace_back(new WiFiUDP());
+    echoes.back()->begin(IPAddress(127, 0, 0, 1), 0);
+    setReceiveBuffer(echoes.back()->fd());
+  }
+  WiFiUDP client;
+  client.begin(IPAddress(127, 0, 0, 1), 0);
+  setReceiveBuffer(client.fd());
+
+  uint8_t payload[1024];
+  uint8_t buffer[2048];
+  memset(payload, 'x', sizeof(payload));
+  IPAddress loopback(127, 0, 0, 1);
+  RunResult result = {};
+  unsigned next = 0;
+
+  double start = threadCpuSeconds();
+  unsigned long wallStart = millis();
+  while (millis() - wallStart < seconds * 1000) {
+    uint32_t answered = 0;
+    for (int i = 0; i < BURST; i++) {
+      client.beginPacket(loopback, echoes[next]->localPort());
+      client.write(payload, size);
+      client.endPacket();
+      next = (next + 1) % modules;
+    }
+    // A module loop: every socket gets a parsePacket() per pass
+    unsigned long roundStart = millis();
+    while (answered < BURST && millis() - roundStart < 200) {
+      for (auto& echo : echoes) {
+        int len;
+        while ((len = echo->parsePacket()) > 0) {
+          echo->read(buffer, sizeof(buffer));
+          echo->beginPacket(echo->remoteIP(), echo->remotePort());
+          echo->write(buffer, len);
+          echo->endPacket();
+        }
+      }
+      while (client.parsePacket() > 0) answered++;
+    }
+    result.datagrams += 2 * BURST + 2 * answered;
+    result.lost += BURST - answered;
+  }
+  result.cpu = threadCpuSeconds() - start;
+
+  for (auto& echo : echoes) {
+    result.syscalls += echo->ioStats().rxCalls + echo->ioStats().txCalls;
+  }
+  // parsePacket() calls that found nothing aren't in ioStats, so this
+  // undercounts polling
+  result.syscalls += client.ioStats().rxCalls + client.ioStats().txCalls;
+  return result;
+}
+
+static void report(const char* name, unsigned modules, size_t size, const RunResult& result) {
+  printf("%-10s %7u %6zu %12.0f %10.1f %10.3f %8llu\n", name, modules, size,
+         result.cpu > 0 ? result.datagrams / result.cpu : 0,
+         result.datagrams ? result.cpu * 1e9 / result.datagrams : 0,
+         result.datagrams ? (double)result.syscalls / result.datagrams : 0, (unsigned long long)result.lost);
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  const unsigned moduleCounts[] = {1, 64, 1024};
+  const size_t sizes[] = {64, 1024};
+
+  QubiEventLoop uring(QubiEventBackend::IO_URING);
+  QubiEventLoop epoll(QubiEventBackend::EPOLL);
+  if (uring.backend() != QubiEventBackend::IO_URING) {
+    printf("io_uring unavailable, its rows run on epoll\n");
+  }
+
+  printf("%-10s %7s %6s %12s %10s %10s %8s\n", "backend", "modules", "bytes", "dgrams/s", "ns/dgram",
+         "sys/dgram", "lost");
+  for (unsigned modules : moduleCounts) {
+    for (size_t size : sizes) {
+      report(qubiEventBackendName(uring.backend()), modules, size, runEventLoop(uring, modules, size, seconds));
+      report("epoll", modules, size, runEventLoop(epoll, modules, size, seconds));
+      report("WiFiUDP", modules, size, runPolling(modules, size, seconds));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,106 @@
+/*
+ * Cost of reading the integer params of the sample actions (set_servo,
+ * set_eyes, set_brightness, set_expression) with the usual deserializeJson()
+ * and cmd.params["angle"] lookups, and with QubiParamCursor::toInt(). Then
+ * toInt() alone, per number.
+ *
+ *   g++ -std=c++17 -O2 -Iplatform -I../arduino/QubiProtocol/src \
+ *     -I/path/to/ArduinoJson/src bench/IntDecodeBench.cpp \
+ *     ../arduino/QubiProtocol/src/Qubi*.cpp platform/Host*.cpp platform/Qubi*.cpp \
+ *     -o int_decode_bench
+ */
+
+#include "QubiProtocol.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+struct SampleAction {
+  const char* action;
+  const char* params;
+  const char* keys[4][2];  // Key, and the key inside it for nested objects
+};
+
+static const SampleAction samples[] = {
+  {"set_servo", "{\"angle\":95,\"speed\":120,\"easing\":\"ease-in\"}",
+   {{"angle", nullptr}, {"speed", nullptr}}},
+  {"set_eyes", "{\"left_eye\":{\"x\":-12,\"y\":8},\"right_eye\":{\"x\":14,\"y\":8},\"blink\":false}",
+   {{"left_eye", "x"}, {"left_eye", "y"}, {"right_eye", "x"}, {"right_eye", "y"}}},
+  {"set_brightness", "{\"brightness\":80}", {{"brightness", nullptr}}},
+  {"set_expression", "{\"expression\":\"happy\",\"intensity\":75}", {{"intensity", nullptr}}},
+};
+
+static volatile long sink;
+
+template <typename F>
+static void run(const char* name, F extract, int perCall = 1, const char* unit = "command") {
+  const int iterations = 100000;
+  const size_t count = sizeof(samples) / sizeof(samples[0]);
+  double best = 0;
+  for (int round = 0; round < 5; round++) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+      sink = sink + extract(samples[i % count]);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ns = std::chrono::duration<double, std::nano>(end - start).count() / iterations / perCall;
+    best = round == 0 ? ns : min(best, ns);
+  }
+  printf("%-30s %8.1f ns/%s\n", name, best, unit);
+}
+
+static long cursorSum(const SampleAction& sample) {
+  QubiParamCursor params(sample.params, strlen(sample.params));
+  long sum = 0;
+  for (const auto& key : sample.keys) {
+    if (!key[0] || !params.find(key[0])) break;
+    int32_t value = 0;
+    if (key[1]) {
+      QubiParamCursor inner = params.child();
+      if (inner.find(key[1])) inner.toInt(value);
+    } else {
+      params.toInt(value);
+    }
+    sum += value;
+  }
+  return sum;
+}
+
+int main() {
+  JsonDocument doc;
+  run("cmd.params[\"...\"]", [&](const SampleAction& sample) {
+    deserializeJson(doc, sample.params);
+    JsonObject params = doc.as<JsonObject>();
+    long sum = 0;
+    for (const auto& key : sample.keys) {
+      if (!key[0]) break;
+      sum += key[1] ? params[key[0]][key[1]].as<int>() : params[key[0]].as<int>();
+    }
+    return sum;
+  });
+
+  run("QubiParamCursor::toInt()", cursorSum);
+
+  // Decoding alone, on the values above, each after a key as in a command
+  const char* numbers[] = {"95", "120", "-12", "8", "14", "80", "75", "180", "255", "1000"};
+  const size_t count = sizeof(numbers) / sizeof(numbers[0]);
+  QubiParamCursor cursors[count];
+  std::string texts[count];
+  for (size_t i = 0; i < count; i++) {
+    texts[i] = std::string("{\"value\":") + numbers[i] + "}";
+    cursors[i] = QubiParamCursor(texts[i].c_str(), texts[i].size());
+    cursors[i].find("value");
+  }
+  printf("\n");
+  run("toInt()", [&](const SampleAction&) {
+    long sum = 0;
+    for (size_t i = 0; i < count; i++) {
+      int32_t value = 0;
+      cursors[i].toInt(value);
+      sum += value;
+    }
+    return sum;
+  }, count, "number");
+  return 0;
+}
@@ -0,0 +1,105 @@
+/*
+ * Datagrams per second per core through the host WiFiUDP over loopback,
+ * one datagram per syscall against recvmmsg()/sendmmsg() batches.
+ *
+ * One thread alternates a burst of fixed-size datagrams from a sender
+ * socket with draining them from a receiver socket through
+ * parsePacket()/read(), and times each side with the thread's CPU clock, so
+ * the rates read as packets/s for one fully busy core. Bursts fit in the
+ * receive buffer, so the receiver always finds a full queue. On loopback the
+ * send side also pays for the kernel's delivery to the receiving socket.
+ *
+ *   g++ -std=c++17 -O2 -Iplatform bench/PacketRateBench.cpp \
+ *     platform/Host*.cpp platform/Qubi*.cpp -lpthread -o packet_rate_bench
+ *
+ *   ./packet_rate_bench [seconds-per-run]
+ */
+
+#include "WiFiUdp.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sys/socket.h>
+
+#define BURST 512
+
+static double threadCpuSeconds() {
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+struct RunResult {
+  uint32_t sent;
+  uint32_t received;
+  double sendCpu;
+  double receiveCpu;
+  double packetsPerSendCall;
+  double packetsPerReceiveCall;
+};
+
+static RunResult run(size_t size, unsigned batch, double seconds) {
+  WiFiUDP receiver;
+  receiver.begin(IPAddress(127, 0, 0, 1), 0);
+  receiver.setReceiveBatch(batch);
+  int bufferSize = 4 * 1024 * 1024;
+  setsockopt(receiver.fd(), SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+  WiFiUDP sender;
+  sender.begin(0);
+  sender.setSendBatch(batch);
+
+  uint8_t payload[1024];
+  uint8_t buffer[2048];
+  memset(payload, 'x', sizeof(payload));
+  IPAddress target(127, 0, 0, 1);
+  uint16_t port = receiver.localPort();
+
+  RunResult result = {};
+  unsigned long wallStart = millis();
+  while (millis() - wallStart < seconds * 1000) {
+    double start = threadCpuSeconds();
+    for (int i = 0; i < BURST; i++) {
+      sender.beginPacket(target, port);
+      sender.write(payload, size);
+      sender.endPacket();
+    }
+    sender.flushSends();
+    double sentAt = threadCpuSeconds();
+    while (receiver.parsePacket() > 0) {
+      receiver.read(buffer, sizeof(buffer));
+      result.received++;
+    }
+    result.sendCpu += sentAt - start;
+    result.receiveCpu += threadCpuSeconds() - sentAt;
+    result.sent += BURST;
+  }
+
+  const QubiUdpIoStats& rx = receiver.ioStats();
+  const QubiUdpIoStats& tx = sender.ioStats();
+  result.sent -= tx.txDropped;
+  result.packetsPerSendCall = tx.txCalls ? (double)tx.txPackets / tx.txCalls : 0;
+  result.packetsPerReceiveCall = rx.rxCalls ? (double)rx.rxPackets / rx.rxCalls : 0;
+  return result;
+}
+
+int main(int argc, char** argv) {
+  double seconds = argc > 1 ? atof(argv[1]) : 1.0;
+  const size_t sizes[] = {64, 256, 512, 1024};
+  const unsigned batches[] = {1, QUBI_HOST_UDP_BATCH};
+
+  printf("%6s %6s %14s %14s %10s %12s %12s\n", "bytes", "batch", "send pps/core", "recv pps/core",
+         "delivered", "pkts/sendcall", "pkts/recvcall");
+  for (size_t size : sizes) {
+    for (unsigned batch : batches) {
+      RunResult result = run(size, batch, seconds);
+      printf("%6zu %6u %14.0f %14.0f %9.1f%% %12.1f %12.1f\n", size, batch,
+             result.sendCpu > 0 ? result.sent / result.sendCpu : 0,
+             result.receiveCpu > 0 ? result.received / result.receiveCpu : 0,
+             result.sent ? 100.0 * result.received / result.sent : 0, result.packetsPerSendCall,
+             result.packetsPerReceiveCall);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * Cost of extracting set_servo parameters three ways: repeated
+ * cmd.params["..."] lookups (each a linear key scan), QubiModule::bind()
+ * with a constexpr field table, and the schema-generated qubiDecode().
+ *
+ *   g++ -std=c++17 -O2 -Iplatform -I../arduino/QubiProtocol/src \
+ *     -I/path/to/ArduinoJson/src bench/ParamBindBench.cpp \
+ *     ../arduino/QubiProtocol/src/Qubi*.cpp platform/Host*.cpp platform/Qubi*.cpp \
+ *     -o param_bind_bench
+ */
+
+#include "QubiProtocol.h"
+#include "QubiSchema.h"
+
+#include <chrono>
+#include <cstdio>
+
+struct ServoParams {
+  int angle = 0;
+  int speed = 255;
+  const char* easing = "linear";
+  static constexpr QubiField<ServoParams> fields[] = {
+    {"angle", &ServoParams::angle, 0, 180, QUBI_REQUIRED},
+    {"speed", &ServoParams::speed, 0, 255},
+    {"easing", &ServoParams::easing},
+  };
+};
+
+static volatile long sink;
+
+template <typename F>
+static void run(const char* name, F extract) {
+  const int iterations = 200000;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < iterations; i++) {
+    sink = sink + extract();
+  }
+  auto end = std::chrono::steady_clock::now();
+  printf("%-24s %8.1f ns/command\n", name,
+         std::chrono::duration<double, std::nano>(end - start).count() / iterations);
+}
+
+int main() {
+  // Not begun: nothing here fails validation, so no response is ever sent
+  ActuatorModule module;
+
+  // Fields in the order a client builder emits them, plus keys the handler
+  // ignores, so lookups for later fields scan past the earlier ones
+  JsonDocument doc;
+  deserializeJson(doc, "{\"trace_id\":\"a1b2\",\"easing\":\"ease-in\",\"duration\":400,"
+                       "\"speed\":120,\"angle\":95}");
+  QubiCommand cmd;
+  cmd.action = "set_servo";
+  cmd.params = doc.as<JsonObject>();
+
+  run("params[\"...\"] lookups", [&] {
+    int angle = cmd.params["angle"];
+    int speed = cmd.params["speed"] | 255;
+    const char* easing = cmd.params["easing"] | "linear";
+    if (angle < 0 || angle > 180 || speed < 0 || speed > 255) return 0L;
+    return (long)(angle + speed + easing[0]);
+  });
+
+  run("bind<ServoParams>()", [&] {
+    ServoParams params;
+    if (!module.bind(cmd, params)) return 0L;
+    return (long)(params.angle + params.speed + params.easing[0]);
+  });
+
+  run("qubiDecode() (schema)", [&] {
+    QubiSetServoParams params;
+    if (!qubiDecode(module, cmd, params)) return 0L;
+    return (long)(params.angle + params.speed + (int)params.easing);
+  });
+
+  return 0;
+}
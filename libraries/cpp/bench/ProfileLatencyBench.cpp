@@ -0,0 +1,123 @@
+/*
+ * Round-trip time of a "discover" request, per latency profile.
+ *
+ * With a module address, pings a real module and reports the profile it
+ * answers with; flash it once per profile and run again. Without one, runs
+ * an in-process module over loopback with each profile in turn, which shows
+ * only the loop delay part of the latency (the host radio settings are
+ * recorded, not applied).
+ *
+ *   g++ -std=c++17 -O2 -Iplatform -I../arduino/QubiProtocol/src \
+ *     -I/path/to/ArduinoJson/src bench/ProfileLatencyBench.cpp \
+ *     ../arduino/QubiProtocol/src/Qubi*.cpp platform/Host*.cpp platform/Qubi*.cpp \
+ *     -lpthread -o profile_latency_bench
+ *
+ *   ./profile_latency_bench [module-ip [count [interval-ms]]]
+ */
+
+#include "QubiProtocol.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const char* discoverRequest =
+  "{\"version\":\"1.0\",\"timestamp\":1,\"commands\":"
+  "[{\"module_id\":\"*\",\"module_type\":\"custom\",\"action\":\"discover\",\"params\":{}}]}";
+
+static const char* profileName(QubiLatencyProfile profile) {
+  switch (profile) {
+    case QubiLatencyProfile::LOW_LATENCY: return "low_latency";
+    case QubiLatencyProfile::LOW_POWER: return "low_power";
+    default: return "balanced";
+  }
+}
+
+// Sends count requests, one every intervalMs, and prints the RTT spread.
+// Sparse requests are the interesting case: with modem sleep the radio is
+// off between them.
+static void measure(const char* label, IPAddress module, uint16_t port, int count, int intervalMs) {
+  WiFiUDP udp;
+  udp.begin(0);
+
+  std::vector<double> rtts;
+  std::string profile = "?";
+  char buffer[QUBI_BUFFER_SIZE];
+  // Sends on a fixed schedule: waiting a fixed time after each answer would
+  // lock the requests to one phase of the module's loop
+  unsigned long start = micros();
+  for (int i = 0; i < count; i++) {
+    while (micros() - start < (unsigned long)i * intervalMs * 1000) delayMicroseconds(100);
+    while (udp.parsePacket() > 0) udp.flush();  // Late answers to earlier requests
+
+    unsigned long sent = micros();
+    udp.beginPacket(module, port);
+    udp.print(discoverRequest);
+    udp.endPacket();
+
+    while (micros() - sent < 1000000) {
+      if (udp.parsePacket() <= 0) {
+        delayMicroseconds(50);
+        continue;
+      }
+      rtts.push_back((micros() - sent) / 1000.0);
+      int length = udp.read(buffer, sizeof(buffer) - 1);
+      buffer[length > 0 ? length : 0] = '\0';
+      JsonDocument doc;
+      if (!deserializeJson(doc, buffer)) {
+        profile = doc["data"]["profile"] | "?";
+      }
+      break;
+    }
+  }
+
+  if (rtts.empty()) {
+    printf("%-12s no answers\n", label);
+    return;
+  }
+  std::sort(rtts.begin(), rtts.end());
+  auto at = [&](double q) { return rtts[std::min(rtts.size() - 1, (size_t)(q * rtts.size()))]; };
+  printf("%-12s profile=%-11s p50 %7.2f ms  p90 %7.2f ms  p99 %7.2f ms  max %7.2f ms  lost %d/%d\n",
+         label, profile.c_str(), at(0.5), at(0.9), at(0.99), rtts.back(), count - (int)rtts.size(), count);
+}
+
+int main(int argc, char** argv) {
+  int count = argc > 2 ? atoi(argv[2]) : 200;
+  int intervalMs = argc > 3 ? atoi(argv[3]) : 200;
+
+  if (argc > 1) {
+    IPAddress module;
+    if (!module.fromString(argv[1])) {
+      fprintf(stderr, "usage: %s [module-ip [count [interval-ms]]]\n", argv[0]);
+      return 1;
+    }
+    measure(argv[1], module, QUBI_DEFAULT_PORT, count, intervalMs);
+    return 0;
+  }
+
+  const QubiLatencyProfile profiles[] = {QubiLatencyProfile::LOW_LATENCY, QubiLatencyProfile::BALANCED,
+                                         QubiLatencyProfile::LOW_POWER};
+  for (QubiLatencyProfile profile : profiles) {
+    ActuatorModule module;
+    module.begin("bench", QubiModuleType::ACTUATOR, QUBI_DEFAULT_PORT, profile);
+
+    // The sketch's loop(): process, then wait as the profile suggests
+    std::atomic<bool> running(true);
+    std::thread loop([&] {
+      while (running) {
+        module.processMessages();
+        delay(module.getLoopDelay());
+      }
+    });
+    // An interval off the loop periods, so requests land at every loop phase
+    measure(profileName(profile), IPAddress(127, 0, 0, 1), QUBI_DEFAULT_PORT, count / 4, intervalMs / 4 + 3);
+    running = false;
+    loop.join();
+    module.end();
+  }
+  return 0;
+}
@@ -0,0 +1,145 @@
+#ifndef QUBI_HOST_ARDUINO_H
+#define QUBI_HOST_ARDUINO_H
+
+// Host (Linux) stand-in for the subset of the Arduino core used by the
+// QubiProtocol library, so QubiModule can run in-process on a PC.
+
+#include <algorithm>
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#ifndef ARDUINOJSON_ENABLE_ARDUINO_STRING
+#define ARDUINOJSON_ENABLE_ARDUINO_STRING 1
+#endif
+#ifndef ARDUINOJSON_ENABLE_ARDUINO_STREAM
+#define ARDUINOJSON_ENABLE_ARDUINO_STREAM 0
+#endif
+#ifndef ARDUINOJSON_ENABLE_ARDUINO_PRINT
+#define ARDUINOJSON_ENABLE_ARDUINO_PRINT 0
+#endif
+#ifndef ARDUINOJSON_ENABLE_PROGMEM
+#define ARDUINOJSON_ENABLE_PROGMEM 0
+#endif
+
+#define QUBI_HOST_PLATFORM 1
+
+using std::min;
+using std::max;
+
+class String {
+private:
+  std::string _str;
+
+public:
+  String() {}
+  String(const char* str) : _str(str ? str : "") {}
+  String(const char* str, size_t len) : _str(str ? str : "", str ? len : 0) {}
+  String(const std::string& str) : _str(str) {}
+  explicit String(char c) : _str(1, c) {}
+  explicit String(int value) : _str(std::to_string(value)) {}
+  explicit String(unsigned int value) : _str(std::to_string(value)) {}
+  explicit String(long value) : _str(std::to_string(value)) {}
+  explicit String(unsigned long value) : _str(std::to_string(value)) {}
+  explicit String(float value, unsigned int decimals = 2);
+  explicit String(double value, unsigned int decimals = 2);
+
+  String& operator=(const char* str) { _str = str ? str : ""; return *this; }
+
+  const char* c_str() const { return _str.c_str(); }
+  unsigned int length() const { return (unsigned int)_str.size(); }
+  bool isEmpty() const { return _str.empty(); }
+  char charAt(unsigned int index) const { return index < _str.size() ? _str[index] : 0; }
+  char operator[](unsigned int index) const { return charAt(index); }
+  const std::string& str() const { return _str; }
+
+  bool concat(const char* str) { if (str) _str += str; return true; }
+  bool concat(const char* str, unsigned int len) { if (str) _str.append(str, len); return true; }
+  bool concat(const String& str) { _str += str._str; return true; }
+  bool concat(char c) { _str += c; return true; }
+
+  String& operator+=(const String& rhs) { _str += rhs._str; return *this; }
+  String& operator+=(const char* rhs) { return concat(rhs), *this; }
+  String& operator+=(char rhs) { _str += rhs; return *this; }
+
+  bool equals(const String& rhs) const { return _str == rhs._str; }
+  bool startsWith(const String& prefix) const { return _str.compare(0, prefix._str.size(), prefix._str) == 0; }
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t pos = _str.find(c, from);
+    return pos == std::string::npos ? -1 : (int)pos;
+  }
+  String substring(unsigned int from, unsigned int to = (unsigned int)-1) const {
+    if (from >= _str.size()) return String();
+    return String(_str.substr(from, to == (unsigned int)-1 ? std::string::npos : to - from));
+  }
+  long toInt() const { return strtol(_str.c_str(), nullptr, 10); }
+  float toFloat() const { return strtof(_str.c_str(), nullptr); }
+
+  friend bool operator==(const String& lhs, const String& rhs) { return lhs._str == rhs._str; }
+  friend bool operator==(const String& lhs, const char* rhs) { return lhs._str == (rhs ? rhs : ""); }
+  friend bool operator!=(const String& lhs, const String& rhs) { return !(lhs == rhs); }
+  friend bool operator!=(const String& lhs, const char* rhs) { return !(lhs == rhs); }
+  friend bool operator<(const String& lhs, const String& rhs) { return lhs._str < rhs._str; }
+  friend String operator+(const String& lhs, const String& rhs) { return String(lhs._str + rhs._str); }
+  friend String operator+(const String& lhs, const char* rhs) { return String(lhs._str + (rhs ? rhs : "")); }
+  friend String operator+(const char* lhs, const String& rhs) { return String((lhs ? lhs : "") + rhs._str); }
+};
+
+class IPAddress {
+private:
+  // Octets in network order, i.e. the same layout as in_addr.s_addr
+  uint32_t _address;
+
+public:
+  IPAddress() : _address(0) {}
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) {
+    uint8_t* bytes = reinterpret_cast<uint8_t*>(&_address);
+    bytes[0] = a; bytes[1] = b; bytes[2] = c; bytes[3] = d;
+  }
+  IPAddress(uint32_t address) : _address(address) {}
+
+  operator uint32_t() const { return _address; }
+  uint8_t operator[](int index) const { return reinterpret_cast<const uint8_t*>(&_address)[index]; }
+  bool operator==(const IPAddress& rhs) const { return _address == rhs._address; }
+  bool operator!=(const IPAddress& rhs) const { return _address != rhs._address; }
+
+  bool fromString(const char* address);
+  bool fromString(const String& address) { return fromString(address.c_str()); }
+  String toString() const;
+};
+
+// Timing. Backed by the monotonic clock unless a QubiClock is installed.
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void yield();
+
+long map(long x, long inMin, long inMax, long outMin, long outMax);
+long random(long maxValue);
+long random(long minValue, long maxValue);
+void randomSeed(unsigned long seed);
+
+class HostSerial {
+public:
+  void begin(unsigned long baud) { (void)baud; }
+  void end() {}
+  operator bool() const { return true; }
+
+  size_t print(const char* str) { return fputs(str, stdout) >= 0 ? strlen(str) : 0; }
+  size_t print(const String& str) { return print(str.c_str()); }
+  size_t print(int value) { return printf("%d", value); }
+  size_t print(unsigned long value) { return printf("%lu", value); }
+  size_t print(const IPAddress& address) { return print(address.toString()); }
+  size_t println() { return print("\n"); }
+  template <typename T>
+  size_t println(const T& value) { size_t n = print(value); return n + println(); }
+  size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3)));
+};
+
+extern HostSerial Serial;
+
+#endif // QUBI_HOST_ARDUINO_H
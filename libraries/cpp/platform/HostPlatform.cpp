@@ -0,0 +1,211 @@
+#include "Arduino.h"
+#include "QubiClock.h"
+#include "WiFi.h"
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <random>
+#include <thread>
+
+HostSerial Serial;
+HostWiFiClass WiFi;
+
+static std::mt19937 randomEngine;
+
+class SystemClock : public QubiClock {
+private:
+  std::chrono::steady_clock::time_point _start = std::chrono::steady_clock::now();
+
+public:
+  uint64_t nowUs() override {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::steady_clock::now() - _start).count();
+  }
+  void sleepUs(uint64_t us) override {
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+  }
+};
+
+static SystemClock systemClock;
+static QubiClock* activeClock = &systemClock;
+
+void qubiSetClock(QubiClock* clock) {
+  activeClock = clock ? clock : &systemClock;
+}
+
+QubiClock& qubiClock() {
+  return *activeClock;
+}
+
+String::String(float value, unsigned int decimals) : String((double)value, decimals) {}
+
+String::String(double value, unsigned int decimals) {
+  char buffer[64];
+  snprintf(buffer, sizeof(buffer), "%.*f", (int)decimals, value);
+  _str = buffer;
+}
+
+bool IPAddress::fromString(const char* address) {
+  in_addr parsed;
+  if (!address || inet_pton(AF_INET, address, &parsed) != 1) return false;
+  _address = parsed.s_addr;
+  return true;
+}
+
+String IPAddress::toString() const {
+  char buffer[INET_ADDRSTRLEN];
+  in_addr address;
+  address.s_addr = _address;
+  inet_ntop(AF_INET, &address, buffer, sizeof(buffer));
+  return String(buffer);
+}
+
+unsigned long millis() {
+  return micros() / 1000;
+}
+
+unsigned long micros() {
+  return (unsigned long)activeClock->nowUs();
+}
+
+void delay(unsigned long ms) {
+  activeClock->sleepUs((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us) {
+  activeClock->sleepUs(us);
+}
+
+void yield() {
+  std::this_thread::yield();
+}
+
+long map(long x, long inMin, long inMax, long outMin, long outMax) {
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+long random(long maxValue) {
+  return random(0, maxValue);
+}
+
+long random(long minValue, long maxValue) {
+  if (maxValue <= minValue) return minValue;
+  return minValue + (long)(randomEngine() % (unsigned long)(maxValue - minValue));
+}
+
+void randomSeed(unsigned long seed) {
+  randomEngine.seed((std::mt19937::result_type)seed);
+}
+
+size_t HostSerial::printf(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  int written = vprintf(format, args);
+  va_end(args);
+  return written > 0 ? (size_t)written : 0;
+}
+
+HostWiFiClass::HostWiFiClass()
+  : _status(WL_CONNECTED), _localIP(127, 0, 0, 1), _gateway(127, 0, 0, 1), _subnet(255, 0, 0, 0),
+    _dns(127, 0, 0, 1), _leaseIP(127, 0, 0, 1), _staticIP(false), _sleep(WIFI_PS_MIN_MODEM),
+    _txPower(WIFI_POWER_19_5dBm), _apChannel(6), _apBssid{0x02, 0x00, 0x00, 0x00, 0x00, 0x01}, _scanMs(0),
+    _associateMs(0), _dhcpMs(0), _connecting(false), _connectAt(0), _dhcpPending(false), _renewing(false),
+    _linkGeneration(0), _linkDownAt(0), _dropClosesSockets(false) {}
+
+wl_status_t HostWiFiClass::begin(const char* ssid, const char* passphrase, int32_t channel,
+                                 const uint8_t* bssid, bool connect) {
+  (void)ssid;
+  (void)passphrase;
+  setLinkDown(WL_DISCONNECTED);
+  if (!connect) return _status;
+  
+  bool direct = channel > 0 && bssid;
+  if (direct && (channel != _apChannel || memcmp(bssid, _apBssid, sizeof(_apBssid)) != 0)) {
+    return _status;  // Nothing answers on that channel; the caller has to time out
+  }
+  _connecting = true;
+  _dhcpPending = !_staticIP;
+  _connectAt = millis() + (direct ? 0 : _scanMs) + _associateMs + (_staticIP ? 0 : _dhcpMs);
+  return status();
+}
+
+bool HostWiFiClass::config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1, IPAddress dns2) {
+  (void)dns2;
+  bool wasStatic = _staticIP;
+  _staticIP = (uint32_t)local != 0;
+  if (_staticIP) {
+    _localIP = local;
+    _gateway = gateway;
+    _subnet = subnet;
+    _dns = dns1;
+    _renewing = false;
+  } else if (wasStatic && _status == WL_CONNECTED) {
+    // Like esp_netif_dhcpc_start(): the interface has no address until the
+    // lease arrives
+    _localIP = IPAddress();
+    startLease();
+  }
+  return true;
+}
+
+void HostWiFiClass::startLeaseKeepingAddress() {
+  if (!_staticIP || _status != WL_CONNECTED) return;
+  _staticIP = false;
+  startLease();
+}
+
+void HostWiFiClass::startLease() {
+  _renewing = true;
+  _dhcpPending = true;
+  _connectAt = millis() + _dhcpMs;
+}
+
+wl_status_t HostWiFiClass::status() {
+  bool due = (long)(millis() - _connectAt) >= 0;
+  if (_connecting && due) {
+    _connecting = false;
+    _status = WL_CONNECTED;
+  }
+  if (_status == WL_CONNECTED && _dhcpPending && (!_renewing || due)) {
+    _dhcpPending = false;
+    _renewing = false;
+    _localIP = _leaseIP;
+  }
+  return _status;
+}
+
+void HostWiFiClass::setStatus(wl_status_t status) {
+  if (status == WL_CONNECTED) {
+    _connecting = false;
+    _status = status;
+  } else {
+    setLinkDown(status);
+  }
+}
+
+void HostWiFiClass::setLinkDown(wl_status_t status) {
+  if (_status == WL_CONNECTED) {
+    _linkGeneration++;
+    _linkDownAt = millis();
+  }
+  _connecting = false;
+  _renewing = false;
+  _status = status;
+}
+
+void HostWiFiClass::setAccessPoint(int32_t channel, const uint8_t bssid[6]) {
+  _apChannel = channel;
+  memcpy(_apBssid, bssid, sizeof(_apBssid));
+}
+
+void HostWiFiClass::setConnectTimes(unsigned long scanMs, unsigned long associateMs, unsigned long dhcpMs) {
+  _scanMs = scanMs;
+  _associateMs = associateMs;
+  _dhcpMs = dhcpMs;
+}
+
+bool HostWiFiClass::disconnect(bool wifiOff) {
+  (void)wifiOff;
+  setLinkDown(WL_DISCONNECTED);
+  return true;
+}
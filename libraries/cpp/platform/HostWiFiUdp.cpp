@@ -0,0 +1,396 @@
+#include "WiFiUdp.h"
+#include "QubiSimNetwork.h"
+#include "WiFi.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// One recvmmsg()/sendmmsg() vector, with a slot the socket's datagram size
+// for each datagram. The block is allocated uninitialised, so only pages
+// that datagrams have touched take memory.
+struct QubiUdpBatch {
+  mmsghdr messages[QUBI_HOST_UDP_BATCH];
+  iovec vectors[QUBI_HOST_UDP_BATCH];
+  sockaddr_in addresses[QUBI_HOST_UDP_BATCH];
+  uint8_t* data;
+  size_t slotSize;
+  unsigned count;  // Slots filled
+  unsigned next;   // Next received slot to hand out
+
+  explicit QubiUdpBatch(size_t slotSize) : slotSize(slotSize), count(0), next(0) {
+    data = new uint8_t[(size_t)QUBI_HOST_UDP_BATCH * slotSize];
+    memset(messages, 0, sizeof(messages));
+    memset(addresses, 0, sizeof(addresses));
+    for (unsigned i = 0; i < QUBI_HOST_UDP_BATCH; i++) {
+      vectors[i].iov_base = slot(i);
+      vectors[i].iov_len = slotSize;
+      messages[i].msg_hdr.msg_iov = &vectors[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+      messages[i].msg_hdr.msg_name = &addresses[i];
+      messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+    }
+  }
+  ~QubiUdpBatch() { delete[] data; }
+  QubiUdpBatch(const QubiUdpBatch&) = delete;
+  QubiUdpBatch& operator=(const QubiUdpBatch&) = delete;
+
+  uint8_t* slot(unsigned i) { return data + (size_t)i * slotSize; }
+};
+
+WiFiUDP::WiFiUDP()
+  : _fd(-1), _sim(nullptr), _localPort(0), _linkGeneration(0), _onLink(true),
+    _datagramSize(QUBI_HOST_UDP_DEFAULT_PACKET), _rxBuffer(nullptr), _rxData(nullptr), _rxLength(0),
+    _rxPosition(0), _remotePort(0), _txBuffer(nullptr), _txLength(0), _txPort(0), _rxBatch(nullptr),
+    _txBatch(nullptr), _rxBatchSize(QUBI_HOST_UDP_BATCH), _txBatchSize(1) {
+  memset(&_ioStats, 0, sizeof(_ioStats));
+}
+
+WiFiUDP::~WiFiUDP() {
+  stop();
+  releaseBuffers();
+}
+
+void WiFiUDP::releaseBuffers() {
+  delete[] _rxBuffer;
+  delete[] _txBuffer;
+  delete _rxBatch;
+  delete _txBatch;
+  _rxBuffer = _txBuffer = nullptr;
+  _rxBatch = _txBatch = nullptr;
+}
+
+void WiFiUDP::setDatagramSize(size_t bytes) {
+  flushSends();
+  _rxLength = _rxPosition = 0;
+  _txLength = 0;
+  releaseBuffers();
+  _datagramSize = bytes < 1 ? 1 : bytes > QUBI_HOST_UDP_MAX_PACKET ? QUBI_HOST_UDP_MAX_PACKET : bytes;
+}
+
+uint8_t WiFiUDP::begin(uint16_t port) {
+  return begin(IPAddress(0, 0, 0, 0), port);
+}
+
+uint8_t WiFiUDP::begin(IPAddress address, uint16_t port) {
+  stop();
+  _linkGeneration = WiFi.linkGeneration();
+
+  if (QubiSimNetwork* network = QubiSimNetwork::active()) {
+    if (!network->bind(this, (uint32_t)address, port)) return 0;
+    _sim = network;
+    _localPort = port;
+    return 1;
+  }
+
+  _fd = socket(AF_INET, SOCK_DGRAM, 0);
+  if (_fd < 0) return 0;
+
+  int yes = 1;
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  setsockopt(_fd, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes));
+  fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL, 0) | O_NONBLOCK);
+
+  sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = (uint32_t)address;
+  if (bind(_fd, (sockaddr*)&local, sizeof(local)) < 0) {
+    stop();
+    return 0;
+  }
+
+  socklen_t localLen = sizeof(local);
+  getsockname(_fd, (sockaddr*)&local, &localLen);
+  _localPort = ntohs(local.sin_port);
+  return 1;
+}
+
+uint8_t WiFiUDP::beginMulticast(IPAddress multicast, uint16_t port) {
+  if (!begin(port)) return 0;
+  if (_sim) return 1;  // The simulated network delivers multicast to every port match
+
+  ip_mreq request = {};
+  request.imr_multiaddr.s_addr = (uint32_t)multicast;
+  request.imr_interface.s_addr = htonl(INADDR_ANY);
+  if (setsockopt(_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &request, sizeof(request)) < 0) {
+    stop();
+    return 0;
+  }
+  return 1;
+}
+
+void WiFiUDP::stop() {
+  if (_fd >= 0) {
+    flushSends();
+    close(_fd);
+    _fd = -1;
+  }
+  if (_sim) {
+    if (_sim == QubiSimNetwork::active()) _sim->unbind(this);
+    _sim = nullptr;
+  }
+  _localPort = 0;
+  _rxLength = _rxPosition = 0;
+  _txLength = 0;
+  if (_rxBatch) _rxBatch->count = _rxBatch->next = 0;
+}
+
+int WiFiUDP::beginPacket(IPAddress ip, uint16_t port) {
+  if (!_txBuffer) _txBuffer = new uint8_t[_datagramSize];
+  _txIP = ip;
+  _txPort = port;
+  _txLength = 0;
+  return isOpen() ? 1 : 0;
+}
+
+int WiFiUDP::beginPacket(const char* host, uint16_t port) {
+  IPAddress address;
+  if (!address.fromString(host)) {
+    addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    addrinfo* result = nullptr;
+    if (getaddrinfo(host, nullptr, &hints, &result) != 0 || !result) return 0;
+    address = IPAddress((uint32_t)((sockaddr_in*)result->ai_addr)->sin_addr.s_addr);
+    freeaddrinfo(result);
+  }
+  return beginPacket(address, port);
+}
+
+size_t WiFiUDP::write(uint8_t byte) {
+  return write(&byte, 1);
+}
+
+size_t WiFiUDP::write(const uint8_t* buffer, size_t size) {
+  if (!_txBuffer) _txBuffer = new uint8_t[_datagramSize];
+  size_t room = _datagramSize - _txLength;
+  if (size > room) size = room;
+  memcpy(_txBuffer + _txLength, buffer, size);
+  _txLength += size;
+  return size;
+}
+
+int WiFiUDP::endPacket() {
+  if (!isOpen()) return 0;
+
+  size_t len = _txLength;
+  _txLength = 0;
+  if (!linkUp()) return 0;
+
+  if (_outbound.enabled()) {
+    _outbound.submit(_txBuffer, len, (uint32_t)_txIP, _txPort, micros());
+    pumpOutbound();
+    return 1;
+  }
+  return sendRaw(_txBuffer, len, (uint32_t)_txIP, _txPort) ? 1 : 0;
+}
+
+bool WiFiUDP::sendRaw(const uint8_t* data, size_t len, uint32_t address, uint16_t port) {
+  if (_sim) return _sim->send(this, data, len, address, port);
+
+  if (_txBatchSize > 1) {
+    if (!_txBatch) _txBatch = new QubiUdpBatch(_datagramSize);
+    QubiUdpBatch& batch = *_txBatch;
+    unsigned i = batch.count++;
+    memcpy(batch.slot(i), data, len);
+    batch.vectors[i].iov_len = len;
+    batch.addresses[i].sin_family = AF_INET;
+    batch.addresses[i].sin_port = htons(port);
+    batch.addresses[i].sin_addr.s_addr = address;
+    if (batch.count >= _txBatchSize) flushSends();
+    return true;
+  }
+
+  sockaddr_in remote = {};
+  remote.sin_family = AF_INET;
+  remote.sin_port = htons(port);
+  remote.sin_addr.s_addr = address;
+  _ioStats.txCalls++;
+  if (sendto(_fd, data, len, 0, (sockaddr*)&remote, sizeof(remote)) != (ssize_t)len) return false;
+  _ioStats.txPackets++;
+  return true;
+}
+
+bool WiFiUDP::flushSends() {
+  if (!_txBatch || _txBatch->count == 0) return true;
+
+  QubiUdpBatch& batch = *_txBatch;
+  unsigned sent = 0;
+  bool ok = true;
+  while (sent < batch.count) {
+    int result = sendmmsg(_fd, batch.messages + sent, batch.count - sent, MSG_DONTWAIT);
+    _ioStats.txCalls++;
+    if (result > 0) {
+      sent += result;
+      _ioStats.txPackets += result;
+      continue;
+    }
+
+    // The first unsent datagram failed. A full socket buffer would refuse
+    // the rest as well; anything else is specific to that one.
+    ok = false;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      _ioStats.txDropped += batch.count - sent;
+      break;
+    }
+    _ioStats.txDropped++;
+    sent++;
+  }
+  batch.count = 0;
+  return ok;
+}
+
+void WiFiUDP::pumpOutbound() {
+  QubiImpairedPacket packet;
+  uint64_t now = micros();
+  while (_outbound.poll(now, packet)) {
+    sendRaw(packet.data.data(), packet.data.size(), packet.address, packet.port);
+  }
+}
+
+int WiFiUDP::receiveRaw(const uint8_t*& data, uint32_t& address, uint16_t& port) {
+  if (_sim) {
+    QubiSimDatagram datagram;
+    for (;;) {
+      if (!_sim->receive(this, datagram)) return -1;
+      if (datagram.data.size() <= _datagramSize) break;
+      _ioStats.rxTruncated++;
+    }
+    if (!_rxBuffer) _rxBuffer = new uint8_t[_datagramSize];
+    memcpy(_rxBuffer, datagram.data.data(), datagram.data.size());
+    data = _rxBuffer;
+    address = datagram.address;
+    port = datagram.port;
+    return (int)datagram.data.size();
+  }
+
+  if (!_rxBatch) _rxBatch = new QubiUdpBatch(_datagramSize);
+  QubiUdpBatch& batch = *_rxBatch;
+  for (;;) {
+    if (batch.next == batch.count) {
+      batch.next = batch.count = 0;
+      for (unsigned i = 0; i < _rxBatchSize; i++) {
+        batch.messages[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+      }
+      int received = recvmmsg(_fd, batch.messages, _rxBatchSize, MSG_DONTWAIT, nullptr);
+      if (received <= 0) return -1;
+      batch.count = received;
+      _ioStats.rxCalls++;
+      _ioStats.rxPackets += received;
+    }
+
+    // The kernel has already discarded the end of a datagram that didn't fit
+    unsigned i = batch.next++;
+    if (batch.messages[i].msg_hdr.msg_flags & MSG_TRUNC) {
+      _ioStats.rxTruncated++;
+      continue;
+    }
+
+    // Valid until the batch is refilled, i.e. the next parsePacket()
+    data = batch.slot(i);
+    address = batch.addresses[i].sin_addr.s_addr;
+    port = ntohs(batch.addresses[i].sin_port);
+    return (int)batch.messages[i].msg_len;
+  }
+}
+
+bool WiFiUDP::linkUp() {
+  if (!_onLink) return true;
+  return WiFi.status() == WL_CONNECTED &&
+         (!WiFi.dropClosesSockets() || _linkGeneration == WiFi.linkGeneration());
+}
+
+int WiFiUDP::parsePacket() {
+  if (!isOpen()) return 0;
+
+  _rxLength = _rxPosition = 0;
+
+  const uint8_t* data;
+  uint32_t address;
+  uint16_t port;
+
+  if (!linkUp()) {
+    // Whatever arrives meanwhile is lost, as it would be over the air
+    while (receiveRaw(data, address, port) >= 0) {}
+    return 0;
+  }
+  pumpOutbound();
+  flushSends();
+
+  if (!_inbound.enabled()) {
+    int len = receiveRaw(data, address, port);
+    if (len <= 0) return 0;
+    _rxData = data;
+    _rxLength = len;
+    _remoteIP = IPAddress(address);
+    _remotePort = port;
+    return len;
+  }
+
+  // Move everything the kernel has queued onto the emulated link, then hand
+  // out whatever the link has released by now
+  uint64_t now = micros();
+  int len;
+  while ((len = receiveRaw(data, address, port)) >= 0) {
+    _inbound.submit(data, len, address, port, now);
+  }
+
+  QubiImpairedPacket packet;
+  if (!_inbound.poll(now, packet)) return 0;
+
+  if (!_rxBuffer) _rxBuffer = new uint8_t[_datagramSize];
+  memcpy(_rxBuffer, packet.data.data(), packet.data.size());
+  _rxData = _rxBuffer;
+  _rxLength = packet.data.size();
+  _remoteIP = IPAddress(packet.address);
+  _remotePort = packet.port;
+  return (int)_rxLength;
+}
+
+int WiFiUDP::available() {
+  return (int)(_rxLength - _rxPosition);
+}
+
+int WiFiUDP::read() {
+  return _rxPosition < _rxLength ? _rxData[_rxPosition++] : -1;
+}
+
+int WiFiUDP::read(unsigned char* buffer, size_t len) {
+  size_t remaining = _rxLength - _rxPosition;
+  if (len > remaining) len = remaining;
+  memcpy(buffer, _rxData + _rxPosition, len);
+  _rxPosition += len;
+  return (int)len;
+}
+
+int WiFiUDP::peek() {
+  return _rxPosition < _rxLength ? _rxData[_rxPosition] : -1;
+}
+
+void WiFiUDP::flush() {
+  _rxPosition = _rxLength;
+}
+
+void WiFiUDP::setInboundImpairment(const QubiImpairmentConfig& config) {
+  _inbound.configure(config);
+  _inbound.reset();
+}
+
+void WiFiUDP::setOutboundImpairment(const QubiImpairmentConfig& config) {
+  _outbound.configure(config);
+  _outbound.reset();
+}
+
+void WiFiUDP::setReceiveBatch(unsigned count) {
+  _rxBatchSize = count < 1 ? 1 : count > QUBI_HOST_UDP_BATCH ? QUBI_HOST_UDP_BATCH : count;
+}
+
+void WiFiUDP::setSendBatch(unsigned count) {
+  flushSends();
+  _txBatchSize = count < 1 ? 1 : count > QUBI_HOST_UDP_BATCH ? QUBI_HOST_UDP_BATCH : count;
+}
@@ -0,0 +1,20 @@
+#ifndef QUBI_CLOCK_H
+#define QUBI_CLOCK_H
+
+#include <cstdint>
+
+// Time source behind millis(), micros() and delay() on the host. The default
+// is the monotonic system clock; tests can install a QubiVirtualClock to run
+// module code on simulated time.
+class QubiClock {
+public:
+  virtual ~QubiClock() = default;
+  virtual uint64_t nowUs() = 0;
+  virtual void sleepUs(uint64_t us) = 0;
+};
+
+// Installs a clock for the whole process; nullptr restores the system clock
+void qubiSetClock(QubiClock* clock);
+QubiClock& qubiClock();
+
+#endif // QUBI_CLOCK_H
@@ -0,0 +1,613 @@
+#include "QubiEventLoop.h"
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define QUBI_EVENT_LOOP_RING_ENTRIES 1024
+#define QUBI_EVENT_LOOP_EPOLL_BATCH 32
+#define QUBI_EVENT_LOOP_MAX_DATAGRAM 65507
+
+namespace {
+
+// Completion tags: kind in the top byte, then the socket's generation (24
+// bits) and descriptor
+const uint64_t KIND_RECEIVE = 1;
+const uint64_t KIND_SEND = 2;
+const uint64_t KIND_CANCEL = 3;
+
+uint64_t tag(uint64_t kind, uint32_t generation, uint32_t index) {
+  return kind << 56 | (uint64_t)(generation & 0xFFFFFF) << 32 | index;
+}
+
+// liburing isn't assumed to be installed; the raw interface is small enough
+int ioUringSetup(unsigned entries, io_uring_params* params) {
+  return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+int ioUringEnter(int fd, unsigned submit, unsigned waitFor, unsigned flags, void* arg, size_t argSize) {
+  return (int)syscall(__NR_io_uring_enter, fd, submit, waitFor, flags, arg, argSize);
+}
+
+int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned count) {
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, count);
+}
+
+template <typename T> T loadAcquire(const T* value) {
+  return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+template <typename T> void storeRelease(T* value, T update) {
+  __atomic_store_n(value, update, __ATOMIC_RELEASE);
+}
+
+int openUdp(uint32_t address, uint16_t port) {
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  setsockopt(fd, SOL_SOCKET, SO_BROADCAST, &yes, sizeof(yes));
+
+  sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  local.sin_port = htons(port);
+  local.sin_addr.s_addr = address;
+  if (bind(fd, (sockaddr*)&local, sizeof(local)) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+}  // namespace
+
+struct QubiEventLoop::SendSlot {
+  int socket;
+  mmsghdr message;
+  iovec vector;
+  sockaddr_in address;
+  std::vector<uint8_t> data;
+};
+
+struct QubiEventLoop::Engine {
+  // io_uring
+  int ring;
+  void* sqMap;
+  size_t sqMapSize;
+  void* cqMap;
+  size_t cqMapSize;
+  io_uring_sqe* sqes;
+  size_t sqesSize;
+  unsigned* sqHead;
+  unsigned* sqTail;
+  unsigned* sqArray;
+  unsigned sqMask;
+  unsigned sqEntries;
+  unsigned sqPending;  // Prepared since the last io_uring_enter()
+  unsigned* cqHead;
+  unsigned* cqTail;
+  unsigned cqMask;
+  io_uring_cqe* cqes;
+  // The provided-buffer ring's entries. Not io_uring_buf_ring::bufs: in C++
+  // the header's flexible array lands 8 bytes in, past where the kernel reads.
+  io_uring_buf* bufferRing;
+  uint16_t bufferTail;
+  msghdr receiveShape;  // Multishot receives fill in the source address only
+
+  // epoll
+  int epoll;
+  mmsghdr batch[QUBI_EVENT_LOOP_EPOLL_BATCH];
+  iovec batchVectors[QUBI_EVENT_LOOP_EPOLL_BATCH];
+  sockaddr_in batchAddresses[QUBI_EVENT_LOOP_EPOLL_BATCH];
+
+  uint8_t* buffers;
+
+  Engine() {
+    memset(this, 0, sizeof(*this));
+    ring = -1;
+    epoll = -1;
+  }
+};
+
+const char* qubiEventBackendName(QubiEventBackend backend) {
+  return backend == QubiEventBackend::IO_URING ? "io_uring" : "epoll";
+}
+
+QubiEventLoop::QubiEventLoop(QubiEventBackend preferred)
+  : _backend(preferred), _engine(new Engine()), _generation(0), _running(false) {
+  memset(&_stats, 0, sizeof(_stats));
+  _engine->buffers = new uint8_t[(size_t)QUBI_EVENT_LOOP_BUFFER_COUNT * QUBI_EVENT_LOOP_BUFFER_SIZE];
+
+  if (_backend == QubiEventBackend::IO_URING && setupRing()) {
+    if (probeReceive() > 0) return;
+  }
+
+  // Fall back to epoll; a half set-up ring is no use
+  if (_engine->ring >= 0) {
+    ::close(_engine->ring);
+    _engine->ring = -1;
+  }
+  _backend = QubiEventBackend::EPOLL;
+  _engine->epoll = epoll_create1(EPOLL_CLOEXEC);
+  for (unsigned i = 0; i < QUBI_EVENT_LOOP_EPOLL_BATCH; i++) {
+    _engine->batchVectors[i].iov_base = _engine->buffers + (size_t)i * QUBI_EVENT_LOOP_BUFFER_SIZE;
+    _engine->batchVectors[i].iov_len = QUBI_EVENT_LOOP_BUFFER_SIZE;
+    _engine->batch[i].msg_hdr.msg_iov = &_engine->batchVectors[i];
+    _engine->batch[i].msg_hdr.msg_iovlen = 1;
+    _engine->batch[i].msg_hdr.msg_name = &_engine->batchAddresses[i];
+  }
+}
+
+QubiEventLoop::~QubiEventLoop() {
+  for (size_t fd = 0; fd < _sockets.size(); fd++) {
+    if (_sockets[fd].open) ::close((int)fd);
+  }
+
+  // Closing the ring cancels whatever is still in flight
+  Engine& engine = *_engine;
+  if (engine.ring >= 0) ::close(engine.ring);
+  if (engine.sqes) munmap(engine.sqes, engine.sqesSize);
+  if (engine.cqMap && engine.cqMap != engine.sqMap) munmap(engine.cqMap, engine.cqMapSize);
+  if (engine.sqMap) munmap(engine.sqMap, engine.sqMapSize);
+  free(engine.bufferRing);
+  if (engine.epoll >= 0) ::close(engine.epoll);
+  delete[] engine.buffers;
+  delete _engine;
+}
+
+bool QubiEventLoop::setupRing() {
+  Engine& engine = *_engine;
+
+  // Multishot receives post many completions per submission
+  io_uring_params params = {};
+  params.flags = IORING_SETUP_CQSIZE;
+  params.cq_entries = QUBI_EVENT_LOOP_BUFFER_COUNT * 4;
+  engine.ring = ioUringSetup(QUBI_EVENT_LOOP_RING_ENTRIES, &params);
+  if (engine.ring < 0) return false;
+  if (!(params.features & IORING_FEAT_EXT_ARG) || !(params.features & IORING_FEAT_NODROP)) return false;
+
+  engine.sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  engine.cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  bool single = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single && engine.cqMapSize > engine.sqMapSize) engine.sqMapSize = engine.cqMapSize;
+
+  engine.sqMap = mmap(nullptr, engine.sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine.ring,
+                      IORING_OFF_SQ_RING);
+  if (engine.sqMap == MAP_FAILED) {
+    engine.sqMap = nullptr;
+    return false;
+  }
+  if (single) {
+    engine.cqMap = engine.sqMap;
+  } else {
+    engine.cqMap = mmap(nullptr, engine.cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine.ring,
+                        IORING_OFF_CQ_RING);
+    if (engine.cqMap == MAP_FAILED) {
+      engine.cqMap = nullptr;
+      return false;
+    }
+  }
+  engine.sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+  void* sqes = mmap(nullptr, engine.sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, engine.ring,
+                    IORING_OFF_SQES);
+  if (sqes == MAP_FAILED) return false;
+  engine.sqes = (io_uring_sqe*)sqes;
+
+  uint8_t* sq = (uint8_t*)engine.sqMap;
+  engine.sqHead = (unsigned*)(sq + params.sq_off.head);
+  engine.sqTail = (unsigned*)(sq + params.sq_off.tail);
+  engine.sqArray = (unsigned*)(sq + params.sq_off.array);
+  engine.sqMask = *(unsigned*)(sq + params.sq_off.ring_mask);
+  engine.sqEntries = params.sq_entries;
+  uint8_t* cq = (uint8_t*)engine.cqMap;
+  engine.cqHead = (unsigned*)(cq + params.cq_off.head);
+  engine.cqTail = (unsigned*)(cq + params.cq_off.tail);
+  engine.cqMask = *(unsigned*)(cq + params.cq_off.ring_mask);
+  engine.cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  // One buffer group shared by every socket; the ring must be page aligned
+  void* bufferRing = nullptr;
+  if (posix_memalign(&bufferRing, 4096, QUBI_EVENT_LOOP_BUFFER_COUNT * sizeof(io_uring_buf)) != 0) return false;
+  memset(bufferRing, 0, QUBI_EVENT_LOOP_BUFFER_COUNT * sizeof(io_uring_buf));
+  engine.bufferRing = (io_uring_buf*)bufferRing;
+
+  for (uint16_t id = 0; id < QUBI_EVENT_LOOP_BUFFER_COUNT; id++) {
+    io_uring_buf& buffer = engine.bufferRing[id];
+    buffer.addr = (uint64_t)(uintptr_t)(engine.buffers + (size_t)id * QUBI_EVENT_LOOP_BUFFER_SIZE);
+    buffer.len = QUBI_EVENT_LOOP_BUFFER_SIZE;
+    buffer.bid = id;
+  }
+  engine.bufferTail = QUBI_EVENT_LOOP_BUFFER_COUNT;
+  storeRelease(&((io_uring_buf_ring*)engine.bufferRing)->tail, engine.bufferTail);
+
+  io_uring_buf_reg registration = {};
+  registration.ring_addr = (uint64_t)(uintptr_t)engine.bufferRing;
+  registration.ring_entries = QUBI_EVENT_LOOP_BUFFER_COUNT;
+  registration.bgid = 0;
+  if (ioUringRegister(engine.ring, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) return false;
+
+  engine.receiveShape.msg_namelen = sizeof(sockaddr_in);
+  return true;
+}
+
+std::vector<io_uring_cqe> QubiEventLoop::takeCompletions() {
+  Engine& engine = *_engine;
+  std::vector<io_uring_cqe> completions;
+  unsigned head = *engine.cqHead;
+  unsigned tail = loadAcquire(engine.cqTail);
+  for (; head != tail; head++) {
+    completions.push_back(engine.cqes[head & engine.cqMask]);
+  }
+  storeRelease(engine.cqHead, head);
+  return completions;
+}
+
+int QubiEventLoop::probeReceive() {
+  // Multishot receive came in 6.0, one release after buffer rings. Receive
+  // one datagram on a scratch socket: a kernel without it fails with
+  // -EINVAL.
+  int fd = openUdp(htonl(INADDR_LOOPBACK), 0);
+  if (fd < 0) return -EBADF;
+  sockaddr_in self = {};
+  socklen_t length = sizeof(self);
+  getsockname(fd, (sockaddr*)&self, &length);
+  sendto(fd, "probe", 5, 0, (sockaddr*)&self, sizeof(self));
+
+  armReceive(fd);
+  submitRing(1, 1000);
+  int result = -ETIME;
+  bool armed = false;
+  for (const io_uring_cqe& cqe : takeCompletions()) {
+    if (cqe.user_data >> 56 != KIND_RECEIVE) continue;
+    result = cqe.res;
+    armed = cqe.flags & IORING_CQE_F_MORE;
+    if (cqe.flags & IORING_CQE_F_BUFFER) recycleBuffer(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+  }
+
+  if (armed) {
+    io_uring_sqe* cancel = nextSqe();
+    cancel->opcode = IORING_OP_ASYNC_CANCEL;
+    cancel->addr = tag(KIND_RECEIVE, 0, fd);
+    cancel->user_data = tag(KIND_CANCEL, 0, fd);
+    submitRing(2, 1000);
+    takeCompletions();
+  }
+  ::close(fd);
+  return result;
+}
+
+void QubiEventLoop::recycleBuffer(uint16_t id) {
+  Engine& engine = *_engine;
+  uint8_t* buffer = engine.buffers + (size_t)id * QUBI_EVENT_LOOP_BUFFER_SIZE;
+
+  io_uring_buf& slot = engine.bufferRing[engine.bufferTail & (QUBI_EVENT_LOOP_BUFFER_COUNT - 1)];
+  slot.addr = (uint64_t)(uintptr_t)buffer;
+  slot.len = QUBI_EVENT_LOOP_BUFFER_SIZE;
+  slot.bid = id;
+  engine.bufferTail++;
+  storeRelease(&((io_uring_buf_ring*)engine.bufferRing)->tail, engine.bufferTail);
+}
+
+io_uring_sqe* QubiEventLoop::nextSqe() {
+  Engine& engine = *_engine;
+  if (*engine.sqTail + engine.sqPending - loadAcquire(engine.sqHead) >= engine.sqEntries) submitRing(0, 0);
+
+  unsigned tail = *engine.sqTail + engine.sqPending;
+  unsigned index = tail & engine.sqMask;
+  io_uring_sqe* sqe = &engine.sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  engine.sqArray[index] = index;
+  engine.sqPending++;
+  return sqe;
+}
+
+void QubiEventLoop::armReceive(int socket) {
+  uint32_t generation = socket < (int)_sockets.size() ? _sockets[socket].generation : 0;
+  io_uring_sqe* sqe = nextSqe();
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->fd = socket;
+  sqe->addr = (uint64_t)(uintptr_t)&_engine->receiveShape;
+  sqe->len = 1;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = 0;
+  sqe->user_data = tag(KIND_RECEIVE, generation, socket);
+}
+
+void QubiEventLoop::submitRing(unsigned waitFor, int timeoutMs) {
+  Engine& engine = *_engine;
+  unsigned submit = engine.sqPending;
+  storeRelease(engine.sqTail, *engine.sqTail + submit);
+  engine.sqPending = 0;
+
+  unsigned flags = waitFor || timeoutMs == 0 ? IORING_ENTER_GETEVENTS : 0;
+  io_uring_getevents_arg arg = {};
+  __kernel_timespec timeout = {};
+  void* argument = nullptr;
+  size_t argumentSize = 0;
+  if (waitFor && timeoutMs >= 0) {
+    timeout.tv_sec = timeoutMs / 1000;
+    timeout.tv_nsec = (long long)(timeoutMs % 1000) * 1000000;
+    arg.ts = (uint64_t)(uintptr_t)&timeout;
+    flags |= IORING_ENTER_EXT_ARG;
+    argument = &arg;
+    argumentSize = sizeof(arg);
+  }
+  if (!submit && !flags) return;
+
+  _stats.syscalls++;
+  // -ETIME and -EINTR just end the wait; -EBUSY means completions must be
+  // reaped before more can be submitted, which run() does next
+  ioUringEnter(engine.ring, submit, waitFor, flags, argument, argumentSize);
+}
+
+bool QubiEventLoop::isCurrent(int socket, uint32_t generation) const {
+  return socket >= 0 && socket < (int)_sockets.size() && _sockets[socket].open &&
+         (_sockets[socket].generation & 0xFFFFFF) == generation;
+}
+
+size_t QubiEventLoop::reapRing() {
+  Engine& engine = *_engine;
+  size_t handled = 0;
+  unsigned head = *engine.cqHead;
+  unsigned tail = loadAcquire(engine.cqTail);
+
+  for (; head != tail; head++) {
+    io_uring_cqe cqe = engine.cqes[head & engine.cqMask];
+    uint64_t kind = cqe.user_data >> 56;
+    uint32_t generation = (cqe.user_data >> 32) & 0xFFFFFF;
+    int socket = (int)(uint32_t)cqe.user_data;
+
+    if (kind == KIND_SEND) {
+      if (cqe.res >= 0) {
+        _stats.sent++;
+      } else {
+        _stats.sendErrors++;
+      }
+      _freeSlots.push_back((uint32_t)cqe.user_data);
+      continue;
+    }
+    if (kind != KIND_RECEIVE) continue;
+
+    if (cqe.flags & IORING_CQE_F_BUFFER) {
+      uint16_t id = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+      uint8_t* buffer = engine.buffers + (size_t)id * QUBI_EVENT_LOOP_BUFFER_SIZE;
+      io_uring_recvmsg_out* out = (io_uring_recvmsg_out*)buffer;
+
+      if (cqe.res >= 0 && isCurrent(socket, generation)) {
+        if (out->flags & MSG_TRUNC) {
+          _stats.truncated++;
+        } else {
+          const sockaddr_in* from = (const sockaddr_in*)(out + 1);
+          const uint8_t* payload = (const uint8_t*)(out + 1) + engine.receiveShape.msg_namelen;
+          _stats.received++;
+          handled++;
+          _sockets[socket].handler(socket, payload, out->payloadlen, from->sin_addr.s_addr, ntohs(from->sin_port));
+        }
+      }
+
+      recycleBuffer(id);
+    } else if (cqe.res == -ENOBUFS) {
+      _stats.noBuffers++;
+    }
+
+    // A multishot receive stops after an error or when it ran out of
+    // buffers; datagrams wait in the socket until it is re-armed
+    if (!(cqe.flags & IORING_CQE_F_MORE) && isCurrent(socket, generation)) {
+      armReceive(socket);
+    }
+  }
+
+  storeRelease(engine.cqHead, head);
+  return handled;
+}
+
+int QubiEventLoop::open(uint16_t port, QubiDatagramHandler handler, uint32_t address) {
+  int fd = openUdp(address, port);
+  if (fd < 0) return -1;
+
+  if (fd >= (int)_sockets.size()) _sockets.resize(fd + 1);
+  Socket& socket = _sockets[fd];
+  socket.open = true;
+  socket.generation = ++_generation & 0xFFFFFF;
+  socket.handler = handler;
+
+  if (_backend == QubiEventBackend::IO_URING) {
+    armReceive(fd);
+  } else {
+    epoll_event event = {};
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    if (epoll_ctl(_engine->epoll, EPOLL_CTL_ADD, fd, &event) < 0) {
+      socket.open = false;
+      ::close(fd);
+      return -1;
+    }
+  }
+  return fd;
+}
+
+void QubiEventLoop::close(int socket) {
+  if (socket < 0 || socket >= (int)_sockets.size() || !_sockets[socket].open) return;
+
+  // Sends already queued for this socket go out first
+  flush();
+  Socket& entry = _sockets[socket];
+  entry.open = false;
+  // It may be the handler that is running
+  _retiredHandlers.push_back(std::move(entry.handler));
+  entry.handler = nullptr;
+
+  if (_backend == QubiEventBackend::IO_URING) {
+    io_uring_sqe* cancel = nextSqe();
+    cancel->opcode = IORING_OP_ASYNC_CANCEL;
+    cancel->addr = tag(KIND_RECEIVE, entry.generation, socket);
+    cancel->user_data = tag(KIND_CANCEL, entry.generation, socket);
+    submitRing(0, -1);
+  } else {
+    epoll_ctl(_engine->epoll, EPOLL_CTL_DEL, socket, nullptr);
+  }
+  ::close(socket);
+}
+
+uint16_t QubiEventLoop::localPort(int socket) const {
+  sockaddr_in local = {};
+  socklen_t length = sizeof(local);
+  if (getsockname(socket, (sockaddr*)&local, &length) < 0) return 0;
+  return ntohs(local.sin_port);
+}
+
+bool QubiEventLoop::send(int socket, const uint8_t* data, size_t len, uint32_t address, uint16_t port) {
+  if (socket < 0 || socket >= (int)_sockets.size() || !_sockets[socket].open) return false;
+  if (len > QUBI_EVENT_LOOP_MAX_DATAGRAM) return false;
+
+  uint32_t index;
+  if (_freeSlots.empty()) {
+    index = _sendSlots.size();
+    _sendSlots.emplace_back(new SendSlot());
+  } else {
+    index = _freeSlots.back();
+    _freeSlots.pop_back();
+  }
+
+  SendSlot& slot = *_sendSlots[index];
+  slot.socket = socket;
+  slot.data.assign(data, data + len);
+  slot.vector.iov_base = slot.data.data();
+  slot.vector.iov_len = len;
+  slot.address = sockaddr_in();
+  slot.address.sin_family = AF_INET;
+  slot.address.sin_port = htons(port);
+  slot.address.sin_addr.s_addr = address;
+  slot.message = mmsghdr();
+  slot.message.msg_hdr.msg_name = &slot.address;
+  slot.message.msg_hdr.msg_namelen = sizeof(slot.address);
+  slot.message.msg_hdr.msg_iov = &slot.vector;
+  slot.message.msg_hdr.msg_iovlen = 1;
+
+  if (_backend == QubiEventBackend::IO_URING) {
+    io_uring_sqe* sqe = nextSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = socket;
+    sqe->addr = (uint64_t)(uintptr_t)&slot.message.msg_hdr;
+    sqe->len = 1;
+    sqe->user_data = tag(KIND_SEND, 0, index);
+  } else {
+    _queuedSends.push_back(index);
+  }
+  return true;
+}
+
+void QubiEventLoop::flush() {
+  if (_backend == QubiEventBackend::IO_URING) {
+    if (_engine->sqPending) submitRing(0, -1);
+  } else {
+    flushEpoll();
+  }
+}
+
+size_t QubiEventLoop::run(int timeoutMs) {
+  if (_backend == QubiEventBackend::EPOLL) return runEpoll(timeoutMs);
+
+  Engine& engine = *_engine;
+  // One io_uring_enter() submits queued sends and re-arms, and waits if
+  // nothing has completed yet
+  bool ready = *engine.cqHead != loadAcquire(engine.cqTail);
+  submitRing(ready ? 0 : 1, ready ? 0 : timeoutMs);
+  size_t handled = reapRing();
+
+  // Replies go out now rather than with the next wait
+  if (engine.sqPending) submitRing(0, -1);
+  _retiredHandlers.clear();
+  return handled;
+}
+
+void QubiEventLoop::loop() {
+  _running = true;
+  while (_running) {
+    run(-1);
+  }
+}
+
+size_t QubiEventLoop::runEpoll(int timeoutMs) {
+  flushEpoll();
+
+  epoll_event events[64];
+  _stats.syscalls++;
+  int count = epoll_wait(_engine->epoll, events, 64, timeoutMs);
+
+  size_t handled = 0;
+  for (int i = 0; i < count; i++) {
+    handled += receiveEpoll(events[i].data.fd);
+  }
+  flushEpoll();
+  _retiredHandlers.clear();
+  return handled;
+}
+
+size_t QubiEventLoop::receiveEpoll(int socket) {
+  Engine& engine = *_engine;
+  size_t handled = 0;
+
+  // Level-triggered, so one batch per wakeup is enough for fairness
+  // between sockets; the rest is picked up by the next run()
+  for (unsigned i = 0; i < QUBI_EVENT_LOOP_EPOLL_BATCH; i++) {
+    engine.batch[i].msg_hdr.msg_namelen = sizeof(sockaddr_in);
+  }
+  _stats.syscalls++;
+  int count = recvmmsg(socket, engine.batch, QUBI_EVENT_LOOP_EPOLL_BATCH, MSG_DONTWAIT, nullptr);
+  if (count <= 0) return 0;
+
+  uint32_t generation = _sockets[socket].generation;
+  for (int i = 0; i < count && isCurrent(socket, generation); i++) {
+    const msghdr& header = engine.batch[i].msg_hdr;
+    if (header.msg_flags & MSG_TRUNC) {
+      _stats.truncated++;
+      continue;
+    }
+    _stats.received++;
+    handled++;
+    _sockets[socket].handler(socket, (const uint8_t*)engine.batchVectors[i].iov_base, engine.batch[i].msg_len,
+            engine.batchAddresses[i].sin_addr.s_addr, ntohs(engine.batchAddresses[i].sin_port));
+  }
+  return handled;
+}
+
+void QubiEventLoop::flushEpoll() {
+  mmsghdr batch[QUBI_EVENT_LOOP_EPOLL_BATCH];
+  size_t next = 0;
+  while (next < _queuedSends.size()) {
+    // sendmmsg() takes one socket, so send runs of datagrams for the same one
+    int socket = _sendSlots[_queuedSends[next]]->socket;
+    unsigned count = 0;
+    while (next + count < _queuedSends.size() && count < QUBI_EVENT_LOOP_EPOLL_BATCH &&
+           _sendSlots[_queuedSends[next + count]]->socket == socket) {
+      batch[count] = _sendSlots[_queuedSends[next + count]]->message;
+      count++;
+    }
+
+    _stats.syscalls++;
+    int sent = sendmmsg(socket, batch, count, MSG_DONTWAIT);
+    if (sent <= 0) {
+      // The first one failed; carry on with the rest
+      _stats.sendErrors++;
+      sent = 1;
+    } else {
+      _stats.sent += sent;
+    }
+    next += sent;
+  }
+
+  _freeSlots.insert(_freeSlots.end(), _queuedSends.begin(), _queuedSends.end());
+  _queuedSends.clear();
+}
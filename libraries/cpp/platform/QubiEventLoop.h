@@ -0,0 +1,123 @@
+#ifndef QUBI_EVENT_LOOP_H
+#define QUBI_EVENT_LOOP_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <vector>
+
+// Event loop for host components that serve many UDP sockets at high packet
+// rates, such as gateways and module simulators. Unlike WiFiUDP it does not
+// poll: handlers are called with each datagram as it is reaped.
+//
+// The io_uring backend keeps one multishot receive armed per socket, with
+// the kernel picking buffers from a shared provided-buffer ring, and sends
+// through batched SENDMSG entries. Submitting and waiting is one
+// io_uring_enter() per run(), so a busy loop makes a small fraction of a
+// syscall per datagram. Where multishot receive is missing (before 6.0) or
+// io_uring is disabled (kernel.io_uring_disabled, seccomp), it falls back to
+// epoll with recvmmsg()/sendmmsg().
+//
+// Real sockets only: QubiSimNetwork and the impairment emulator are not
+// involved.
+#define QUBI_EVENT_LOOP_BUFFER_SIZE 2048   // Per received datagram, including 32 bytes of header
+#define QUBI_EVENT_LOOP_BUFFER_COUNT 1024  // Receive buffers, a power of two
+
+enum class QubiEventBackend : uint8_t {
+  IO_URING,
+  EPOLL
+};
+
+struct QubiEventLoopStats {
+  uint64_t received;
+  uint64_t sent;
+  uint64_t sendErrors;
+  uint64_t truncated;   // Larger than a receive buffer; dropped
+  uint64_t noBuffers;   // Times every receive buffer was in use
+  uint64_t syscalls;    // io_uring_enter(), or epoll_wait(), recvmmsg() and sendmmsg()
+};
+
+// Source address and port are in network and host byte order respectively,
+// as in WiFiUDP. The data is only valid during the call.
+typedef std::function<void(int socket, const uint8_t* data, size_t len, uint32_t address, uint16_t port)>
+  QubiDatagramHandler;
+
+class QubiEventLoop {
+private:
+  struct Engine;    // Backend state, kept out of this header
+  struct SendSlot;  // A datagram and its message header, fixed in memory while in flight
+  struct Socket {
+    bool open;
+    uint32_t generation;  // Tells completions for a reused descriptor apart
+    QubiDatagramHandler handler;
+  };
+
+  QubiEventBackend _backend;
+  Engine* _engine;
+  // Indexed by descriptor. A deque, so that opening a socket from a handler
+  // doesn't move the running handler.
+  std::deque<Socket> _sockets;
+  uint32_t _generation;
+  // Handlers of sockets closed during run(), kept until it returns
+  std::vector<QubiDatagramHandler> _retiredHandlers;
+
+  // Grows to the most sends ever in flight at once
+  std::vector<std::unique_ptr<SendSlot>> _sendSlots;
+  std::vector<uint32_t> _freeSlots;
+  std::vector<uint32_t> _queuedSends;  // epoll: waiting for sendmmsg()
+
+  QubiEventLoopStats _stats;
+  std::atomic<bool> _running;
+
+  bool setupRing();
+  int probeReceive();
+  void recycleBuffer(uint16_t id);
+  std::vector<struct io_uring_cqe> takeCompletions();
+  void armReceive(int socket);
+  struct io_uring_sqe* nextSqe();
+  void submitRing(unsigned waitFor, int timeoutMs);
+  size_t reapRing();
+  size_t runEpoll(int timeoutMs);
+  size_t receiveEpoll(int socket);
+  void flushEpoll();
+  bool isCurrent(int socket, uint32_t generation) const;
+
+public:
+  explicit QubiEventLoop(QubiEventBackend preferred = QubiEventBackend::IO_URING);
+  ~QubiEventLoop();
+  QubiEventLoop(const QubiEventLoop&) = delete;
+  QubiEventLoop& operator=(const QubiEventLoop&) = delete;
+
+  // The backend actually in use, after any fallback
+  QubiEventBackend backend() const { return _backend; }
+
+  // Opens a non-blocking UDP socket on address:port (0 = any free port) and
+  // calls the handler for every datagram it receives. Returns the socket's
+  // descriptor, or -1.
+  int open(uint16_t port, QubiDatagramHandler handler, uint32_t address = 0);
+  void close(int socket);
+  uint16_t localPort(int socket) const;
+
+  // Queues a datagram; it is submitted with the next run() or flush(). False
+  // if the socket is not open or the datagram is too big.
+  bool send(int socket, const uint8_t* data, size_t len, uint32_t address, uint16_t port);
+  void flush();
+
+  // Waits up to timeoutMs (0 = don't wait, -1 = forever) for traffic, calls
+  // handlers for everything that has arrived and submits the sends they
+  // queued. Handlers may send, open and close sockets, but not call run().
+  // Returns the number of datagrams handled.
+  size_t run(int timeoutMs);
+  // Calls run() until stop(), e.g. from a handler or signal handler
+  void loop();
+  void stop() { _running = false; }
+
+  const QubiEventLoopStats& getStats() const { return _stats; }
+};
+
+const char* qubiEventBackendName(QubiEventBackend backend);
+
+#endif // QUBI_EVENT_LOOP_H
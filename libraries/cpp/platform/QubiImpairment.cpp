@@ -0,0 +1,143 @@
+#include "QubiImpairment.h"
+
+#include <cmath>
+
+uint64_t QubiRandom::next() {
+  uint64_t z = (_state += 0x9E3779B97F4A7C15ULL);
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+double QubiRandom::uniform() {
+  return (next() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+double QubiRandom::normal() {
+  double u1 = uniform();
+  double u2 = uniform();
+  if (u1 < 1e-300) u1 = 1e-300;
+  return std::sqrt(-2.0 * std::log(u1)) * std::cos(2.0 * M_PI * u2);
+}
+
+QubiImpairment::QubiImpairment(const QubiImpairmentConfig& config)
+  : _config(config), _random(config.seed), _geBad(false), _linkFreeUs(0), _order(0) {}
+
+void QubiImpairment::configure(const QubiImpairmentConfig& config) {
+  _config = config;
+  _random.seed(config.seed);
+  _geBad = false;
+}
+
+void QubiImpairment::reset() {
+  _queue = decltype(_queue)();
+  _stats = QubiImpairmentStats();
+  _random.seed(_config.seed);
+  _geBad = false;
+  _linkFreeUs = 0;
+  _order = 0;
+}
+
+bool QubiImpairment::enabled() const {
+  return _config.lossModel != QubiLossModel::NONE || _config.latencyUs > 0 ||
+         _config.jitter != QubiJitterDistribution::NONE || _config.reorderRate > 0.0f ||
+         _config.duplicateRate > 0.0f || _config.bandwidthBps > 0;
+}
+
+bool QubiImpairment::shouldDrop() {
+  switch (_config.lossModel) {
+    case QubiLossModel::BERNOULLI:
+      return _random.chance(_config.lossRate);
+    case QubiLossModel::GILBERT_ELLIOTT: {
+      // Transition first, then draw the loss for the state we end up in
+      if (_geBad) {
+        if (_random.chance(_config.geBadToGood)) _geBad = false;
+      } else {
+        if (_random.chance(_config.geGoodToBad)) _geBad = true;
+      }
+      return _random.chance(_geBad ? _config.geLossBad : _config.geLossGood);
+    }
+    default:
+      return false;
+  }
+}
+
+uint64_t QubiImpairment::sampleDelay() {
+  double delay = _config.latencyUs;
+  double jitter = _config.jitterUs;
+
+  switch (_config.jitter) {
+    case QubiJitterDistribution::UNIFORM:
+      delay += (_random.uniform() * 2.0 - 1.0) * jitter;
+      break;
+    case QubiJitterDistribution::NORMAL:
+      delay += _random.normal() * jitter;
+      break;
+    case QubiJitterDistribution::PARETO: {
+      // Shifted Pareto: mostly small, occasionally very large (WiFi retries)
+      double u = 1.0 - _random.uniform();
+      delay += jitter * (std::pow(u, -1.0 / _config.paretoShape) - 1.0);
+      break;
+    }
+    default:
+      break;
+  }
+
+  return delay > 0.0 ? (uint64_t)delay : 0;
+}
+
+void QubiImpairment::schedule(const uint8_t* data, size_t len, uint32_t address, uint16_t port, uint64_t releaseUs) {
+  QubiImpairedPacket packet;
+  packet.data.assign(data, data + len);
+  packet.address = address;
+  packet.port = port;
+  packet.releaseUs = releaseUs;
+  packet.order = _order++;
+  _queue.push(std::move(packet));
+}
+
+void QubiImpairment::submit(const uint8_t* data, size_t len, uint32_t address, uint16_t port, uint64_t nowUs) {
+  _stats.submitted++;
+
+  if (shouldDrop()) {
+    _stats.lost++;
+    return;
+  }
+
+  // Serialize onto the capped link; the packet leaves once the link is free
+  uint64_t departUs = nowUs;
+  if (_config.bandwidthBps > 0) {
+    uint64_t startUs = _linkFreeUs > nowUs ? _linkFreeUs : nowUs;
+    if (startUs - nowUs > _config.maxQueueDelayUs) {
+      _stats.queueDrops++;
+      return;
+    }
+    departUs = startUs + (uint64_t)len * 8 * 1000000 / _config.bandwidthBps;
+    _linkFreeUs = departUs;
+  }
+
+  uint64_t releaseUs = departUs + sampleDelay();
+  if (_random.chance(_config.reorderRate)) {
+    releaseUs += _config.reorderDelayUs;
+    _stats.reordered++;
+  }
+  schedule(data, len, address, port, releaseUs);
+
+  if (_random.chance(_config.duplicateRate)) {
+    _stats.duplicated++;
+    schedule(data, len, address, port, departUs + sampleDelay());
+  }
+}
+
+bool QubiImpairment::poll(uint64_t nowUs, QubiImpairedPacket& packet) {
+  if (_queue.empty() || _queue.top().releaseUs > nowUs) return false;
+
+  packet = _queue.top();
+  _queue.pop();
+  _stats.delivered++;
+  return true;
+}
+
+uint64_t QubiImpairment::nextReleaseUs() const {
+  return _queue.empty() ? UINT64_MAX : _queue.top().releaseUs;
+}
@@ -0,0 +1,133 @@
+#ifndef QUBI_IMPAIRMENT_H
+#define QUBI_IMPAIRMENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+// Network impairment layer for the host UDP backend. Emulates what a real
+// WiFi link does to datagrams (loss, delay, jitter, reordering, duplication
+// and a bandwidth cap) so retry, dedup and jitter-buffer behavior can be
+// exercised over loopback. All randomness comes from a seeded generator, so
+// a given seed and packet sequence always produce the same impairments.
+
+enum class QubiLossModel {
+  NONE,
+  BERNOULLI,        // Independent drops with probability lossRate
+  GILBERT_ELLIOTT   // Two-state bursty channel
+};
+
+enum class QubiJitterDistribution {
+  NONE,
+  UNIFORM,   // latencyUs +/- jitterUs
+  NORMAL,    // latencyUs + N(0, jitterUs), clamped at zero
+  PARETO     // latencyUs + heavy-tailed extra delay with scale jitterUs
+};
+
+struct QubiImpairmentConfig {
+  QubiLossModel lossModel = QubiLossModel::NONE;
+  float lossRate = 0.0f;
+
+  // Gilbert-Elliott: transition probabilities per packet and the loss
+  // probability while in each state
+  float geGoodToBad = 0.0f;
+  float geBadToGood = 1.0f;
+  float geLossGood = 0.0f;
+  float geLossBad = 1.0f;
+
+  uint32_t latencyUs = 0;
+  uint32_t jitterUs = 0;
+  QubiJitterDistribution jitter = QubiJitterDistribution::NONE;
+  float paretoShape = 2.5f;
+
+  // A reordered packet is held back by reorderDelayUs so later ones overtake it
+  float reorderRate = 0.0f;
+  uint32_t reorderDelayUs = 0;
+
+  float duplicateRate = 0.0f;
+
+  // Bandwidth cap in bits per second (0 = unlimited). Packets that would wait
+  // longer than maxQueueDelayUs for the link are tail-dropped.
+  uint32_t bandwidthBps = 0;
+  uint32_t maxQueueDelayUs = 100000;
+
+  uint64_t seed = 1;
+};
+
+struct QubiImpairmentStats {
+  uint32_t submitted = 0;
+  uint32_t delivered = 0;
+  uint32_t lost = 0;
+  uint32_t queueDrops = 0;
+  uint32_t duplicated = 0;
+  uint32_t reordered = 0;
+};
+
+struct QubiImpairedPacket {
+  std::vector<uint8_t> data;
+  uint32_t address;   // Peer IPv4 address, network byte order
+  uint16_t port;
+  uint64_t releaseUs;
+  uint64_t order;
+};
+
+// SplitMix64. Used instead of <random> engines and distributions, whose
+// output is not specified identically across standard libraries.
+class QubiRandom {
+private:
+  uint64_t _state;
+
+public:
+  explicit QubiRandom(uint64_t seed = 1) : _state(seed) {}
+  void seed(uint64_t seed) { _state = seed; }
+  uint64_t next();
+  double uniform();                   // [0, 1)
+  bool chance(float probability) { return probability > 0.0f && uniform() < probability; }
+  double normal();                    // Standard normal (Box-Muller)
+};
+
+class QubiImpairment {
+private:
+  struct ReleaseOrder {
+    bool operator()(const QubiImpairedPacket& a, const QubiImpairedPacket& b) const {
+      return a.releaseUs != b.releaseUs ? a.releaseUs > b.releaseUs : a.order > b.order;
+    }
+  };
+
+  QubiImpairmentConfig _config;
+  QubiRandom _random;
+  QubiImpairmentStats _stats;
+  std::priority_queue<QubiImpairedPacket, std::vector<QubiImpairedPacket>, ReleaseOrder> _queue;
+  bool _geBad;
+  uint64_t _linkFreeUs;
+  uint64_t _order;
+
+  bool shouldDrop();
+  uint64_t sampleDelay();
+  void schedule(const uint8_t* data, size_t len, uint32_t address, uint16_t port, uint64_t releaseUs);
+
+public:
+  explicit QubiImpairment(const QubiImpairmentConfig& config = QubiImpairmentConfig());
+
+  // Replaces the configuration and reseeds; packets already in flight keep
+  // their release times.
+  void configure(const QubiImpairmentConfig& config);
+  void reset();
+
+  // Offers a datagram to the emulated link at time nowUs
+  void submit(const uint8_t* data, size_t len, uint32_t address, uint16_t port, uint64_t nowUs);
+
+  // Pops the next packet whose release time is <= nowUs
+  bool poll(uint64_t nowUs, QubiImpairedPacket& packet);
+
+  // Release time of the earliest queued packet, or UINT64_MAX if none
+  uint64_t nextReleaseUs() const;
+  size_t pending() const { return _queue.size(); }
+
+  bool enabled() const;
+  const QubiImpairmentConfig& config() const { return _config; }
+  const QubiImpairmentStats& stats() const { return _stats; }
+};
+
+#endif // QUBI_IMPAIRMENT_H
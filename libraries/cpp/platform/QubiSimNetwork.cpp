@@ -0,0 +1,91 @@
+#include "QubiSimNetwork.h"
+
+static QubiSimNetwork* activeNetwork = nullptr;
+
+QubiSimNetwork::QubiSimNetwork(uint32_t hostAddress)
+  : _hostAddress(hostAddress), _nextEphemeralPort(49152), _queueLimit(64),
+    _delivered(0), _unroutable(0), _overflows(0) {
+  activeNetwork = this;
+}
+
+QubiSimNetwork::~QubiSimNetwork() {
+  if (activeNetwork == this) activeNetwork = nullptr;
+}
+
+QubiSimNetwork* QubiSimNetwork::active() {
+  return activeNetwork;
+}
+
+QubiSimNetwork::Endpoint* QubiSimNetwork::find(const WiFiUDP* socket) {
+  for (Endpoint& endpoint : _endpoints) {
+    if (endpoint.socket == socket) return &endpoint;
+  }
+  return nullptr;
+}
+
+bool QubiSimNetwork::isBroadcast(uint32_t address) {
+  // 255.255.255.255 or 224.0.0.0/4, in network byte order
+  const uint8_t* octets = reinterpret_cast<const uint8_t*>(&address);
+  return address == 0xFFFFFFFF || (octets[0] & 0xF0) == 0xE0;
+}
+
+bool QubiSimNetwork::bind(WiFiUDP* socket, uint32_t address, uint16_t& port) {
+  unbind(socket);
+
+  if (port == 0) {
+    port = _nextEphemeralPort++;
+    if (_nextEphemeralPort == 0) _nextEphemeralPort = 49152;
+  }
+  for (const Endpoint& endpoint : _endpoints) {
+    if (endpoint.port == port && endpoint.address == address) return false;
+  }
+
+  _endpoints.push_back(Endpoint{socket, address, port, {}});
+  return true;
+}
+
+void QubiSimNetwork::unbind(WiFiUDP* socket) {
+  for (size_t i = 0; i < _endpoints.size(); i++) {
+    if (_endpoints[i].socket == socket) {
+      _endpoints.erase(_endpoints.begin() + i);
+      return;
+    }
+  }
+}
+
+bool QubiSimNetwork::send(const WiFiUDP* from, const uint8_t* data, size_t len, uint32_t address, uint16_t port) {
+  Endpoint* source = find(from);
+  if (!source) return false;
+
+  QubiSimDatagram datagram;
+  datagram.data.assign(data, data + len);
+  datagram.address = source->address ? source->address : _hostAddress;
+  datagram.port = source->port;
+
+  bool broadcast = isBroadcast(address);
+  bool routed = false;
+  for (Endpoint& endpoint : _endpoints) {
+    if (endpoint.port != port) continue;
+    if (!broadcast && endpoint.address != 0 && endpoint.address != address) continue;
+
+    routed = true;
+    if (endpoint.queue.size() >= _queueLimit) {
+      _overflows++;
+      continue;
+    }
+    endpoint.queue.push_back(datagram);
+    _delivered++;
+  }
+
+  if (!routed) _unroutable++;
+  return true;
+}
+
+bool QubiSimNetwork::receive(WiFiUDP* socket, QubiSimDatagram& datagram) {
+  Endpoint* endpoint = find(socket);
+  if (!endpoint || endpoint->queue.empty()) return false;
+
+  datagram = std::move(endpoint->queue.front());
+  endpoint->queue.pop_front();
+  return true;
+}
@@ -0,0 +1,65 @@
+#ifndef QUBI_SIM_NETWORK_H
+#define QUBI_SIM_NETWORK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+class WiFiUDP;
+
+struct QubiSimDatagram {
+  std::vector<uint8_t> data;
+  uint32_t address;   // Source IPv4 address, network byte order
+  uint16_t port;
+};
+
+// In-memory datagram network for virtual-time tests. While one exists, host
+// WiFiUDP sockets opened with begin() attach to it instead of the kernel, so
+// delivery involves no real I/O and ordering is fully deterministic. Delay and
+// loss come from each socket's impairment settings, which read the installed
+// QubiClock.
+class QubiSimNetwork {
+private:
+  struct Endpoint {
+    WiFiUDP* socket;
+    uint32_t address;
+    uint16_t port;
+    std::deque<QubiSimDatagram> queue;
+  };
+
+  std::vector<Endpoint> _endpoints;
+  uint32_t _hostAddress;
+  uint16_t _nextEphemeralPort;
+  size_t _queueLimit;
+  uint64_t _delivered;
+  uint64_t _unroutable;
+  uint64_t _overflows;
+
+  Endpoint* find(const WiFiUDP* socket);
+  static bool isBroadcast(uint32_t address);
+
+public:
+  // hostAddress is the source address for sockets bound to 0.0.0.0
+  explicit QubiSimNetwork(uint32_t hostAddress = 0x0100007F);
+  ~QubiSimNetwork();
+  QubiSimNetwork(const QubiSimNetwork&) = delete;
+  QubiSimNetwork& operator=(const QubiSimNetwork&) = delete;
+
+  static QubiSimNetwork* active();
+
+  // Used by WiFiUDP
+  bool bind(WiFiUDP* socket, uint32_t address, uint16_t& port);
+  void unbind(WiFiUDP* socket);
+  bool send(const WiFiUDP* from, const uint8_t* data, size_t len, uint32_t address, uint16_t port);
+  bool receive(WiFiUDP* socket, QubiSimDatagram& datagram);
+
+  // Per-socket receive queue depth before datagrams are dropped
+  void setQueueLimit(size_t datagrams) { _queueLimit = datagrams; }
+
+  uint64_t delivered() const { return _delivered; }
+  uint64_t unroutable() const { return _unroutable; }
+  uint64_t overflows() const { return _overflows; }
+};
+
+#endif // QUBI_SIM_NETWORK_H
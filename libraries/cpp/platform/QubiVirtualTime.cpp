@@ -0,0 +1,74 @@
+#include "QubiVirtualTime.h"
+
+QubiVirtualClock::QubiVirtualClock(uint64_t startUs)
+  : _nowUs(startUs), _order(0), _nextId(1), _dispatching(false), _eventsRun(0) {}
+
+QubiVirtualClock::EventId QubiVirtualClock::push(uint64_t atUs, uint64_t periodUs, std::function<void()> callback) {
+  EventId id = _nextId++;
+  _events.push(Event{atUs < _nowUs ? _nowUs : atUs, _order++, id, periodUs, std::move(callback)});
+  _live.insert(id);
+  return id;
+}
+
+QubiVirtualClock::EventId QubiVirtualClock::at(uint64_t atUs, std::function<void()> callback) {
+  return push(atUs, 0, std::move(callback));
+}
+
+QubiVirtualClock::EventId QubiVirtualClock::after(uint64_t delayUs, std::function<void()> callback) {
+  return push(_nowUs + delayUs, 0, std::move(callback));
+}
+
+QubiVirtualClock::EventId QubiVirtualClock::every(uint64_t periodUs, std::function<void()> callback, uint64_t firstUs) {
+  if (periodUs == 0) periodUs = 1;
+  return push(_nowUs + firstUs, periodUs, std::move(callback));
+}
+
+void QubiVirtualClock::cancel(EventId id) {
+  _live.erase(id);
+}
+
+bool QubiVirtualClock::step() {
+  while (!_events.empty()) {
+    Event event = _events.top();
+    _events.pop();
+    if (!_live.count(event.id)) continue;
+
+    // A delay() inside an earlier event may already have pushed time past
+    // this event; it then runs late rather than moving time backwards
+    if (event.atUs > _nowUs) _nowUs = event.atUs;
+
+    if (event.periodUs > 0) {
+      _events.push(Event{event.atUs + event.periodUs, _order++, event.id, event.periodUs, event.callback});
+    } else {
+      _live.erase(event.id);
+    }
+
+    _dispatching = true;
+    event.callback();
+    _dispatching = false;
+    _eventsRun++;
+    return true;
+  }
+  return false;
+}
+
+void QubiVirtualClock::runUntil(uint64_t untilUs) {
+  while (!_events.empty()) {
+    // Discard cancelled events so they cannot stall the horizon check
+    if (!_live.count(_events.top().id)) {
+      _events.pop();
+      continue;
+    }
+    if (_events.top().atUs > untilUs) break;
+    step();
+  }
+  if (untilUs > _nowUs) _nowUs = untilUs;
+}
+
+void QubiVirtualClock::sleepUs(uint64_t us) {
+  if (_dispatching) {
+    _nowUs += us;
+    return;
+  }
+  runUntil(_nowUs + us);
+}
@@ -0,0 +1,77 @@
+#ifndef QUBI_VIRTUAL_TIME_H
+#define QUBI_VIRTUAL_TIME_H
+
+#include "QubiClock.h"
+
+#include <functional>
+#include <queue>
+#include <unordered_set>
+#include <vector>
+
+// Discrete-event clock. Time only moves when the scheduler advances it, so
+// minutes of module behavior (loop ticks, timers, packet arrivals) run in
+// milliseconds of CPU and the same schedule always gives the same result.
+//
+//   QubiVirtualClock clock;
+//   QubiVirtualClockScope scope(clock);
+//   clock.every(10000, [&] { module.processMessages(); });   // 10ms loop
+//   clock.runFor(10ull * 60 * 1000000);                      // 10 minutes
+class QubiVirtualClock : public QubiClock {
+public:
+  typedef uint32_t EventId;
+
+private:
+  struct Event {
+    uint64_t atUs;
+    uint64_t order;
+    EventId id;
+    uint64_t periodUs;
+    std::function<void()> callback;
+  };
+  struct EventOrder {
+    bool operator()(const Event& a, const Event& b) const {
+      return a.atUs != b.atUs ? a.atUs > b.atUs : a.order > b.order;
+    }
+  };
+
+  uint64_t _nowUs;
+  uint64_t _order;
+  EventId _nextId;
+  bool _dispatching;
+  uint64_t _eventsRun;
+  std::priority_queue<Event, std::vector<Event>, EventOrder> _events;
+  std::unordered_set<EventId> _live;
+
+  EventId push(uint64_t atUs, uint64_t periodUs, std::function<void()> callback);
+
+public:
+  explicit QubiVirtualClock(uint64_t startUs = 0);
+
+  uint64_t nowUs() override { return _nowUs; }
+
+  // delay() from module code. Outside an event this advances time and runs
+  // anything that falls due; inside an event it only moves time forward.
+  void sleepUs(uint64_t us) override;
+
+  EventId at(uint64_t atUs, std::function<void()> callback);
+  EventId after(uint64_t delayUs, std::function<void()> callback);
+  EventId every(uint64_t periodUs, std::function<void()> callback, uint64_t firstUs = 0);
+  void cancel(EventId id);
+
+  // Runs the next event, advancing time to it. Returns false when idle.
+  bool step();
+  void runUntil(uint64_t untilUs);
+  void runFor(uint64_t durationUs) { runUntil(_nowUs + durationUs); }
+
+  size_t pendingEvents() const { return _live.size(); }
+  uint64_t eventsRun() const { return _eventsRun; }
+};
+
+// Installs a clock for the lifetime of the scope
+class QubiVirtualClockScope {
+public:
+  explicit QubiVirtualClockScope(QubiClock& clock) { qubiSetClock(&clock); }
+  ~QubiVirtualClockScope() { qubiSetClock(nullptr); }
+};
+
+#endif // QUBI_VIRTUAL_TIME_H
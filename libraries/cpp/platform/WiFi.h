@@ -0,0 +1,123 @@
+#ifndef QUBI_HOST_WIFI_H
+#define QUBI_HOST_WIFI_H
+
+#include "Arduino.h"
+
+typedef enum {
+  WL_IDLE_STATUS = 0,
+  WL_NO_SSID_AVAIL = 1,
+  WL_SCAN_COMPLETED = 2,
+  WL_CONNECTED = 3,
+  WL_CONNECT_FAILED = 4,
+  WL_CONNECTION_LOST = 5,
+  WL_DISCONNECTED = 6
+} wl_status_t;
+
+// Same values as the ESP32 core: power save mode and TX power in 0.25 dBm
+typedef enum {
+  WIFI_PS_NONE = 0,
+  WIFI_PS_MIN_MODEM = 1,
+  WIFI_PS_MAX_MODEM = 2
+} wifi_ps_type_t;
+
+typedef enum {
+  WIFI_POWER_19_5dBm = 78,
+  WIFI_POWER_19dBm = 76,
+  WIFI_POWER_18_5dBm = 74,
+  WIFI_POWER_17dBm = 68,
+  WIFI_POWER_15dBm = 60,
+  WIFI_POWER_13dBm = 52,
+  WIFI_POWER_11dBm = 44,
+  WIFI_POWER_8_5dBm = 34,
+  WIFI_POWER_7dBm = 28,
+  WIFI_POWER_5dBm = 20,
+  WIFI_POWER_2dBm = 8,
+  WIFI_POWER_MINUS_1dBm = -4
+} wifi_power_t;
+
+// The host is always "associated"; the link state can be forced from tests
+// to exercise reconnect handling. Connecting is instant unless connect times
+// are set, in which case begin() completes after them on the active clock.
+class HostWiFiClass {
+private:
+  wl_status_t _status;
+  IPAddress _localIP;
+  IPAddress _gateway;
+  IPAddress _subnet;
+  IPAddress _dns;
+  IPAddress _leaseIP;      // What DHCP hands out
+  bool _staticIP;
+  wifi_ps_type_t _sleep;
+  wifi_power_t _txPower;
+  
+  // Emulated access point and how long each connect step takes
+  int32_t _apChannel;
+  uint8_t _apBssid[6];
+  unsigned long _scanMs;
+  unsigned long _associateMs;
+  unsigned long _dhcpMs;
+  bool _connecting;
+  unsigned long _connectAt;
+  bool _dhcpPending;       // The current connect or renewal ends with a lease
+  bool _renewing;          // DHCP started on a live link; the lease is due at _connectAt
+  
+  // Bumped each time the link goes down; see setDropClosesSockets()
+  uint32_t _linkGeneration;
+  unsigned long _linkDownAt;
+  bool _dropClosesSockets;
+  
+  void setLinkDown(wl_status_t status);
+  void startLease();
+
+public:
+  HostWiFiClass();
+
+  // As on the ESP32: a channel and BSSID skip the scan, and only reach an
+  // access point that matches both
+  wl_status_t begin(const char* ssid, const char* passphrase = nullptr, int32_t channel = 0,
+                    const uint8_t* bssid = nullptr, bool connect = true);
+  // A zero local address goes back to DHCP. On a live link the address is
+  // cleared, as on the ESP32, and the lease arrives after the DHCP time.
+  bool config(IPAddress local, IPAddress gateway, IPAddress subnet, IPAddress dns1 = IPAddress(),
+              IPAddress dns2 = IPAddress());
+  bool disconnect(bool wifiOff = false);
+  wl_status_t status();
+  IPAddress localIP() const { return _localIP; }
+  IPAddress gatewayIP() const { return _gateway; }
+  IPAddress subnetMask() const { return _subnet; }
+  IPAddress dnsIP(uint8_t index = 0) const { return index == 0 ? _dns : IPAddress(); }
+  int32_t channel() const { return _apChannel; }
+  const uint8_t* BSSID() const { return _apBssid; }
+  
+  // Radio settings are only recorded; the host link does not change
+  bool setSleep(bool enabled) { return setSleep(enabled ? WIFI_PS_MIN_MODEM : WIFI_PS_NONE); }
+  bool setSleep(wifi_ps_type_t type) { _sleep = type; return true; }
+  wifi_ps_type_t getSleep() const { return _sleep; }
+  bool setTxPower(wifi_power_t power) { _txPower = power; return true; }
+  wifi_power_t getTxPower() const { return _txPower; }
+
+  // Stands in for starting lwIP's DHCP client directly on the ESP32: a link
+  // on a static address keeps it until the lease replaces it
+  void startLeaseKeepingAddress();
+
+  // Host-only controls
+  void setStatus(wl_status_t status);
+  // Sets the current address and the one DHCP hands out
+  void setLocalIP(const IPAddress& address) { _localIP = _leaseIP = address; }
+  // Only the address the next DHCP lease gets, e.g. after the server gave
+  // the old one away
+  void setLeaseIP(const IPAddress& address) { _leaseIP = address; }
+  void setAccessPoint(int32_t channel, const uint8_t bssid[6]);
+  void setConnectTimes(unsigned long scanMs, unsigned long associateMs, unsigned long dhcpMs);
+  // No datagrams move while the link is down. With this set, sockets opened
+  // before a drop also stay dead after it, as they can on the ESP32, until
+  // they are reopened with begin().
+  void setDropClosesSockets(bool closes) { _dropClosesSockets = closes; }
+  bool dropClosesSockets() const { return _dropClosesSockets; }
+  uint32_t linkGeneration() const { return _linkGeneration; }
+  unsigned long linkDownAt() const { return _linkDownAt; }
+};
+
+extern HostWiFiClass WiFi;
+
+#endif // QUBI_HOST_WIFI_H
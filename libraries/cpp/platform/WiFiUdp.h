@@ -0,0 +1,141 @@
+#ifndef QUBI_HOST_WIFIUDP_H
+#define QUBI_HOST_WIFIUDP_H
+
+#include "Arduino.h"
+#include "QubiImpairment.h"
+
+#define QUBI_HOST_UDP_MAX_PACKET 65507
+#define QUBI_HOST_UDP_DEFAULT_PACKET 1460  // The ESP32 core's WiFiUDP buffers
+#define QUBI_HOST_UDP_BATCH 32  // Datagrams per recvmmsg()/sendmmsg() call
+
+class QubiSimNetwork;
+struct QubiUdpBatch;
+
+struct QubiUdpIoStats {
+  uint32_t rxPackets;
+  uint32_t rxCalls;     // recvmmsg() calls that returned datagrams
+  uint32_t txPackets;
+  uint32_t txCalls;     // sendto() or sendmmsg() calls
+  uint32_t txDropped;   // Batched sends the kernel refused
+  uint32_t rxTruncated; // Datagrams longer than the socket's datagram size, dropped
+};
+
+// Host UDP backend with the same shape as the ESP32 core's WiFiUDP, built on
+// a non-blocking POSIX datagram socket, or on a QubiSimNetwork if one exists
+// when begin() is called. Inbound and outbound traffic can each be passed
+// through a QubiImpairment link emulator.
+//
+// On a kernel socket, parsePacket() takes up to QUBI_HOST_UDP_BATCH queued
+// datagrams per recvmmsg() call and hands them out one at a time. Sends can
+// be batched too (setSendBatch()): endPacket() then queues the datagram, and
+// the queue goes out in one sendmmsg() call when it is full, on the next
+// parsePacket() or on flushSends().
+//
+// Like the ESP32 core's, a socket handles datagrams of up to 1460 bytes
+// unless setDatagramSize() says otherwise, and its buffers are only
+// allocated once used, so a simulation can open thousands of them.
+class WiFiUDP {
+private:
+  int _fd;
+  QubiSimNetwork* _sim;
+  uint16_t _localPort;
+  uint32_t _linkGeneration;  // WiFi link generation when the socket was opened
+  bool _onLink;
+
+  size_t _datagramSize;
+
+  // Current inbound packet, in _rxBuffer or a receive batch slot
+  uint8_t* _rxBuffer;        // Allocated on first use, as is _txBuffer
+  const uint8_t* _rxData;
+  size_t _rxLength;
+  size_t _rxPosition;
+  IPAddress _remoteIP;
+  uint16_t _remotePort;
+
+  // Outbound packet being assembled between beginPacket() and endPacket()
+  uint8_t* _txBuffer;
+  size_t _txLength;
+  IPAddress _txIP;
+  uint16_t _txPort;
+
+  QubiImpairment _inbound;
+  QubiImpairment _outbound;
+
+  QubiUdpBatch* _rxBatch;  // Allocated on first use
+  QubiUdpBatch* _txBatch;
+  unsigned _rxBatchSize;
+  unsigned _txBatchSize;
+  QubiUdpIoStats _ioStats;
+
+  int receiveRaw(const uint8_t*& data, uint32_t& address, uint16_t& port);
+  bool sendRaw(const uint8_t* data, size_t len, uint32_t address, uint16_t port);
+  void pumpOutbound();
+  void releaseBuffers();
+  bool isOpen() const { return _fd >= 0 || _sim != nullptr; }
+  bool linkUp();
+
+public:
+  WiFiUDP();
+  ~WiFiUDP();
+  WiFiUDP(const WiFiUDP&) = delete;
+  WiFiUDP& operator=(const WiFiUDP&) = delete;
+
+  uint8_t begin(uint16_t port);
+  uint8_t begin(IPAddress address, uint16_t port);
+  uint8_t beginMulticast(IPAddress multicast, uint16_t port);
+  void stop();
+
+  // Sending
+  int beginPacket(IPAddress ip, uint16_t port);
+  int beginPacket(const char* host, uint16_t port);
+  int endPacket();
+  size_t write(uint8_t byte);
+  size_t write(const uint8_t* buffer, size_t size);
+  size_t print(const char* str) { return write((const uint8_t*)str, strlen(str)); }
+  size_t print(const String& str) { return write((const uint8_t*)str.c_str(), str.length()); }
+
+  // Receiving
+  int parsePacket();
+  int available();
+  int read();
+  int read(unsigned char* buffer, size_t len);
+  int read(char* buffer, size_t len) { return read((unsigned char*)buffer, len); }
+  int peek();
+  void flush();
+
+  IPAddress remoteIP() const { return _remoteIP; }
+  uint16_t remotePort() const { return _remotePort; }
+
+  // Host-only: link emulation. Configuring a direction resets its queue.
+  void setInboundImpairment(const QubiImpairmentConfig& config);
+  void setOutboundImpairment(const QubiImpairmentConfig& config);
+  const QubiImpairment& inboundImpairment() const { return _inbound; }
+  const QubiImpairment& outboundImpairment() const { return _outbound; }
+
+  // Host-only: sends still held by the outbound link emulator
+  size_t pendingOutbound() const { return _outbound.pending(); }
+  int fd() const { return _fd; }
+  bool simulated() const { return _sim != nullptr; }
+  uint16_t localPort() const { return _localPort; }
+  // False for sockets standing in for a peer elsewhere on the network, such
+  // as a test's controller, which the module's WiFi drops do not affect
+  void setOnLink(bool onLink) { _onLink = onLink; }
+
+  // Host-only: largest datagram sent or received, up to
+  // QUBI_HOST_UDP_MAX_PACKET. Longer writes are cut off, and longer inbound
+  // datagrams dropped (counted in ioStats().rxTruncated). Set it before
+  // begin(); anything batched or queued on the socket is discarded.
+  void setDatagramSize(size_t bytes);
+  size_t datagramSize() const { return _datagramSize; }
+
+  // Host-only: datagrams per receive and send syscall, 1 to
+  // QUBI_HOST_UDP_BATCH. Receives default to a full batch, sends to 1
+  // (sent by endPacket()). Ignored on the simulated network.
+  void setReceiveBatch(unsigned count);
+  void setSendBatch(unsigned count);
+  // Sends batched datagrams now; false if the kernel refused any
+  bool flushSends();
+  const QubiUdpIoStats& ioStats() const { return _ioStats; }
+};
+
+#endif // QUBI_HOST_WIFIUDP_H
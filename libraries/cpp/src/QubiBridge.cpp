@@ -0,0 +1,607 @@
+#include "QubiBridge.h"
+
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+const char* WEBSOCKET_GUID = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+enum : uint8_t {
+  OP_CONTINUATION = 0x0,
+  OP_TEXT = 0x1,
+  OP_BINARY = 0x2,
+  OP_CLOSE = 0x8,
+  OP_PING = 0x9,
+  OP_PONG = 0xA
+};
+
+// Close codes (RFC 6455, 7.4.1)
+const uint16_t CLOSE_NORMAL = 1000;
+const uint16_t CLOSE_PROTOCOL_ERROR = 1002;
+const uint16_t CLOSE_TOO_BIG = 1009;
+
+uint32_t rotateLeft(uint32_t value, int bits) {
+  return value << bits | value >> (32 - bits);
+}
+
+// SHA-1, which the handshake needs for Sec-WebSocket-Accept and nothing else
+void sha1(const uint8_t* data, size_t len, uint8_t digest[20]) {
+  uint32_t h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+  std::string message((const char*)data, len);
+  message += (char)0x80;
+  while (message.size() % 64 != 56) message += (char)0;
+  uint64_t bits = (uint64_t)len * 8;
+  for (int i = 7; i >= 0; i--) message += (char)(bits >> (i * 8));
+
+  for (size_t block = 0; block < message.size(); block += 64) {
+    const uint8_t* p = (const uint8_t*)message.data() + block;
+    uint32_t w[80];
+    for (int i = 0; i < 16; i++) {
+      w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 | (uint32_t)p[i * 4 + 2] << 8 | p[i * 4 + 3];
+    }
+    for (int i = 16; i < 80; i++) {
+      w[i] = rotateLeft(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+    for (int i = 0; i < 80; i++) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d);
+        k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d;
+        k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d);
+        k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d;
+        k = 0xCA62C1D6;
+      }
+      uint32_t next = rotateLeft(a, 5) + f + e + k + w[i];
+      e = d;
+      d = c;
+      c = rotateLeft(b, 30);
+      b = a;
+      a = next;
+    }
+    h[0] += a;
+    h[1] += b;
+    h[2] += c;
+    h[3] += d;
+    h[4] += e;
+  }
+
+  for (int i = 0; i < 20; i++) {
+    digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+  }
+}
+
+std::string base64(const uint8_t* data, size_t len) {
+  static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  for (size_t i = 0; i < len; i += 3) {
+    uint32_t chunk = (uint32_t)data[i] << 16;
+    if (i + 1 < len) chunk |= (uint32_t)data[i + 1] << 8;
+    if (i + 2 < len) chunk |= data[i + 2];
+    out += alphabet[chunk >> 18 & 0x3F];
+    out += alphabet[chunk >> 12 & 0x3F];
+    out += i + 1 < len ? alphabet[chunk >> 6 & 0x3F] : '=';
+    out += i + 2 < len ? alphabet[chunk & 0x3F] : '=';
+  }
+  return out;
+}
+
+std::string lowercase(std::string text) {
+  for (char& c : text) {
+    if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+  }
+  return text;
+}
+
+// An HTTP header's value, trimmed; "" if it is missing. Names are matched
+// case-insensitively, so pass them in lower case.
+std::string headerValue(const std::string& request, const char* name) {
+  std::string lower = lowercase(request);
+  std::string needle = std::string("\r\n") + name + ":";
+  size_t start = lower.find(needle);
+  if (start == std::string::npos) return "";
+  start += needle.size();
+  size_t end = request.find("\r\n", start);
+  while (start < end && request[start] == ' ') start++;
+  while (end > start && request[end - 1] == ' ') end--;
+  return request.substr(start, end - start);
+}
+
+}  // namespace
+
+QubiBridge::QubiBridge(const QubiBridgeOptions& options)
+  : _options(options), _listener(-1), _port(0), _clientId(0), _sequence(0) {
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+QubiBridge::~QubiBridge() {
+  close();
+}
+
+bool QubiBridge::begin(uint16_t port, uint16_t udpPort) {
+  close();
+  _listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (_listener < 0) return false;
+
+  int yes = 1;
+  setsockopt(_listener, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  sockaddr_in address = {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = (uint32_t)_options.listenAddress;
+  address.sin_port = htons(port);
+  socklen_t length = sizeof(address);
+  _udp.setDatagramSize(QUBI_HOST_UDP_MAX_PACKET);
+  if (bind(_listener, (sockaddr*)&address, sizeof(address)) < 0 || ::listen(_listener, 128) < 0 ||
+      getsockname(_listener, (sockaddr*)&address, &length) < 0 || _udp.begin(udpPort) != 1) {
+    close();
+    return false;
+  }
+  _port = ntohs(address.sin_port);
+  // Everything browsers sent in one poll() goes out in as few sendmmsg()
+  // calls as possible
+  _udp.setSendBatch(QUBI_HOST_UDP_BATCH);
+  return true;
+}
+
+void QubiBridge::close() {
+  for (auto& client : _clients) {
+    ::close(client->fd);
+  }
+  _clients.clear();
+  if (_listener >= 0) {
+    ::close(_listener);
+    _listener = -1;
+  }
+  _udp.stop();
+  _routes.clear();
+  _routeExpiry.clear();
+  _lastSender.clear();
+}
+
+void QubiBridge::addModule(const String& id, IPAddress ip, uint16_t port) {
+  _modules[id.c_str()] = addressKey(ip, port);
+}
+
+QubiBridge::Client* QubiBridge::findClient(uint32_t id) {
+  for (auto& client : _clients) {
+    if (client->id == id) return client->closing ? nullptr : client.get();
+  }
+  return nullptr;
+}
+
+void QubiBridge::accept() {
+  for (;;) {
+    int fd = accept4(_listener, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd < 0) return;
+    if (_clients.size() >= _options.maxClients) {
+      ::close(fd);
+      _stats.rejected++;
+      continue;
+    }
+
+    // Replies are small and latency matters more than segment count
+    int yes = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+    std::unique_ptr<Client> client(new Client());
+    client->fd = fd;
+    do {
+      _clientId++;
+    } while (_clientId == 0);
+    client->id = _clientId;
+    client->upgraded = false;
+    client->closing = false;
+    client->opcode = 0;
+    client->target = 0;
+    _clients.push_back(std::move(client));
+  }
+}
+
+bool QubiBridge::readClient(Client& client) {
+  char buffer[16384];
+  for (;;) {
+    ssize_t received = recv(client.fd, buffer, sizeof(buffer), 0);
+    if (received > 0) {
+      client.input.append(buffer, received);
+      continue;
+    }
+    if (received == 0) return false;
+    if (errno == EINTR) continue;
+    if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+    return false;
+  }
+
+  if (!client.upgraded) {
+    if (!handshake(client)) {
+      client.closing = true;  // Once the refusal is out
+      return true;
+    }
+    if (!client.upgraded) return true;  // Headers still incomplete
+  }
+  readFrames(client);
+  return true;
+}
+
+bool QubiBridge::handshake(Client& client) {
+  size_t end = client.input.find("\r\n\r\n");
+  if (end == std::string::npos) {
+    if (client.input.size() <= QUBI_BRIDGE_MAX_HANDSHAKE) return true;
+    end = client.input.size();
+  }
+  std::string request = client.input.substr(0, end + 2);
+  client.input.erase(0, end + 4 < client.input.size() ? end + 4 : client.input.size());
+
+  std::string key = headerValue(request, "sec-websocket-key");
+  const char* refusal = nullptr;
+  if (request.compare(0, 4, "GET ") != 0 || key.empty() ||
+      lowercase(headerValue(request, "upgrade")) != "websocket") {
+    refusal = "400 Bad Request\r\n";
+  } else if (headerValue(request, "sec-websocket-version") != "13") {
+    refusal = "426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\n";
+  } else if (!originAllowed(client, request)) {
+    // Any page the browser has open could otherwise drive the robot
+    refusal = "403 Forbidden\r\n";
+  }
+  if (refusal) {
+    _stats.rejected++;
+    client.output = std::string("HTTP/1.1 ") + refusal + "Connection: close\r\nContent-Length: 0\r\n\r\n";
+    return false;
+  }
+
+  // The module for binary frames may be named in the URL, ?module=<id>
+  std::string target = request.substr(4, request.find(' ', 4) - 4);
+  size_t query = target.find("module=");
+  if (query != std::string::npos && query > 0 && (target[query - 1] == '?' || target[query - 1] == '&')) {
+    std::string id = target.substr(query + 7, target.find('&', query) - query - 7);
+    auto known = _modules.find(id);
+    if (known != _modules.end()) client.target = known->second;
+  }
+
+  std::string accept = key + WEBSOCKET_GUID;
+  uint8_t digest[20];
+  sha1((const uint8_t*)accept.data(), accept.size(), digest);
+  client.output += "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                   "Sec-WebSocket-Accept: " + base64(digest, sizeof(digest)) + "\r\n\r\n";
+  client.upgraded = true;
+  _stats.connections++;
+  return true;
+}
+
+bool QubiBridge::originAllowed(const Client& client, const std::string& request) const {
+  std::string origin = lowercase(headerValue(request, "origin"));
+  if (origin.empty()) return true;
+  for (const std::string& allowed : _options.allowedOrigins) {
+    if (allowed == "*" || lowercase(allowed) == origin) return true;
+  }
+
+  // The Host header is the page's to choose, so compare against the address
+  // the connection actually arrived on
+  size_t start = origin.find("://");
+  if (start == std::string::npos) return false;  // "null", e.g. a file:// page
+  start += 3;
+  std::string host = origin.substr(start, origin.find_first_of(":/", start) - start);
+  sockaddr_in local = {};
+  socklen_t length = sizeof(local);
+  if (getsockname(client.fd, (sockaddr*)&local, &length) < 0) return false;
+  if (host == IPAddress((uint32_t)local.sin_addr.s_addr).toString().c_str()) return true;
+  return host == "localhost" && ntohl(local.sin_addr.s_addr) >> 24 == 127;
+}
+
+bool QubiBridge::readFrames(Client& client) {
+  size_t offset = 0;
+  bool open = true;
+  while (open && !client.closing) {
+    uint8_t* p = (uint8_t*)&client.input[offset];
+    size_t available = client.input.size() - offset;
+    if (available < 2) break;
+
+    bool fin = p[0] & 0x80;
+    uint8_t opcode = p[0] & 0x0F;
+    uint64_t length = p[1] & 0x7F;
+    size_t header = 2;
+    if (length == 126) {
+      if (available < 4) break;
+      length = (uint64_t)p[2] << 8 | p[3];
+      header = 4;
+    } else if (length == 127) {
+      if (available < 10) break;
+      length = 0;
+      for (int i = 0; i < 8; i++) length = length << 8 | p[2 + i];
+      header = 10;
+    }
+
+    // Browsers mask every frame; anything a datagram can't carry is refused
+    uint16_t error = 0;
+    if (!(p[1] & 0x80) || ((opcode & 0x8) && (!fin || length > 125))) error = CLOSE_PROTOCOL_ERROR;
+    if (length > QUBI_HOST_UDP_MAX_PACKET) error = CLOSE_TOO_BIG;
+    if (error == 0 && available < header + 4 + length) break;
+
+    uint8_t* payload = p + header + 4;
+    if (error == 0) {
+      const uint8_t* mask = p + header;
+      for (size_t i = 0; i < length; i++) payload[i] ^= mask[i & 3];
+      offset += header + 4 + length;
+    }
+
+    if (error == 0) {
+      switch (opcode) {
+        case OP_TEXT:
+        case OP_BINARY:
+          if (client.opcode != 0) {
+            error = CLOSE_PROTOCOL_ERROR;  // A new message inside a fragmented one
+          } else if (fin) {
+            handleMessage(client, opcode, (const char*)payload, length);
+          } else {
+            client.opcode = opcode;
+            client.message.assign((const char*)payload, length);
+          }
+          break;
+        case OP_CONTINUATION:
+          if (client.opcode == 0) {
+            error = CLOSE_PROTOCOL_ERROR;
+          } else if (client.message.size() + length > QUBI_HOST_UDP_MAX_PACKET) {
+            error = CLOSE_TOO_BIG;
+          } else {
+            client.message.append((const char*)payload, length);
+            if (fin) {
+              handleMessage(client, client.opcode, client.message.data(), client.message.size());
+              client.opcode = 0;
+              client.message.clear();
+            }
+          }
+          break;
+        case OP_PING:
+          sendFrame(client, OP_PONG, (const char*)payload, length);
+          break;
+        case OP_PONG:
+          break;
+        case OP_CLOSE: {
+          uint8_t code[2] = {(uint8_t)(CLOSE_NORMAL >> 8), (uint8_t)CLOSE_NORMAL};
+          sendFrame(client, OP_CLOSE, (const char*)code, sizeof(code));
+          client.closing = true;
+          open = false;
+          break;
+        }
+        default:
+          error = CLOSE_PROTOCOL_ERROR;
+      }
+    }
+
+    if (error != 0) {
+      uint8_t code[2] = {(uint8_t)(error >> 8), (uint8_t)error};
+      sendFrame(client, OP_CLOSE, (const char*)code, sizeof(code));
+      client.closing = true;
+      open = false;
+    }
+  }
+  client.input.erase(0, offset);
+  return open;
+}
+
+void QubiBridge::handleMessage(Client& client, uint8_t opcode, const char* data, size_t len) {
+  _stats.messagesIn++;
+  if (opcode == OP_BINARY) {
+    if (client.target == 0) {
+      reject(client, 0, (int)QubiStatusCode::CONFLICT, "No module for binary frames yet");
+      return;
+    }
+    _udp.beginPacket(IPAddress((uint32_t)(client.target >> 16)), (uint16_t)client.target);
+    _udp.write((const uint8_t*)data, len);
+    _udp.endPacket();
+    _lastSender[client.target] = client.id;
+    _stats.forwarded++;
+    return;
+  }
+
+  if (deserializeJson(_doc, data, len)) {
+    reject(client, 0, (int)QubiStatusCode::BAD_REQUEST, "Invalid message format");
+  } else if (_doc.is<JsonArray>()) {
+    for (JsonObject message : _doc.as<JsonArray>()) {
+      forward(client, message);
+    }
+  } else if (_doc.is<JsonObject>()) {
+    forward(client, _doc.as<JsonObject>());
+  } else {
+    reject(client, 0, (int)QubiStatusCode::BAD_REQUEST, "Invalid message format");
+  }
+}
+
+void QubiBridge::forward(Client& client, JsonObject message) {
+  uint32_t sequence = message["sequence"] | (uint32_t)0;
+  const char* moduleId = message["commands"][0]["module_id"] | "";
+  bool broadcast = strcmp(moduleId, "*") == 0;
+  uint64_t target;
+  if (broadcast) {
+    target = addressKey(_options.broadcastAddress, _options.broadcastPort);
+  } else {
+    auto known = _modules.find(moduleId);
+    if (known == _modules.end()) {
+      _stats.unknownModule++;
+      reject(client, sequence, (int)QubiStatusCode::NOT_FOUND, "Unknown module");
+      return;
+    }
+    target = known->second;
+  }
+
+  // Every message gets a sequence number of the bridge's own, so that
+  // replies find their way back even if the client left it out
+  do {
+    _sequence = _sequence >= QUBI_BRIDGE_FIRST_SEQUENCE && _sequence < QUBI_CONTROLLER_MAX_SEQUENCE
+                  ? _sequence + 1 : QUBI_BRIDGE_FIRST_SEQUENCE;
+  } while (_routes.count(_sequence));
+  _routes[_sequence] = Route{client.id, sequence, broadcast ? 0 : target};
+  _routeExpiry.push_back(std::make_pair(millis() + _options.routeTimeoutMs, _sequence));
+  message["sequence"] = _sequence;
+
+  std::string payload;
+  serializeJson(message, payload);
+  _udp.beginPacket(IPAddress((uint32_t)(target >> 16)), (uint16_t)target);
+  _udp.write((const uint8_t*)payload.data(), payload.size());
+  _udp.endPacket();
+  _stats.forwarded++;
+  if (!broadcast) {
+    client.target = target;
+    _lastSender[target] = client.id;
+  }
+}
+
+void QubiBridge::reject(Client& client, uint32_t sequence, int status, const char* text) {
+  JsonDocument doc;
+  doc["status"] = status;
+  doc["message"] = text;
+  doc["module_id"] = "bridge";
+  doc["timestamp"] = millis();
+  if (sequence != 0) doc["data"]["sequence"] = sequence;
+
+  std::string payload;
+  serializeJson(doc, payload);
+  sendFrame(client, OP_TEXT, payload.data(), payload.size());
+}
+
+void QubiBridge::sendFrame(Client& client, uint8_t opcode, const char* data, size_t len) {
+  char header[10];
+  size_t size = 2;
+  header[0] = (char)(0x80 | opcode);
+  if (len < 126) {
+    header[1] = (char)len;
+  } else if (len <= 0xFFFF) {
+    header[1] = 126;
+    header[2] = (char)(len >> 8);
+    header[3] = (char)len;
+    size = 4;
+  } else {
+    header[1] = 127;
+    for (int i = 0; i < 8; i++) header[2 + i] = (char)((uint64_t)len >> (56 - i * 8));
+    size = 10;
+  }
+  client.output.append(header, size);
+  client.output.append(data, len);
+
+  // A browser that stopped reading isn't worth the memory
+  if (client.output.size() > _options.maxBacklog) {
+    client.output.clear();
+    client.closing = true;
+  }
+}
+
+void QubiBridge::flushClient(Client& client) {
+  size_t written = 0;
+  while (written < client.output.size()) {
+    ssize_t sent = send(client.fd, client.output.data() + written, client.output.size() - written, MSG_NOSIGNAL);
+    if (sent > 0) {
+      written += sent;
+    } else if (sent < 0 && errno == EINTR) {
+      continue;
+    } else if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      break;
+    } else {
+      client.output.clear();
+      client.closing = true;
+      return;
+    }
+  }
+  client.output.erase(0, written);
+}
+
+size_t QubiBridge::receiveReplies() {
+  size_t count = 0;
+  int length;
+  while ((length = _udp.parsePacket()) > 0) {
+    count++;
+    _stats.replies++;
+    length = _udp.read(_rxBuffer, sizeof(_rxBuffer));
+    if (length <= 0) continue;
+    uint64_t source = addressKey(_udp.remoteIP(), _udp.remotePort());
+
+    bool json = _rxBuffer[0] == '{' && !deserializeJson(_doc, (const char*)_rxBuffer, length);
+    if (json) {
+      const char* moduleId = _doc["module_id"] | "";
+      if (*moduleId) _modules[moduleId] = source;
+
+      uint32_t sequence = _doc["data"]["sequence"] | (uint32_t)0;
+      auto route = _routes.find(sequence);
+      bool matched = route != _routes.end() && (route->second.module == 0 || route->second.module == source);
+      Client* client = matched ? findClient(route->second.client) : nullptr;
+      if (client) {
+        _stats.routed++;
+        if (route->second.sequence != 0) {
+          _doc["data"]["sequence"] = route->second.sequence;
+        } else if (_doc["data"].size() == 1) {
+          _doc.remove("data");
+        } else {
+          _doc["data"].remove("sequence");
+        }
+        std::string text;
+        serializeJson(_doc, text);
+        sendFrame(*client, OP_TEXT, text.data(), text.size());
+        continue;
+      }
+    }
+
+    auto last = _lastSender.find(source);
+    Client* client = last != _lastSender.end() ? findClient(last->second) : nullptr;
+    if (!client) {
+      _stats.unroutable++;
+      continue;
+    }
+    sendFrame(*client, json ? OP_TEXT : OP_BINARY, (const char*)_rxBuffer, length);
+  }
+  return count;
+}
+
+void QubiBridge::expireRoutes(unsigned long now) {
+  while (!_routeExpiry.empty() && (long)(now - _routeExpiry.front().first) >= 0) {
+    _routes.erase(_routeExpiry.front().second);
+    _routeExpiry.pop_front();
+  }
+}
+
+size_t QubiBridge::poll() {
+  if (_listener < 0) return 0;
+  uint32_t before = _stats.messagesIn + _stats.replies;
+
+  accept();
+  for (auto& client : _clients) {
+    if (!client->closing && !readClient(*client)) {
+      client->output.clear();
+      client->closing = true;
+    }
+  }
+  _udp.flushSends();
+  receiveReplies();
+  expireRoutes(millis());
+
+  // One write per connection per poll() for all the frames queued above
+  for (size_t i = 0; i < _clients.size();) {
+    Client& client = *_clients[i];
+    if (!client.output.empty()) flushClient(client);
+    if (client.closing && client.output.empty()) {
+      ::close(client.fd);
+      _clients.erase(_clients.begin() + i);
+    } else {
+      i++;
+    }
+  }
+  return _stats.messagesIn + _stats.replies - before;
+}
+
+void QubiBridge::wait(uint32_t maxMs) {
+  std::vector<pollfd> sockets;
+  if (_listener >= 0) sockets.push_back(pollfd{_listener, POLLIN, 0});
+  if (_udp.fd() >= 0) sockets.push_back(pollfd{_udp.fd(), POLLIN, 0});
+  for (auto& client : _clients) {
+    sockets.push_back(pollfd{client->fd, (short)(POLLIN | (client->output.empty() ? 0 : POLLOUT)), 0});
+  }
+  ::poll(sockets.data(), sockets.size(), (int)maxMs);
+}
@@ -0,0 +1,133 @@
+#ifndef QUBI_BRIDGE_H
+#define QUBI_BRIDGE_H
+
+#include "QubiController.h"
+
+#include <deque>
+#include <memory>
+
+// WebSocket-to-UDP bridge for browser controllers, which can't send UDP.
+// Browsers connect to ws://host:8891/ and send ordinary request messages as
+// text frames, or a JSON array of them to batch several in one frame. Each
+// goes to the module named by its first command's module_id ("*" is a
+// broadcast, e.g. for discover), with its sequence number swapped for one
+// that is unique across connections; replies carrying it are routed back
+// with the client's own number restored. Module addresses come from
+// addModule() and from the module_id of every reply the bridge sees, so
+// discovering through the bridge is enough to reach modules by id.
+//
+// Binary frames are forwarded as they are, e.g. compressed or authenticated
+// datagrams, to the module the connection addressed last, or the one named
+// in the URL (ws://host:8891/?module=<id>). Replies the bridge can't route
+// by sequence go to the connection that last sent to that module, as binary
+// frames if they aren't JSON.
+#define QUBI_BRIDGE_PORT 8891
+#define QUBI_BRIDGE_MAX_HANDSHAKE 8192
+// The bridge numbers requests from here up, clear of the client numbers
+// that binary frames carry through
+#define QUBI_BRIDGE_FIRST_SEQUENCE 0x40000000
+
+struct QubiBridgeOptions {
+  IPAddress listenAddress = IPAddress(127, 0, 0, 1);  // 0.0.0.0 to serve other machines too
+  IPAddress broadcastAddress = IPAddress(255, 255, 255, 255);
+  uint16_t broadcastPort = QUBI_DEFAULT_PORT;
+  uint32_t routeTimeoutMs = 10000;    // How long replies to a request are routed
+  size_t maxClients = 64;
+  size_t maxBacklog = 1024 * 1024;    // Unsent bytes per connection before it is dropped
+  // Origins (scheme://host[:port]) of other pages that may connect, or "*"
+  // for any. Pages served from the address a connection arrives on, or from
+  // localhost over loopback, always may; clients that send no Origin are
+  // not browsers and are let through.
+  std::vector<std::string> allowedOrigins;
+};
+
+struct QubiBridgeStats {
+  uint32_t connections;
+  uint32_t rejected;       // Failed handshakes, other origins, or over maxClients
+  uint32_t messagesIn;     // From browsers
+  uint32_t forwarded;      // Datagrams to modules
+  uint32_t unknownModule;  // Messages for a module with no known address
+  uint32_t replies;        // Datagrams from modules
+  uint32_t routed;         // Replies matched by sequence
+  uint32_t unroutable;
+};
+
+class QubiBridge {
+private:
+  struct Client {
+    int fd;
+    uint32_t id;
+    bool upgraded;
+    bool closing;        // Close frame sent; drop once the backlog is out
+    std::string input;   // Received, not yet parsed
+    std::string output;  // Frames not yet written
+    std::string message; // Fragments of the message being received
+    uint8_t opcode;      // Of that message
+    uint64_t target;     // Module address for binary frames; 0 if none yet
+  };
+  struct Route {
+    uint32_t client;
+    uint32_t sequence;  // The client's own
+    uint64_t module;    // Address the request went to; 0 for a broadcast
+  };
+
+  QubiBridgeOptions _options;
+  int _listener;
+  uint16_t _port;
+  WiFiUDP _udp;
+  uint32_t _clientId;
+  uint32_t _sequence;
+
+  std::vector<std::unique_ptr<Client>> _clients;
+  std::unordered_map<std::string, uint64_t> _modules;  // Id to address
+  std::unordered_map<uint32_t, Route> _routes;         // By bridge sequence number
+  std::deque<std::pair<unsigned long, uint32_t>> _routeExpiry;
+  std::unordered_map<uint64_t, uint32_t> _lastSender;  // Module address to client
+
+  JsonDocument _doc;
+  uint8_t _rxBuffer[QUBI_HOST_UDP_MAX_PACKET];
+  QubiBridgeStats _stats;
+
+  static uint64_t addressKey(IPAddress ip, uint16_t port) { return (uint64_t)(uint32_t)ip << 16 | port; }
+  Client* findClient(uint32_t id);
+  void accept();
+  bool readClient(Client& client);
+  bool handshake(Client& client);
+  bool originAllowed(const Client& client, const std::string& request) const;
+  bool readFrames(Client& client);
+  void handleMessage(Client& client, uint8_t opcode, const char* data, size_t len);
+  void forward(Client& client, JsonObject message);
+  void reject(Client& client, uint32_t sequence, int status, const char* text);
+  void sendFrame(Client& client, uint8_t opcode, const char* data, size_t len);
+  void flushClient(Client& client);
+  size_t receiveReplies();
+  void expireRoutes(unsigned long now);
+
+public:
+  explicit QubiBridge(const QubiBridgeOptions& options = QubiBridgeOptions());
+  ~QubiBridge();
+  QubiBridge(const QubiBridge&) = delete;
+  QubiBridge& operator=(const QubiBridge&) = delete;
+
+  // Listens for WebSocket connections on port (0 = any free port) and opens
+  // the socket towards the modules
+  bool begin(uint16_t port = QUBI_BRIDGE_PORT, uint16_t udpPort = 0);
+  void close();
+  uint16_t localPort() const { return _port; }
+
+  void addModule(const String& id, IPAddress ip, uint16_t port = QUBI_DEFAULT_PORT);
+  size_t moduleCount() const { return _modules.size(); }
+  size_t clientCount() const { return _clients.size(); }
+
+  // Accepts connections, forwards what browsers sent and routes replies;
+  // returns the number of messages and replies handled
+  size_t poll();
+  // Blocks until a socket is ready or maxMs has passed
+  void wait(uint32_t maxMs);
+
+  const QubiBridgeStats& getStats() const { return _stats; }
+  // Host-only access to the module socket, e.g. for impairment setup
+  WiFiUDP& udp() { return _udp; }
+};
+
+#endif // QUBI_BRIDGE_H
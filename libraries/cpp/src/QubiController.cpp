@@ -0,0 +1,328 @@
+#include "QubiController.h"
+
+#include <chrono>
+#include <poll.h>
+
+namespace {
+
+unsigned long long wallClockMs() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+bool qubiParseResponse(JsonDocument& doc, const char* text, size_t length, QubiResponse& response) {
+  if (deserializeJson(doc, text, length) || !doc["status"].is<int>()) return false;
+
+  response.status = doc["status"].as<int>();
+  response.message = doc["message"] | "";
+  response.moduleId = doc["module_id"] | "";
+  response.timestamp = doc["timestamp"] | 0UL;
+  response.data = doc["data"];
+  response.sequence = doc["data"]["sequence"] | (uint32_t)0;
+  return true;
+}
+
+const char* qubiModuleTypeName(QubiModuleType type) {
+  switch (type) {
+    case QubiModuleType::ACTUATOR: return "actuator";
+    case QubiModuleType::DISPLAY: return "display";
+    case QubiModuleType::MOBILE: return "mobile";
+    case QubiModuleType::SENSOR: return "sensor";
+    default: return "custom";
+  }
+}
+
+QubiModuleType qubiModuleTypeFromName(const char* name) {
+  if (strcmp(name, "actuator") == 0) return QubiModuleType::ACTUATOR;
+  if (strcmp(name, "display") == 0) return QubiModuleType::DISPLAY;
+  if (strcmp(name, "mobile") == 0) return QubiModuleType::MOBILE;
+  if (strcmp(name, "sensor") == 0) return QubiModuleType::SENSOR;
+  return QubiModuleType::CUSTOM;
+}
+
+QubiController::QubiController(IPAddress host, uint16_t port, const QubiControllerOptions& options)
+  : _host(host), _port(port), _options(options), _open(false), _sequence(0) {
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+QubiController::~QubiController() {
+  close();
+}
+
+bool QubiController::begin(uint16_t localPort) {
+  close();
+  // Responses such as action stats can exceed the ESP32-sized default
+  _udp.setDatagramSize(QUBI_HOST_UDP_MAX_PACKET);
+  _open = _udp.begin(localPort) == 1;
+  return _open;
+}
+
+void QubiController::close() {
+  if (_open) {
+    _udp.stop();
+    _open = false;
+  }
+
+  // Callbacks may queue new requests; those fail at once since we're closed
+  std::unordered_map<uint32_t, Pending> failed;
+  failed.swap(_pending);
+  _deadlines = decltype(_deadlines)();
+  QubiResponse none = QubiResponse();
+  for (auto& entry : failed) {
+    none.sequence = entry.first;
+    entry.second.callback(QubiRequestResult::CLOSED, none);
+  }
+}
+
+uint32_t QubiController::nextSequence() {
+  // 0 means "no sequence" to the module; skip it, and any still in use
+  // after a wrap
+  do {
+    _sequence = _sequence % QUBI_CONTROLLER_MAX_SEQUENCE + 1;
+  } while (_pending.count(_sequence));
+  return _sequence;
+}
+
+std::string qubiSerializeCommands(const QubiCommand* commands, size_t count, uint32_t sequence) {
+  JsonDocument doc;
+  doc["version"] = QUBI_PROTOCOL_VERSION;
+  doc["timestamp"] = wallClockMs();
+  if (sequence != 0) {
+    doc["sequence"] = sequence;
+  }
+
+  JsonArray list = doc["commands"].to<JsonArray>();
+  for (size_t i = 0; i < count; i++) {
+    JsonObject command = list.add<JsonObject>();
+    command["module_id"] = commands[i].moduleId;
+    command["module_type"] = qubiModuleTypeName(commands[i].moduleType);
+    command["action"] = commands[i].action;
+    if (commands[i].params.isNull()) {
+      command["params"].to<JsonObject>();
+    } else {
+      command["params"] = commands[i].params;
+    }
+  }
+
+  std::string payload;
+  serializeJson(doc, payload);
+  return payload;
+}
+
+bool QubiController::transmit(const std::string& payload) {
+  _stats.sent++;
+  if (!_udp.beginPacket(_host, _port) ||
+      _udp.write((const uint8_t*)payload.data(), payload.size()) != payload.size() || !_udp.endPacket()) {
+    _stats.sendFailures++;
+    return false;
+  }
+  return true;
+}
+
+uint32_t QubiController::sendCommandAsync(const QubiCommand& command, QubiResponseCallback callback) {
+  return sendBatchAsync(&command, 1, callback);
+}
+
+uint32_t QubiController::sendBatchAsync(const QubiCommand* commands, size_t count, QubiResponseCallback callback) {
+  QubiResponse none = QubiResponse();
+  if (!_open || _pending.size() >= _options.maxPending) {
+    callback(QubiRequestResult::SEND_FAILED, none);
+    return 0;
+  }
+
+  uint32_t sequence = _options.sequenceTracking ? nextSequence() : 0;
+  std::string payload = qubiSerializeCommands(commands, count, sequence);
+  if (payload.size() > QUBI_BUFFER_SIZE) {
+    callback(QubiRequestResult::SEND_FAILED, none);
+    return 0;
+  }
+
+  bool sent = transmit(payload);
+  if (sequence == 0) {
+    // Nothing to match a response against: done once it is on the wire
+    callback(sent ? QubiRequestResult::OK : QubiRequestResult::SEND_FAILED, none);
+    return 0;
+  }
+
+  // A failed send is left to the deadline, which resends it like a loss
+  unsigned long deadline = millis() + _options.timeoutMs;
+  _pending[sequence] = Pending{std::move(payload), deadline, 1, std::move(callback)};
+  _deadlines.push(Deadline(deadline, sequence));
+  return sequence;
+}
+
+bool QubiController::readResponse(QubiResponse& response) {
+  int length = _udp.parsePacket();
+  if (length <= 0) return false;
+
+  _stats.received++;
+  length = _udp.read(_rxBuffer, QUBI_HOST_UDP_MAX_PACKET);
+  response = QubiResponse();
+  response.ip = _udp.remoteIP();
+  response.port = _udp.remotePort();
+  if (length <= 0 || !qubiParseResponse(_rxDoc, _rxBuffer, length, response)) {
+    _stats.invalid++;
+    response.status = 0;
+  }
+  return true;
+}
+
+size_t QubiController::poll() {
+  size_t count = 0;
+  QubiResponse response;
+  while (_open && readResponse(response)) {
+    count++;
+    if (response.status == 0) continue;
+
+    for (auto& handler : _responseHandlers) {
+      handler(response);
+    }
+
+    auto entry = _pending.find(response.sequence);
+    if (response.sequence == 0 || entry == _pending.end()) {
+      _stats.unmatched++;
+      continue;
+    }
+    _stats.matched++;
+    QubiResponseCallback callback = std::move(entry->second.callback);
+    _pending.erase(entry);
+    callback(response.status < 400 ? QubiRequestResult::OK : QubiRequestResult::ERROR, response);
+  }
+
+  expire(millis());
+  return count;
+}
+
+void QubiController::expire(unsigned long now) {
+  while (!_deadlines.empty() && (long)(now - _deadlines.top().first) >= 0) {
+    Deadline due = _deadlines.top();
+    _deadlines.pop();
+
+    auto entry = _pending.find(due.second);
+    if (entry == _pending.end() || entry->second.deadline != due.first) continue;  // Answered or resent
+
+    Pending& request = entry->second;
+    if (request.attempts <= _options.retries) {
+      // Backoff as in the Python controller: 100 ms, 200 ms, 400 ms, ...
+      unsigned long backoff = 100UL << (request.attempts - 1);
+      request.attempts++;
+      request.deadline = now + backoff + _options.timeoutMs;
+      _deadlines.push(Deadline(request.deadline, due.second));
+      _stats.resent++;
+      transmit(request.payload);
+      continue;
+    }
+
+    _stats.timeouts++;
+    QubiResponseCallback callback = std::move(request.callback);
+    _pending.erase(entry);
+    QubiResponse none = QubiResponse();
+    none.sequence = due.second;
+    callback(QubiRequestResult::TIMEOUT, none);
+  }
+}
+
+void QubiController::waitForData(uint32_t maxMs) {
+  if (_udp.fd() < 0) {
+    delay(1);  // Simulated network: nothing to block on
+    return;
+  }
+  pollfd socket = {_udp.fd(), POLLIN, 0};
+  ::poll(&socket, 1, (int)maxMs);
+}
+
+QubiRequestResult QubiController::sendCommand(const QubiCommand& command, QubiResponse& response) {
+  return sendBatch(&command, 1, response);
+}
+
+QubiRequestResult QubiController::sendBatch(const QubiCommand* commands, size_t count, QubiResponse& response) {
+  bool done = false;
+  QubiRequestResult result = QubiRequestResult::SEND_FAILED;
+  sendBatchAsync(commands, count, [&](QubiRequestResult outcome, const QubiResponse& received) {
+    done = true;
+    result = outcome;
+    response = received;
+    // Keep the data past the next poll()
+    _resultDoc.set(received.data);
+    response.data = _resultDoc.as<JsonVariantConst>();
+  });
+
+  while (!done) {
+    unsigned long next = _deadlines.empty() ? millis() + 10 : _deadlines.top().first;
+    long wait = (long)(next - millis());
+    waitForData(wait > 0 ? (uint32_t)wait : 0);
+    poll();
+  }
+  return result;
+}
+
+std::vector<QubiDiscoveredModule> QubiController::discover(const QubiDiscoveryOptions& options) {
+  std::vector<QubiDiscoveredModule> modules;
+  WiFiUDP socket;
+  socket.setDatagramSize(QUBI_HOST_UDP_MAX_PACKET);
+  if (!socket.begin(0)) return modules;
+
+  QubiCommand command;
+  command.moduleId = "*";
+  command.moduleType = QubiModuleType::CUSTOM;
+  command.action = "discover";
+  std::string payload = qubiSerializeCommands(&command, 1, 0);
+
+  uint8_t rounds = options.retries > 0 ? options.retries : 1;
+  uint32_t roundMs = options.timeoutMs / rounds;
+  JsonDocument doc;
+  for (uint8_t round = 0; round < rounds; round++) {
+    socket.beginPacket(options.broadcastAddress, _port);
+    socket.write((const uint8_t*)payload.data(), payload.size());
+    socket.endPacket();
+
+    unsigned long start = millis();
+    while (millis() - start < roundMs) {
+      int length = socket.parsePacket();
+      if (length <= 0) {
+        if (socket.fd() >= 0) {
+          pollfd ready = {socket.fd(), POLLIN, 0};
+          ::poll(&ready, 1, (int)(roundMs - (millis() - start)));
+        } else {
+          delay(1);
+        }
+        continue;
+      }
+
+      length = socket.read(_rxBuffer, QUBI_HOST_UDP_MAX_PACKET);
+      QubiResponse response;
+      if (length <= 0 || !qubiParseResponse(doc, _rxBuffer, length, response) ||
+          !response.data["module_type"].is<const char*>()) {
+        continue;
+      }
+
+      // Answers to later rounds repeat earlier ones
+      bool seen = false;
+      for (auto& known : modules) {
+        if (known.id == response.moduleId && known.ip == socket.remoteIP() && known.port == socket.remotePort()) {
+          known.lastSeen = millis();
+          seen = true;
+        }
+      }
+      if (seen) continue;
+
+      QubiDiscoveredModule module;
+      module.id = response.moduleId;
+      module.type = response.data["module_type"] | "";
+      module.ip = socket.remoteIP();
+      module.port = socket.remotePort();
+      module.minVersion = response.data["min_version"] | QUBI_PROTOCOL_VERSION;
+      module.maxVersion = response.data["max_version"] | QUBI_PROTOCOL_VERSION;
+      module.capabilities = response.data["capabilities"] | (uint32_t)0;
+      module.lastSeen = millis();
+      modules.push_back(module);
+    }
+  }
+  return modules;
+}
+
+void QubiController::addResponseHandler(std::function<void(const QubiResponse&)> handler) {
+  _responseHandlers.push_back(handler);
+}
@@ -0,0 +1,161 @@
+#ifndef QUBI_CONTROLLER_H
+#define QUBI_CONTROLLER_H
+
+#include "QubiProtocol.h"
+
+#include <functional>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Host-side controller, the C++ counterpart of the Python and TypeScript
+// QubiController. Requests are pipelined: each message gets a sequence
+// number, the module echoes it as data.sequence, and responses are matched
+// through a table of pending requests, so thousands can be in flight on one
+// non-blocking socket. It uses the Arduino library's message types and the
+// host WiFiUDP, so it also runs on QubiSimNetwork and under impairments.
+#define QUBI_CONTROLLER_MAX_SEQUENCE 2147483647
+
+enum class QubiRequestResult : uint8_t {
+  OK,           // Response with status below 400
+  ERROR,        // Response with an error status
+  TIMEOUT,      // No response after all retries
+  SEND_FAILED,  // Not queued: controller closed, pending table full or message too big
+  CLOSED        // Controller closed while the request was pending
+};
+
+struct QubiResponse {
+  int status;
+  String message;
+  String moduleId;
+  unsigned long timestamp;
+  uint32_t sequence;
+  IPAddress ip;
+  uint16_t port;
+  // Points into the controller's receive buffer: valid until the callback
+  // returns, or for blocking calls until the next call on the controller
+  JsonVariantConst data;
+};
+
+struct QubiDiscoveredModule {
+  String id;
+  String type;
+  IPAddress ip;
+  uint16_t port;
+  String minVersion;
+  String maxVersion;
+  uint32_t capabilities;
+  unsigned long lastSeen;
+};
+
+struct QubiControllerOptions {
+  uint32_t timeoutMs = 5000;     // Per attempt
+  uint8_t retries = 3;           // Resends after a timeout, with exponential backoff
+  bool sequenceTracking = true;  // Without it, requests complete when sent
+  size_t maxPending = 65536;
+};
+
+struct QubiDiscoveryOptions {
+  uint32_t timeoutMs = 3000;
+  IPAddress broadcastAddress = IPAddress(255, 255, 255, 255);
+  uint8_t retries = 2;
+};
+
+struct QubiControllerStats {
+  uint32_t sent;         // Datagrams, resends included
+  uint32_t resent;
+  uint32_t received;
+  uint32_t matched;
+  uint32_t unmatched;    // Valid responses with no pending request (late, duplicate or unsolicited)
+  uint32_t invalid;      // Datagrams that were not a JSON response
+  uint32_t timeouts;
+  uint32_t sendFailures;
+};
+
+typedef std::function<void(QubiRequestResult result, const QubiResponse& response)> QubiResponseCallback;
+
+class QubiController {
+private:
+  struct Pending {
+    std::string payload;   // Kept for resends
+    unsigned long deadline;  // millis()
+    uint8_t attempts;
+    QubiResponseCallback callback;
+  };
+
+  IPAddress _host;
+  uint16_t _port;
+  QubiControllerOptions _options;
+  WiFiUDP _udp;
+  bool _open;
+  uint32_t _sequence;
+
+  std::unordered_map<uint32_t, Pending> _pending;
+  // Deadline order over the pending table; entries whose request has
+  // completed or been resent are skipped when they come up
+  typedef std::pair<unsigned long, uint32_t> Deadline;
+  std::priority_queue<Deadline, std::vector<Deadline>, std::greater<Deadline>> _deadlines;
+
+  JsonDocument _rxDoc;
+  JsonDocument _resultDoc;
+  char _rxBuffer[QUBI_HOST_UDP_MAX_PACKET + 1];
+  std::vector<std::function<void(const QubiResponse&)>> _responseHandlers;
+  QubiControllerStats _stats;
+
+  uint32_t nextSequence();
+  bool transmit(const std::string& payload);
+  bool readResponse(QubiResponse& response);
+  void expire(unsigned long now);
+  void waitForData(uint32_t maxMs);
+
+public:
+  explicit QubiController(IPAddress host, uint16_t port = QUBI_DEFAULT_PORT,
+                          const QubiControllerOptions& options = QubiControllerOptions());
+  ~QubiController();
+  QubiController(const QubiController&) = delete;
+  QubiController& operator=(const QubiController&) = delete;
+
+  // Opens the socket (port 0 = any free port)
+  bool begin(uint16_t localPort = 0);
+  // Fails every pending request with CLOSED
+  void close();
+  bool isConnected() const { return _open; }
+
+  // Pipelined requests. The callback runs from poll() with the first
+  // response carrying the request's sequence number, or on timeout. Returns
+  // the sequence number; 0 means the callback has already run, either with
+  // SEND_FAILED or, without sequence tracking, with OK once sent.
+  uint32_t sendCommandAsync(const QubiCommand& command, QubiResponseCallback callback);
+  uint32_t sendBatchAsync(const QubiCommand* commands, size_t count, QubiResponseCallback callback);
+  // Reads every queued response, runs callbacks and handles deadlines;
+  // returns the number of responses read
+  size_t poll();
+  size_t pending() const { return _pending.size(); }
+
+  // Blocking forms, like send_command/send_batch in Python. They wait on the
+  // system clock, so use the async forms under a QubiVirtualClock.
+  QubiRequestResult sendCommand(const QubiCommand& command, QubiResponse& response);
+  QubiRequestResult sendBatch(const QubiCommand* commands, size_t count, QubiResponse& response);
+
+  // Broadcasts "discover" and collects the answers (blocking)
+  std::vector<QubiDiscoveredModule> discover(const QubiDiscoveryOptions& options = QubiDiscoveryOptions());
+
+  // Called for every response, matched or not, before its request callback
+  void addResponseHandler(std::function<void(const QubiResponse&)> handler);
+
+  IPAddress getHost() const { return _host; }
+  uint16_t getPort() const { return _port; }
+  const QubiControllerStats& getStats() const { return _stats; }
+  // Host-only access to the socket, e.g. for impairment setup
+  WiFiUDP& udp() { return _udp; }
+};
+
+const char* qubiModuleTypeName(QubiModuleType type);
+QubiModuleType qubiModuleTypeFromName(const char* name);  // CUSTOM if unknown
+// A request message with the given commands; sequence 0 leaves it out
+std::string qubiSerializeCommands(const QubiCommand* commands, size_t count, uint32_t sequence);
+// Reads the fields every response carries; false if it is not one
+bool qubiParseResponse(JsonDocument& doc, const char* text, size_t length, QubiResponse& response);
+
+#endif // QUBI_CONTROLLER_H
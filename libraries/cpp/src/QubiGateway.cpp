@@ -0,0 +1,412 @@
+#include "QubiGateway.h"
+
+#include <poll.h>
+
+const char* qubiRequestResultName(QubiRequestResult result) {
+  switch (result) {
+    case QubiRequestResult::OK: return "ok";
+    case QubiRequestResult::ERROR: return "error";
+    case QubiRequestResult::TIMEOUT: return "timeout";
+    case QubiRequestResult::SEND_FAILED: return "send_failed";
+    default: return "closed";
+  }
+}
+
+QubiGateway::QubiGateway(const QubiGatewayOptions& options)
+  : _options(options), _open(false), _listening(false), _fanoutId(0) {
+  memset(&_stats, 0, sizeof(_stats));
+}
+
+QubiGateway::~QubiGateway() {
+  close();
+}
+
+bool QubiGateway::begin(uint16_t localPort) {
+  close();
+  _udp.setDatagramSize(QUBI_HOST_UDP_MAX_PACKET);
+  _open = _udp.begin(localPort) == 1;
+  // A fan-out's requests go out in as few sendmmsg() calls as possible
+  _udp.setSendBatch(QUBI_HOST_UDP_BATCH);
+  return _open;
+}
+
+bool QubiGateway::listen(uint16_t port) {
+  if (_listening) _front.stop();
+  _front.setDatagramSize(QUBI_HOST_UDP_MAX_PACKET);
+  _listening = _front.begin(port) == 1;
+  return _listening;
+}
+
+void QubiGateway::close() {
+  if (_open) {
+    _udp.stop();
+    _open = false;
+  }
+  if (_listening) {
+    _front.stop();
+    _listening = false;
+  }
+
+  std::vector<uint32_t> ids;
+  for (auto& entry : _fanouts) {
+    ids.push_back(entry.first);
+  }
+  for (uint32_t id : ids) {
+    complete(id, QubiRequestResult::CLOSED);
+  }
+  _attemptDeadlines = decltype(_attemptDeadlines)();
+  _fanoutDeadlines = decltype(_fanoutDeadlines)();
+}
+
+void QubiGateway::addModule(const QubiFleetModule& module) {
+  for (auto& member : _members) {
+    if (member.module.id == module.id) {
+      member.module = module;
+      return;
+    }
+  }
+  _members.push_back(Member{module, 0});
+}
+
+bool QubiGateway::removeModule(const String& id) {
+  for (size_t i = 0; i < _members.size(); i++) {
+    if (_members[i].module.id == id) {
+      // Requests in flight still match by address and complete as usual
+      _members.erase(_members.begin() + i);
+      return true;
+    }
+  }
+  return false;
+}
+
+size_t QubiGateway::addModules(const std::vector<QubiDiscoveredModule>& modules, const String& group) {
+  size_t added = 0;
+  for (const auto& found : modules) {
+    size_t before = _members.size();
+    addModule(QubiFleetModule{found.id, qubiModuleTypeFromName(found.type.c_str()), group, found.ip, found.port});
+    added += _members.size() - before;
+  }
+  return added;
+}
+
+std::vector<size_t> QubiGateway::select(const String& moduleId, QubiModuleType type) const {
+  std::vector<size_t> selected;
+  bool all = moduleId == "*";
+  bool group = moduleId.startsWith("@");
+  String name = group ? moduleId.substring(1) : String();
+
+  for (size_t i = 0; i < _members.size(); i++) {
+    const QubiFleetModule& module = _members[i].module;
+    if (!all && !group) {
+      if (module.id == moduleId) selected.push_back(i);
+      continue;
+    }
+    if (group && module.group != name) continue;
+    if (type != QubiModuleType::CUSTOM && module.type != type) continue;
+    selected.push_back(i);
+  }
+  return selected;
+}
+
+uint32_t QubiGateway::nextSequence(Member& member) {
+  // Each module sees its own gap-free run of sequence numbers; skip 0 and
+  // any still in flight after a wrap
+  uint64_t address = addressKey(member.module.ip, member.module.port);
+  do {
+    member.sequence = member.sequence % QUBI_CONTROLLER_MAX_SEQUENCE + 1;
+  } while (_requests.count(RequestKey{address, member.sequence}));
+  return member.sequence;
+}
+
+bool QubiGateway::transmit(const Request& request) {
+  _stats.sent++;
+  return _udp.beginPacket(request.ip, request.port) &&
+         _udp.write((const uint8_t*)request.payload.data(), request.payload.size()) == request.payload.size() &&
+         _udp.endPacket();
+}
+
+uint32_t QubiGateway::fanOut(const QubiCommand* commands, size_t count, QubiFanoutCallback callback,
+                             uint32_t deadlineMs) {
+  _stats.fanouts++;
+
+  // The commands for each selected module, in the order the modules were
+  // first selected
+  std::vector<size_t> order;
+  std::unordered_map<size_t, std::vector<size_t>> assigned;
+  for (size_t i = 0; i < count; i++) {
+    for (size_t index : select(commands[i].moduleId, commands[i].moduleType)) {
+      std::vector<size_t>& list = assigned[index];
+      if (list.empty()) order.push_back(index);
+      list.push_back(i);
+    }
+  }
+
+  do {
+    _fanoutId++;
+  } while (_fanoutId == 0 || _fanouts.count(_fanoutId));
+  uint32_t id = _fanoutId;
+  Fanout& fanout = _fanouts[id];
+  fanout.result.id = id;
+  fanout.result.modules.resize(order.size());
+  fanout.result.ok = fanout.result.failed = fanout.result.timedOut = fanout.result.elapsedUs = 0;
+  fanout.callback = std::move(callback);
+  fanout.requests.resize(order.size(), RequestKey{0, 0});
+  fanout.outstanding = order.size();
+  fanout.startUs = micros();
+  fanout.deadline = millis() + (deadlineMs > 0 ? deadlineMs : _options.deadlineMs);
+
+  for (size_t slot = 0; slot < order.size(); slot++) {
+    Member& member = _members[order[slot]];
+    const std::vector<size_t>& list = assigned[order[slot]];
+    QubiModuleOutcome& outcome = fanout.result.modules[slot];
+    outcome.moduleId = member.module.id;
+    outcome.status = 0;
+    outcome.latencyUs = 0;
+    outcome.attempts = 0;
+
+    // A module takes at most QUBI_MAX_COMMANDS per message
+    if (!_open || list.size() > QUBI_MAX_COMMANDS) {
+      settle(fanout, slot, QubiRequestResult::SEND_FAILED);
+      continue;
+    }
+    QubiCommand batch[QUBI_MAX_COMMANDS];
+    for (size_t i = 0; i < list.size(); i++) {
+      batch[i] = commands[list[i]];
+      batch[i].moduleId = member.module.id;
+      batch[i].moduleType = member.module.type;
+    }
+    RequestKey key = {addressKey(member.module.ip, member.module.port), nextSequence(member)};
+    std::string payload = qubiSerializeCommands(batch, list.size(), key.sequence);
+    if (payload.size() > QUBI_BUFFER_SIZE) {
+      settle(fanout, slot, QubiRequestResult::SEND_FAILED);
+      continue;
+    }
+
+    // A failed send is left to the attempt deadline, which resends it
+    Request& request = _requests[key];
+    request = Request{id, slot, std::move(payload), member.module.ip, member.module.port, micros(),
+                      millis() + _options.attemptTimeoutMs};
+    fanout.requests[slot] = key;
+    outcome.attempts = 1;
+    transmit(request);
+    _attemptDeadlines.push(AttemptDeadline(request.deadline, key));
+  }
+  _udp.flushSends();
+
+  if (fanout.outstanding == 0) {
+    complete(id, QubiRequestResult::TIMEOUT);
+    return 0;
+  }
+  _fanoutDeadlines.push(FanoutDeadline(fanout.deadline, id));
+  return id;
+}
+
+void QubiGateway::settle(Fanout& fanout, size_t slot, QubiRequestResult result) {
+  fanout.result.modules[slot].result = result;
+  fanout.outstanding--;
+  if (result == QubiRequestResult::OK) {
+    fanout.result.ok++;
+  } else if (result == QubiRequestResult::TIMEOUT || result == QubiRequestResult::CLOSED) {
+    fanout.result.timedOut++;
+  } else {
+    fanout.result.failed++;
+  }
+}
+
+void QubiGateway::complete(uint32_t id, QubiRequestResult unanswered) {
+  auto entry = _fanouts.find(id);
+  if (entry == _fanouts.end()) return;
+  Fanout fanout = std::move(entry->second);
+  _fanouts.erase(entry);
+
+  for (size_t slot = 0; slot < fanout.requests.size(); slot++) {
+    auto request = _requests.find(fanout.requests[slot]);
+    if (request == _requests.end() || request->second.fanout != id) continue;  // Answered or never sent
+    _requests.erase(request);
+    if (unanswered == QubiRequestResult::TIMEOUT) _stats.timeouts++;
+    settle(fanout, slot, unanswered);
+  }
+
+  fanout.result.elapsedUs = micros() - fanout.startUs;
+  fanout.callback(fanout.result);
+}
+
+size_t QubiGateway::receive() {
+  size_t count = 0;
+  int length;
+  while (_open && (length = _udp.parsePacket()) > 0) {
+    count++;
+    _stats.received++;
+    length = _udp.read(_rxBuffer, QUBI_HOST_UDP_MAX_PACKET);
+    QubiResponse response = QubiResponse();
+    if (length <= 0 || !qubiParseResponse(_rxDoc, _rxBuffer, length, response)) {
+      _stats.invalid++;
+      continue;
+    }
+
+    auto entry = _requests.find(RequestKey{addressKey(_udp.remoteIP(), _udp.remotePort()), response.sequence});
+    if (response.sequence == 0 || entry == _requests.end()) {
+      _stats.unmatched++;
+      continue;
+    }
+    _stats.matched++;
+    uint32_t id = entry->second.fanout;
+    size_t slot = entry->second.slot;
+    unsigned long sentUs = entry->second.sentUs;
+    _requests.erase(entry);
+
+    Fanout& fanout = _fanouts[id];
+    QubiModuleOutcome& outcome = fanout.result.modules[slot];
+    outcome.status = response.status;
+    outcome.message = response.message;
+    outcome.latencyUs = micros() - sentUs;
+    outcome.data.set(response.data);
+    outcome.data.remove("sequence");  // The module's own, not the client's
+    settle(fanout, slot, response.status < 400 ? QubiRequestResult::OK : QubiRequestResult::ERROR);
+    if (fanout.outstanding == 0) complete(id, QubiRequestResult::TIMEOUT);
+  }
+  return count;
+}
+
+void QubiGateway::expire(unsigned long now) {
+  while (!_fanoutDeadlines.empty() && (long)(now - _fanoutDeadlines.top().first) >= 0) {
+    uint32_t id = _fanoutDeadlines.top().second;
+    _fanoutDeadlines.pop();
+    complete(id, QubiRequestResult::TIMEOUT);
+  }
+
+  while (!_attemptDeadlines.empty() && (long)(now - _attemptDeadlines.top().first) >= 0) {
+    AttemptDeadline due = _attemptDeadlines.top();
+    _attemptDeadlines.pop();
+
+    auto entry = _requests.find(due.second);
+    if (entry == _requests.end() || entry->second.deadline != due.first) continue;  // Answered or resent
+
+    Request& request = entry->second;
+    QubiModuleOutcome& outcome = _fanouts[request.fanout].result.modules[request.slot];
+    if (outcome.attempts > _options.retries) continue;  // Left to the fan-out's deadline
+    outcome.attempts++;
+    request.deadline = now + _options.attemptTimeoutMs;
+    _attemptDeadlines.push(AttemptDeadline(request.deadline, due.second));
+    _stats.resent++;
+    transmit(request);
+  }
+  _udp.flushSends();
+}
+
+void QubiGateway::reply(IPAddress ip, uint16_t port, const JsonDocument& doc) {
+  if (!_listening) return;
+  std::string payload;
+  serializeJson(doc, payload);
+  _front.beginPacket(ip, port);
+  _front.write((const uint8_t*)payload.data(), payload.size());
+  _front.endPacket();
+}
+
+size_t QubiGateway::serveClients() {
+  size_t count = 0;
+  int length;
+  while (_listening && (length = _front.parsePacket()) > 0) {
+    count++;
+    _stats.clientRequests++;
+    IPAddress ip = _front.remoteIP();
+    uint16_t port = _front.remotePort();
+    length = _front.read(_rxBuffer, QUBI_HOST_UDP_MAX_PACKET);
+
+    JsonDocument& doc = _frontDoc;
+    if (length <= 0 || deserializeJson(doc, _rxBuffer, length) || !doc["commands"].is<JsonArray>()) {
+      _stats.clientErrors++;
+      JsonDocument error;
+      error["status"] = (int)QubiStatusCode::BAD_REQUEST;
+      error["message"] = "Invalid message format";
+      error["module_id"] = "gateway";
+      error["timestamp"] = millis();
+      reply(ip, port, error);
+      continue;
+    }
+
+    uint32_t sequence = doc["sequence"] | (uint32_t)0;
+    uint32_t deadlineMs = doc["deadline_ms"] | (uint32_t)0;
+    std::vector<QubiCommand> commands;
+    for (JsonObject item : doc["commands"].as<JsonArray>()) {
+      QubiCommand command;
+      command.moduleId = item["module_id"] | "*";
+      command.moduleType = qubiModuleTypeFromName(item["module_type"] | "custom");
+      command.action = item["action"] | "";
+      command.params = item["params"].as<JsonObject>();
+      commands.push_back(command);
+    }
+
+    fanOut(commands.data(), commands.size(), [this, ip, port, sequence](const QubiFanoutResult& result) {
+      JsonDocument response;
+      if (result.modules.empty()) {
+        _stats.clientErrors++;
+        response["status"] = (int)QubiStatusCode::NOT_FOUND;
+        response["message"] = "No module matches";
+      } else {
+        // The fan-out itself succeeded; how each module fared is in results
+        response["status"] = (int)QubiStatusCode::SUCCESS;
+        response["message"] = "OK";
+      }
+      response["module_id"] = "gateway";
+      response["timestamp"] = millis();
+
+      JsonObject data = response["data"].to<JsonObject>();
+      if (sequence != 0) data["sequence"] = sequence;
+      data["ok"] = result.ok;
+      data["failed"] = result.failed;
+      data["timed_out"] = result.timedOut;
+      data["elapsed_us"] = result.elapsedUs;
+      JsonArray results = data["results"].to<JsonArray>();
+      for (const QubiModuleOutcome& outcome : result.modules) {
+        JsonObject entry = results.add<JsonObject>();
+        entry["module_id"] = outcome.moduleId;
+        entry["result"] = qubiRequestResultName(outcome.result);
+        entry["status"] = outcome.status;
+        entry["attempts"] = outcome.attempts;
+        if (outcome.status != 0) {
+          entry["message"] = outcome.message;
+          entry["latency_us"] = outcome.latencyUs;
+          if (outcome.data.size() > 0) entry["data"] = outcome.data;
+        }
+      }
+
+      // Module data is the first thing to go if the answer won't fit
+      if (measureJson(response) > QUBI_HOST_UDP_MAX_PACKET) {
+        for (JsonObject entry : results) {
+          entry.remove("data");
+        }
+      }
+      reply(ip, port, response);
+    }, deadlineMs);
+  }
+  return count;
+}
+
+size_t QubiGateway::poll() {
+  size_t count = receive() + serveClients();
+  expire(millis());
+  return count;
+}
+
+void QubiGateway::wait(uint32_t maxMs) {
+  unsigned long now = millis();
+  if (!_attemptDeadlines.empty()) {
+    long left = (long)(_attemptDeadlines.top().first - now);
+    maxMs = left <= 0 ? 0 : std::min<uint32_t>(maxMs, left);
+  }
+  if (!_fanoutDeadlines.empty()) {
+    long left = (long)(_fanoutDeadlines.top().first - now);
+    maxMs = left <= 0 ? 0 : std::min<uint32_t>(maxMs, left);
+  }
+
+  pollfd sockets[2];
+  nfds_t count = 0;
+  if (_open && _udp.fd() >= 0) sockets[count++] = {_udp.fd(), POLLIN, 0};
+  if (_listening && _front.fd() >= 0) sockets[count++] = {_front.fd(), POLLIN, 0};
+  if (count == 0) {
+    delay(maxMs < 1 ? maxMs : 1);  // Simulated network: nothing to block on
+    return;
+  }
+  ::poll(sockets, count, (int)maxMs);
+}
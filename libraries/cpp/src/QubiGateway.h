@@ -0,0 +1,190 @@
+#ifndef QUBI_GATEWAY_H
+#define QUBI_GATEWAY_H
+
+#include "QubiController.h"
+
+// Fleet gateway. It takes one command addressed to a group of modules, sends
+// it to each of them from a single socket, and reports one aggregated result
+// with every module's status and latency once all have answered or the
+// deadline has passed.
+//
+// A command's module_id picks the modules:
+//   "*"        every known module
+//   "@name"    the modules in group "name", e.g. one robot
+//   otherwise  the module with that id
+// A module_type other than "custom" narrows "*" and "@name" to that type.
+// Each module gets the commands that selected it in one message, under its
+// own id and its own sequence numbers, and requests that go unanswered are
+// resent until the deadline.
+//
+// listen() also serves requests from clients such as web UIs and scripts
+// over UDP, in the usual message format with an optional "deadline_ms".
+#define QUBI_GATEWAY_PORT 8890
+
+struct QubiFleetModule {
+  String id;
+  QubiModuleType type;
+  String group;  // Optional, e.g. the robot the module belongs to
+  IPAddress ip;
+  uint16_t port;
+};
+
+struct QubiGatewayOptions {
+  uint32_t deadlineMs = 1000;        // Per fan-out, unless the request gives its own
+  uint32_t attemptTimeoutMs = 200;   // Before an unanswered request is resent
+  uint8_t retries = 2;               // Resends per module, within the deadline
+};
+
+struct QubiModuleOutcome {
+  String moduleId;
+  QubiRequestResult result;
+  int status;          // Response status; 0 without a response
+  String message;
+  uint32_t latencyUs;  // From the first send to the response
+  uint8_t attempts;
+  JsonDocument data;   // The response's data
+};
+
+struct QubiFanoutResult {
+  uint32_t id;
+  std::vector<QubiModuleOutcome> modules;
+  uint32_t ok;
+  uint32_t failed;     // ERROR and SEND_FAILED
+  uint32_t timedOut;   // TIMEOUT and CLOSED
+  uint32_t elapsedUs;
+};
+
+struct QubiGatewayStats {
+  uint32_t fanouts;
+  uint32_t sent;            // Datagrams to modules, resends included
+  uint32_t resent;
+  uint32_t received;        // Datagrams from modules
+  uint32_t matched;
+  uint32_t unmatched;       // Late, duplicate or unsolicited responses
+  uint32_t invalid;
+  uint32_t timeouts;        // Modules without an answer by the deadline
+  uint32_t clientRequests;  // Through listen()
+  uint32_t clientErrors;    // Client requests answered with 400 or 404
+};
+
+typedef std::function<void(const QubiFanoutResult& result)> QubiFanoutCallback;
+
+class QubiGateway {
+private:
+  struct Member {
+    QubiFleetModule module;
+    uint32_t sequence;
+  };
+  // A module's request: its source address and the sequence number it went
+  // out with, which the module echoes
+  struct RequestKey {
+    uint64_t address;
+    uint32_t sequence;
+    bool operator==(const RequestKey& other) const {
+      return address == other.address && sequence == other.sequence;
+    }
+  };
+  struct RequestKeyHash {
+    size_t operator()(const RequestKey& key) const {
+      return std::hash<uint64_t>()(key.address * 0x9E3779B97F4A7C15ULL ^ key.sequence);
+    }
+  };
+  struct Request {
+    uint32_t fanout;
+    size_t slot;  // In the fan-out's result
+    std::string payload;
+    IPAddress ip;
+    uint16_t port;
+    unsigned long sentUs;
+    unsigned long deadline;  // Of the current attempt, millis()
+  };
+  struct Fanout {
+    QubiFanoutResult result;
+    QubiFanoutCallback callback;
+    std::vector<RequestKey> requests;  // By slot
+    size_t outstanding;
+    unsigned long startUs;
+    unsigned long deadline;
+  };
+
+  QubiGatewayOptions _options;
+  WiFiUDP _udp;
+  WiFiUDP _front;
+  bool _open;
+  bool _listening;
+  uint32_t _fanoutId;
+
+  std::vector<Member> _members;
+  std::unordered_map<RequestKey, Request, RequestKeyHash> _requests;
+  std::unordered_map<uint32_t, Fanout> _fanouts;
+  // Deadline order, as in QubiController: entries for requests that have
+  // been answered or resent, and fan-outs that have completed, are skipped
+  typedef std::pair<unsigned long, RequestKey> AttemptDeadline;
+  struct AttemptLater {
+    bool operator()(const AttemptDeadline& a, const AttemptDeadline& b) const { return a.first > b.first; }
+  };
+  std::priority_queue<AttemptDeadline, std::vector<AttemptDeadline>, AttemptLater> _attemptDeadlines;
+  typedef std::pair<unsigned long, uint32_t> FanoutDeadline;
+  std::priority_queue<FanoutDeadline, std::vector<FanoutDeadline>, std::greater<FanoutDeadline>> _fanoutDeadlines;
+
+  JsonDocument _rxDoc;
+  JsonDocument _frontDoc;
+  char _rxBuffer[QUBI_HOST_UDP_MAX_PACKET + 1];
+  QubiGatewayStats _stats;
+
+  static uint64_t addressKey(IPAddress ip, uint16_t port) { return (uint64_t)(uint32_t)ip << 16 | port; }
+  uint32_t nextSequence(Member& member);
+  bool transmit(const Request& request);
+  void settle(Fanout& fanout, size_t slot, QubiRequestResult result);
+  void complete(uint32_t id, QubiRequestResult unanswered);
+  size_t receive();
+  size_t serveClients();
+  void reply(IPAddress ip, uint16_t port, const JsonDocument& doc);
+  void expire(unsigned long now);
+
+public:
+  explicit QubiGateway(const QubiGatewayOptions& options = QubiGatewayOptions());
+  ~QubiGateway();
+  QubiGateway(const QubiGateway&) = delete;
+  QubiGateway& operator=(const QubiGateway&) = delete;
+
+  // Opens the socket towards the modules (port 0 = any free port)
+  bool begin(uint16_t localPort = 0);
+  // Also serves client requests on this port
+  bool listen(uint16_t port = QUBI_GATEWAY_PORT);
+  // Completes every fan-out in progress, with CLOSED for modules that had
+  // not answered
+  void close();
+
+  // Adds a module, or updates the one with the same id
+  void addModule(const QubiFleetModule& module);
+  bool removeModule(const String& id);
+  // Adds what QubiController::discover() found; returns the number added
+  size_t addModules(const std::vector<QubiDiscoveredModule>& modules, const String& group = "");
+  size_t moduleCount() const { return _members.size(); }
+  const QubiFleetModule& module(size_t index) const { return _members[index].module; }
+  // Indexes of the modules a module_id and module_type select
+  std::vector<size_t> select(const String& moduleId, QubiModuleType type) const;
+
+  // Sends the commands to the modules they select. The callback runs from
+  // poll() once every module has answered or the deadline (0 = the
+  // options' default) has passed. Returns the fan-out's id; 0 means the
+  // callback has already run, because no module was selected or none could
+  // be sent to.
+  uint32_t fanOut(const QubiCommand* commands, size_t count, QubiFanoutCallback callback, uint32_t deadlineMs = 0);
+  // Reads responses and client requests, resends and completes fan-outs;
+  // returns the number of datagrams read
+  size_t poll();
+  // Blocks until a socket has data, the next deadline, or maxMs
+  void wait(uint32_t maxMs);
+  size_t pending() const { return _fanouts.size(); }
+
+  const QubiGatewayStats& getStats() const { return _stats; }
+  // Host-only access to the sockets, e.g. for impairment setup
+  WiFiUDP& udp() { return _udp; }
+  WiFiUDP& front() { return _front; }
+};
+
+const char* qubiRequestResultName(QubiRequestResult result);
+
+#endif // QUBI_GATEWAY_H
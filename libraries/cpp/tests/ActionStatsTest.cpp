@@ -0,0 +1,97 @@
+/*
+ * Per-action latency entries and budgets.
+ *
+ * Handlers take a set virtual time, so the histograms and budget overruns
+ * can be checked exactly. Built-in actions, budgeted actions and tracked
+ * actions get entries of their own; a client sending made-up action names,
+ * through either parse path, must only ever add to the shared "*" entry,
+ * and the table keeps a slot for "*" however many actions are tracked.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+uint32_t countOf(const QubiModule& module, const char* action) {
+  const QubiActionStats* stats = module.findActionStats(action);
+  return stats ? stats->count : 0;
+}
+
+}  // namespace
+
+int main() {
+  {
+    QubiTestFixture<> bench;
+    bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+      delayMicroseconds(cmd.action == "set_servo" ? 3000 : 100);
+      bench.module.sendSuccess();
+    });
+    uint32_t alarms = 0;
+    uint32_t alarmTotal = 0;
+    bench.module.setBudgetHandler([&](const QubiActionStats& stats, uint32_t totalUs) {
+      QUBI_CHECK(strcmp(stats.action, "set_servo") == 0);
+      alarms++;
+      alarmTotal = totalUs;
+    });
+    QUBI_CHECK(bench.module.setActionBudget("set_servo", 2000));
+    QUBI_CHECK(bench.module.setActionBudget("stop", 2000));
+    QUBI_CHECK(bench.module.trackAction("get_position"));
+    QUBI_CHECK(bench.module.getActionStatsCount() == 3);
+
+    for (int i = 0; i < 3; i++) bench.request("set_servo", "{\"angle\":1}");
+    bench.request("stop");
+    bench.request("get_position");
+    bench.request("discover");
+    const QubiActionStats* servo = bench.module.findActionStats("set_servo");
+    QUBI_CHECK(servo && servo->count == 3 && servo->overruns == 3);
+    if (servo) QUBI_CHECK_RANGE(servo->handler.maxUs, 3000, 3100);
+    QUBI_CHECK(alarms == 3 && bench.module.getStats().budgetOverruns == 3);
+    QUBI_CHECK_RANGE(alarmTotal, 3000, 3100);
+    QUBI_CHECK(countOf(bench.module, "stop") == 1 && bench.module.findActionStats("stop")->overruns == 0);
+    QUBI_CHECK(countOf(bench.module, "get_position") == 1 && countOf(bench.module, "discover") == 1);
+
+    // Made-up names, then an untracked real one, all land in "*"
+    for (int i = 0; i < 20; i++) bench.request(("junk" + std::to_string(i)).c_str());
+    bench.module.setStreamHandler([&](QubiStreamCommand&) { bench.module.sendSuccess(); });
+    for (int i = 20; i < 30; i++) bench.request(("junk" + std::to_string(i)).c_str());
+    bench.module.setStreamHandler(nullptr);
+    bench.request("set_position");
+    QUBI_CHECK(countOf(bench.module, "*") == 31);
+    QUBI_CHECK(!bench.module.findActionStats("junk0") && !bench.module.findActionStats("set_position"));
+    QUBI_CHECK(bench.module.getActionStatsCount() == 5);
+
+    // Controllers see the same entries
+    JsonDocument doc;
+    QUBI_CHECK(!deserializeJson(doc, bench.request("action_stats")));
+    int reported = 0;
+    for (JsonObject entry : doc["data"]["actions"].as<JsonArray>()) {
+      reported++;
+      if (std::string(entry["action"] | "") == "*") QUBI_CHECK((entry["count"] | 0) == 31);
+      if (std::string(entry["action"] | "") == "set_servo") QUBI_CHECK((entry["overruns"] | 0) == 3);
+    }
+    QUBI_CHECK(reported == 5);
+
+    // Room for two more named entries with "*" in place, and budgets kept
+    // through a reset
+    QUBI_CHECK(bench.module.trackAction("a") && bench.module.trackAction("b"));
+    QUBI_CHECK(!bench.module.trackAction("c") && !bench.module.setActionBudget("c", 10));
+    QUBI_CHECK(bench.module.getActionStatsCount() == QUBI_MAX_ACTION_STATS);
+    bench.module.resetActionStats();
+    QUBI_CHECK(countOf(bench.module, "*") == 0 && bench.module.findActionStats("set_servo")->budgetUs == 2000);
+  }
+
+  {
+    // Tracking fills every slot but the one kept for "*"
+    QubiTestFixture<> bench;
+    bench.module.setCommandHandler([&](const QubiCommand&) { bench.module.sendSuccess(); });
+    for (int i = 0; i < QUBI_MAX_ACTION_STATS - 1; i++) {
+      QUBI_CHECK(bench.module.trackAction(("action" + std::to_string(i)).c_str()));
+    }
+    QUBI_CHECK(!bench.module.trackAction("one_more"));
+    bench.request("one_more");
+    bench.request("action0");
+    QUBI_CHECK(countOf(bench.module, "*") == 1 && countOf(bench.module, "action0") == 1);
+    QUBI_CHECK(bench.module.getActionStatsCount() == QUBI_MAX_ACTION_STATS);
+  }
+  return qubiTestResult("ActionStatsTest");
+}
@@ -0,0 +1,129 @@
+/*
+ * Message authentication and replay rejection.
+ *
+ * With a key added, only correctly tagged request frames reach a handler:
+ * forged tags, unknown keys, plain datagrams, replays and the module's own
+ * responses sent back to it are dropped without a reply and counted.
+ * Responses are tagged in the response direction. After a restart, frames
+ * captured earlier are still replays.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+const uint8_t KEY[QUBI_AUTH_KEY_SIZE] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16};
+
+// Frames are kept as byte strings, as the fixture sends and receives them
+typedef std::string Frame;
+
+Frame frame(uint32_t sequence, const std::string& json, uint8_t keyId = 0,
+            uint8_t domain = QUBI_AUTH_DOMAIN_REQUEST) {
+  const uint8_t header[] = {QUBI_FRAME_MAGIC, QUBI_FRAME_AUTHENTICATED, (uint8_t)(json.size() >> 8),
+                            (uint8_t)json.size(), keyId, (uint8_t)(sequence >> 24), (uint8_t)(sequence >> 16),
+                            (uint8_t)(sequence >> 8), (uint8_t)sequence};
+  Frame f((const char*)header, sizeof(header));
+  f += json;
+  QubiSipHash mac(KEY);
+  mac.update(&domain, 1);
+  mac.update((const uint8_t*)f.data(), f.size());
+  uint8_t tag[QUBI_AUTH_TAG_SIZE];
+  mac.finish(tag);
+  f.append((const char*)tag, sizeof(tag));
+  return f;
+}
+
+bool tagValid(const Frame& f, uint8_t domain) {
+  if (f.size() < QUBI_FRAME_HEADER_SIZE + QUBI_AUTH_HEADER_SIZE + QUBI_AUTH_TAG_SIZE) return false;
+  QubiSipHash mac(KEY);
+  mac.update(&domain, 1);
+  mac.update((const uint8_t*)f.data(), f.size() - QUBI_AUTH_TAG_SIZE);
+  uint8_t tag[QUBI_AUTH_TAG_SIZE];
+  mac.finish(tag);
+  return qubiTagsEqual(tag, (const uint8_t*)f.data() + f.size() - QUBI_AUTH_TAG_SIZE);
+}
+
+uint32_t sequenceOf(const Frame& f) {
+  if (f.size() < QUBI_FRAME_HEADER_SIZE + QUBI_AUTH_HEADER_SIZE) return 0;
+  const uint8_t* p = (const uint8_t*)f.data() + QUBI_FRAME_HEADER_SIZE + 1;
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+// Sends a frame and returns the reply, empty if the module dropped it
+Frame transact(QubiTestFixture<>& bench, const Frame& f) {
+  bench.sendMessage(f);
+  return bench.process();
+}
+
+}  // namespace
+
+int main() {
+  const std::string discover = qubiTestMessage("arm", "discover");
+  const std::string servo = qubiTestMessage("arm", "set_servo", "{\"angle\":45}");
+  Frame captured;
+
+  {
+    QubiTestFixture<> bench;
+    QUBI_CHECK(bench.module.addAuthKey(KEY) == 0);
+    int handled = 0;
+    bench.module.setCommandHandler([&](const QubiCommand&) {
+      handled++;
+      QUBI_CHECK(bench.module.isAuthenticated());
+      bench.module.sendSuccess();
+    });
+
+    // A tagged request is answered with a response tagged the other way
+    captured = frame(100, servo);
+    Frame response = transact(bench, captured);
+    QUBI_CHECK(handled == 1);
+    QUBI_CHECK(!response.empty() && (response[1] & QUBI_FRAME_AUTHENTICATED));
+    QUBI_CHECK(tagValid(response, QUBI_AUTH_DOMAIN_RESPONSE));
+    QUBI_CHECK(!tagValid(response, QUBI_AUTH_DOMAIN_REQUEST));
+
+    // Replays, reflections, forgeries, unknown keys and plain text. The
+    // reflected response carries a low sequence number, so it is a replay.
+    QUBI_CHECK(transact(bench, captured).empty());
+    QUBI_CHECK(bench.module.getStats().replays == 1);
+    QUBI_CHECK(transact(bench, response).empty());
+    QUBI_CHECK(transact(bench, frame(120, servo, 0, QUBI_AUTH_DOMAIN_RESPONSE)).empty());
+    Frame forged = frame(121, servo);
+    forged[QUBI_FRAME_HEADER_SIZE + QUBI_AUTH_HEADER_SIZE + 10] ^= 0x01;
+    QUBI_CHECK(transact(bench, forged).empty());
+    QUBI_CHECK(transact(bench, frame(122, servo, 3)).empty());
+    QUBI_CHECK(bench.module.getStats().authFailures == 3);
+    QUBI_CHECK(bench.module.getStats().replays == 2);
+    QUBI_CHECK(bench.request("set_servo", "{\"angle\":45}").empty());
+    QUBI_CHECK(bench.module.getStats().unauthenticated == 1);
+    QUBI_CHECK(handled == 1);
+
+    // Out of order within the window is fine, once each
+    QUBI_CHECK(!transact(bench, frame(130, discover)).empty());
+    QUBI_CHECK(!transact(bench, frame(125, discover)).empty());
+    QUBI_CHECK(transact(bench, frame(125, discover)).empty());
+    QUBI_CHECK(transact(bench, frame(130 - QUBI_REPLAY_WINDOW, discover)).empty());
+    QUBI_CHECK(bench.module.getStats().replays == 4);
+
+    // Response sequence numbers keep increasing
+    Frame first = transact(bench, frame(131, discover));
+    Frame second = transact(bench, frame(132, discover));
+    QUBI_CHECK(sequenceOf(second) > sequenceOf(first));
+  }
+
+  {
+    // After a restart everything up to the last reservation is a replay,
+    // and responses continue above the last reserved response sequence
+    QubiTestFixture<> bench;
+    bench.module.addAuthKey(KEY);
+    QUBI_CHECK(transact(bench, captured).empty());
+    QUBI_CHECK(transact(bench, frame(100 + QUBI_AUTH_SEQUENCE_RESERVE, discover)).empty());
+    QUBI_CHECK(bench.module.getStats().replays == 2);
+    Frame response = transact(bench, frame(101 + QUBI_AUTH_SEQUENCE_RESERVE, discover));
+    QUBI_CHECK(tagValid(response, QUBI_AUTH_DOMAIN_RESPONSE));
+    QUBI_CHECK(sequenceOf(response) > QUBI_AUTH_SEQUENCE_RESERVE);
+
+    // Plain datagrams are accepted again only when asked for
+    bench.module.setAuthRequired(false);
+    QUBI_CHECK(!bench.request("discover").empty());
+  }
+  return qubiTestResult("AuthTest");
+}
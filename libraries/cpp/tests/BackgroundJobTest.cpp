@@ -0,0 +1,95 @@
+/*
+ * Background jobs don't hold up commands.
+ *
+ * A job takes 300 us per step and always has more work, so every idle loop
+ * call gives it a full 1 ms slice. Commands are timed to arrive while the
+ * job is running; each must be handled as soon as the step in progress
+ * ends, in the same call, rather than on the next 10 ms loop tick.
+ *
+ * A second scenario runs jobs whose steps take no virtual time at all. The
+ * time budget never runs out, so only the step cap ends their turns; the
+ * jobs must still share each call and return.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+void runSlowSteps() {
+  QubiTestFixture<> bench;
+  int8_t job = bench.module.addBackgroundJob("flash", [] {
+    delayMicroseconds(300);
+    return true;
+  });
+
+  const int commands = 100;
+  uint64_t arrivals[commands];
+  int handled = 0;
+  unsigned long totalWaitUs = 0;
+  unsigned long maxWaitUs = 0;
+  bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+    int i = cmd.params["i"] | 0;
+    unsigned long waitUs = (unsigned long)(micros() - arrivals[i]);
+    handled++;
+    totalWaitUs += waitUs;
+    maxWaitUs = max(maxWaitUs, waitUs);
+    bench.module.sendSuccess("ok");
+  });
+
+  // Loop ticks at multiples of 10 ms run the job from the tick to 1.2 ms
+  // after it. Each command is sent between ticks and held on the inbound
+  // link for 0.1-1.1 ms from when the next tick first reads the socket.
+  for (int i = 0; i < commands; i++) {
+    uint64_t sendUs = 50000ull * i + 5000;
+    QubiImpairmentConfig link;
+    link.latencyUs = 100 + (i * 137) % 1000;
+    arrivals[i] = sendUs + 5000 + link.latencyUs;
+    bench.clock.at(sendUs, [&bench, i, link] {
+      bench.module.udp().setInboundImpairment(link);
+      char params[16];
+      snprintf(params, sizeof(params), "{\"i\":%d}", i);
+      bench.send("set_servo", params);
+      std::string reply;
+      while (bench.receive(reply)) {}
+    });
+  }
+  bench.loop(10000);
+  bench.clock.runFor(50000ull * commands);
+
+  const QubiBackgroundJob* stats = bench.module.getBackgroundJob(job);
+  std::printf("300 us steps: %d commands handled, wait after arrival avg %lu us, max %lu us; %u steps\n",
+              handled, handled ? totalWaitUs / handled : 0, maxWaitUs, stats->steps);
+  QUBI_CHECK(handled == commands);
+  QUBI_CHECK_RANGE(maxWaitUs, 0, 300);
+  QUBI_CHECK(stats->maxStepUs == 300);
+  // Four steps fill the slice in each of the 500 calls, less those cut
+  // short by a command
+  QUBI_CHECK_RANGE(stats->steps, 3 * 500, 4 * 500);
+}
+
+void runZeroTimeSteps() {
+  QubiTestFixture<QubiModule> bench("m1", QubiModuleType::CUSTOM);
+  int8_t first = bench.module.addBackgroundJob("first", [] { return true; });
+  int8_t second = bench.module.addBackgroundJob("second", [] { return true; });
+
+  int calls = 0;
+  bench.clock.every(10000, [&] {
+    bench.module.processMessages();
+    calls++;
+  });
+  bench.clock.runFor(1000000);
+
+  uint32_t firstSteps = bench.module.getBackgroundJob(first)->steps;
+  uint32_t secondSteps = bench.module.getBackgroundJob(second)->steps;
+  std::printf("zero-time steps: %d calls, %u and %u steps\n", calls, firstSteps, secondSteps);
+  QUBI_CHECK(firstSteps == (uint32_t)calls * QUBI_JOB_MAX_STEPS);
+  QUBI_CHECK(secondSteps == firstSteps);
+}
+
+}  // namespace
+
+int main() {
+  runSlowSteps();
+  runZeroTimeSteps();
+  return qubiTestResult("BackgroundJobTest");
+}
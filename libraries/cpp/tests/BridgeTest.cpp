@@ -0,0 +1,247 @@
+/*
+ * The WebSocket bridge's handshake and routing.
+ *
+ * Browsers connect over real loopback TCP; the modules are on the simulated
+ * network. The handshake must answer RFC 6455's sample key correctly and
+ * refuse other protocol versions and pages from other origins unless they
+ * are allowed. Two connections using the same sequence numbers must each
+ * get their own replies back under their own numbers, modules must become
+ * reachable by id once a broadcast discover has found them, and binary
+ * frames must reach the module named in the URL.
+ */
+
+#include "QubiTest.h"
+#include "QubiBridge.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+const char* SAMPLE_KEY = "dGhlIHNhbXBsZSBub25jZQ==";
+const char* SAMPLE_ACCEPT = "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=";
+
+struct Frame {
+  uint8_t opcode;
+  std::string payload;
+};
+
+// A browser's end of one connection
+struct Browser {
+  int fd = -1;
+  std::string input;
+
+  ~Browser() {
+    if (fd >= 0) close(fd);
+  }
+
+  bool connect(uint16_t port) {
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return ::connect(fd, (sockaddr*)&address, sizeof(address)) == 0;
+  }
+
+  void write(const std::string& data) { send(fd, data.data(), data.size(), MSG_NOSIGNAL); }
+
+  void drain() {
+    char buffer[4096];
+    ssize_t received;
+    while ((received = recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT)) > 0) input.append(buffer, received);
+  }
+
+  // The HTTP response to the handshake, "" if it hasn't arrived
+  std::string response() {
+    drain();
+    size_t end = input.find("\r\n\r\n");
+    if (end == std::string::npos) return "";
+    std::string headers = input.substr(0, end + 4);
+    input.erase(0, end + 4);
+    return headers;
+  }
+
+  // Masked, as browsers send them
+  void sendFrame(uint8_t opcode, const std::string& payload) {
+    std::string frame(1, (char)(0x80 | opcode));
+    if (payload.size() < 126) {
+      frame += (char)(0x80 | payload.size());
+    } else {
+      frame += (char)(0x80 | 126);
+      frame += (char)(payload.size() >> 8);
+      frame += (char)payload.size();
+    }
+    const uint8_t mask[4] = {0x12, 0x34, 0x56, 0x78};
+    frame.append((const char*)mask, 4);
+    for (size_t i = 0; i < payload.size(); i++) frame += (char)(payload[i] ^ mask[i % 4]);
+    write(frame);
+  }
+
+  bool nextFrame(Frame& frame) {
+    drain();
+    if (input.size() < 2) return false;
+    size_t length = input[1] & 0x7F;
+    size_t header = 2;
+    if (length == 126) {
+      if (input.size() < 4) return false;
+      length = (uint8_t)input[2] << 8 | (uint8_t)input[3];
+      header = 4;
+    }
+    if (input.size() < header + length) return false;
+    frame.opcode = input[0] & 0x0F;
+    frame.payload = input.substr(header, length);
+    input.erase(0, header + length);
+    return true;
+  }
+};
+
+std::string upgrade(const char* target = "/", const char* extra = "", const char* version = "13") {
+  return std::string("GET ") + target + " HTTP/1.1\r\nHost: 127.0.0.1\r\nUpgrade: websocket\r\n"
+         "Connection: Upgrade\r\nSec-WebSocket-Key: " + SAMPLE_KEY + "\r\nSec-WebSocket-Version: " + version +
+         "\r\n" + extra + "\r\n";
+}
+
+struct Rig {
+  QubiTestFixture<> bench;
+  QubiBridge bridge;
+
+  explicit Rig(const QubiBridgeOptions& options = QubiBridgeOptions()) : bridge(options) {
+    QUBI_CHECK(bridge.begin(0));
+    bench.loop(10000);
+    bench.module.setCommandHandler([this](const QubiCommand& cmd) {
+      JsonDocument data;
+      data["angle"] = cmd.params["angle"] | -1;
+      bench.module.sendSuccess("ok", data.as<JsonObject>());
+    });
+  }
+
+  // Lets the bridge and the module run for a while
+  void settle(int rounds = 5) {
+    for (int i = 0; i < rounds; i++) {
+      bridge.poll();
+      bench.clock.runFor(10000);
+    }
+    bridge.poll();
+  }
+
+  // Status line of the answer to a handshake
+  std::string shake(Browser& browser, const std::string& request) {
+    QUBI_CHECK(browser.connect(bridge.localPort()));
+    browser.write(request);
+    settle(1);
+    std::string response = browser.response();
+    return response.substr(0, response.find("\r\n"));
+  }
+
+  // Sends a text message and returns the reply's document
+  bool exchangeText(Browser& browser, const std::string& message, JsonDocument& reply) {
+    browser.sendFrame(0x1, message);
+    settle();
+    Frame frame;
+    return browser.nextFrame(frame) && frame.opcode == 0x1 && !deserializeJson(reply, frame.payload);
+  }
+};
+
+std::string servo(const char* moduleId, int sequence, int angle) {
+  return std::string("{\"version\":\"1.0\",\"sequence\":") + std::to_string(sequence) +
+         ",\"commands\":[{\"module_id\":\"" + moduleId + "\",\"action\":\"set_servo\",\"params\":{\"angle\":" +
+         std::to_string(angle) + "}}]}";
+}
+
+}  // namespace
+
+int main() {
+  {
+    Rig rig;
+
+    // RFC 6455's sample handshake; requests without an Origin are scripts
+    Browser script;
+    QUBI_CHECK(script.connect(rig.bridge.localPort()));
+    script.write(upgrade());
+    rig.settle(1);
+    std::string response = script.response();
+    QUBI_CHECK(response.compare(0, 12, "HTTP/1.1 101") == 0);
+    QUBI_CHECK(response.find(std::string("Sec-WebSocket-Accept: ") + SAMPLE_ACCEPT + "\r\n") != std::string::npos);
+
+    // Pages from the bridge's own address or localhost, on any port
+    Browser local, named;
+    const std::string upgraded = "HTTP/1.1 101 Switching Protocols";
+    QUBI_CHECK(rig.shake(local, upgrade("/", "Origin: http://127.0.0.1:8080\r\n")) == upgraded);
+    QUBI_CHECK(rig.shake(named, upgrade("/", "Origin: http://LOCALHOST\r\n")) == upgraded);
+
+    // Other origins, whatever the Host header claims; other versions; no key
+    Browser evil, rebound, sandboxed, old, broken;
+    QUBI_CHECK(rig.shake(evil, upgrade("/", "Origin: http://evil.example\r\n")) == "HTTP/1.1 403 Forbidden");
+    QUBI_CHECK(rig.shake(rebound, "GET / HTTP/1.1\r\nHost: evil.example:8891\r\nOrigin: http://evil.example\r\n"
+                                  "Upgrade: websocket\r\nSec-WebSocket-Key: x\r\nSec-WebSocket-Version: 13\r\n\r\n") ==
+               "HTTP/1.1 403 Forbidden");
+    QUBI_CHECK(rig.shake(sandboxed, upgrade("/", "Origin: null\r\n")) == "HTTP/1.1 403 Forbidden");
+    QUBI_CHECK(rig.shake(old, upgrade("/", "", "8")) == "HTTP/1.1 426 Upgrade Required");
+    QUBI_CHECK(rig.shake(broken, "GET / HTTP/1.1\r\nUpgrade: websocket\r\n\r\n") == "HTTP/1.1 400 Bad Request");
+    QUBI_CHECK(rig.bridge.getStats().rejected == 5 && rig.bridge.getStats().connections == 3);
+
+    // A module the bridge hasn't heard of, then a discover that finds it
+    JsonDocument reply;
+    QUBI_CHECK(rig.exchangeText(script, servo("arm", 3, 10), reply));
+    QUBI_CHECK((reply["status"] | 0) == 404 && (reply["data"]["sequence"] | 0) == 3);
+    QUBI_CHECK(rig.exchangeText(script, "{\"version\":\"1.0\",\"sequence\":4,\"commands\":[{\"module_id\":\"*\","
+                                        "\"action\":\"discover\",\"params\":{}}]}", reply));
+    QUBI_CHECK((reply["status"] | 0) == 200 && (reply["data"]["sequence"] | 0) == 4);
+    QUBI_CHECK(std::string(reply["module_id"] | "") == "arm");
+    QUBI_CHECK(rig.bridge.moduleCount() == 1);
+
+    // Two pages with the same sequence numbers get their own replies
+    local.sendFrame(0x1, servo("arm", 5, 20));
+    named.sendFrame(0x1, servo("arm", 5, 30));
+    local.sendFrame(0x1, "[" + servo("arm", 6, 21) + "," + servo("arm", 7, 22) + "]");
+    rig.settle();
+    Frame frame;
+    int localReplies = 0;
+    while (local.nextFrame(frame)) {
+      QUBI_CHECK(!deserializeJson(reply, frame.payload));
+      int sequence = reply["data"]["sequence"] | 0;
+      QUBI_CHECK(sequence >= 5 && sequence <= 7 && (reply["data"]["angle"] | -1) == 15 + sequence);
+      localReplies++;
+    }
+    QUBI_CHECK(localReplies == 3);
+    QUBI_CHECK(named.nextFrame(frame) && !deserializeJson(reply, frame.payload));
+    QUBI_CHECK((reply["data"]["sequence"] | 0) == 5 && (reply["data"]["angle"] | -1) == 30);
+    QUBI_CHECK(!named.nextFrame(frame));
+  }
+
+  {
+    // Listed origins; a URL that names the module for binary frames, also
+    // when module= starts the target
+    QubiBridgeOptions options;
+    options.allowedOrigins.push_back("http://robot.local:8080");
+    Rig rig(options);
+    rig.bridge.addModule("arm", IPAddress(127, 0, 0, 1));
+    Browser listed, unlisted, bare, page;
+    QUBI_CHECK(rig.shake(listed, upgrade("/", "Origin: http://robot.local:8080\r\n")) ==
+               "HTTP/1.1 101 Switching Protocols");
+    QUBI_CHECK(rig.shake(unlisted, upgrade("/", "Origin: http://robot.local:9090\r\n")) == "HTTP/1.1 403 Forbidden");
+    QUBI_CHECK(rig.shake(bare, upgrade("module=arm")) == "HTTP/1.1 101 Switching Protocols");
+    QUBI_CHECK(rig.shake(page, upgrade("/?module=arm")) == "HTTP/1.1 101 Switching Protocols");
+
+    page.sendFrame(0x2, servo("arm", 9, 40));
+    rig.settle();
+    Frame frame;
+    JsonDocument reply;
+    QUBI_CHECK(page.nextFrame(frame) && frame.opcode == 0x1 && !deserializeJson(reply, frame.payload));
+    QUBI_CHECK((reply["data"]["sequence"] | 0) == 9 && (reply["data"]["angle"] | -1) == 40);
+  }
+
+  {
+    QubiBridgeOptions options;
+    options.allowedOrigins.push_back("*");
+    Rig rig(options);
+    Browser anywhere;
+    QUBI_CHECK(rig.shake(anywhere, upgrade("/", "Origin: https://example.org\r\n")) ==
+               "HTTP/1.1 101 Switching Protocols");
+  }
+  return qubiTestResult("BridgeTest");
+}
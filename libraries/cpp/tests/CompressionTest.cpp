@@ -0,0 +1,152 @@
+/*
+ * LZ compression round trips, on its own and through a module.
+ *
+ * The codec must give back exactly what went in, whatever chunk sizes the
+ * decompressor is fed, and must reject streams that are corrupt or would
+ * overflow the output. A module must accept compressed request frames and
+ * compress long responses, but only for clients that negotiated it.
+ */
+
+#include "QubiTest.h"
+
+#include <vector>
+
+namespace {
+
+bool roundTrip(const std::vector<uint8_t>& data, size_t chunk, size_t* compressedSize = nullptr) {
+  QubiCompressor compressor;
+  std::vector<uint8_t> compressed(data.size() * 2 + 16);
+  size_t length = compressor.compress(data.data(), data.size(), compressed.data(), compressed.size());
+  if (length == 0 && !data.empty()) return false;
+  if (compressedSize) *compressedSize = length;
+
+  std::vector<uint8_t> out(data.size());
+  QubiDecompressor decompressor(out.data(), out.size());
+  for (size_t at = 0; at < length; at += chunk) {
+    if (!decompressor.feed(compressed.data() + at, min(chunk, length - at))) return false;
+  }
+  return decompressor.length() == data.size() && out == data;
+}
+
+std::vector<uint8_t> bytes(const std::string& text) {
+  return std::vector<uint8_t>(text.begin(), text.end());
+}
+
+std::string trajectory(int points) {
+  std::string json = "{\"status\":200,\"data\":{\"points\":[";
+  for (int i = 0; i < points; i++) {
+    json += (i ? "," : "") + std::string("{\"t\":") + std::to_string(i * 20) + ",\"angle\":" +
+            std::to_string(90 + (i % 30) - 15) + "}";
+  }
+  return json + "]}}";
+}
+
+// Builds a compressed request frame: magic, flags, plain length, body
+std::string compressedFrame(const std::string& json) {
+  QubiCompressor compressor;
+  uint8_t body[QUBI_BUFFER_SIZE];
+  size_t length = compressor.compress((const uint8_t*)json.data(), json.size(), body, sizeof(body));
+  std::string frame;
+  frame += (char)QUBI_FRAME_MAGIC;
+  frame += (char)QUBI_FRAME_COMPRESSED;
+  frame += (char)(json.size() >> 8);
+  frame += (char)(json.size() & 0xFF);
+  frame.append((const char*)body, length);
+  return frame;
+}
+
+// Decodes a response frame, compressed or not
+std::string decodeReply(const std::string& reply, bool& compressed) {
+  compressed = !reply.empty() && (uint8_t)reply[0] == QUBI_FRAME_MAGIC;
+  if (!compressed) return reply;
+  size_t length = ((uint8_t)reply[2] << 8) | (uint8_t)reply[3];
+  std::string out(length, '\0');
+  QubiDecompressor decompressor((uint8_t*)&out[0], length);
+  if (!decompressor.feed((const uint8_t*)reply.data() + QUBI_FRAME_HEADER_SIZE,
+                         reply.size() - QUBI_FRAME_HEADER_SIZE) || decompressor.length() != length) {
+    return std::string();
+  }
+  return out;
+}
+
+}  // namespace
+
+int main() {
+  // Codec alone: typical payloads, incompressible data and edge sizes, fed
+  // in chunks of one byte up to all at once
+  std::vector<std::vector<uint8_t>> samples;
+  samples.push_back(bytes(trajectory(40)));
+  samples.push_back(bytes(std::string(1000, 'a')));
+  samples.push_back(bytes("x"));
+  samples.push_back(bytes("ab"));
+  std::vector<uint8_t> noise(700);
+  uint32_t state = 12345;
+  for (uint8_t& b : noise) {
+    state = state * 1103515245 + 12345;
+    b = (uint8_t)(state >> 16);
+  }
+  samples.push_back(noise);
+  for (const std::vector<uint8_t>& sample : samples) {
+    for (size_t chunk : {1, 7, 64, 4096}) {
+      QUBI_CHECK(roundTrip(sample, chunk));
+    }
+  }
+  size_t compressedSize = 0;
+  QUBI_CHECK(roundTrip(samples[0], 64, &compressedSize));
+  QUBI_CHECK_RANGE((double)compressedSize / samples[0].size(), 0, 0.5);
+
+  // Output too small for what the stream decodes to
+  std::string text = trajectory(10);
+  QubiCompressor compressor;
+  uint8_t compressed[QUBI_BUFFER_SIZE];
+  size_t length = compressor.compress((const uint8_t*)text.data(), text.size(), compressed, sizeof(compressed));
+  std::vector<uint8_t> small(text.size() / 2);
+  QubiDecompressor overflow(small.data(), small.size());
+  QUBI_CHECK(!overflow.feed(compressed, length) && overflow.error());
+  // A back-reference before the start of the output
+  const uint8_t bogus[] = {0x00, 0xFF, 0xFF};
+  std::vector<uint8_t> out(64);
+  QubiDecompressor corrupt(out.data(), out.size());
+  QUBI_CHECK(!corrupt.feed(bogus, sizeof(bogus)) && corrupt.error());
+
+  // Through a module: a compressed request is decoded and handled
+  QubiTestFixture<> bench;
+  std::string longMessage(400, '\0');
+  for (size_t i = 0; i < longMessage.size(); i++) {
+    longMessage[i] = "servo moved "[i % 12];
+  }
+  int handled = 0;
+  bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+    handled++;
+    bench.module.sendSuccess(String(longMessage.c_str()), cmd.params);
+  });
+  std::string request = qubiTestMessage("arm", "set_servo", "{\"angle\":45,\"padding\":\"....................\"}");
+  bench.sendMessage(compressedFrame(request));
+  bool wasCompressed;
+  std::string reply = decodeReply(bench.process(), wasCompressed);
+  QUBI_CHECK(handled == 1);
+  QUBI_CHECK(!wasCompressed);  // Not negotiated yet
+  QUBI_CHECK(reply.find(longMessage) != std::string::npos);
+
+  // Long responses are compressed once negotiated, short ones never
+  bench.request("handshake", "{\"capabilities\":2}");
+  std::string raw;
+  bench.send("set_servo", "{\"angle\":45}");
+  raw = bench.process();
+  reply = decodeReply(raw, wasCompressed);
+  QUBI_CHECK(wasCompressed);
+  QUBI_CHECK(raw.size() < reply.size());
+  QUBI_CHECK(reply.find(longMessage) != std::string::npos);
+  QUBI_CHECK(reply.find("\"angle\":45") != std::string::npos);
+  decodeReply(bench.request("discover"), wasCompressed);
+  QUBI_CHECK(!wasCompressed);
+
+  // A corrupt compressed request gets 400 and is not handled
+  std::string broken = compressedFrame(request);
+  broken[2] = (char)0x03;  // Declares more bytes than the body decodes to
+  bench.sendMessage(broken);
+  reply = decodeReply(bench.process(), wasCompressed);
+  QUBI_CHECK(handled == 2);
+  QUBI_CHECK(reply.find("\"status\":400") != std::string::npos);
+  return qubiTestResult("CompressionTest");
+}
@@ -0,0 +1,144 @@
+/*
+ * The pipelined host controller against a module.
+ *
+ * Hundreds of requests are in flight at once over a link that delays,
+ * reorders and drops datagrams; every callback must get the response to
+ * its own request, matched by the echoed sequence number, through both the
+ * DOM and the stream parse path. The stream parser must echo a sequence
+ * number wherever it sits in the message, and a request nobody answers
+ * must time out after its retries.
+ */
+
+#include "QubiTest.h"
+#include "QubiController.h"
+
+namespace {
+
+const int REQUESTS = 400;
+
+struct Tally {
+  int ok = 0;
+  int mismatched = 0;
+  int failed = 0;
+};
+
+// Sends REQUESTS set_servo commands at once and checks each response
+// carries the angle its own request asked for
+Tally pipeline(QubiTestFixture<>& bench, QubiController& controller) {
+  Tally tally;
+  for (int i = 0; i < REQUESTS; i++) {
+    JsonDocument params;
+    params["angle"] = i % 181;
+    QubiCommand command;
+    command.moduleId = "arm";
+    command.moduleType = QubiModuleType::ACTUATOR;
+    command.action = "set_servo";
+    command.params = params.as<JsonObject>();
+    int expected = i % 181;
+    controller.sendCommandAsync(command, [&tally, expected](QubiRequestResult result, const QubiResponse& r) {
+      if (result != QubiRequestResult::OK) {
+        tally.failed++;
+      } else if ((r.data["angle"] | -1) != expected) {
+        tally.mismatched++;
+      } else {
+        tally.ok++;
+      }
+    });
+  }
+  QubiVirtualClock::EventId poll = bench.clock.every(500, [&] { controller.poll(); });
+  bench.clock.runFor(3000000);
+  bench.clock.cancel(poll);
+  return tally;
+}
+
+}  // namespace
+
+int main() {
+  QubiTestFixture<> bench;
+  bench.network.setQueueLimit(2 * REQUESTS);
+  bench.loop(200);
+
+  QubiControllerOptions options;
+  options.timeoutMs = 100;
+  QubiController controller(IPAddress(127, 0, 0, 1), QUBI_DEFAULT_PORT, options);
+  QUBI_CHECK(controller.begin());
+  QubiImpairmentConfig link;
+  link.latencyUs = 2000;
+  link.jitterUs = 1500;
+  link.jitter = QubiJitterDistribution::UNIFORM;
+  link.reorderRate = 0.2f;
+  link.reorderDelayUs = 3000;
+  link.lossModel = QubiLossModel::BERNOULLI;
+  link.lossRate = 0.05f;
+  link.seed = 7;
+  controller.udp().setOutboundImpairment(link);
+
+  bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+    JsonDocument data;
+    data["angle"] = cmd.params["angle"] | -1;
+    bench.module.sendSuccess("ok", data.as<JsonObject>());
+  });
+  Tally dom = pipeline(bench, controller);
+  std::printf("DOM path: %d ok, %d mismatched, %d failed, %u resent\n", dom.ok, dom.mismatched, dom.failed,
+              controller.getStats().resent);
+  QUBI_CHECK(dom.ok == REQUESTS && dom.mismatched == 0);
+  QUBI_CHECK(controller.getStats().resent > 0);
+  QUBI_CHECK(controller.pending() == 0);
+
+  bench.module.setStreamHandler([&](QubiStreamCommand& command) {
+    int32_t angle = -1;
+    if (command.params.find("angle")) command.params.toInt(angle);
+    JsonDocument data;
+    data["angle"] = angle;
+    bench.module.sendSuccess("ok", data.as<JsonObject>());
+  });
+  Tally stream = pipeline(bench, controller);
+  std::printf("stream path: %d ok, %d mismatched, %d failed\n", stream.ok, stream.mismatched, stream.failed);
+  QUBI_CHECK(stream.ok == REQUESTS && stream.mismatched == 0);
+
+  // The controller writes the sequence before the commands; other clients
+  // may put it after them or leave it out
+  QubiCommand probe;
+  probe.moduleId = "arm";
+  probe.action = "set_servo";
+  std::string payload = qubiSerializeCommands(&probe, 1, 42);
+  QUBI_CHECK(payload.find("\"sequence\"") < payload.find("\"commands\""));
+  const char* commands = "\"commands\":[{\"module_id\":\"arm\",\"action\":\"set_servo\",\"params\":{\"angle\":5}},"
+                         "{\"module_id\":\"arm\",\"action\":\"set_servo\",\"params\":{\"angle\":6}}]";
+  std::string reply;
+  while (bench.receive(reply)) {}
+  bench.clock.runFor(100000);
+  bench.sendMessage(std::string("{\"version\":\"1.0\",") + commands + ",\"sequence\":77}");
+  bench.clock.runFor(10000);
+  for (int i = 0; i < 2; i++) {
+    JsonDocument doc;
+    QUBI_CHECK(bench.receive(reply) && !deserializeJson(doc, reply));
+    QUBI_CHECK((doc["data"]["sequence"] | 0) == 77);
+    QUBI_CHECK((doc["data"]["angle"] | -1) == 5 + i);
+  }
+  bench.sendMessage(std::string("{") + commands + ",\"version\":\"1.0\"}");
+  bench.clock.runFor(10000);
+  for (int i = 0; i < 2; i++) {
+    JsonDocument doc;
+    QUBI_CHECK(bench.receive(reply) && !deserializeJson(doc, reply));
+    QUBI_CHECK(doc["data"]["sequence"].isNull());
+    QUBI_CHECK((doc["data"]["angle"] | -1) == 5 + i);
+  }
+
+  // Nobody answers: three resends with backoff, then a timeout
+  QubiRequestResult result = QubiRequestResult::OK;
+  unsigned long finishedAt = 0;
+  probe.moduleId = "absent";
+  uint32_t resentBefore = controller.getStats().resent;
+  unsigned long sentAt = millis();
+  controller.sendCommandAsync(probe, [&](QubiRequestResult r, const QubiResponse&) {
+    result = r;
+    finishedAt = millis();
+  });
+  bench.clock.every(1000, [&] { controller.poll(); });
+  bench.clock.runFor(2000000);
+  QUBI_CHECK(result == QubiRequestResult::TIMEOUT);
+  QUBI_CHECK(controller.getStats().resent - resentBefore == 3);
+  QUBI_CHECK_RANGE(finishedAt - sentAt, 1100, 1110);
+  return qubiTestResult("ControllerTest");
+}
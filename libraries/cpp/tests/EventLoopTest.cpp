@@ -0,0 +1,120 @@
+/*
+ * The host event loop on both backends.
+ *
+ * A client socket sends bursts to an echo socket on the same loop. Every
+ * datagram must be handled once, with its source address, and its echo
+ * must come back whole; an oversize datagram is dropped and counted
+ * without disturbing the ones after it. A handler may open a socket and
+ * close its own, and the loop must make fewer syscalls than it handles
+ * datagrams. The io_uring run falls back to epoll where io_uring is
+ * unavailable, and says so.
+ */
+
+#include "QubiTest.h"
+#include "QubiEventLoop.h"
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <vector>
+
+namespace {
+
+const int BURSTS = 5;
+const int BURST = 64;
+
+std::string datagram(int i) {
+  return "datagram " + std::to_string(i) + " " + std::string(i % 113, 'x');
+}
+
+// Runs the loop until the client has count datagrams, for at most 2 s
+void runUntil(QubiEventLoop& loop, const std::vector<std::string>& received, size_t count) {
+  unsigned long start = millis();
+  while (received.size() < count && millis() - start < 2000) loop.run(10);
+}
+
+void exercise(QubiEventBackend preferred) {
+  const uint32_t loopback = htonl(0x7F000001);
+  QubiEventLoop loop(preferred);
+  std::printf("%s requested, %s in use\n", qubiEventBackendName(preferred), qubiEventBackendName(loop.backend()));
+  if (preferred == QubiEventBackend::EPOLL) QUBI_CHECK(loop.backend() == QubiEventBackend::EPOLL);
+
+  std::vector<std::string> received;
+  int client = loop.open(0, [&](int, const uint8_t* data, size_t len, uint32_t, uint16_t) {
+    received.push_back(std::string((const char*)data, len));
+  }, loopback);
+  QUBI_CHECK(client >= 0);
+  uint16_t clientPort = loop.localPort(client);
+
+  int strangers = 0;
+  QubiDatagramHandler echo = [&](int socket, const uint8_t* data, size_t len, uint32_t address, uint16_t port) {
+    if (address != loopback || port != clientPort) strangers++;
+    if (std::string((const char*)data, len) == "move") {
+      // Answer from a new socket and close this one
+      int moved = loop.open(0, echo, loopback);
+      std::string reply = std::to_string(loop.localPort(moved));
+      loop.send(moved, (const uint8_t*)reply.data(), reply.size(), address, port);
+      loop.close(socket);
+      return;
+    }
+    loop.send(socket, data, len, address, port);
+  };
+  int server = loop.open(0, echo, loopback);
+  QUBI_CHECK(server >= 0);
+  uint16_t serverPort = loop.localPort(server);
+
+  auto sendTo = [&](uint16_t port, const std::string& text) {
+    return loop.send(client, (const uint8_t*)text.data(), text.size(), loopback, port);
+  };
+
+  std::vector<std::string> expected;
+  for (int burst = 0; burst < BURSTS; burst++) {
+    for (int i = 0; i < BURST; i++) {
+      expected.push_back(datagram(burst * BURST + i));
+      QUBI_CHECK(sendTo(serverPort, expected.back()));
+    }
+    runUntil(loop, received, expected.size());
+  }
+  std::vector<std::string> sorted = received;
+  std::sort(sorted.begin(), sorted.end());
+  std::sort(expected.begin(), expected.end());
+  QUBI_CHECK(sorted == expected);
+  QUBI_CHECK(strangers == 0);
+  const QubiEventLoopStats& stats = loop.getStats();
+  std::printf("  %llu datagrams handled with %llu syscalls\n", (unsigned long long)stats.received,
+              (unsigned long long)stats.syscalls);
+  QUBI_CHECK(stats.received == 2u * BURSTS * BURST && stats.sent == 2u * BURSTS * BURST);
+  QUBI_CHECK(stats.syscalls < stats.received);
+
+  // An oversize datagram is dropped alone
+  received.clear();
+  QUBI_CHECK(sendTo(serverPort, std::string(3000, 'y')));
+  QUBI_CHECK(sendTo(serverPort, "after"));
+  runUntil(loop, received, 1);
+  loop.run(10);
+  QUBI_CHECK(received.size() == 1 && received[0] == "after");
+  QUBI_CHECK(loop.getStats().truncated == 1);
+
+  // The echo moves to a new socket from inside its handler
+  received.clear();
+  QUBI_CHECK(sendTo(serverPort, "move"));
+  runUntil(loop, received, 1);
+  QUBI_CHECK(received.size() == 1);
+  if (received.size() != 1) return;
+  uint16_t movedPort = (uint16_t)std::stoi(received[0]);
+  QUBI_CHECK(movedPort != 0 && movedPort != serverPort);
+  received.clear();
+  QUBI_CHECK(sendTo(serverPort, "to the old socket"));
+  QUBI_CHECK(sendTo(movedPort, "to the new socket"));
+  runUntil(loop, received, 1);
+  loop.run(10);
+  QUBI_CHECK(received.size() == 1 && received[0] == "to the new socket");
+  QUBI_CHECK(!loop.send(server, (const uint8_t*)"x", 1, loopback, clientPort));
+}
+
+}  // namespace
+
+int main() {
+  exercise(QubiEventBackend::IO_URING);
+  exercise(QubiEventBackend::EPOLL);
+  return qubiTestResult("EventLoopTest");
+}
@@ -0,0 +1,205 @@
+/*
+ * The fleet gateway's fan-out and aggregation.
+ *
+ * Five modules in two groups, one of which is never started. A group
+ * command must reach exactly the modules it selects, each under its own id
+ * and with all of its commands in one message, and the aggregated result
+ * must carry each module's status, data and latency. A module that stays
+ * silent is resent to and reported as timed out at the deadline, not
+ * before; the others are reported as soon as they answer. Clients get the
+ * same through listen().
+ */
+
+#include "QubiTest.h"
+#include "QubiGateway.h"
+
+#include <map>
+#include <vector>
+
+namespace {
+
+struct Fleet {
+  QubiTestFixture<> bench;  // "arm", port 8888
+  ActuatorModule grip;
+  SensorModule eye;
+  ActuatorModule wheel;
+  QubiGateway gateway;
+  std::map<String, std::vector<String>> seen;  // Actions each module handled
+
+  explicit Fleet(const QubiGatewayOptions& options) : gateway(options) {
+    grip.begin("grip", QubiModuleType::ACTUATOR, 8901);
+    eye.begin("eye", QubiModuleType::SENSOR, 8902);
+    wheel.begin("wheel", QubiModuleType::ACTUATOR, 8903);
+    serve(bench.module, "arm");
+    serve(grip, "grip");
+    serve(eye, "eye");
+    serve(wheel, "wheel");
+    bench.loop(10000);
+    bench.clock.every(10000, [this] { grip.processMessages(); }, 3000);
+    bench.clock.every(10000, [this] { eye.processMessages(); }, 6000);
+    bench.clock.every(50000, [this] { wheel.processMessages(); });
+
+    QUBI_CHECK(gateway.begin());
+    const IPAddress local(127, 0, 0, 1);
+    gateway.addModule({"arm", QubiModuleType::ACTUATOR, "left", local, QUBI_DEFAULT_PORT});
+    gateway.addModule({"grip", QubiModuleType::ACTUATOR, "left", local, 8901});
+    gateway.addModule({"eye", QubiModuleType::SENSOR, "left", local, 8902});
+    gateway.addModule({"wheel", QubiModuleType::ACTUATOR, "right", local, 8903});
+    gateway.addModule({"ghost", QubiModuleType::ACTUATOR, "right", local, 8904});
+    bench.clock.every(1000, [this] { gateway.poll(); });
+  }
+
+  void serve(QubiModule& module, const char* id) {
+    module.setCommandHandler([this, &module, id](const QubiCommand& cmd) {
+      seen[id].push_back(cmd.action);
+      if (cmd.moduleId != id) {
+        module.sendError(QubiStatusCode::BAD_REQUEST, "Wrong module");
+      } else if (cmd.action == "fail") {
+        module.sendError(QubiStatusCode::NOT_FOUND, "No such thing");
+      } else {
+        JsonDocument data;
+        data["angle"] = cmd.params["angle"] | -1;
+        module.sendSuccess("ok", data.as<JsonObject>());
+      }
+    });
+  }
+
+  void reset() { seen.clear(); }
+};
+
+QubiCommand command(const char* moduleId, const char* action, JsonDocument& params,
+                    QubiModuleType type = QubiModuleType::CUSTOM) {
+  QubiCommand cmd;
+  cmd.moduleId = moduleId;
+  cmd.moduleType = type;
+  cmd.action = action;
+  cmd.params = params.as<JsonObject>();
+  return cmd;
+}
+
+const QubiModuleOutcome* outcomeFor(const QubiFanoutResult& result, const char* id) {
+  for (const QubiModuleOutcome& outcome : result.modules) {
+    if (outcome.moduleId == id) return &outcome;
+  }
+  return nullptr;
+}
+
+}  // namespace
+
+int main() {
+  QubiGatewayOptions options;
+  options.deadlineMs = 300;
+  options.attemptTimeoutMs = 120;
+  options.retries = 1;
+  Fleet fleet(options);
+  QubiVirtualClock& clock = fleet.bench.clock;
+  clock.runFor(100000);
+
+  // Selection
+  QUBI_CHECK(fleet.gateway.select("*", QubiModuleType::CUSTOM).size() == 5);
+  QUBI_CHECK(fleet.gateway.select("@left", QubiModuleType::CUSTOM).size() == 3);
+  QUBI_CHECK(fleet.gateway.select("@left", QubiModuleType::ACTUATOR).size() == 2);
+  QUBI_CHECK(fleet.gateway.select("eye", QubiModuleType::ACTUATOR).size() == 1);
+  QUBI_CHECK(fleet.gateway.select("@nobody", QubiModuleType::CUSTOM).empty());
+
+  // The left arm's actuators, each answering within its loop period
+  JsonDocument angle;
+  angle["angle"] = 30;
+  QubiCommand servo = command("@left", "set_servo", angle, QubiModuleType::ACTUATOR);
+  QubiFanoutResult result;
+  int callbacks = 0;
+  unsigned long startedAt = millis();
+  unsigned long finishedAt = 0;
+  auto collect = [&](const QubiFanoutResult& r) {
+    result = r;
+    callbacks++;
+    finishedAt = millis();
+  };
+  QUBI_CHECK(fleet.gateway.fanOut(&servo, 1, collect) != 0);
+  clock.runFor(400000);
+  QUBI_CHECK(callbacks == 1);
+  QUBI_CHECK(result.modules.size() == 2 && result.ok == 2 && result.failed == 0 && result.timedOut == 0);
+  QUBI_CHECK(fleet.seen.size() == 2 && fleet.seen.count("arm") && fleet.seen.count("grip"));
+  for (const QubiModuleOutcome& outcome : result.modules) {
+    QUBI_CHECK(outcome.result == QubiRequestResult::OK && outcome.status == 200 && outcome.attempts == 1);
+    QUBI_CHECK((outcome.data["angle"] | -1) == 30 && outcome.data["sequence"].isNull());
+    QUBI_CHECK_RANGE(outcome.latencyUs, 0, 12000);
+  }
+  QUBI_CHECK(finishedAt - startedAt < 20);
+
+  // Everyone: the ghost holds the result until the deadline, after a resend
+  fleet.reset();
+  callbacks = 0;
+  uint32_t timeoutsBefore = fleet.gateway.getStats().timeouts;
+  uint32_t resentBefore = fleet.gateway.getStats().resent;
+  QubiCommand everyone = command("*", "set_servo", angle);
+  startedAt = millis();
+  QUBI_CHECK(fleet.gateway.fanOut(&everyone, 1, collect) != 0);
+  clock.runFor(200000);
+  QUBI_CHECK(callbacks == 0 && fleet.gateway.pending() == 1);
+  clock.runFor(200000);
+  QUBI_CHECK(callbacks == 1);
+  QUBI_CHECK(result.modules.size() == 5 && result.ok == 4 && result.timedOut == 1);
+  QUBI_CHECK_RANGE(finishedAt - startedAt, 300, 302);
+  QUBI_CHECK_RANGE(result.elapsedUs, 300000, 302000);
+  const QubiModuleOutcome* ghost = outcomeFor(result, "ghost");
+  QUBI_CHECK(ghost && ghost->result == QubiRequestResult::TIMEOUT && ghost->status == 0 && ghost->attempts == 2);
+  QUBI_CHECK(fleet.gateway.getStats().timeouts - timeoutsBefore == 1);
+  QUBI_CHECK(fleet.gateway.getStats().resent - resentBefore == 1);
+  const QubiModuleOutcome* wheel = outcomeFor(result, "wheel");
+  QUBI_CHECK(wheel && wheel->result == QubiRequestResult::OK);
+  if (wheel) QUBI_CHECK_RANGE(wheel->latencyUs, 0, 52000);
+
+  // A module's commands arrive in one message, in order, and its first
+  // response is its result
+  fleet.reset();
+  callbacks = 0;
+  uint32_t sentBefore = fleet.gateway.getStats().sent;
+  JsonDocument none;
+  QubiCommand mixed[] = {command("arm", "set_servo", angle), command("@left", "fail", none),
+                         command("grip", "set_servo", angle)};
+  fleet.gateway.fanOut(mixed, 3, collect, 100);
+  QUBI_CHECK(fleet.gateway.getStats().sent - sentBefore == 3);
+  clock.runFor(200000);
+  QUBI_CHECK(callbacks == 1 && result.modules.size() == 3);
+  QUBI_CHECK(fleet.seen["arm"] == std::vector<String>({"set_servo", "fail"}));
+  QUBI_CHECK(fleet.seen["grip"] == std::vector<String>({"fail", "set_servo"}));
+  QUBI_CHECK(fleet.seen["eye"] == std::vector<String>({"fail"}));
+  const QubiModuleOutcome* eye = outcomeFor(result, "eye");
+  QUBI_CHECK(eye && eye->result == QubiRequestResult::ERROR && eye->status == 404 && eye->message == "No such thing");
+  QUBI_CHECK(result.ok == 1 && result.failed == 2);
+
+  // Nothing selected: the callback runs at once
+  callbacks = 0;
+  QubiCommand nobody = command("@nobody", "set_servo", angle);
+  QUBI_CHECK(fleet.gateway.fanOut(&nobody, 1, collect) == 0);
+  QUBI_CHECK(callbacks == 1 && result.modules.empty());
+
+  // Clients through listen()
+  QUBI_CHECK(fleet.gateway.listen());
+  WiFiUDP client;
+  client.setOnLink(false);
+  client.begin(IPAddress(10, 0, 0, 8), 5001);
+  qubiTestSend(client, "{\"version\":\"1.0\",\"sequence\":9,\"deadline_ms\":150,\"commands\":[{\"module_id\":"
+                       "\"@right\",\"action\":\"set_servo\",\"params\":{\"angle\":12}}]}", QUBI_GATEWAY_PORT);
+  clock.runFor(300000);
+  std::string text;
+  JsonDocument doc;
+  QUBI_CHECK(qubiTestReceive(client, text) && !deserializeJson(doc, text));
+  QUBI_CHECK((doc["status"] | 0) == 200 && (doc["data"]["sequence"] | 0) == 9);
+  QUBI_CHECK((doc["data"]["ok"] | -1) == 1 && (doc["data"]["timed_out"] | -1) == 1);
+  QUBI_CHECK_RANGE(doc["data"]["elapsed_us"] | 0, 150000, 152000);
+  for (JsonObject entry : doc["data"]["results"].as<JsonArray>()) {
+    std::string id = entry["module_id"] | "";
+    std::string outcome = entry["result"] | "";
+    QUBI_CHECK((id == "wheel" && outcome == "ok" && (entry["data"]["angle"] | -1) == 12) ||
+               (id == "ghost" && outcome == "timeout"));
+  }
+  qubiTestSend(client, "{\"commands\":[{\"module_id\":\"@nobody\",\"action\":\"x\"}]}", QUBI_GATEWAY_PORT);
+  qubiTestSend(client, "{\"commands\":7}", QUBI_GATEWAY_PORT);
+  clock.runFor(10000);
+  QUBI_CHECK(qubiTestReceive(client, text) && !deserializeJson(doc, text) && (doc["status"] | 0) == 404);
+  QUBI_CHECK(qubiTestReceive(client, text) && !deserializeJson(doc, text) && (doc["status"] | 0) == 400);
+  QUBI_CHECK(fleet.gateway.getStats().clientErrors == 2);
+  return qubiTestResult("GatewayTest");
+}
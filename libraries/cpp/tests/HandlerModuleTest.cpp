@@ -0,0 +1,101 @@
+/*
+ * Static handler binding.
+ *
+ * A QubiHandlerModule gets every command for it that isn't a built-in
+ * action in its own handleCommand() and ignores a handler set with
+ * setCommandHandler(). Built-in actions are still answered by the module.
+ * Under a pipeline the stages wrap the statically bound handler as they
+ * wrap any other.
+ */
+
+#include "QubiTest.h"
+#include "QubiPipeline.h"
+
+#include <vector>
+
+namespace {
+
+class ServoModule : public QubiHandlerModule<ServoModule, ActuatorModule> {
+public:
+  std::vector<std::string> actions;
+  int angle = -1;
+
+  void handleCommand(const QubiCommand& cmd) override {
+    actions.push_back(cmd.action.c_str());
+    if (cmd.action == "set_servo") {
+      angle = cmd.params["angle"] | -1;
+      sendServoResponse(angle);
+    } else {
+      sendError(QubiStatusCode::NOT_FOUND, "Unknown action");
+    }
+  }
+};
+
+struct CountStage : QubiStage {
+  uint32_t entered = 0;
+  uint32_t finished = 0;
+  uint16_t lastStatus = 0;
+
+  bool before(QubiModule& module, const QubiCommand& cmd) {
+    (void)module;
+    (void)cmd;
+    entered++;
+    return true;
+  }
+  void after(QubiModule& module, const QubiCommand& cmd, uint16_t status) {
+    (void)module;
+    (void)cmd;
+    finished++;
+    lastStatus = status;
+  }
+};
+
+class PipedServoModule : public QubiPipelineModule<QubiHandlerModule<PipedServoModule, ActuatorModule>, CountStage> {
+public:
+  int handled = 0;
+
+  void handleCommand(const QubiCommand& cmd) override {
+    (void)cmd;
+    handled++;
+    sendSuccess();
+  }
+};
+
+int status(const std::string& reply) {
+  JsonDocument doc;
+  if (deserializeJson(doc, reply)) return 0;
+  return doc["status"] | 0;
+}
+
+}  // namespace
+
+int main() {
+  {
+    QubiTestFixture<ServoModule> bench;
+    int functionCalls = 0;
+    bench.module.setCommandHandler([&](const QubiCommand&) { functionCalls++; });
+
+    QUBI_CHECK(status(bench.request("set_servo", "{\"angle\":33}")) == 200);
+    QUBI_CHECK(bench.module.angle == 33);
+    QUBI_CHECK(status(bench.request("spin")) == 404);
+    std::string discover = bench.request("discover");
+    QUBI_CHECK(status(discover) == 200 && discover.find("\"arm\"") != std::string::npos);
+    QUBI_CHECK(bench.module.actions == std::vector<std::string>({"set_servo", "spin"}));
+    QUBI_CHECK(functionCalls == 0);
+
+    // Commands for other modules never reach the handler
+    bench.sendMessage(qubiTestMessage("leg", "set_servo", "{\"angle\":1}"));
+    bench.process();
+    QUBI_CHECK(bench.module.actions.size() == 2 && bench.module.angle == 33);
+  }
+
+  {
+    QubiTestFixture<PipedServoModule> bench;
+    QUBI_CHECK(status(bench.request("set_servo", "{\"angle\":10}")) == 200);
+    QUBI_CHECK(status(bench.request("discover")) == 200);
+    CountStage& stage = bench.module.stage<CountStage>();
+    QUBI_CHECK(bench.module.handled == 1);
+    QUBI_CHECK(stage.entered == 2 && stage.finished == 2 && stage.lastStatus == 200);
+  }
+  return qubiTestResult("HandlerModuleTest");
+}
@@ -0,0 +1,71 @@
+/*
+ * Version and capability negotiation.
+ *
+ * A handshake settles on the highest version both sides support and the
+ * capabilities both have; ranges with nothing in common, or malformed
+ * ones, get 400. Messages are accepted for any minor version of a
+ * supported major version. The encoded range constants must match the
+ * version strings the module advertises.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+int status(const std::string& reply) {
+  JsonDocument doc;
+  if (deserializeJson(doc, reply)) return 0;
+  return doc["status"] | 0;
+}
+
+}  // namespace
+
+int main() {
+  uint16_t encoded = 0;
+  QUBI_CHECK(QubiModule::parseVersion(QUBI_PROTOCOL_VERSION_MIN, encoded) &&
+             encoded == QUBI_PROTOCOL_VERSION_MIN_CODE);
+  QUBI_CHECK(QubiModule::parseVersion(QUBI_PROTOCOL_VERSION_MAX, encoded) &&
+             encoded == QUBI_PROTOCOL_VERSION_MAX_CODE);
+  QUBI_CHECK(!QubiModule::parseVersion("1.0beta", encoded));
+  QUBI_CHECK(!QubiModule::parseVersion("256.0", encoded));
+
+  QubiTestFixture<> bench;
+  bench.module.setCapabilities(QUBI_CAP_COMPRESSION | QUBI_CAP_LOAD_REPORT);
+
+  // Highest common version, and only the capabilities both sides have
+  std::string reply = bench.request("handshake", "{\"min_version\":\"1.0\",\"max_version\":\"1.7\","
+                                                 "\"capabilities\":4294967295}");
+  JsonDocument doc;
+  deserializeJson(doc, reply);
+  QUBI_CHECK((doc["status"] | -1) == 200);
+  QUBI_CHECK(std::string(doc["data"]["version"] | "") == "1.0");
+  QUBI_CHECK((doc["data"]["capabilities"] | -1) == (int)(QUBI_CAP_COMPRESSION | QUBI_CAP_LOAD_REPORT));
+  QUBI_CHECK(bench.module.getSession() != nullptr);
+  QUBI_CHECK(bench.module.getSession()->capabilities == (QUBI_CAP_COMPRESSION | QUBI_CAP_LOAD_REPORT));
+
+  deserializeJson(doc, bench.request("handshake", "{\"capabilities\":1}"));
+  QUBI_CHECK((doc["status"] | -1) == 200);
+  QUBI_CHECK((doc["data"]["capabilities"] | -1) == 0);
+
+  deserializeJson(doc, bench.request("handshake", "{\"min_version\":\"2.0\",\"max_version\":\"3.1\"}"));
+  QUBI_CHECK((doc["status"] | -1) == 400);
+  QUBI_CHECK(std::string(doc["message"] | "") == "No common protocol version");
+  QUBI_CHECK(status(bench.request("handshake", "{\"min_version\":\"1.2\",\"max_version\":\"1.0\"}")) == 400);
+  QUBI_CHECK(status(bench.request("handshake", "{\"min_version\":\"one\"}")) == 400);
+
+  // Any 1.x message is understood; 2.x and malformed versions are not
+  bench.sendMessage("{\"version\":\"1.9\",\"commands\":[{\"module_id\":\"arm\",\"action\":\"discover\"}]}");
+  QUBI_CHECK(status(bench.process()) == 200);
+  bench.sendMessage("{\"version\":\"2.0\",\"commands\":[{\"module_id\":\"arm\",\"action\":\"discover\"}]}");
+  QUBI_CHECK(status(bench.process()) == 400);
+  bench.sendMessage("{\"version\":\"1\",\"commands\":[{\"module_id\":\"arm\",\"action\":\"discover\"}]}");
+  QUBI_CHECK(status(bench.process()) == 400);
+
+  // The stream parser applies the same check
+  bench.module.setStreamHandler([](QubiStreamCommand&) {});
+  bench.sendMessage("{\"version\":\"1.9\",\"commands\":[{\"module_id\":\"arm\",\"action\":\"discover\"}]}");
+  QUBI_CHECK(status(bench.process()) == 200);
+  bench.sendMessage("{\"version\":\"2.0\",\"commands\":[{\"module_id\":\"arm\",\"action\":\"discover\"}]}");
+  QUBI_CHECK(status(bench.process()) == 400);
+  return qubiTestResult("HandshakeTest");
+}
@@ -0,0 +1,151 @@
+/*
+ * QubiParamCursor::toInt() against strtoll and the DOM path.
+ *
+ * Numbers of up to 8 digits are decoded a word at a time, reading bytes
+ * before the number, so every length from 1 to 10 digits is tried at every
+ * offset from the start of the text, with and without a sign, with leading
+ * zeros, at the limits of both integer widths and with a '.', 'e' or sign
+ * among the digits. toInt() must agree with strtoll on which values are
+ * integers that fit and on their value. Through a module, the stream
+ * handler must see the same numbers the DOM handler does, and both must
+ * refuse what JSON doesn't allow.
+ */
+
+#include "QubiTest.h"
+
+#include <cerrno>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct Expected {
+  bool integer;  // JSON integer syntax, whatever its size
+  bool fits64;
+  int64_t value;
+};
+
+// What toInt() should make of text that is already a valid JSON number
+Expected expect(const std::string& text) {
+  Expected result = {text.find_first_of(".eE") == std::string::npos, false, 0};
+  if (!result.integer) return result;
+  char* end;
+  errno = 0;
+  long long value = strtoll(text.c_str(), &end, 10);
+  result.fits64 = errno == 0 && *end == '\0';
+  result.value = value;
+  return result;
+}
+
+// The number as the only element of an array, after padding spaces
+bool checkCursor(const std::string& text, size_t padding) {
+  std::string json = "[" + std::string(padding, ' ') + text + "]";
+  QubiParamCursor cursor(json.data(), json.size());
+  if (!cursor.next() || cursor.type() != QubiJsonType::NUMBER) return false;
+
+  Expected expected = expect(text);
+  int64_t wide = -1;
+  bool wideOk = cursor.toInt(wide);
+  int32_t narrow = -1;
+  bool narrowOk = cursor.toInt(narrow);
+  bool fits32 = expected.fits64 && expected.value >= INT32_MIN && expected.value <= INT32_MAX;
+  bool ok = wideOk == expected.fits64 && (!wideOk || wide == expected.value) && narrowOk == fits32 &&
+            (!narrowOk || narrow == expected.value);
+  if (!ok) std::printf("  toInt(%s) at offset %zu: %d %lld, %d %d\n", text.c_str(), padding + 1, wideOk,
+                       (long long)wide, narrowOk, narrow);
+  return ok;
+}
+
+std::string message(const std::string& angle) {
+  return "{\"version\":\"1.0\",\"commands\":[{\"module_id\":\"arm\",\"action\":\"set_servo\",\"params\":{\"angle\":" +
+         angle + "}}]}";
+}
+
+int status(const std::string& reply) {
+  JsonDocument doc;
+  if (deserializeJson(doc, reply)) return 0;
+  return doc["status"] | 0;
+}
+
+}  // namespace
+
+int main() {
+  std::vector<std::string> corpus = {
+    "0", "-0", "7", "-7", "10", "99", "100", "255", "256", "1000", "9999", "10000", "65535", "65536",
+    "99999999", "100000000", "123456789", "999999999", "1000000000", "2147483647", "2147483648",
+    "-2147483648", "-2147483649", "4294967295", "4294967296", "9999999999", "-9999999999",
+    "9223372036854775807", "9223372036854775808", "-9223372036854775807", "-9223372036854775808",
+    "18446744073709551615", "99999999999999999999", "123456789012345678901234",
+    "1.5", "-0.5", "12.0", "1234567.8", "0.1234567", "1e5", "1E+2", "-3e-1", "12345e1", "1234567E1",
+    "9999999.9", "99999999.9", "1.0e0",
+  };
+  // Every length, with each digit in each place
+  std::mt19937 random(100);
+  for (int length = 1; length <= 10; length++) {
+    for (int i = 0; i < 30; i++) {
+      std::string digits(1, (char)('1' + random() % 9));
+      while ((int)digits.size() < length) digits += (char)('0' + random() % 10);
+      corpus.push_back(digits);
+      corpus.push_back("-" + digits);
+    }
+    corpus.push_back(std::string(length, '9'));
+    corpus.push_back("1" + std::string(length - 1, '0'));
+  }
+
+  // The cursor alone, with the number close to and far from the start
+  int failures = 0;
+  for (const std::string& text : corpus) {
+    for (size_t padding = 0; padding <= 9; padding++) {
+      if (!checkCursor(text, padding)) failures++;
+    }
+  }
+  QUBI_CHECK(failures == 0);
+
+  // Leading zeros, a plus sign and hex aren't JSON numbers
+  for (const char* text : {"01", "-01", "007", "00000000", "+5", "0x10", "1-2", "--1", "1.", "-"}) {
+    std::string json = std::string("[") + text + "]";
+    QubiParamCursor cursor(json.data(), json.size());
+    while (cursor.next()) {}
+    if (!cursor.error()) std::printf("  accepted: %s\n", text);
+    QUBI_CHECK(cursor.error());
+  }
+
+  // Through a module: the stream handler against the DOM handler
+  QubiTestFixture<> bench;
+  int32_t streamAngle = 0;
+  bool streamOk = false;
+  int domAngle = 0;
+  int handled = 0;
+  bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+    handled++;
+    domAngle = cmd.params["angle"] | -999;
+    bench.module.sendSuccess();
+  });
+  for (const std::string& text : corpus) {
+    Expected expected = expect(text);
+    bool fits32 = expected.fits64 && expected.value >= INT32_MIN && expected.value <= INT32_MAX;
+
+    handled = 0;
+    bench.module.setStreamHandler([&](QubiStreamCommand& command) {
+      handled++;
+      streamOk = command.params.find("angle") && command.params.toInt(streamAngle);
+      bench.module.sendSuccess();
+    });
+    bench.sendMessage(message(text));
+    QUBI_CHECK(status(bench.process()) == 200 && handled == 1);
+    QUBI_CHECK(streamOk == fits32 && (!streamOk || streamAngle == expected.value));
+    if (!fits32) continue;
+
+    bench.module.setStreamHandler(nullptr);
+    bench.sendMessage(message(text));
+    QUBI_CHECK(status(bench.process()) == 200 && handled == 2);
+    QUBI_CHECK(domAngle == streamAngle);
+  }
+  for (const char* text : {"01", "+5", "0x10", "1.", "-"}) {
+    handled = 0;
+    bench.module.setStreamHandler([&](QubiStreamCommand&) { handled++; });
+    bench.sendMessage(message(text));
+    QUBI_CHECK(status(bench.process()) == 400 && handled == 0);
+  }
+  return qubiTestResult("IntDecodeTest");
+}
@@ -0,0 +1,78 @@
+/*
+ * The module recovers from a WiFi drop.
+ *
+ * A 3 s outage with WiFi.setDropClosesSockets(true), so the module's socket
+ * stays dead until it is reopened, as can happen on the ESP32. The
+ * controller sits elsewhere on the network and keeps sending at 10 Hz. The
+ * module must reopen its socket, announce itself to the known client and
+ * answer again, with its session kept. This runs once with a loop that
+ * calls processMessages() throughout, and once with one that only calls it
+ * while the link is up, so no call sees the outage.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+void run(bool pollDuringOutage) {
+  std::printf("%s\n", pollDuringOutage ? "polling throughout:" : "polling only while connected:");
+  QubiTestFixture<> bench;
+  WiFi.setDropClosesSockets(true);
+  ActuatorModule& module = bench.module;
+  QubiVirtualClock& clock = bench.clock;
+  module.setCommandHandler([&](const QubiCommand&) { module.sendSuccess("ok"); });
+  bench.send("handshake", "{\"capabilities\":2}");
+
+  int okBefore = 0;
+  int okDuring = 0;
+  int announcements = 0;
+  unsigned long announcedAt = 0;
+  unsigned long firstOkAfter = 0;
+  clock.every(10000, [&] {
+    if (pollDuringOutage || WiFi.status() == WL_CONNECTED) {
+      module.processMessages();
+    }
+  });
+  clock.every(100000, [&] { bench.send("set_servo", "{\"angle\":1}"); }, 50000);
+  clock.every(1000, [&] {
+    std::string reply;
+    while (bench.receive(reply)) {
+      unsigned long now = millis();
+      if (reply.find("Module reconnected") != std::string::npos) {
+        announcements++;
+        announcedAt = now;
+      } else if (reply.find("\"ok\"") != std::string::npos) {
+        if (now < 5000) {
+          okBefore++;
+        } else if (now < 8000) {
+          okDuring++;
+        } else if (firstOkAfter == 0) {
+          firstOkAfter = now;
+        }
+      }
+    }
+  });
+  clock.at(5000000, [&] { WiFi.setStatus(WL_CONNECTION_LOST); });
+  clock.at(8000000, [&] { WiFi.setStatus(WL_CONNECTED); });
+  clock.runFor(12ull * 1000000);
+
+  const QubiModuleStats& stats = module.getStats();
+  QUBI_CHECK_RANGE(okBefore, 48, 50);
+  QUBI_CHECK(okDuring == 0);
+  QUBI_CHECK(stats.linkDrops == 1);
+  QUBI_CHECK(stats.recoveries == 1);
+  QUBI_CHECK_RANGE(stats.lastOutageMs, 3000, 3010);
+  QUBI_CHECK(announcements == 1);
+  QUBI_CHECK_RANGE(announcedAt, 8000, 8020);
+  // The next command goes out at 8.05 s
+  QUBI_CHECK_RANGE(firstOkAfter, 8050, 8070);
+  QUBI_CHECK(module.getSession() != nullptr);
+}
+
+}  // namespace
+
+int main() {
+  run(true);
+  run(false);
+  return qubiTestResult("LinkRecoveryTest");
+}
@@ -0,0 +1,110 @@
+/*
+ * The load report lets a controller pace itself.
+ *
+ * A controller negotiates the load report and sends set_servo at 300 pps to
+ * a module on a 100 Hz loop, which handles at most 100 commands/s; the
+ * socket queue holds 16 datagrams. A fixed-rate sender loses most of its
+ * packets in the queue. One that follows the reported max_rate settles
+ * below the loop rate and, once settled, loses nothing.
+ *
+ * A second scenario checks that utilization is busy time: a handler that
+ * takes 500 us, at 1000 commands/s, keeps the module about half busy.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+struct PacingResult {
+  int sent = 0;
+  int handled = 0;
+  int lastMaxRate = 0;
+  int lastBacklog = 0;
+  uint64_t overflows = 0;
+  uint64_t settledOverflows = 0;  // Over the last three seconds
+};
+
+PacingResult runPacing(bool adaptive) {
+  QubiTestFixture<> bench;
+  bench.network.setQueueLimit(16);
+  bench.module.setLoadBeacon(500);
+  PacingResult result;
+  bench.module.setCommandHandler([&](const QubiCommand&) {
+    result.handled++;
+    bench.module.sendSuccess("ok");
+  });
+  bench.send("handshake", "{\"capabilities\":32}");
+
+  unsigned long periodUs = 1000000 / 300;
+  unsigned long nextSendUs = 5000;
+  const std::string command = qubiTestMessage("arm", "set_servo", "{\"angle\":90}");
+  bench.loop();
+  bench.clock.every(100, [&] {
+    if (micros() >= nextSendUs) {
+      bench.sendMessage(command);
+      result.sent++;
+      nextSendUs += periodUs;
+    }
+  });
+  bench.clock.every(1000, [&] {
+    std::string reply;
+    while (bench.receive(reply)) {
+      JsonDocument doc;
+      deserializeJson(doc, reply);
+      JsonObject load = doc["load"];
+      if (load.isNull()) continue;
+      result.lastMaxRate = load["max_rate"] | 0;
+      result.lastBacklog = load["backlog"] | 0;
+      if (adaptive && result.lastMaxRate > 0) {
+        periodUs = 1000000 / result.lastMaxRate;
+      }
+    }
+  });
+  bench.clock.runFor(2ull * 1000000);
+  uint64_t earlyOverflows = bench.network.overflows();
+  bench.clock.runFor(3ull * 1000000);
+
+  result.overflows = bench.network.overflows();
+  result.settledOverflows = result.overflows - earlyOverflows;
+  std::printf("%s: sent=%d handled=%d lost in queue=%llu (%llu after 2 s) max_rate=%d backlog=%d\n",
+              adaptive ? "adaptive" : "fixed", result.sent, result.handled,
+              (unsigned long long)result.overflows, (unsigned long long)result.settledOverflows,
+              result.lastMaxRate, result.lastBacklog);
+  return result;
+}
+
+uint8_t runUtilization() {
+  QubiTestFixture<QubiModule> bench("m1", QubiModuleType::CUSTOM);
+  bench.module.setCommandHandler([&](const QubiCommand&) {
+    delayMicroseconds(500);
+    bench.module.sendSuccess();
+  });
+
+  bench.loop(250);
+  bench.clock.every(1000, [&] {
+    bench.send("x");
+    while (bench.controller.parsePacket() > 0) bench.controller.flush();
+  }, 100);
+  bench.clock.runFor(2500000);
+  return bench.module.getLoad().utilization;
+}
+
+}  // namespace
+
+int main() {
+  PacingResult fixed = runPacing(false);
+  PacingResult adaptive = runPacing(true);
+
+  QUBI_CHECK(fixed.sent >= 1490);
+  // The loop handles about 100 of the 300 packets per second
+  QUBI_CHECK_RANGE(fixed.overflows, 0.5 * fixed.sent, 0.75 * fixed.sent);
+  QUBI_CHECK_RANGE(fixed.lastMaxRate, 1, 100);
+  QUBI_CHECK_RANGE(adaptive.lastMaxRate, 50, 100);
+  // Until the first report arrives it sends at 300 pps too
+  QUBI_CHECK_RANGE(adaptive.settledOverflows, 0, 10);
+  QUBI_CHECK(adaptive.handled > fixed.handled * 0.8);
+
+  uint8_t utilization = runUtilization();
+  QUBI_CHECK_RANGE(utilization, 45, 55);
+  return qubiTestResult("LoadReportTest");
+}
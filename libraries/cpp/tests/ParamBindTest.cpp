@@ -0,0 +1,120 @@
+/*
+ * Typed parameter binding.
+ *
+ * bind() fills a params struct from its field table: values the command
+ * leaves out keep the struct's defaults, and a missing required field, a
+ * wrong type or a value out of range answers 400 naming the field. For
+ * set_servo it must accept and reject exactly what the generated decoder
+ * does.
+ */
+
+#include "QubiTest.h"
+#include "QubiSchema.h"
+
+namespace {
+
+struct ServoParams {
+  int angle = 0;
+  int speed = 255;
+  static constexpr QubiField<ServoParams> fields[] = {
+    {"angle", &ServoParams::angle, 0, 180, QUBI_REQUIRED},
+    {"speed", &ServoParams::speed, 0, 255},
+  };
+};
+
+struct MixedParams {
+  float gain = 1.0f;
+  bool enabled = false;
+  const char* label = "none";
+  int offset = 0;
+  static constexpr QubiField<MixedParams> fields[] = {
+    {"gain", &MixedParams::gain, 0.0f, 10.0f},
+    {"enabled", &MixedParams::enabled},
+    {"label", &MixedParams::label},
+    {"offset", &MixedParams::offset, -50},
+  };
+};
+
+struct Outcome {
+  bool bound;
+  int status;
+  std::string message;
+};
+
+// Runs one command through a handler that binds it; check() sees the
+// params while the message they point into is still alive
+template <typename Params, typename Check>
+Outcome bindWith(QubiTestFixture<>& bench, const char* action, const char* params, Check check) {
+  bool bound = false;
+  bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+    Params out;
+    bound = bench.module.bind(cmd, out);
+    if (!bound) return;
+    check(out);
+    bench.module.sendSuccess();
+  });
+  JsonDocument doc;
+  deserializeJson(doc, bench.request(action, params));
+  return {bound, doc["status"] | 0, doc["message"] | ""};
+}
+
+Outcome bindServo(QubiTestFixture<>& bench, const char* params, ServoParams& out) {
+  return bindWith<ServoParams>(bench, "set_servo", params, [&](const ServoParams& p) { out = p; });
+}
+
+}  // namespace
+
+int main() {
+  QubiTestFixture<> bench;
+
+  ServoParams servo;
+  Outcome outcome = bindServo(bench, "{\"angle\":45}", servo);
+  QUBI_CHECK(outcome.bound && outcome.status == 200);
+  QUBI_CHECK(servo.angle == 45 && servo.speed == 255);
+  outcome = bindServo(bench, "{\"speed\":0,\"note\":\"x\",\"angle\":180}", servo);
+  QUBI_CHECK(outcome.bound && servo.angle == 180 && servo.speed == 0);
+
+  outcome = bindServo(bench, "{\"speed\":10}", servo);
+  QUBI_CHECK(!outcome.bound && outcome.status == 400 && outcome.message == "Missing parameter: angle");
+  outcome = bindServo(bench, "{\"angle\":-1}", servo);
+  QUBI_CHECK(!outcome.bound && outcome.message == "angle must be between 0 and 180");
+  outcome = bindServo(bench, "{\"angle\":1.5}", servo);
+  QUBI_CHECK(!outcome.bound && outcome.message == "Invalid type for parameter: angle");
+
+  // Every field type, one-sided ranges and defaults
+  outcome = bindWith<MixedParams>(bench, "configure", "{\"gain\":2.5,\"enabled\":true,\"label\":\"left\"}",
+                                  [&](const MixedParams& p) {
+    QUBI_CHECK(p.gain == 2.5f && p.enabled && std::string(p.label) == "left" && p.offset == 0);
+  });
+  QUBI_CHECK(outcome.bound);
+  outcome = bindWith<MixedParams>(bench, "configure", "{}", [&](const MixedParams& p) {
+    QUBI_CHECK(p.gain == 1.0f && !p.enabled && std::string(p.label) == "none");
+  });
+  QUBI_CHECK(outcome.bound);
+  outcome = bindWith<MixedParams>(bench, "configure", "{\"offset\":-51}", [](const MixedParams&) {});
+  QUBI_CHECK(!outcome.bound && outcome.message == "offset must be at least -50");
+  outcome = bindWith<MixedParams>(bench, "configure", "{\"enabled\":1}", [](const MixedParams&) {});
+  QUBI_CHECK(!outcome.bound && outcome.message == "Invalid type for parameter: enabled");
+  outcome = bindWith<MixedParams>(bench, "configure", "{\"label\":7}", [](const MixedParams&) {});
+  QUBI_CHECK(!outcome.bound && outcome.message == "Invalid type for parameter: label");
+
+  // Same verdicts and values as the generated set_servo decoder
+  const char* corpus[] = {
+    "{\"angle\":0}", "{\"angle\":180,\"speed\":255}", "{\"angle\":90,\"speed\":256}", "{\"angle\":181}",
+    "{\"angle\":true}", "{\"speed\":3}", "{\"angle\":7,\"speed\":-1}", "{\"angle\":12,\"other\":null}",
+  };
+  for (const char* params : corpus) {
+    ServoParams bound;
+    Outcome byBind = bindServo(bench, params, bound);
+    QubiSetServoParams decoded;
+    bool ok = false;
+    bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+      ok = qubiDecode(bench.module, cmd, decoded);
+      if (ok) bench.module.sendSuccess();
+    });
+    bench.request("set_servo", params);
+    QUBI_CHECK(byBind.bound == ok);
+    if (ok) QUBI_CHECK(bound.angle == decoded.angle && bound.speed == decoded.speed);
+  }
+  return qubiTestResult("ParamBindTest");
+}
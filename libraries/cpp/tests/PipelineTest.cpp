@@ -0,0 +1,164 @@
+/*
+ * The compile-time command pipeline.
+ *
+ * Stages must see every command, built-in actions and streamed commands
+ * included, with before() hooks in the order listed and after() hooks in
+ * reverse, each with the status of the response sent for that command. A
+ * stage that refuses a command stops it before the later stages and the
+ * handler, whether it answered or not. The metrics stage counts outcomes,
+ * and the auth stage lets only discover and handshake through without a
+ * tag.
+ */
+
+#include "QubiTest.h"
+#include "QubiPipeline.h"
+
+#include <vector>
+
+namespace {
+
+std::vector<std::string>& trace() {
+  static std::vector<std::string> events;
+  return events;
+}
+
+// Records its hooks; "p" marks a command that came with params
+template <char Name>
+struct TraceStage : QubiStage {
+  bool before(QubiModule& module, const QubiCommand& cmd) {
+    (void)module;
+    trace().push_back(std::string(1, Name) + ">" + (cmd.params.isNull() ? "" : "p"));
+    return true;
+  }
+  void after(QubiModule& module, const QubiCommand& cmd, uint16_t status) {
+    (void)module;
+    (void)cmd;
+    trace().push_back("<" + std::string(1, Name) + std::to_string(status));
+  }
+};
+
+// Refuses "forbidden" with an error and drops "ignored" silently
+struct GateStage : QubiStage {
+  bool before(QubiModule& module, const QubiCommand& cmd) {
+    trace().push_back("gate");
+    if (cmd.action == "forbidden") {
+      module.sendError(QubiStatusCode::METHOD_NOT_ALLOWED, "Not here");
+      return false;
+    }
+    return cmd.action != "ignored";
+  }
+};
+
+class PipedModule
+  : public QubiPipelineModule<ActuatorModule, QubiMetricsStage, TraceStage<'a'>, GateStage, TraceStage<'b'>> {};
+
+class GuardedModule : public QubiPipelineModule<QubiModule, QubiAuthStage> {};
+
+typedef std::vector<std::string> Events;
+
+// Sends one message and returns the trace it left
+Events run(QubiTestFixture<PipedModule>& bench, const std::string& message, std::string& reply) {
+  trace().clear();
+  bench.sendMessage(message);
+  reply = bench.process();
+  return trace();
+}
+
+int status(const std::string& reply) {
+  JsonDocument doc;
+  if (deserializeJson(doc, reply)) return 0;
+  return doc["status"] | 0;
+}
+
+const uint8_t KEY[QUBI_AUTH_KEY_SIZE] = {9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 1, 2, 3, 4, 5, 6};
+
+std::string tagged(uint32_t sequence, const std::string& json) {
+  const uint8_t header[] = {QUBI_FRAME_MAGIC, QUBI_FRAME_AUTHENTICATED, (uint8_t)(json.size() >> 8),
+                            (uint8_t)json.size(), 0, (uint8_t)(sequence >> 24), (uint8_t)(sequence >> 16),
+                            (uint8_t)(sequence >> 8), (uint8_t)sequence};
+  std::string frame((const char*)header, sizeof(header));
+  frame += json;
+  uint8_t domain = QUBI_AUTH_DOMAIN_REQUEST;
+  QubiSipHash mac(KEY);
+  mac.update(&domain, 1);
+  mac.update((const uint8_t*)frame.data(), frame.size());
+  uint8_t tag[QUBI_AUTH_TAG_SIZE];
+  mac.finish(tag);
+  frame.append((const char*)tag, sizeof(tag));
+  return frame;
+}
+
+}  // namespace
+
+int main() {
+  {
+    QubiTestFixture<PipedModule> bench;
+    bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+      trace().push_back("handler");
+      if (cmd.action != "quiet") bench.module.sendSuccess();
+    });
+    std::string reply;
+
+    Events events = run(bench, qubiTestMessage("arm", "set_servo", "{\"angle\":5}"), reply);
+    QUBI_CHECK(events == Events({"a>p", "gate", "b>p", "handler", "<b200", "<a200"}));
+    QUBI_CHECK(status(reply) == 200);
+
+    // Built-in actions go through the stages too
+    events = run(bench, qubiTestMessage("arm", "discover"), reply);
+    QUBI_CHECK(events == Events({"a>p", "gate", "b>p", "<b200", "<a200"}));
+    QUBI_CHECK(status(reply) == 200);
+
+    // A refusing stage stops the rest; the stages before it still see how
+    // the command ended
+    events = run(bench, qubiTestMessage("arm", "forbidden"), reply);
+    QUBI_CHECK(events == Events({"a>p", "gate", "<a405"}));
+    QUBI_CHECK(status(reply) == 405);
+    events = run(bench, qubiTestMessage("arm", "ignored"), reply);
+    QUBI_CHECK(events == Events({"a>p", "gate", "<a0"}));
+    QUBI_CHECK(reply.empty());
+
+    // Each command of a message gets its own status
+    trace().clear();
+    bench.sendMessage("{\"version\":\"1.0\",\"commands\":[{\"module_id\":\"arm\",\"action\":\"set_servo\"},"
+                      "{\"module_id\":\"arm\",\"action\":\"quiet\"}]}");
+    bench.process();
+    QUBI_CHECK(trace() == Events({"a>", "gate", "b>", "handler", "<b200", "<a200", "a>", "gate", "b>", "handler",
+                                  "<b0", "<a0"}));
+
+    QubiMetricsStage& metrics = bench.module.stage<QubiMetricsStage>();
+    QUBI_CHECK(metrics.commands == 6 && metrics.errors == 1 && metrics.unanswered == 2);
+
+    // Streamed commands: the stages see no params, the handler has them
+    int32_t angle = -1;
+    bench.module.setStreamHandler([&](QubiStreamCommand& command) {
+      trace().push_back("stream");
+      if (command.params.find("angle")) command.params.toInt(angle);
+      bench.module.sendSuccess();
+    });
+    events = run(bench, qubiTestMessage("arm", "set_servo", "{\"angle\":77}"), reply);
+    QUBI_CHECK(events == Events({"a>", "gate", "b>", "stream", "<b200", "<a200"}));
+    QUBI_CHECK(angle == 77 && status(reply) == 200);
+    events = run(bench, qubiTestMessage("arm", "forbidden"), reply);
+    QUBI_CHECK(events == Events({"a>", "gate", "<a405"}));
+    QUBI_CHECK(metrics.commands == 8 && metrics.errors == 2);
+  }
+
+  {
+    // Anyone may discover the module; only key holders may move it
+    QubiTestFixture<GuardedModule> bench;
+    bench.module.addAuthKey(KEY);
+    bench.module.setAuthRequired(false);
+    int handled = 0;
+    bench.module.setCommandHandler([&](const QubiCommand&) {
+      handled++;
+      bench.module.sendSuccess();
+    });
+    QUBI_CHECK(bench.request("set_servo", "{\"angle\":5}").empty());
+    QUBI_CHECK(!bench.request("discover").empty());
+    QUBI_CHECK(handled == 0 && bench.module.stage<QubiAuthStage>().dropped == 1);
+    bench.sendMessage(tagged(1, qubiTestMessage("arm", "set_servo", "{\"angle\":5}")));
+    QUBI_CHECK(!bench.process().empty());
+    QUBI_CHECK(handled == 1 && bench.module.stage<QubiAuthStage>().dropped == 1);
+  }
+  return qubiTestResult("PipelineTest");
+}
@@ -0,0 +1,98 @@
+/*
+ * Pose frames.
+ *
+ * A 16-joint pose fits in a fraction of the bytes the same pose takes as
+ * separate commands, and reaches the handler as one frame: every joint
+ * already set, none set from a frame that fails validation.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+const int JOINTS = 16;
+
+int status(const std::string& reply) {
+  JsonDocument doc;
+  if (deserializeJson(doc, reply)) return 0;
+  return doc["status"] | 0;
+}
+
+}  // namespace
+
+int main() {
+  QubiTestFixture<> bench("body");
+  for (int i = 0; i < JOINTS; i++) {
+    bench.module.addStateField(("joint_" + std::to_string(i)).c_str(), 90, 0, 180);
+  }
+
+  // The handler sees every joint of a frame at once
+  int frames = 0;
+  uint32_t lastMask = 0;
+  uint16_t lastDuration = 0;
+  int32_t seen[JOINTS] = {};
+  bench.module.setPoseHandler([&](const QubiPoseFrame& frame) {
+    frames++;
+    lastMask = frame.channelMask;
+    lastDuration = frame.durationMs;
+    memcpy(seen, frame.values, sizeof(seen));
+  });
+
+  std::string values;
+  for (int i = 0; i < JOINTS; i++) {
+    values += (i ? "," : "") + std::to_string(10 + i * 10);
+  }
+  std::string params = "{\"v\":[" + values + "],\"t\":40}";
+  std::string pose = qubiTestMessage("body", "pose_frame", params.c_str());
+  std::string separate = "{\"version\":\"1.0\",\"timestamp\":1,\"commands\":[";
+  for (int i = 0; i < JOINTS; i++) {
+    separate += std::string(i ? "," : "") + "{\"module_id\":\"body\",\"module_type\":\"actuator\","
+                "\"action\":\"set_servo\",\"params\":{\"channel\":" + std::to_string(i) +
+                ",\"angle\":" + std::to_string(10 + i * 10) + "}}";
+  }
+  separate += "]}";
+  QUBI_CHECK_RANGE(pose.size(), 0, 256);
+  QUBI_CHECK(separate.size() > QUBI_BUFFER_SIZE);
+
+  bench.sendMessage(pose);
+  QUBI_CHECK(status(bench.process()) == 200);
+  QUBI_CHECK(frames == 1 && lastMask == 0xFFFF && lastDuration == 40);
+  for (int i = 0; i < JOINTS; i++) {
+    QUBI_CHECK(seen[i] == 10 + i * 10 && bench.module.getState(i) == 10 + i * 10);
+  }
+
+  // Indexed channels touch only those joints
+  QUBI_CHECK(status(bench.request("pose_frame", "{\"c\":[3,0,15],\"v\":[1,2,3]}")) == 200);
+  QUBI_CHECK(frames == 2 && lastMask == ((1u << 3) | 1u | (1u << 15)) && lastDuration == 0);
+  QUBI_CHECK(bench.module.getState(3) == 1 && bench.module.getState(0) == 2 && bench.module.getState(15) == 3);
+  QUBI_CHECK(bench.module.getState(1) == 20);
+
+  // A frame with any bad channel or value moves nothing, even when the bad
+  // one comes last
+  const char* invalid[] = {
+    "{\"c\":[1,2],\"v\":[50,181]}",
+    "{\"c\":[1,16],\"v\":[50,50]}",
+    "{\"c\":[1,1],\"v\":[50,60]}",
+    "{\"c\":[1,2],\"v\":[50]}",
+    "{\"c\":[1,2],\"v\":[50,\"x\"]}",
+    "{\"v\":[]}",
+  };
+  for (const char* frame : invalid) {
+    QUBI_CHECK(status(bench.request("pose_frame", frame)) == 400);
+  }
+  QUBI_CHECK(frames == 2);
+  QUBI_CHECK(bench.module.getState(1) == 20 && bench.module.getState(2) == 30);
+
+  // Without a pose handler the state handler gets the same mask, and no
+  // client's sync base moves
+  QUBI_CHECK(status(bench.request("sync_state", "{\"b\":0,\"d\":[]}")) == 200);
+  bench.module.setPoseHandler(nullptr);
+  uint32_t stateMask = 0;
+  bench.module.setStateHandler([&](uint32_t mask) { stateMask = mask; });
+  QUBI_CHECK(status(bench.request("pose_frame", "{\"c\":[4,5],\"v\":[0,180]}")) == 200);
+  QUBI_CHECK(stateMask == ((1u << 4) | (1u << 5)));
+  JsonDocument doc;
+  deserializeJson(doc, bench.request("sync_state", "{\"b\":1,\"d\":[]}"));
+  QUBI_CHECK((doc["status"] | -1) == 200 && (doc["data"]["v"] | -1) == 2);
+  return qubiTestResult("PoseFrameTest");
+}
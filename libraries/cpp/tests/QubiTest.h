@@ -0,0 +1,111 @@
+#ifndef QUBI_TEST_H
+#define QUBI_TEST_H
+
+// Minimal support for the host tests: each test is a standalone program
+// that runs its scenarios under virtual time and exits non-zero if any
+// check failed, which is all CTest needs.
+
+#include "QubiProtocol.h"
+#include "QubiSimNetwork.h"
+#include "QubiVirtualTime.h"
+
+#include <cstdio>
+#include <string>
+
+inline int& qubiTestFailures() {
+  static int failures = 0;
+  return failures;
+}
+
+#define QUBI_CHECK(condition)                                               \
+  do {                                                                      \
+    if (!(condition)) {                                                     \
+      std::printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+      qubiTestFailures()++;                                                 \
+    }                                                                       \
+  } while (0)
+
+// Prints a measured value next to the range it has to fall in
+#define QUBI_CHECK_RANGE(value, low, high)                                  \
+  do {                                                                      \
+    double qubiValue = (double)(value);                                     \
+    std::printf("  %s = %g (expected %g..%g)\n", #value, qubiValue, (double)(low), (double)(high)); \
+    QUBI_CHECK(qubiValue >= (low) && qubiValue <= (high));                  \
+  } while (0)
+
+inline int qubiTestResult(const char* name) {
+  if (qubiTestFailures() == 0) {
+    std::printf("%s: passed\n", name);
+    return 0;
+  }
+  std::printf("%s: %d check(s) failed\n", name, qubiTestFailures());
+  return 1;
+}
+
+// One-command message as a controller sends it
+inline std::string qubiTestMessage(const char* moduleId, const char* action, const char* params = "{}") {
+  return std::string("{\"version\":\"1.0\",\"timestamp\":1,\"commands\":[{\"module_id\":\"") + moduleId +
+         "\",\"module_type\":\"actuator\",\"action\":\"" + action + "\",\"params\":" + params + "}]}";
+}
+
+inline void qubiTestSend(WiFiUDP& socket, const std::string& message, uint16_t port = QUBI_DEFAULT_PORT) {
+  socket.beginPacket(IPAddress(127, 0, 0, 1), port);
+  socket.write((const uint8_t*)message.data(), message.size());
+  socket.endPacket();
+}
+
+// Reads one pending reply into text; false if none is waiting
+inline bool qubiTestReceive(WiFiUDP& socket, std::string& text) {
+  if (socket.parsePacket() <= 0) return false;
+  char buffer[QUBI_BUFFER_SIZE];
+  int length = socket.read(buffer, sizeof(buffer));
+  text.assign(buffer, length > 0 ? (size_t)length : 0);
+  return true;
+}
+
+// What most tests start from: a virtual clock and a simulated network,
+// installed for the fixture's lifetime, a started module, and a controller
+// socket elsewhere on the network, so the module's link drops don't affect
+// it. The link starts up and sockets survive drops.
+template <typename Module = ActuatorModule>
+struct QubiTestFixture {
+  QubiVirtualClock clock;
+  QubiVirtualClockScope scope;
+  QubiSimNetwork network;
+  Module module;
+  WiFiUDP controller;
+  const char* moduleId;
+
+  explicit QubiTestFixture(const char* id = "arm", QubiModuleType type = QubiModuleType::ACTUATOR)
+    : scope(clock), moduleId(id) {
+    WiFi.setStatus(WL_CONNECTED);
+    WiFi.setDropClosesSockets(false);
+    module.begin(id, type);
+    controller.setOnLink(false);
+    controller.begin(IPAddress(10, 0, 0, 9), 5000);
+  }
+
+  // Calls processMessages() like a loop() with this delay
+  QubiVirtualClock::EventId loop(uint64_t periodUs = 10000) {
+    return clock.every(periodUs, [this] { module.processMessages(); });
+  }
+
+  void sendMessage(const std::string& message) { qubiTestSend(controller, message); }
+  void send(const char* action, const char* params = "{}") { sendMessage(qubiTestMessage(moduleId, action, params)); }
+  bool receive(std::string& reply) { return qubiTestReceive(controller, reply); }
+
+  // Sends one command, runs a loop call and returns the reply, or an empty
+  // string if there was none
+  std::string request(const char* action, const char* params = "{}") {
+    send(action, params);
+    return process();
+  }
+  std::string process() {
+    module.processMessages();
+    std::string reply;
+    receive(reply);
+    return reply;
+  }
+};
+
+#endif // QUBI_TEST_H
@@ -0,0 +1,72 @@
+/*
+ * A flooding source cannot starve a well-behaved one.
+ *
+ * One client floods the module with 2000 commands/s while another sends at
+ * 20 Hz, for ten simulated seconds against a 10 ms loop and a 64-datagram
+ * socket queue. Without rate limiting, the queue stays full of flood
+ * packets and the good client is almost never answered. With
+ * setRateLimit(20, 5), flood packets are dropped before parsing and don't
+ * use up the loop tick, so nearly every good command is answered.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+struct RunResult {
+  int goodSent = 0;
+  int goodAnswered = 0;
+  uint32_t rateLimited = 0;
+};
+
+RunResult run(bool limit) {
+  QubiTestFixture<> bench;
+  bench.network.setQueueLimit(64);
+  if (limit) {
+    bench.module.setRateLimit(20, 5);
+  }
+  bench.module.setCommandHandler([&](const QubiCommand&) { bench.module.sendSuccess("ok"); });
+
+  // The fixture's controller is the good client
+  WiFiUDP flood;
+  flood.begin(0);
+  const std::string message = qubiTestMessage("arm", "set_servo", "{\"angle\":90}");
+
+  RunResult result;
+  bench.loop();
+  bench.clock.every(500, [&] {
+    qubiTestSend(flood, message);
+    while (flood.parsePacket() > 0) flood.flush();
+  });
+  bench.clock.every(50000, [&] {
+    bench.sendMessage(message);
+    result.goodSent++;
+  }, 1234);
+  bench.clock.every(1000, [&] {
+    std::string reply;
+    while (bench.receive(reply)) {
+      result.goodAnswered++;
+    }
+  });
+  bench.clock.runFor(10ull * 1000000);
+
+  result.rateLimited = bench.module.getStats().rateLimited;
+  std::printf("%s: good client %d of %d answered, %u rate limited\n", limit ? "limited" : "unlimited",
+              result.goodAnswered, result.goodSent, result.rateLimited);
+  return result;
+}
+
+}  // namespace
+
+int main() {
+  RunResult unlimited = run(false);
+  RunResult limited = run(true);
+
+  QUBI_CHECK(unlimited.goodSent == 200);
+  QUBI_CHECK_RANGE(unlimited.goodAnswered, 0, 20);
+  QUBI_CHECK(unlimited.rateLimited == 0);
+  QUBI_CHECK_RANGE(limited.goodAnswered, 190, 200);
+  // Nearly all of the 20000 flood packets, less its burst and refill
+  QUBI_CHECK_RANGE(limited.rateLimited, 19000, 20000);
+  return qubiTestResult("RateLimitTest");
+}
@@ -0,0 +1,89 @@
+/*
+ * Generated schema decoders.
+ *
+ * qubiDecode() fills the params struct with the schema defaults for fields
+ * the command leaves out, and answers 400 with the schema's reason for a
+ * missing, mistyped, out-of-range or unknown enum value, nested objects
+ * included. Action lookups map every schema action and nothing else.
+ */
+
+#include "QubiTest.h"
+#include "QubiSchema.h"
+
+namespace {
+
+struct Outcome {
+  bool decoded;
+  int status;
+  std::string message;
+};
+
+// Runs one command through a handler that decodes it with qubiDecode()
+template <typename Params>
+Outcome decode(QubiTestFixture<>& bench, const char* action, const char* params, Params& out) {
+  bool decoded = false;
+  bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+    decoded = qubiDecode(bench.module, cmd, out);
+    if (decoded) bench.module.sendSuccess();
+  });
+  JsonDocument doc;
+  deserializeJson(doc, bench.request(action, params));
+  return {decoded, doc["status"] | 0, doc["message"] | ""};
+}
+
+}  // namespace
+
+int main() {
+  QUBI_CHECK(qubiActuatorAction("set_servo") == QubiActuatorAction::SET_SERVO);
+  QUBI_CHECK(qubiActuatorAction("get_position") == QubiActuatorAction::GET_POSITION);
+  QUBI_CHECK(qubiActuatorAction("set_servos") == QubiActuatorAction::UNKNOWN);
+  QUBI_CHECK(qubiDisplayAction("set_eyes") == QubiDisplayAction::SET_EYES);
+  QUBI_CHECK(qubiSensorAction("calibrate") == QubiSensorAction::CALIBRATE);
+  QUBI_CHECK(qubiMobileAction("") == QubiMobileAction::UNKNOWN);
+
+  QubiTestFixture<> bench;
+
+  // Defaults for what is left out, enums by name
+  QubiSetServoParams servo;
+  Outcome outcome = decode(bench, "set_servo", "{\"angle\":45}", servo);
+  QUBI_CHECK(outcome.decoded && outcome.status == 200);
+  QUBI_CHECK(servo.angle == 45 && servo.speed == 255 && servo.easing == QubiEasing::LINEAR);
+  outcome = decode(bench, "set_servo", "{\"easing\":\"ease-out\",\"speed\":10,\"angle\":180,\"extra\":1}", servo);
+  QUBI_CHECK(outcome.decoded);
+  QUBI_CHECK(servo.angle == 180 && servo.speed == 10 && servo.easing == QubiEasing::EASE_OUT);
+
+  // Every failure answers 400 with the reason
+  struct Case {
+    const char* params;
+    const char* message;
+  };
+  const Case rejected[] = {
+    {"{}", "Missing parameter: angle"},
+    {"{\"angle\":181}", "angle must be between 0 and 180"},
+    {"{\"angle\":\"90\"}", "angle must be an integer"},
+    {"{\"angle\":90,\"easing\":\"bounce\"}", "easing must be one of linear, ease-in, ease-out"},
+  };
+  for (const Case& c : rejected) {
+    outcome = decode(bench, "set_servo", c.params, servo);
+    QUBI_CHECK(!outcome.decoded && outcome.status == 400);
+    QUBI_CHECK(outcome.message == c.message);
+  }
+
+  // Nested objects are checked field by field
+  QubiSetEyesParams eyes;
+  outcome = decode(bench, "set_eyes", "{\"left_eye\":{\"x\":3,\"y\":4},\"right_eye\":{\"y\":6,\"x\":5}}", eyes);
+  QUBI_CHECK(outcome.decoded);
+  QUBI_CHECK(eyes.leftEye.x == 3 && eyes.leftEye.y == 4 && eyes.rightEye.x == 5 && eyes.rightEye.y == 6);
+  QUBI_CHECK(!eyes.blink);
+  outcome = decode(bench, "set_eyes", "{\"left_eye\":{\"x\":3},\"right_eye\":{\"x\":5,\"y\":6}}", eyes);
+  QUBI_CHECK(!outcome.decoded && outcome.message == "Missing parameter: left_eye.y");
+  outcome = decode(bench, "set_eyes", "{\"left_eye\":[3,4],\"right_eye\":{\"x\":5,\"y\":6}}", eyes);
+  QUBI_CHECK(!outcome.decoded && outcome.message == "left_eye must be an object");
+
+  QubiStartStreamingParams streaming;
+  outcome = decode(bench, "start_streaming", "{\"sensor_type\":\"imu\",\"interval\":12.5}", streaming);
+  QUBI_CHECK(outcome.decoded && streaming.interval == 12.5f);
+  outcome = decode(bench, "start_streaming", "{\"interval\":0,\"sensor_type\":\"imu\"}", streaming);
+  QUBI_CHECK(!outcome.decoded && outcome.message == "interval must be greater than 0");
+  return qubiTestResult("SchemaDecodeTest");
+}
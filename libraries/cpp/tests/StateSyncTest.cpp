@@ -0,0 +1,101 @@
+/*
+ * Delta state sync.
+ *
+ * Each client patches its last acknowledged state: the module answers with
+ * the new version, accepts the previous base again when an ack was lost,
+ * refuses unknown bases with 409 and applies nothing from an invalid patch.
+ * Clients patching different fields do not overwrite each other.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+struct Reply {
+  int status;
+  uint32_t version;
+};
+
+Reply parse(const std::string& text) {
+  JsonDocument doc;
+  if (deserializeJson(doc, text)) return {0, 0};
+  return {doc["status"] | 0, doc["data"]["v"] | (uint32_t)0};
+}
+
+}  // namespace
+
+int main() {
+  QubiTestFixture<> bench("body");
+  int8_t neck = bench.module.addStateField("neck", 90, 0, 180);
+  int8_t eyeX = bench.module.addStateField("eye_x", 0, -100, 100);
+  int8_t expression = bench.module.addStateField("expression", 0, 0, 7);
+  QUBI_CHECK(neck == 0 && eyeX == 1 && expression == 2);
+
+  uint32_t lastMask = 0;
+  int calls = 0;
+  bench.module.setStateHandler([&](uint32_t changedMask) {
+    lastMask = changedMask;
+    calls++;
+  });
+
+  // Version 0 is the defaults; each patch returns the next version
+  Reply reply = parse(bench.request("sync_state", "{\"b\":0,\"d\":[0,120,1,-30]}"));
+  QUBI_CHECK(reply.status == 200 && reply.version == 1);
+  QUBI_CHECK(bench.module.getState(neck) == 120 && bench.module.getState(eyeX) == -30);
+  QUBI_CHECK(calls == 1 && lastMask == 0x3);
+
+  // A one-field change is a few bytes of params
+  const char* patch = "{\"b\":1,\"d\":[2,5]}";
+  QUBI_CHECK(strlen(patch) < 20);
+  reply = parse(bench.request("sync_state", patch));
+  QUBI_CHECK(reply.status == 200 && reply.version == 2);
+  QUBI_CHECK(bench.module.getState(expression) == 5 && bench.module.getState(neck) == 120);
+  QUBI_CHECK(lastMask == 0x4);
+
+  // Resending the same patch against the previous base, as a client does
+  // when the ack was lost, changes nothing and is not reported
+  reply = parse(bench.request("sync_state", patch));
+  QUBI_CHECK(reply.status == 200 && reply.version == 3);
+  QUBI_CHECK(calls == 2);
+
+  // Unknown base: 409 with the current version
+  reply = parse(bench.request("sync_state", "{\"b\":99,\"d\":[0,10]}"));
+  QUBI_CHECK(reply.status == 409 && reply.version == 3);
+  QUBI_CHECK(bench.module.getState(neck) == 120);
+
+  // Invalid patches are refused whole
+  QUBI_CHECK(parse(bench.request("sync_state", "{\"b\":3,\"d\":[0,10,1,500]}")).status == 400);
+  QUBI_CHECK(parse(bench.request("sync_state", "{\"b\":3,\"d\":[0,10,9,1]}")).status == 400);
+  QUBI_CHECK(parse(bench.request("sync_state", "{\"b\":3,\"d\":[0,10,1]}")).status == 400);
+  QUBI_CHECK(parse(bench.request("sync_state", "{\"b\":3,\"d\":[0,\"up\"]}")).status == 400);
+  QUBI_CHECK(bench.module.getState(neck) == 120 && bench.module.getState(eyeX) == -30);
+  QUBI_CHECK(calls == 2);
+  reply = parse(bench.request("sync_state", "{\"b\":3,\"d\":[]}"));
+  QUBI_CHECK(reply.status == 200 && reply.version == 4);
+
+  // A second client has its own versions and only touches its own fields
+  WiFiUDP other;
+  other.setOnLink(false);
+  other.begin(IPAddress(10, 0, 0, 10), 5001);
+  qubiTestSend(other, qubiTestMessage("body", "sync_state", "{\"b\":0,\"d\":[1,60]}"));
+  bench.module.processMessages();
+  std::string text;
+  QUBI_CHECK(qubiTestReceive(other, text));
+  reply = parse(text);
+  QUBI_CHECK(reply.status == 200 && reply.version == 1);
+  QUBI_CHECK(bench.module.getState(eyeX) == 60 && bench.module.getState(neck) == 120);
+  QUBI_CHECK(bench.module.getState(expression) == 5);
+
+  // get_state reports the live values and a fresh base
+  JsonDocument doc;
+  deserializeJson(doc, bench.request("get_state"));
+  QUBI_CHECK((doc["status"] | -1) == 200);
+  QUBI_CHECK((doc["data"]["v"] | -1) == 5);
+  QUBI_CHECK(std::string(doc["data"]["fields"][1] | "") == "eye_x");
+  QUBI_CHECK((doc["data"]["values"][0] | -1) == 120);
+  QUBI_CHECK((doc["data"]["values"][1] | -1) == 60);
+  reply = parse(bench.request("sync_state", "{\"b\":5,\"d\":[0,100]}"));
+  QUBI_CHECK(reply.status == 200 && reply.version == 6);
+  QUBI_CHECK(bench.module.getState(neck) == 100 && bench.module.getState(eyeX) == 60);
+  return qubiTestResult("StateSyncTest");
+}
@@ -0,0 +1,114 @@
+/*
+ * Stream parser against the DOM parser.
+ *
+ * The same messages go through a module twice, once parsed into a
+ * JsonDocument and once walked by QubiStreamParser. Both must accept the
+ * same messages, hand the handler the same values, and refuse malformed
+ * literals and numbers anywhere in the message with 400 before the
+ * command runs.
+ */
+
+#include "QubiTest.h"
+
+#include <vector>
+
+namespace {
+
+struct Result {
+  int status;
+  int handled;
+  int32_t angle;
+};
+
+std::string message(const char* params, const char* extra = "") {
+  return std::string("{\"version\":\"1.0\",\"timestamp\":1") + extra +
+         ",\"commands\":[{\"module_id\":\"arm\",\"action\":\"set_servo\",\"params\":" + params + "}]}";
+}
+
+int status(const std::string& reply) {
+  JsonDocument doc;
+  if (deserializeJson(doc, reply)) return 0;
+  return doc["status"] | 0;
+}
+
+Result viaDom(QubiTestFixture<>& bench, const std::string& text) {
+  Result result = {0, 0, -999};
+  bench.module.setStreamHandler(nullptr);
+  bench.module.setCommandHandler([&](const QubiCommand& cmd) {
+    result.handled++;
+    result.angle = cmd.params["angle"] | -999;
+    bench.module.sendSuccess();
+  });
+  bench.sendMessage(text);
+  result.status = status(bench.process());
+  return result;
+}
+
+Result viaStream(QubiTestFixture<>& bench, const std::string& text) {
+  Result result = {0, 0, -999};
+  bench.module.setStreamHandler([&](QubiStreamCommand& command) {
+    result.handled++;
+    if (command.params.find("angle")) command.params.toInt(result.angle);
+    bench.module.sendSuccess();
+  });
+  bench.sendMessage(text);
+  result.status = status(bench.process());
+  return result;
+}
+
+// Walks every member of an object; false if the cursor reports an error
+bool walk(const char* json) {
+  QubiParamCursor cursor(json, strlen(json));
+  while (cursor.next()) {}
+  return !cursor.error();
+}
+
+}  // namespace
+
+int main() {
+  // The cursor alone
+  QUBI_CHECK(walk("{\"a\":true,\"b\":false,\"c\":null,\"d\":-0.5e-3,\"e\":[1,{\"f\":2E+2}],\"g\":{}}"));
+  const char* malformed[] = {
+    "{\"a\":tru}", "{\"a\":-}", "{\"a\":nul}", "{\"a\":falsey}", "{\"a\":1e}", "{\"a\":1-2}",
+    "{\"a\":--1}", "{\"a\":1.}", "{\"a\":01}", "{\"a\":[1,tru]}", "{\"a\":{\"b\":-}}", "{\"a\":[1 2]}",
+    "{\"a\":{\"b\" 1}}", "{\"a\":[1,]}", "{\"a\":{,}}", "{\"a\":x}",
+  };
+  for (const char* json : malformed) {
+    if (walk(json)) std::printf("  accepted: %s\n", json);
+    QUBI_CHECK(!walk(json));
+  }
+
+  QubiTestFixture<> bench;
+  const char* valid[] = {
+    "{\"angle\":45}",
+    "{\"angle\":-3,\"flag\":true,\"off\":false,\"none\":null}",
+    "{ \"speed\" : 1.5e2 , \"angle\" : 0 , \"curve\" : [ 0.25 , -1E-2 , [ ] ] }",
+    "{\"meta\":{\"tags\":[\"a\",\"b\\\"c\"],\"n\":{\"m\":[true,false]}},\"angle\":180}",
+    "{}",
+  };
+  for (const char* params : valid) {
+    std::string text = message(params);
+    Result dom = viaDom(bench, text);
+    Result stream = viaStream(bench, text);
+    QUBI_CHECK(dom.status == 200 && stream.status == 200);
+    QUBI_CHECK(dom.handled == 1 && stream.handled == 1);
+    QUBI_CHECK(dom.angle == stream.angle);
+  }
+
+  // Malformed params, and malformed fields outside the commands
+  std::vector<std::string> refused;
+  for (const char* params : {"{\"angle\":tru}", "{\"angle\":-}", "{\"angle\":45,\"x\":nul}",
+                             "{\"angle\":45,\"x\":[1,fals]}", "{\"angle\":1e}", "{\"angle\":4-5}",
+                             "{\"angle\":45,\"x\":{\"y\":truex}}"}) {
+    refused.push_back(message(params));
+  }
+  refused.push_back(message("{\"angle\":45}", ",\"sequence\":-"));
+  refused.push_back(message("{\"angle\":45}", ",\"extra\":nulll"));
+  for (const std::string& text : refused) {
+    Result dom = viaDom(bench, text);
+    Result stream = viaStream(bench, text);
+    QUBI_CHECK(dom.status == 400 && stream.status == 400);
+    QUBI_CHECK(dom.handled == 0 && stream.handled == 0);
+  }
+  return qubiTestResult("StreamParserTest");
+}
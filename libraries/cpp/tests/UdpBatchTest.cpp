@@ -0,0 +1,85 @@
+/*
+ * Batched receives and sends on kernel sockets.
+ *
+ * Two loopback sockets, no simulated network. Batched sends wait in the
+ * queue until it is full, flushSends() or the next parsePacket(); receives
+ * are drained a batch per recvmmsg() call. Every datagram must still arrive
+ * once, in order, whole and with its sender, and one longer than the
+ * socket's datagram size must be dropped without losing the rest of its
+ * batch.
+ */
+
+#include "QubiTest.h"
+
+namespace {
+
+std::string datagram(int i) {
+  return "datagram " + std::to_string(i) + " " + std::string(i % 97, 'x');
+}
+
+// Sends datagrams first..last-1 from the sender to the receiver
+void sendRange(WiFiUDP& sender, const WiFiUDP& receiver, int first, int last) {
+  for (int i = first; i < last; i++) qubiTestSend(sender, datagram(i), receiver.localPort());
+}
+
+// Receives everything waiting; false if anything is missing, out of order,
+// damaged or from the wrong port
+bool receiveRange(WiFiUDP& receiver, const WiFiUDP& sender, int first, int last) {
+  std::string text;
+  int i = first;
+  while (qubiTestReceive(receiver, text)) {
+    if (i >= last || text != datagram(i) || receiver.remotePort() != sender.localPort()) return false;
+    i++;
+  }
+  return i == last;
+}
+
+}  // namespace
+
+int main() {
+  WiFiUDP sender;
+  WiFiUDP receiver;
+  sender.setOnLink(false);
+  receiver.setOnLink(false);
+  QUBI_CHECK(sender.begin(IPAddress(127, 0, 0, 1), 0) && receiver.begin(IPAddress(127, 0, 0, 1), 0));
+  QUBI_CHECK(!sender.simulated() && sender.fd() >= 0);
+
+  // Sends go out eight at a time
+  sender.setSendBatch(8);
+  sendRange(sender, receiver, 0, 99);
+  QUBI_CHECK(sender.ioStats().txPackets == 96 && sender.ioStats().txCalls == 12);
+  QUBI_CHECK(sender.flushSends());
+  QUBI_CHECK(sender.ioStats().txPackets == 99 && sender.ioStats().txCalls == 13);
+
+  // Received 32 at a time
+  QUBI_CHECK(receiveRange(receiver, sender, 0, 99));
+  std::printf("99 datagrams: %u receive calls\n", receiver.ioStats().rxCalls);
+  QUBI_CHECK(receiver.ioStats().rxPackets == 99 && receiver.ioStats().rxCalls == 4);
+
+  // A datagram still queued goes out on the sender's next parsePacket()
+  sendRange(sender, receiver, 99, 100);
+  QUBI_CHECK(sender.ioStats().txPackets == 99);
+  QUBI_CHECK(sender.parsePacket() == 0);
+  QUBI_CHECK(sender.ioStats().txPackets == 100);
+  QUBI_CHECK(receiveRange(receiver, sender, 99, 100));
+
+  // An oversize datagram in the middle of a batch is dropped alone
+  sender.flushSends();
+  sender.setDatagramSize(4000);
+  sender.setSendBatch(1);
+  sendRange(sender, receiver, 100, 102);
+  qubiTestSend(sender, std::string(2000, 'y'), receiver.localPort());
+  sendRange(sender, receiver, 102, 104);
+  uint32_t callsBefore = receiver.ioStats().rxCalls;
+  QUBI_CHECK(receiveRange(receiver, sender, 100, 104));
+  QUBI_CHECK(receiver.ioStats().rxTruncated == 1);
+  QUBI_CHECK(receiver.ioStats().rxCalls - callsBefore == 1);
+
+  // Batches of one are a call per datagram
+  receiver.setReceiveBatch(1);
+  sendRange(sender, receiver, 104, 114);
+  callsBefore = receiver.ioStats().rxCalls;
+  QUBI_CHECK(receiveRange(receiver, sender, 104, 114));
+  QUBI_CHECK(receiver.ioStats().rxCalls - callsBefore == 10);
+  return qubiTestResult("UdpBatchTest");
+}
@@ -0,0 +1,89 @@
+/*
+ * WebSocket-to-UDP bridge daemon: lets browser controllers reach modules.
+ *
+ * Modules are found by discovering through the bridge, or named up front:
+ *
+ *   ./qubi_bridge --module servo_01=192.168.1.21 --module face=192.168.1.22:8888
+ *
+ *   g++ -std=c++17 -O2 -Iplatform -Isrc -I../arduino/QubiProtocol/src \
+ *     -I/path/to/ArduinoJson/src tools/BridgeDaemon.cpp src/Qubi*.cpp \
+ *     ../arduino/QubiProtocol/src/Qubi*.cpp platform/Host*.cpp platform/Qubi*.cpp \
+ *     -lpthread -o qubi_bridge
+ *
+ *   ./qubi_bridge [--port 8891] [--listen address] [--broadcast address]
+ *                 [--module id=ip[:port]]... [--allow-origin origin]...
+ *
+ * Pages from other hosts than the bridge's need --allow-origin, e.g.
+ * --allow-origin http://robot.local:8080, or "*" for any.
+ */
+
+#include "QubiBridge.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int) {
+  running = 0;
+}
+
+int main(int argc, char** argv) {
+  uint16_t port = QUBI_BRIDGE_PORT;
+  QubiBridgeOptions options;
+  std::vector<String> modules;
+  for (int i = 1; i < argc; i++) {
+    String arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--port" && hasValue) {
+      port = atoi(argv[++i]);
+    } else if (arg == "--listen" && hasValue && options.listenAddress.fromString(argv[i + 1])) {
+      i++;
+    } else if (arg == "--broadcast" && hasValue && options.broadcastAddress.fromString(argv[i + 1])) {
+      i++;
+    } else if (arg == "--module" && hasValue) {
+      modules.push_back(argv[++i]);
+    } else if (arg == "--allow-origin" && hasValue) {
+      options.allowedOrigins.push_back(argv[++i]);
+    } else {
+      fprintf(stderr,
+              "usage: %s [--port n] [--listen address] [--broadcast address] [--module id=ip[:port]]... "
+              "[--allow-origin origin]...\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  QubiBridge bridge(options);
+  for (const String& module : modules) {
+    int equals = module.indexOf('=');
+    int colon = module.indexOf(':', equals + 1);
+    String address = colon > equals ? module.substring(equals + 1, colon) : module.substring(equals + 1);
+    IPAddress ip;
+    if (equals <= 0 || !ip.fromString(address)) {
+      fprintf(stderr, "Bad --module %s, expected id=ip[:port]\n", module.c_str());
+      return 2;
+    }
+    bridge.addModule(module.substring(0, equals), ip,
+                     colon > equals ? atoi(module.substring(colon + 1).c_str()) : QUBI_DEFAULT_PORT);
+  }
+
+  if (!bridge.begin(port)) {
+    fprintf(stderr, "Can't listen on port %u\n", port);
+    return 1;
+  }
+  printf("Bridge on ws://%s:%u/\n", options.listenAddress.toString().c_str(), bridge.localPort());
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  while (running) {
+    bridge.wait(1000);
+    bridge.poll();
+  }
+
+  const QubiBridgeStats& stats = bridge.getStats();
+  printf("%u connections, %u rejected, %u messages, %u forwarded, %u replies routed, %u unroutable\n",
+         stats.connections, stats.rejected, stats.messagesIn, stats.forwarded, stats.routed, stats.unroutable);
+  return 0;
+}
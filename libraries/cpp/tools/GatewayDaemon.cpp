@@ -0,0 +1,110 @@
+/*
+ * Fleet gateway daemon: serves QubiGateway requests from web UIs and
+ * scripts on one UDP port.
+ *
+ * Modules come from a fleet file, from discovery, or both. A fleet file
+ * lists modules with the group they belong to:
+ *
+ *   {"modules": [
+ *     {"id": "robot1-face", "type": "display", "group": "robot1",
+ *      "ip": "192.168.1.21", "port": 8888},
+ *     ...
+ *   ]}
+ *
+ *   g++ -std=c++17 -O2 -Iplatform -Isrc -I../arduino/QubiProtocol/src \
+ *     -I/path/to/ArduinoJson/src tools/GatewayDaemon.cpp src/Qubi*.cpp \
+ *     ../arduino/QubiProtocol/src/Qubi*.cpp platform/Host*.cpp platform/Qubi*.cpp \
+ *     -lpthread -o qubi_gateway
+ *
+ *   ./qubi_gateway [--port 8890] [--fleet fleet.json] [--discover]
+ *                  [--deadline ms] [--retries n]
+ */
+
+#include "QubiGateway.h"
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+static volatile sig_atomic_t running = 1;
+
+static void onSignal(int) {
+  running = 0;
+}
+
+static bool loadFleet(QubiGateway& gateway, const char* path) {
+  std::ifstream file(path);
+  std::stringstream text;
+  text << file.rdbuf();
+  JsonDocument doc;
+  if (!file || deserializeJson(doc, text.str()) || !doc["modules"].is<JsonArray>()) {
+    fprintf(stderr, "Can't read fleet file %s\n", path);
+    return false;
+  }
+
+  for (JsonObject entry : doc["modules"].as<JsonArray>()) {
+    QubiFleetModule module;
+    module.id = entry["id"] | "";
+    module.type = qubiModuleTypeFromName(entry["type"] | "custom");
+    module.group = entry["group"] | "";
+    module.port = entry["port"] | QUBI_DEFAULT_PORT;
+    if (module.id.length() == 0 || !module.ip.fromString(entry["ip"] | "")) {
+      fprintf(stderr, "Skipping fleet entry without an id or address\n");
+      continue;
+    }
+    gateway.addModule(module);
+  }
+  return true;
+}
+
+int main(int argc, char** argv) {
+  uint16_t port = QUBI_GATEWAY_PORT;
+  const char* fleet = nullptr;
+  bool discover = false;
+  QubiGatewayOptions options;
+  for (int i = 1; i < argc; i++) {
+    String arg = argv[i];
+    bool hasValue = i + 1 < argc;
+    if (arg == "--port" && hasValue) {
+      port = atoi(argv[++i]);
+    } else if (arg == "--fleet" && hasValue) {
+      fleet = argv[++i];
+    } else if (arg == "--discover") {
+      discover = true;
+    } else if (arg == "--deadline" && hasValue) {
+      options.deadlineMs = atoi(argv[++i]);
+    } else if (arg == "--retries" && hasValue) {
+      options.retries = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--port n] [--fleet file] [--discover] [--deadline ms] [--retries n]\n", argv[0]);
+      return 2;
+    }
+  }
+
+  QubiGateway gateway(options);
+  if (fleet && !loadFleet(gateway, fleet)) return 1;
+  if (discover) {
+    QubiController scout(IPAddress(255, 255, 255, 255));
+    size_t added = gateway.addModules(scout.discover());
+    printf("Discovered %zu new modules\n", added);
+  }
+  if (!gateway.begin() || !gateway.listen(port)) {
+    fprintf(stderr, "Can't open the gateway sockets\n");
+    return 1;
+  }
+  printf("Gateway for %zu modules on port %u\n", gateway.moduleCount(), port);
+
+  signal(SIGINT, onSignal);
+  signal(SIGTERM, onSignal);
+  while (running) {
+    gateway.wait(1000);
+    gateway.poll();
+  }
+
+  const QubiGatewayStats& stats = gateway.getStats();
+  printf("%u requests, %u fan-outs, %u sent (%u resent), %u matched, %u timeouts\n", stats.clientRequests,
+         stats.fanouts, stats.sent, stats.resent, stats.matched, stats.timeouts);
+  return 0;
+}